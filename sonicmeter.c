@@ -10,12 +10,40 @@
 #include <notification/notification.h>
 #include <notification/notification_messages.h>
 #include "sonicmeter_icons.h"
+#include <stdatomic.h>
+#include "sonicmeter_worker.h"
+#include "sonicmeter_convert.h"
+#include "sonicmeter_recorder.h"
+#include "sonicmeter_stream.h"
+#include "sonicmeter_probe.h"
+#include "sonicmeter_text.h"
+#include "sonicmeter_snapshot.h"
+#include "sonicmeter_history.h"
+#include "sonicmeter_pins.h"
+#include "sonicmeter_stats.h"
+#include "sonicmeter_velocity.h"
+#include "sonicmeter_memory.h"
+#include "sonicmeter_cli.h"
+#include <storage/storage.h>
 
 #define TAG "SonicMeter"
 
 // Change this to BACKLIGHT_AUTO if you don't want the backlight to be continuously on.
 #define BACKLIGHT_ON 1
 
+// Cap on the measure screen refresh rate, independent of the sample rate
+#define SONICMETER_FRAME_PERIOD_MS 50
+
+// Rough battery side draw, for the battery life estimate only
+#define SONICMETER_POWER_BASE_MA 20 // The Flipper running this app with the backlight on
+#define SONICMETER_POWER_SENSOR_MA 24 // One HC-SR04 at 15 mA on 5V, through the OTG booster
+// How often the fuel gauge is asked for the remaining capacity
+#define SONICMETER_BATTERY_PERIOD_MS 10000
+
+// Rows of the history graph, below its title line
+#define SONICMETER_GRAPH_TOP 10
+#define SONICMETER_GRAPH_HEIGHT 54
+
 // Our application menu has 3 items.
 typedef enum {
     SonicMeterSubmenuIndexConfigure,
@@ -34,8 +62,57 @@ typedef enum {
 typedef enum {
     SonicMeterEventIdRedrawScreen = 0, // Custom event to redraw the screen
     SonicMeterEventIdOkPressed = 42, // Custom event to process OK button getting pressed down
+    SonicMeterEventIdUpPressed, // Custom event to go to the previous page
+    SonicMeterEventIdDownPressed, // Custom event to go to the next page
+    SonicMeterEventIdLeftPressed, // Custom event to zoom the graph out
+    SonicMeterEventIdRightPressed, // Custom event to zoom the graph in
 } SonicMeterEventId;
 
+// Pages of the measure screen, Up and Down go through them
+typedef enum {
+    SonicMeterMeasurePageMain, // The measurement
+    SonicMeterMeasurePageGraph, // The history graph of one sensor
+    SonicMeterMeasurePageStats, // Percentiles of the long run statistics
+    SonicMeterMeasurePageMemory, // Stack, arena and heap use, debug only
+    SonicMeterMeasurePageProbes, // The stage timings, debug only
+} SonicMeterMeasurePage;
+
+// The lines of the measure screen, formatted ahead of drawing
+typedef struct {
+    SonicMeterMeasurePage page; // Page to draw
+    bool debug; // Layout with the debug lines
+    char rate[12]; // Achieved sample rate
+    char recording[32]; // Recording status, empty when not recording
+    char link[16]; // USB stream status, empty when not streaming
+    char distance[24]; // Distance, or why there is none
+    char velocity[20]; // Speed towards or away from the sensor, single sensor only
+    char ticks[28]; // Echo width and capture backend, debug only
+    char time[24]; // Echo width in microseconds, debug only
+    char trigger_pin[20];
+    char echo_pin[16];
+    char power[24]; // 5V rail duty cycle and battery life estimate
+    char alarm[24]; // Alarm state, and its latency in debug
+    uint32_t sensors; // Columns below are shown instead of the distance when more than one
+    char sensor_distance[SONICMETER_SAMPLE_SENSORS_MAX][8]; // Distance in cm, or why there is none
+    char sensor_rate[SONICMETER_SAMPLE_SENSORS_MAX][8]; // Achieved sample rate of the sensor
+    uint32_t sensor_alarm; // Sensors whose alarm is raised, one bit each
+    char graph_title[16]; // Sensor and samples per column, graph page only
+    char graph_range[24]; // Distance span of the graph, graph page only
+    SonicMeterHistoryPlot graph; // Columns of the graph, graph page only
+    char stats[SonicMeterStatsSeriesCount][3][8]; // p50, p99 and p99.9, stats page only
+    char stats_count[24]; // Samples in the statistics, stats page only
+    char schedule[24]; // Trigger lateness and skipped periods, stats page only
+    char memory[SonicMeterMemoryThreadCount + 1][2][8]; // Stack sizes and use, then the arena
+    char memory_heap[2][28]; // Heap peak, then free heap now and at its lowest
+} SonicMeterMeasureText;
+
+// Achieved sample rate over roughly one second worth of samples
+typedef struct {
+    uint64_t window_start; // Timestamp of the first sample in the window
+    uint32_t window_count; // Samples in the window
+    uint32_t dhz; // Tenths of a sample per second
+} SonicMeterRate;
+
 typedef struct {
     ViewDispatcher* view_dispatcher; // Switches between our views
     NotificationApp* notifications; // Used for controlling the backlight
@@ -44,36 +121,94 @@ typedef struct {
     View* view_measure; // The main screen
     Widget* widget_about; // The about screen
 
-    FuriTimer* timer; // Timer for redrawing the screen
+    SonicMeterWorker* worker; // Triggers measurements on its own thread
+    SonicMeterRecorder* recorder; // Records samples to the SD card
+    SonicMeterStream* stream; // Streams samples over USB
+    SonicMeterRingReader reader; // Position of the measure screen in the sample ring
+    SonicMeterArena* arena; // The large buffers, allocated once
+    SonicMeterHistory* history; // One per sensor the worker can drive
+    SonicMeterStats* stats; // Histograms since measuring started, fed on the worker thread
+    FuriMutex* sampling; // Held by whoever has the worker, the measure screen or a CLI run
+    SonicMeterCli* cli; // The sonicmeter CLI command
+    atomic_bool sample_pending; // A redraw event is queued and has not drained the ring yet
+    FuriTimer* frame_timer; // Brings back a redraw that came too soon after the last frame
+    uint32_t frame_tick; // Time of the last frame
+    SonicMeterMeasureText text; // The next frame
+    SonicMeterMeasureText shown; // The last frame published to the screen
+    uint32_t battery_tick; // Time the fuel gauge was last asked
 } SonicMeterApp;
 
+_Static_assert(
+    SONICMETER_ARENA_ROUND(3 * sizeof(SonicMeterMeasureText)) <= SONICMETER_MEMORY_FRAMES,
+    "Measure screen frames over their memory budget");
+_Static_assert(
+    SONICMETER_ARENA_ROUND(sizeof(SonicMeterHistory) * SONICMETER_SAMPLE_SENSORS_MAX) <=
+        SONICMETER_MEMORY_HISTORY,
+    "Graph history over its memory budget");
+
 typedef struct {
+    uint32_t setting_driver_index; // The sensor type setting index
     uint32_t setting_triggerpin_index; // The trigger pin setting index
     uint32_t setting_echopin_index; // The echo pin setting index
+    uint32_t setting_sensors_index; // The sensor count setting index
+    uint32_t setting_capture_index; // The capture backend setting index
+    uint32_t setting_range_index; // The max range setting index
+    bool setting_burst; // Trigger as fast as the sensor allows
+    uint32_t setting_interval_index; // The sample interval setting index, when not bursting
+    uint32_t setting_power_index; // The 5V rail setting index
+    int32_t setting_temperature_c; // Air temperature for the speed of sound
+    uint32_t setting_filter_index; // The filter setting index
+    uint32_t setting_window_index; // The filter window setting index
+    bool setting_reject_outliers; // Put the outlier gate in front of the filter
+    uint32_t setting_alarm_index; // The alarm outputs setting index, 0 for off
+    uint32_t setting_alarm_near_index; // The alarm near threshold setting index
+    uint32_t setting_alarm_far_index; // The alarm far threshold setting index
+    uint32_t setting_hysteresis_index; // The alarm hysteresis setting index
+    uint32_t setting_debounce_index; // The alarm debounce setting index
+    uint32_t setting_alarm_pin_index; // The alarm output pin setting index, 0 for none
+    uint32_t setting_stream_index; // The USB stream setting index
     bool setting_debug;
+    SonicMeterMeasurePage page; // The page shown
+    uint32_t graph_sensor; // Sensor shown on the graph page
+    uint32_t graph_level; // History level shown on the graph page, 0 is the most detailed
 
     uint32_t ticks;
     uint32_t echo_us; // The time in microseconds for the echo pin to go high
     bool have_5v;
     bool measurement_made;
-    float distance_cm;
-} SonicMeterMeasureModel;
+    uint32_t distance_um;
+    uint32_t filtered_um;
+    SonicMeterDriverType driver; // The driver of the sensors being sampled
+    SonicMeterEchoBackend capture_backend; // The backend actually in use
+    SonicMeterCaptureResult capture_result; // The result of the last capture
+    uint32_t spurious_edges; // Edges the capture did not expect
 
-uint32_t cpu_ticks_to_us(uint32_t ticks) {
-    return ticks * 1.5888f / 1e2f;
-}
+    SonicMeterRate rate; // Achieved sample rate of all sensors together
 
-float cpu_ticks_to_hc_sr04_cm(uint32_t ticks) {
-    // Speed of sound in air is 34300 cm/s
-    // The echo pin goes high when the sound wave is sent and received
-    // The distance is half the time it takes for the echo pin to go high
-    // The time is the time it takes for the sound wave to go to the object and back
-    uint32_t pulse_duration = cpu_ticks_to_us(ticks);
+    uint32_t sensor_count; // Sensors being sampled
+    SonicMeterRate sensor_rate[SONICMETER_SAMPLE_SENSORS_MAX];
+    SonicMeterCaptureResult sensor_result[SONICMETER_SAMPLE_SENSORS_MAX]; // Last capture result
+    uint32_t sensor_filtered_um[SONICMETER_SAMPLE_SENSORS_MAX]; // Last filtered distance
+    bool sensor_alarm[SONICMETER_SAMPLE_SENSORS_MAX]; // The alarm of the sensor is raised
+    SonicMeterVelocity sensor_velocity[SONICMETER_SAMPLE_SENSORS_MAX]; // Over the good samples
 
-    const float speed_of_sound = 0.0343f; // cm/us
-    float distance = pulse_duration * speed_of_sound / 2.0f;
-    return distance;
-}
+    bool alarm_enabled; // The distance alarm is being evaluated
+    SonicMeterWorkerAlarmStats alarm_stats; // State and latency of the distance alarm
+
+    SonicMeterWorkerPowerStats power_stats; // State of the 5V rail
+    SonicMeterScheduleStats schedule_stats; // Lateness of the triggers
+    uint32_t battery_mah; // Remaining battery capacity
+
+    bool recording; // Samples are being recorded to the SD card
+    SonicMeterRecorderStats recorder_stats; // Statistics of the current recording
+
+    bool streaming; // Samples are being streamed over USB
+    SonicMeterStreamStats stream_stats; // Statistics of the USB stream
+
+    bool busy; // A CLI run has the worker, nothing is measured here
+
+    SonicMeterSnapshot* frame; // SonicMeterMeasureText, published here, drawn by the GUI thread
+} SonicMeterMeasureModel;
 
 /**
  * @brief      Callback for exiting the application.
@@ -122,32 +257,343 @@ static void sonicmeter_submenu_callback(void* context, uint32_t index) {
     }
 }
 
+/**
+ * @brief      Pick a pin index other than the one the other pin setting uses.
+ * @details    Trigger and echo cannot share a pin, the pin taken by the other setting is skipped
+ *             in the direction the user is moving.
+ * @param      item      The pin setting item.
+ * @param      previous  The previous index of this setting.
+ * @param      other     The index of the other pin setting.
+ * @return     The index to use.
+*/
+static uint8_t
+    sonicmeter_setting_pin_select(VariableItem* item, uint32_t previous, uint32_t other) {
+    uint8_t index = variable_item_get_current_value_index(item);
+    if(index == other) {
+        const bool up = index == (previous + 1) % SONICMETER_PINS_COUNT;
+        index = up ? (index + 1) % SONICMETER_PINS_COUNT :
+                     (index + SONICMETER_PINS_COUNT - 1) % SONICMETER_PINS_COUNT;
+        variable_item_set_current_value_index(item, index);
+    }
+    variable_item_set_current_value_text(item, sonicmeter_pins[index].name);
+    return index;
+}
+
+/**
+ * Sensor type setting
+ *
+ * Names come from the drivers. Serial sensors sit on the USART pins and ignore the pin settings,
+ * single pin sensors only use the trigger pin.
+*/
+static const char* setting_driver_config_label = "Sensor";
+static void sonicmeter_setting_driver_change(VariableItem* item) {
+    SonicMeterApp* app = variable_item_get_context(item);
+    uint8_t index = variable_item_get_current_value_index(item);
+    variable_item_set_current_value_text(item, sonicmeter_driver_get(index)->name);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    model->setting_driver_index = index;
+}
+
 /**
  * Trigger Pin Setting
 */
 static const char* setting_triggerpin_config_label = "Trigger Pin";
-static uint8_t setting_triggerpin_values[] = {0, 1, 2};
-static char* setting_triggerpin_names[] = {"A4", "A6", "A7"};
 static void sonicmeter_setting_triggerpin_change(VariableItem* item) {
     SonicMeterApp* app = variable_item_get_context(item);
-    uint8_t index = variable_item_get_current_value_index(item);
-    variable_item_set_current_value_text(item, setting_triggerpin_names[index]);
     SonicMeterMeasureModel* model = view_get_model(app->view_measure);
-    model->setting_triggerpin_index = index;
+    model->setting_triggerpin_index = sonicmeter_setting_pin_select(
+        item, model->setting_triggerpin_index, model->setting_echopin_index);
 }
 
 /**
  *  Echo Pin Setting
 */
 static const char* setting_echopin_config_label = "Echo Pin";
-static uint8_t setting_echopin_values[] = {0, 1};
-static char* setting_echopin_names[] = {"B2", "B3"};
 static void sonicmeter_setting_echopin_change(VariableItem* item) {
+    SonicMeterApp* app = variable_item_get_context(item);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    model->setting_echopin_index = sonicmeter_setting_pin_select(
+        item, model->setting_echopin_index, model->setting_triggerpin_index);
+}
+
+/**
+ *  Sensor count setting
+ *
+ *  One sensor uses the trigger and echo pin settings. More than one use the sensor array pins,
+ *  every echo on its own EXTI line: PB3 and PC3 share one, so only PB3 is used as an echo. Single
+ *  pin sensors use the trigger pins of the array. Serial sensors are always one.
+*/
+static const char* setting_sensors_config_label = "Sensors";
+static uint8_t setting_sensors_values[] = {1, 2, 3, 4};
+static char* setting_sensors_names[] = {"1", "2", "3", "4"};
+static void sonicmeter_setting_sensors_change(VariableItem* item) {
+    SonicMeterApp* app = variable_item_get_context(item);
+    uint8_t index = variable_item_get_current_value_index(item);
+    variable_item_set_current_value_text(item, setting_sensors_names[index]);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    model->setting_sensors_index = index;
+}
+
+static const SonicMeterWorkerSensor sonicmeter_sensor_array[SONICMETER_SAMPLE_SENSORS_MAX] = {
+    {.trigger_pin = &gpio_ext_pa4, .echo_pin = &gpio_ext_pb2},
+    {.trigger_pin = &gpio_ext_pa7, .echo_pin = &gpio_ext_pa6},
+    {.trigger_pin = &gpio_ext_pc3, .echo_pin = &gpio_ext_pb3},
+    {.trigger_pin = &gpio_ext_pc1, .echo_pin = &gpio_ext_pc0},
+};
+
+/**
+ *  Capture backend setting
+*/
+static const char* setting_capture_config_label = "Capture";
+static uint8_t setting_capture_values[] = {
+    SonicMeterEchoBackendIrq,
+    SonicMeterEchoBackendTimer,
+    SonicMeterEchoBackendSim};
+static char* setting_capture_names[] = {"IRQ", "Timer", "Sim"};
+static void sonicmeter_setting_capture_change(VariableItem* item) {
     SonicMeterApp* app = variable_item_get_context(item);
     uint8_t index = variable_item_get_current_value_index(item);
-    variable_item_set_current_value_text(item, setting_echopin_names[index]);
+    variable_item_set_current_value_text(item, setting_capture_names[index]);
     SonicMeterMeasureModel* model = view_get_model(app->view_measure);
-    model->setting_echopin_index = index;
+    model->setting_capture_index = index;
+}
+
+/**
+ *  Max range setting
+*/
+static const char* setting_range_config_label = "Max Range";
+static uint16_t setting_range_values[] = {100, 200, 300, 400, 600};
+static char* setting_range_names[] = {"1 m", "2 m", "3 m", "4 m", "6 m"};
+#define SETTING_RANGE_DEFAULT_INDEX 3 // 4 m, the reach of a HC-SR04, 6 m is for the JSN-SR04T
+static void sonicmeter_setting_range_change(VariableItem* item) {
+    SonicMeterApp* app = variable_item_get_context(item);
+    uint8_t index = variable_item_get_current_value_index(item);
+    variable_item_set_current_value_text(item, setting_range_names[index]);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    model->setting_range_index = index;
+}
+
+/**
+ *  Burst setting
+*/
+static const char* setting_burst_config_label = "Burst";
+static uint8_t setting_burst_values[] = {0, 1};
+static char* setting_burst_names[] = {"Off", "On"};
+static void sonicmeter_setting_burst_change(VariableItem* item) {
+    SonicMeterApp* app = variable_item_get_context(item);
+    uint8_t index = variable_item_get_current_value_index(item);
+    variable_item_set_current_value_text(item, setting_burst_names[index]);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    model->setting_burst = index == 1;
+}
+
+/**
+ *  Interval setting
+*/
+static const char* setting_interval_config_label = "Interval";
+static uint16_t setting_interval_values[] = {200, 1000, 5000, 30000};
+static char* setting_interval_names[] = {"200 ms", "1 s", "5 s", "30 s"};
+static void sonicmeter_setting_interval_change(VariableItem* item) {
+    SonicMeterApp* app = variable_item_get_context(item);
+    uint8_t index = variable_item_get_current_value_index(item);
+    variable_item_set_current_value_text(item, setting_interval_names[index]);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    model->setting_interval_index = index;
+}
+
+/**
+ *  5V power setting
+*/
+static const char* setting_power_config_label = "5V Power";
+static uint8_t setting_power_values[] = {
+    SonicMeterWorkerPowerAlwaysOn,
+    SonicMeterWorkerPowerDutyCycle,
+};
+static char* setting_power_names[] = {"Always", "Cycled"};
+static void sonicmeter_setting_power_change(VariableItem* item) {
+    SonicMeterApp* app = variable_item_get_context(item);
+    uint8_t index = variable_item_get_current_value_index(item);
+    variable_item_set_current_value_text(item, setting_power_names[index]);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    model->setting_power_index = index;
+}
+
+/**
+ *  Temperature setting
+*/
+static const char* setting_temperature_config_label = "Temperature";
+static void sonicmeter_setting_temperature_set_text(VariableItem* item, int32_t temperature_c) {
+    char text[8];
+    snprintf(text, sizeof(text), "%ld C", temperature_c);
+    variable_item_set_current_value_text(item, text);
+}
+static void sonicmeter_setting_temperature_change(VariableItem* item) {
+    SonicMeterApp* app = variable_item_get_context(item);
+    uint8_t index = variable_item_get_current_value_index(item);
+    int32_t temperature_c = SONICMETER_CONVERT_TEMPERATURE_MIN + index;
+    sonicmeter_setting_temperature_set_text(item, temperature_c);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    model->setting_temperature_c = temperature_c;
+}
+
+/**
+ *  Filter setting
+*/
+static const char* setting_filter_config_label = "Filter";
+static uint8_t setting_filter_values[] = {
+    SonicMeterFilterTypeNone,
+    SonicMeterFilterTypeMedian,
+    SonicMeterFilterTypeEma,
+    SonicMeterFilterTypeKalman,
+};
+static char* setting_filter_names[] = {"None", "Median", "EMA", "Kalman"};
+static void sonicmeter_setting_filter_change(VariableItem* item) {
+    SonicMeterApp* app = variable_item_get_context(item);
+    uint8_t index = variable_item_get_current_value_index(item);
+    variable_item_set_current_value_text(item, setting_filter_names[index]);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    model->setting_filter_index = index;
+}
+
+/**
+ *  Filter window setting
+*/
+static const char* setting_window_config_label = "Window";
+static uint8_t setting_window_values[] = {3, 5, 9, 15};
+static char* setting_window_names[] = {"3", "5", "9", "15"};
+static void sonicmeter_setting_window_change(VariableItem* item) {
+    SonicMeterApp* app = variable_item_get_context(item);
+    uint8_t index = variable_item_get_current_value_index(item);
+    variable_item_set_current_value_text(item, setting_window_names[index]);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    model->setting_window_index = index;
+}
+
+/**
+ *  Outlier setting
+*/
+static const char* setting_outliers_config_label = "Outliers";
+static uint8_t setting_outliers_values[] = {0, 1};
+static char* setting_outliers_names[] = {"Keep", "Reject"};
+static void sonicmeter_setting_outliers_change(VariableItem* item) {
+    SonicMeterApp* app = variable_item_get_context(item);
+    uint8_t index = variable_item_get_current_value_index(item);
+    variable_item_set_current_value_text(item, setting_outliers_names[index]);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    model->setting_reject_outliers = index == 1;
+}
+
+/**
+ *  Alarm setting
+ *
+ *  The alarm is evaluated by the worker as samples come in. It always shows on screen, this
+ *  picks what else it drives.
+*/
+static const char* setting_alarm_config_label = "Alarm";
+static uint8_t setting_alarm_values[] = {
+    0,
+    0,
+    SonicMeterWorkerAlarmOutputVibro,
+    SonicMeterWorkerAlarmOutputLed,
+    SonicMeterWorkerAlarmOutputVibro | SonicMeterWorkerAlarmOutputLed,
+};
+static char* setting_alarm_names[] = {"Off", "Screen", "Vibro", "LED", "Vibro+LED"};
+static void sonicmeter_setting_alarm_change(VariableItem* item) {
+    SonicMeterApp* app = variable_item_get_context(item);
+    uint8_t index = variable_item_get_current_value_index(item);
+    variable_item_set_current_value_text(item, setting_alarm_names[index]);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    model->setting_alarm_index = index;
+}
+
+/**
+ *  Alarm near threshold setting
+*/
+static const char* setting_alarm_near_config_label = "Alarm Near";
+static uint16_t setting_alarm_near_values[] = {0, 10, 20, 30, 50, 100, 150, 200};
+static char* setting_alarm_near_names[] =
+    {"0 cm", "10 cm", "20 cm", "30 cm", "50 cm", "1 m", "1.5 m", "2 m"};
+static void sonicmeter_setting_alarm_near_change(VariableItem* item) {
+    SonicMeterApp* app = variable_item_get_context(item);
+    uint8_t index = variable_item_get_current_value_index(item);
+    variable_item_set_current_value_text(item, setting_alarm_near_names[index]);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    model->setting_alarm_near_index = index;
+}
+
+/**
+ *  Alarm far threshold setting
+*/
+static const char* setting_alarm_far_config_label = "Alarm Far";
+static uint16_t setting_alarm_far_values[] = {20, 30, 50, 100, 150, 200, 300, 400};
+static char* setting_alarm_far_names[] =
+    {"20 cm", "30 cm", "50 cm", "1 m", "1.5 m", "2 m", "3 m", "4 m"};
+static void sonicmeter_setting_alarm_far_change(VariableItem* item) {
+    SonicMeterApp* app = variable_item_get_context(item);
+    uint8_t index = variable_item_get_current_value_index(item);
+    variable_item_set_current_value_text(item, setting_alarm_far_names[index]);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    model->setting_alarm_far_index = index;
+}
+
+/**
+ *  Alarm hysteresis setting
+*/
+static const char* setting_hysteresis_config_label = "Hysteresis";
+static uint8_t setting_hysteresis_values[] = {0, 1, 2, 5, 10};
+static char* setting_hysteresis_names[] = {"0 cm", "1 cm", "2 cm", "5 cm", "10 cm"};
+static void sonicmeter_setting_hysteresis_change(VariableItem* item) {
+    SonicMeterApp* app = variable_item_get_context(item);
+    uint8_t index = variable_item_get_current_value_index(item);
+    variable_item_set_current_value_text(item, setting_hysteresis_names[index]);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    model->setting_hysteresis_index = index;
+}
+
+/**
+ *  Alarm debounce setting
+*/
+static const char* setting_debounce_config_label = "Debounce";
+static uint8_t setting_debounce_values[] = {1, 2, 3, 5};
+static char* setting_debounce_names[] = {"1", "2", "3", "5"};
+static void sonicmeter_setting_debounce_change(VariableItem* item) {
+    SonicMeterApp* app = variable_item_get_context(item);
+    uint8_t index = variable_item_get_current_value_index(item);
+    variable_item_set_current_value_text(item, setting_debounce_names[index]);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    model->setting_debounce_index = index;
+}
+
+/**
+ *  Alarm output pin setting
+ *
+ *  Index 0 is no pin, the others follow the pin table. A pin the sensors use is dropped when
+ *  measuring starts.
+*/
+static const char* setting_alarm_pin_config_label = "Alarm Pin";
+static const char* sonicmeter_setting_alarm_pin_name(uint32_t index) {
+    return index == 0 ? "None" : sonicmeter_pins[index - 1].name;
+}
+static void sonicmeter_setting_alarm_pin_change(VariableItem* item) {
+    SonicMeterApp* app = variable_item_get_context(item);
+    uint8_t index = variable_item_get_current_value_index(item);
+    variable_item_set_current_value_text(item, sonicmeter_setting_alarm_pin_name(index));
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    model->setting_alarm_pin_index = index;
+}
+
+/**
+ *  USB stream setting
+*/
+static const char* setting_stream_config_label = "USB Stream";
+static uint8_t setting_stream_values[] = {0, 1, 2};
+static char* setting_stream_names[] = {"Off", "Binary", "Text"};
+static void sonicmeter_setting_stream_change(VariableItem* item) {
+    SonicMeterApp* app = variable_item_get_context(item);
+    uint8_t index = variable_item_get_current_value_index(item);
+    variable_item_set_current_value_text(item, setting_stream_names[index]);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    model->setting_stream_index = index;
 }
 
 /**
@@ -165,179 +611,985 @@ static void sonicmeter_setting_debug_change(VariableItem* item) {
         model->setting_debug = true;
     } else {
         model->setting_debug = false;
+        if(model->page == SonicMeterMeasurePageMemory ||
+           model->page == SonicMeterMeasurePageProbes) {
+            model->page = SonicMeterMeasurePageMain;
+        }
     }
 }
 
+#if SONICMETER_PROBES
 /**
- * @brief      Callback for drawing the measure screen.
- * @details    This function is called when the screen needs to be redrawn, like when the model gets updated.
+ * @brief      Format a stage duration.
+ * @param      buffer          The buffer to print into.
+ * @param      size            The size of the buffer.
+ * @param      cycles          The duration in CPU cycles.
+ * @param      cycles_per_us   CPU cycles per microsecond.
+*/
+static void sonicmeter_probe_format_us(
+    char* buffer,
+    size_t size,
+    uint32_t cycles,
+    uint32_t cycles_per_us) {
+    const uint32_t tenths = (uint64_t)cycles * 10 / cycles_per_us;
+    SonicMeterText t;
+
+    sonicmeter_text_init(&t, buffer, size);
+    if(tenths < 10000) {
+        sonicmeter_text_fixed(&t, tenths, 1);
+    } else {
+        sonicmeter_text_u32(&t, tenths / 10);
+    }
+}
+
+/**
+ * @brief      Draw the stage timings debug page.
+ * @details    One line per stage with the min, mean and max duration in microseconds.
  * @param      canvas  The canvas to draw on.
- * @param      model   The model - SonicMeterMeasureModel object.
 */
-static void sonicmeter_view_measure_draw_callback(Canvas* canvas, void* model) {
-    SonicMeterMeasureModel* m = (SonicMeterMeasureModel*)model;
+static void sonicmeter_view_measure_draw_probes(Canvas* canvas) {
+    const uint32_t cycles_per_us = furi_hal_cortex_instructions_per_microsecond();
+    char value[12];
+
+    canvas_draw_str(canvas, 0, 7, "us");
+    canvas_draw_str_aligned(canvas, 62, 0, AlignRight, AlignTop, "min");
+    canvas_draw_str_aligned(canvas, 95, 0, AlignRight, AlignTop, "avg");
+    canvas_draw_str_aligned(canvas, 128, 0, AlignRight, AlignTop, "max");
+
+    for(uint32_t i = 0; i < SonicMeterProbeStageCount; i++) {
+        SonicMeterProbeStats stats;
+        sonicmeter_probe_get(i, &stats);
+        const uint8_t y = 14 + i * 7;
+
+        canvas_draw_str(canvas, 0, y, sonicmeter_probe_get_name(i));
+        if(stats.count == 0) {
+            canvas_draw_str_aligned(canvas, 128, y - 7, AlignRight, AlignTop, "-");
+            continue;
+        }
+        sonicmeter_probe_format_us(value, sizeof(value), stats.min, cycles_per_us);
+        canvas_draw_str_aligned(canvas, 62, y - 7, AlignRight, AlignTop, value);
+        sonicmeter_probe_format_us(
+            value, sizeof(value), stats.sum / stats.count, cycles_per_us);
+        canvas_draw_str_aligned(canvas, 95, y - 7, AlignRight, AlignTop, value);
+        sonicmeter_probe_format_us(value, sizeof(value), stats.max, cycles_per_us);
+        canvas_draw_str_aligned(canvas, 128, y - 7, AlignRight, AlignTop, value);
+    }
+}
+#endif
 
-    canvas_draw_str(canvas, 35, 8, "Sonic Meter");
-    FuriString* xstr = furi_string_alloc();
+/**
+ * @brief      Format the measure screen.
+ * @details    Everything the screen shows goes through here, so comparing the output tells whether
+ *             a redraw would change anything.
+ * @param      m     The SonicMeterMeasureModel object.
+ * @param      text  Filled in with the lines of the screen.
+*/
+static void sonicmeter_view_measure_format(
+    const SonicMeterMeasureModel* m,
+    SonicMeterMeasureText* text) {
+    SonicMeterText t;
+
+    text->page = m->page;
+    text->debug = m->setting_debug;
+    sonicmeter_text_init(&t, text->rate, sizeof(text->rate));
+    sonicmeter_text_fixed(&t, m->rate.dhz, 1);
+    sonicmeter_text_str(&t, "/s");
+
+    sonicmeter_text_init(&t, text->recording, sizeof(text->recording));
+    if(m->recording) {
+        sonicmeter_text_str(&t, "REC ");
+        sonicmeter_text_u32(&t, m->recorder_stats.bytes_written / 1024);
+        sonicmeter_text_str(&t, "K ");
+        sonicmeter_text_u32(&t, m->recorder_stats.write_bps / 1024);
+        sonicmeter_text_str(&t, "K/s d");
+        sonicmeter_text_u32(&t, m->recorder_stats.dropped);
+    }
 
-    if(m->measurement_made) {
-        furi_string_printf(xstr, "Distance %0.2f cm", (double)m->distance_cm);
+    sonicmeter_text_init(&t, text->link, sizeof(text->link));
+    if(m->streaming) {
+        if(m->stream_stats.connected) {
+            sonicmeter_text_str(&t, "USB d");
+            sonicmeter_text_u32(&t, m->stream_stats.dropped);
+        } else {
+            sonicmeter_text_str(&t, "USB --");
+        }
+    }
+
+    sonicmeter_text_init(&t, text->distance, sizeof(text->distance));
+    if(m->busy) {
+        sonicmeter_text_str(&t, "Busy: CLI run");
+    } else if(m->measurement_made) {
+        sonicmeter_text_str(&t, "Distance ");
+        sonicmeter_text_fixed(&t, m->filtered_um / 100, 2);
+        sonicmeter_text_str(&t, " cm");
+    } else if(m->capture_result == SonicMeterCaptureResultOutOfRange) {
+        sonicmeter_text_str(&t, "Out of range");
+    } else if(m->capture_result == SonicMeterCaptureResultLineHigh) {
+        sonicmeter_text_str(&t, "Echo line busy");
     } else {
-        furi_string_printf(xstr, "Distance N/A");
+        sonicmeter_text_str(&t, "Distance N/A");
+    }
+
+    sonicmeter_text_init(&t, text->velocity, sizeof(text->velocity));
+    if(!m->busy && m->sensor_count == 1) {
+        int32_t mm_s;
+        sonicmeter_text_str(&t, "Speed ");
+        if(sonicmeter_velocity_get(&m->sensor_velocity[0], &mm_s)) {
+            if(mm_s < 0) {
+                sonicmeter_text_str(&t, "-");
+            }
+            sonicmeter_text_fixed(&t, mm_s < 0 ? -(uint32_t)mm_s : (uint32_t)mm_s, 1);
+            sonicmeter_text_str(&t, " cm/s");
+        } else {
+            sonicmeter_text_str(&t, "--");
+        }
+    }
+
+    const SonicMeterDriver* driver = sonicmeter_driver_get(m->driver);
+    sonicmeter_text_init(&t, text->ticks, sizeof(text->ticks));
+    if(m->setting_debug) {
+        sonicmeter_text_str(&t, "Ticks: ");
+        sonicmeter_text_u32(&t, m->ticks);
+        sonicmeter_text_str(&t, " ");
+        if(driver->capabilities & SonicMeterDriverCapabilityBackend) {
+            sonicmeter_text_str(&t, setting_capture_names[m->capture_backend]);
+        } else {
+            sonicmeter_text_str(&t, driver->name);
+        }
+    }
+
+    sonicmeter_text_init(&t, text->time, sizeof(text->time));
+    if(m->setting_debug) {
+        sonicmeter_text_str(&t, "Time: ");
+        sonicmeter_text_u32(&t, m->echo_us);
+        sonicmeter_text_str(&t, " us");
     }
 
-    if(!m->setting_debug) {
-        canvas_draw_str(canvas, 30, 35, furi_string_get_cstr(xstr));
+    text->echo_pin[0] = '\0';
+    if(driver->capabilities & SonicMeterDriverCapabilitySerial) {
+        sonicmeter_text_init(&t, text->trigger_pin, sizeof(text->trigger_pin));
+        sonicmeter_text_str(&t, driver->name);
+        sonicmeter_text_init(&t, text->echo_pin, sizeof(text->echo_pin));
+        sonicmeter_text_str(&t, "UART 13/14");
+    } else if(driver->capabilities & SonicMeterDriverCapabilityEchoPin) {
+        sonicmeter_text_init(&t, text->trigger_pin, sizeof(text->trigger_pin));
+        sonicmeter_text_str(&t, "Trigger pin: ");
+        sonicmeter_text_str(&t, sonicmeter_pins[m->setting_triggerpin_index].name);
+        sonicmeter_text_init(&t, text->echo_pin, sizeof(text->echo_pin));
+        sonicmeter_text_str(&t, "Echo pin: ");
+        sonicmeter_text_str(&t, sonicmeter_pins[m->setting_echopin_index].name);
     } else {
-        canvas_draw_str(canvas, 30, 25, furi_string_get_cstr(xstr));
+        sonicmeter_text_init(&t, text->trigger_pin, sizeof(text->trigger_pin));
+        sonicmeter_text_str(&t, driver->name);
+        sonicmeter_text_str(&t, " pin: ");
+        sonicmeter_text_str(&t, sonicmeter_pins[m->setting_triggerpin_index].name);
+    }
 
-        furi_string_printf(xstr, "Ticks: %lu", m->ticks);
-        canvas_draw_str(canvas, 30, 35, furi_string_get_cstr(xstr));
+    sonicmeter_text_init(&t, text->power, sizeof(text->power));
+    sonicmeter_text_str(&t, "5V ");
+    if(m->power_stats.external) {
+        sonicmeter_text_str(&t, "USB");
+    } else {
+        // Average draw with the rail up for its share of the time
+        const uint32_t draw_ma = SONICMETER_POWER_BASE_MA;
+        const uint32_t rail_ma = SONICMETER_POWER_SENSOR_MA * m->sensor_count;
+        const uint32_t duty = m->power_stats.duty_permille;
+        sonicmeter_text_fixed(&t, duty, 1);
+        sonicmeter_text_str(&t, "% ~");
+        sonicmeter_text_u32(&t, m->battery_mah * 1000 / (draw_ma * 1000 + rail_ma * duty));
+        sonicmeter_text_str(&t, "h");
+        if(m->setting_debug && m->power_stats.settle_ms) {
+            sonicmeter_text_str(&t, " s");
+            sonicmeter_text_u32(&t, m->power_stats.settle_ms);
+        }
+    }
 
-        furi_string_printf(xstr, "Time: %lu us", m->echo_us);
-        canvas_draw_str(canvas, 30, 45, furi_string_get_cstr(xstr));
+    sonicmeter_text_init(&t, text->alarm, sizeof(text->alarm));
+    if(m->alarm_enabled) {
+        if(m->alarm_stats.raised) {
+            sonicmeter_text_str(&t, "ALARM");
+        } else if(m->setting_debug) {
+            sonicmeter_text_str(&t, "Alarm");
+        }
+        if(m->setting_debug) {
+            sonicmeter_text_str(&t, " ");
+            if(m->alarm_stats.count) {
+                sonicmeter_text_u32(&t, m->alarm_stats.last_us);
+                sonicmeter_text_str(&t, "/");
+                sonicmeter_text_u32(&t, m->alarm_stats.max_us);
+                sonicmeter_text_str(&t, " us");
+            } else {
+                sonicmeter_text_str(&t, "-");
+            }
+        }
     }
 
-    furi_string_printf(
-        xstr, "Trigger pin: %s", setting_triggerpin_names[m->setting_triggerpin_index]);
-    canvas_draw_str(canvas, 0, 62, furi_string_get_cstr(xstr));
+    text->sensors = m->sensor_count;
+    text->sensor_alarm = 0;
+    for(uint32_t i = 0; i < SONICMETER_SAMPLE_SENSORS_MAX; i++) {
+        sonicmeter_text_init(&t, text->sensor_distance[i], sizeof(text->sensor_distance[i]));
+        sonicmeter_text_init(&t, text->sensor_rate[i], sizeof(text->sensor_rate[i]));
+    }
+    if(m->sensor_count > 1) {
+        for(uint32_t i = 0; i < m->sensor_count; i++) {
+            sonicmeter_text_init(&t, text->sensor_distance[i], sizeof(text->sensor_distance[i]));
+            if(m->sensor_result[i] == SonicMeterCaptureResultOk) {
+                sonicmeter_text_fixed(&t, m->sensor_filtered_um[i] / 1000, 1);
+            } else if(m->sensor_result[i] == SonicMeterCaptureResultOutOfRange) {
+                sonicmeter_text_str(&t, "far");
+            } else if(m->sensor_result[i] == SonicMeterCaptureResultLineHigh) {
+                sonicmeter_text_str(&t, "busy");
+            } else {
+                sonicmeter_text_str(&t, "--");
+            }
+
+            sonicmeter_text_init(&t, text->sensor_rate[i], sizeof(text->sensor_rate[i]));
+            sonicmeter_text_fixed(&t, m->sensor_rate[i].dhz, 1);
+            sonicmeter_text_str(&t, "/s");
+
+            if(m->sensor_alarm[i]) {
+                text->sensor_alarm |= 1U << i;
+            }
+        }
+    }
+}
 
-    furi_string_printf(xstr, "Echo pin: %s", setting_echopin_names[m->setting_echopin_index]);
-    canvas_draw_str(canvas, 75, 62, furi_string_get_cstr(xstr));
+/**
+ * @brief      Format the history graph page.
+ * @details    Decimation is done by the history, this only picks the level and labels it.
+ * @param      history  The histories of all sensors.
+ * @param      m        The SonicMeterMeasureModel object.
+ * @param      text     Filled in with the graph.
+*/
+static void sonicmeter_view_measure_format_graph(
+    const SonicMeterHistory* history,
+    const SonicMeterMeasureModel* m,
+    SonicMeterMeasureText* text) {
+    SonicMeterText t;
+
+    text->graph_title[0] = '\0';
+    text->graph_range[0] = '\0';
+    if(m->page != SonicMeterMeasurePageGraph) {
+        memset(&text->graph, 0, sizeof(text->graph));
+        return;
+    }
 
-    furi_string_free(xstr);
+    sonicmeter_text_init(&t, text->graph_title, sizeof(text->graph_title));
+    sonicmeter_text_str(&t, "S");
+    sonicmeter_text_u32(&t, m->graph_sensor + 1);
+    sonicmeter_text_str(&t, " x");
+    sonicmeter_text_u32(&t, sonicmeter_history_get_scale(m->graph_level));
+
+    const size_t columns = sonicmeter_history_plot(
+        &history[m->graph_sensor], m->graph_level, &text->graph, SONICMETER_GRAPH_HEIGHT);
+    sonicmeter_text_init(&t, text->graph_range, sizeof(text->graph_range));
+    if(columns) {
+        // Millimeters are tenths of a centimeter
+        sonicmeter_text_fixed(&t, text->graph.low_mm, 1);
+        sonicmeter_text_str(&t, "-");
+        sonicmeter_text_fixed(&t, text->graph.high_mm, 1);
+        sonicmeter_text_str(&t, " cm");
+    }
 }
 
 /**
- * @brief     Get the trigger pin based on the setting for the HC-SR04.
- * @details   This function returns the trigger pin based on the setting for the HC-SR04.
- * @param index 
- * @return   The trigger pin.
- */
+ * @brief      Draw the history graph.
+ * @details    One vertical line per column, from the smallest to the largest distance the column
+ *             covers, so flicker shows as a tall column and a steady distance as a single dot.
+ * @param      canvas  The canvas to draw on.
+ * @param      text    The frame to draw.
+*/
+static void sonicmeter_view_measure_draw_graph(Canvas* canvas, const SonicMeterMeasureText* text) {
+    canvas_draw_str(canvas, 0, 8, text->graph_title);
+    if(!text->graph_range[0]) {
+        canvas_draw_str_aligned(canvas, 64, 36, AlignCenter, AlignCenter, "No samples");
+        return;
+    }
+    canvas_draw_str_aligned(canvas, 128, 0, AlignRight, AlignTop, text->graph_range);
 
-static const GpioPin* sonicmeter_get_trigger_pin(uint8_t index) {
-    switch(index) {
-    case 0:
-        return &gpio_ext_pa4;
-    case 1:
-        return &gpio_ext_pa4;
-    case 2:
-        return &gpio_ext_pa4;
-    default:
-        return NULL;
+    for(uint8_t x = 0; x < SONICMETER_HISTORY_PLOT_WIDTH; x++) {
+        if(text->graph.top[x] == SONICMETER_HISTORY_EMPTY) {
+            continue;
+        }
+        canvas_draw_line(
+            canvas,
+            x,
+            SONICMETER_GRAPH_TOP + text->graph.top[x],
+            x,
+            SONICMETER_GRAPH_TOP + text->graph.bottom[x]);
     }
 }
 
+// Percentiles of the stats page, tenths of a percent
+static const uint32_t sonicmeter_stats_page_permille[] = {500, 990, 999};
+static const char* const sonicmeter_stats_page_names[SonicMeterStatsSeriesCount] = {
+    [SonicMeterStatsSeriesWidth] = "Echo us",
+    [SonicMeterStatsSeriesDistance] = "Dist mm",
+    [SonicMeterStatsSeriesInterval] = "Gap ms",
+};
+
 /**
- * @brief     Get the echo pin based on the setting for the HC-SR04.
- * @details   This function returns the echo pin based on the setting for the HC-SR04.
- * @param index 
- * @return   The echo pin.
- */
-static const GpioPin* sonicmeter_get_echo_pin(uint8_t index) {
-    switch(index) {
-    case 0:
-        return &gpio_ext_pb2;
-    case 1:
-        return &gpio_ext_pb3;
-    default:
-        return NULL;
+ * @brief      Format the statistics page.
+ * @details    The percentiles are worked out from the histograms on every frame, one pass over
+ *             the buckets per series.
+ * @param      stats  The SonicMeterStats object.
+ * @param      m      The SonicMeterMeasureModel object.
+ * @param      text   Filled in with the statistics.
+*/
+static void sonicmeter_view_measure_format_stats(
+    const SonicMeterStats* stats,
+    const SonicMeterMeasureModel* m,
+    SonicMeterMeasureText* text) {
+    SonicMeterText t;
+
+    memset(text->stats, 0, sizeof(text->stats));
+    memset(text->stats_count, 0, sizeof(text->stats_count));
+    memset(text->schedule, 0, sizeof(text->schedule));
+    if(m->page != SonicMeterMeasurePageStats) {
+        return;
+    }
+
+    for(uint32_t i = 0; i < SonicMeterStatsSeriesCount; i++) {
+        const SonicMeterHistogram* histogram = sonicmeter_stats_get(stats, i);
+        uint32_t values[COUNT_OF(sonicmeter_stats_page_permille)];
+        sonicmeter_histogram_get_percentiles(
+            histogram, sonicmeter_stats_page_permille, values, COUNT_OF(values));
+        for(uint32_t p = 0; p < COUNT_OF(values); p++) {
+            sonicmeter_text_init(&t, text->stats[i][p], sizeof(text->stats[i][p]));
+            if(histogram->total) {
+                sonicmeter_text_u32(&t, values[p]);
+            } else {
+                sonicmeter_text_str(&t, "-");
+            }
+        }
+    }
+
+    sonicmeter_text_init(&t, text->stats_count, sizeof(text->stats_count));
+    sonicmeter_text_str(&t, "n ");
+    sonicmeter_text_u32(&t, sonicmeter_stats_get(stats, SonicMeterStatsSeriesWidth)->total);
+
+    // Deadline to trigger, mean and worst, then the periods lost to overruns
+    const SonicMeterScheduleStats* schedule = &m->schedule_stats;
+    sonicmeter_text_init(&t, text->schedule, sizeof(text->schedule));
+    sonicmeter_text_str(&t, "late ");
+    if(schedule->fired) {
+        sonicmeter_text_u32(&t, schedule->late_sum_us / schedule->fired);
+        sonicmeter_text_str(&t, "/");
+        sonicmeter_text_u32(&t, schedule->late_max_us);
+        sonicmeter_text_str(&t, "us skip ");
+        sonicmeter_text_u32(&t, schedule->skipped);
+    } else {
+        sonicmeter_text_str(&t, "-");
     }
 }
 
 /**
- * @brief      Callback for timer elapsed.
- * @details    This function is called when the timer is elapsed.  
- *             We use this to queue a redraw event.
- * @param      context  The context - SonicMeterApp object.
+ * @brief      Draw the statistics page.
+ * @param      canvas  The canvas to draw on.
+ * @param      text    The frame to draw.
 */
-static void sonicmeter_view_measure_timer_callback(void* context) {
-    SonicMeterApp* app = (SonicMeterApp*)context;
-    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+static void sonicmeter_view_measure_draw_stats(Canvas* canvas, const SonicMeterMeasureText* text) {
+    canvas_draw_str_aligned(canvas, 62, 0, AlignRight, AlignTop, "p50");
+    canvas_draw_str_aligned(canvas, 95, 0, AlignRight, AlignTop, "p99");
+    canvas_draw_str_aligned(canvas, 128, 0, AlignRight, AlignTop, "p99.9");
+
+    for(uint32_t i = 0; i < SonicMeterStatsSeriesCount; i++) {
+        const uint8_t y = 11 + i * 12;
+        canvas_draw_str(canvas, 0, y + 7, sonicmeter_stats_page_names[i]);
+        canvas_draw_str_aligned(canvas, 62, y, AlignRight, AlignTop, text->stats[i][0]);
+        canvas_draw_str_aligned(canvas, 95, y, AlignRight, AlignTop, text->stats[i][1]);
+        canvas_draw_str_aligned(canvas, 128, y, AlignRight, AlignTop, text->stats[i][2]);
+    }
 
-    model->measurement_made = false;
+    canvas_draw_str(canvas, 0, 53, text->schedule);
+    canvas_draw_str(canvas, 0, 62, text->stats_count);
+    canvas_draw_str_aligned(canvas, 128, 64, AlignRight, AlignBottom, "OK: save");
+}
 
-    if(!model->have_5v) {
-        if(furi_hal_power_is_otg_enabled() || furi_hal_power_is_charging()) {
-            model->have_5v = true;
+/**
+ * @brief      Format the memory page.
+ * @param      m     The SonicMeterMeasureModel object.
+ * @param      text  Filled in with the memory report.
+*/
+static void sonicmeter_view_measure_format_memory(
+    const SonicMeterMeasureModel* m,
+    SonicMeterMeasureText* text) {
+    SonicMeterMemoryStats stats;
+    SonicMeterText t;
+
+    memset(text->memory, 0, sizeof(text->memory));
+    memset(text->memory_heap, 0, sizeof(text->memory_heap));
+    if(m->page != SonicMeterMeasurePageMemory) {
+        return;
+    }
+
+    sonicmeter_memory_get_stats(&stats);
+    for(uint32_t i = 0; i < SonicMeterMemoryThreadCount; i++) {
+        sonicmeter_text_init(&t, text->memory[i][0], sizeof(text->memory[i][0]));
+        sonicmeter_text_u32(&t, stats.stack_size[i]);
+        sonicmeter_text_init(&t, text->memory[i][1], sizeof(text->memory[i][1]));
+        if(stats.stack_used[i]) {
+            sonicmeter_text_u32(&t, stats.stack_used[i]);
         } else {
-            return;
+            sonicmeter_text_str(&t, "-");
         }
     }
+    const uint32_t arena = SonicMeterMemoryThreadCount;
+    sonicmeter_text_init(&t, text->memory[arena][0], sizeof(text->memory[arena][0]));
+    sonicmeter_text_u32(&t, stats.arena_size);
+    sonicmeter_text_init(&t, text->memory[arena][1], sizeof(text->memory[arena][1]));
+    sonicmeter_text_u32(&t, stats.arena_used);
+
+    sonicmeter_text_init(&t, text->memory_heap[0], sizeof(text->memory_heap[0]));
+    sonicmeter_text_str(&t, "heap peak ");
+    sonicmeter_text_u32(&t, stats.heap_peak);
+    sonicmeter_text_init(&t, text->memory_heap[1], sizeof(text->memory_heap[1]));
+    sonicmeter_text_str(&t, "free ");
+    sonicmeter_text_u32(&t, stats.heap_free);
+    sonicmeter_text_str(&t, " low ");
+    sonicmeter_text_u32(&t, stats.heap_low);
+}
+
+/**
+ * @brief      Draw the memory page.
+ * @details    Size and deepest use of every thread stack and of the arena, in bytes, then the
+ *             heap.
+ * @param      canvas  The canvas to draw on.
+ * @param      text    The frame to draw.
+*/
+static void
+    sonicmeter_view_measure_draw_memory(Canvas* canvas, const SonicMeterMeasureText* text) {
+    canvas_draw_str(canvas, 0, 7, "bytes");
+    canvas_draw_str_aligned(canvas, 95, 0, AlignRight, AlignTop, "size");
+    canvas_draw_str_aligned(canvas, 128, 0, AlignRight, AlignTop, "used");
+
+    for(uint32_t i = 0; i <= SonicMeterMemoryThreadCount; i++) {
+        const uint8_t y = 15 + i * 8;
+        canvas_draw_str(
+            canvas,
+            0,
+            y,
+            i < SonicMeterMemoryThreadCount ? sonicmeter_memory_get_thread_name(i) : "arena");
+        canvas_draw_str_aligned(canvas, 95, y - 7, AlignRight, AlignTop, text->memory[i][0]);
+        canvas_draw_str_aligned(canvas, 128, y - 7, AlignRight, AlignTop, text->memory[i][1]);
+    }
+
+    canvas_draw_str(canvas, 0, 55, text->memory_heap[0]);
+    canvas_draw_str(canvas, 0, 63, text->memory_heap[1]);
+}
+
+/**
+ * @brief      Draw the measurement.
+ * @param      canvas  The canvas to draw on.
+ * @param      text    The frame to draw.
+*/
+static void sonicmeter_view_measure_draw_main(Canvas* canvas, const SonicMeterMeasureText* text) {
+    canvas_draw_str(canvas, 35, 8, "Sonic Meter");
+    canvas_draw_str_aligned(canvas, 128, 0, AlignRight, AlignTop, text->rate);
+
+    if(text->recording[0]) {
+        canvas_draw_str(canvas, 0, 16, text->recording);
+    }
+    if(text->link[0]) {
+        canvas_draw_str_aligned(canvas, 128, 9, AlignRight, AlignTop, text->link);
+    }
 
-    notification_message(app->notifications, &sequence_blink_start_yellow);
+    if(text->sensors > 1) {
+        // One column per sensor: name, distance in cm, rate
+        const uint8_t width = 128 / text->sensors;
+        char name[3] = {'S', '1', '\0'};
+        for(uint32_t i = 0; i < text->sensors; i++) {
+            const uint8_t x = width * i + width / 2;
+            name[1] = '1' + i;
+            canvas_draw_str_aligned(canvas, x, 22, AlignCenter, AlignTop, name);
+            if(text->sensor_alarm & (1U << i)) {
+                canvas_draw_frame(canvas, x - 8, 20, 16, 11);
+            }
+            canvas_draw_str_aligned(
+                canvas, x, 34, AlignCenter, AlignTop, text->sensor_distance[i]);
+            canvas_draw_str_aligned(canvas, x, 46, AlignCenter, AlignTop, text->sensor_rate[i]);
+        }
+        canvas_draw_str_aligned(canvas, 128, 64, AlignRight, AlignBottom, "cm");
+        canvas_draw_str_aligned(canvas, 0, 64, AlignLeft, AlignBottom, text->power);
+        return;
+    }
 
-    const uint32_t timeout_ms = 100;
+    // Lines down to y 45, closer together past three. The alarm keeps its line without debug,
+    // so the others do not move when it comes and goes
+    const char* lines[4];
+    uint32_t count = 0;
+    lines[count++] = text->distance;
+    if(text->velocity[0]) {
+        lines[count++] = text->velocity;
+    }
+    if(text->debug) {
+        lines[count++] = text->ticks;
+        // Four lines at most, the ticks tell the echo width too
+        if(!text->velocity[0] || !text->alarm[0]) {
+            lines[count++] = text->time;
+        }
+    }
+    if(!text->debug || text->alarm[0]) {
+        lines[count++] = text->alarm;
+    }
+    const uint8_t step = count > 3 ? 7 : 10;
+    for(uint32_t i = 0; i < count; i++) {
+        canvas_draw_str(canvas, 30, 45 - step * (count - 1 - i), lines[i]);
+    }
 
-    // Setup Pins
-    const GpioPin* trigger_pin = sonicmeter_get_trigger_pin(model->setting_triggerpin_index);
-    furi_hal_gpio_write(trigger_pin, false);
-    furi_hal_gpio_init(trigger_pin, GpioModeOutputPushPull, GpioPullNo, GpioSpeedVeryHigh);
+    canvas_draw_str(canvas, 0, 53, text->power);
+    canvas_draw_str(canvas, 0, 62, text->trigger_pin);
+    canvas_draw_str(canvas, 75, 62, text->echo_pin);
+}
 
-    const GpioPin* echo_pin = sonicmeter_get_echo_pin(model->setting_echopin_index);
-    furi_hal_gpio_write(echo_pin, false);
-    furi_hal_gpio_init(echo_pin, GpioModeInput, GpioPullNo, GpioSpeedVeryHigh);
+/**
+ * @brief      Callback for drawing the measure screen.
+ * @details    This function is called when the screen needs to be redrawn, like when the model gets updated.
+ * @param      canvas  The canvas to draw on.
+ * @param      model   The model - SonicMeterMeasureModel object.
+*/
+static void sonicmeter_view_measure_draw_callback(Canvas* canvas, void* model) {
+    SonicMeterMeasureModel* m = (SonicMeterMeasureModel*)model;
 
-    // Send Trigger
-    furi_hal_gpio_write(trigger_pin, true);
-    furi_delay_us(10);
-    furi_hal_gpio_write(trigger_pin, false);
+    // Only the latest frame published by sonicmeter_view_measure_render is drawn, so everything on
+    // screen comes from the same frame
+    SONICMETER_PROBE_BEGIN(draw_start);
+    const SonicMeterMeasureText* text = sonicmeter_snapshot_read(m->frame);
+    switch(text->page) {
+#if SONICMETER_PROBES
+    case SonicMeterMeasurePageProbes:
+        sonicmeter_view_measure_draw_probes(canvas);
+        break;
+#endif
+    case SonicMeterMeasurePageGraph:
+        sonicmeter_view_measure_draw_graph(canvas, text);
+        break;
+    case SonicMeterMeasurePageStats:
+        sonicmeter_view_measure_draw_stats(canvas, text);
+        break;
+    case SonicMeterMeasurePageMemory:
+        sonicmeter_view_measure_draw_memory(canvas, text);
+        break;
+    default:
+        sonicmeter_view_measure_draw_main(canvas, text);
+        break;
+    }
+    SONICMETER_PROBE_END(SonicMeterProbeStageDraw, draw_start);
+}
 
-    const uint32_t start = furi_get_tick();
+/**
+ * @brief      Callback for a new sample.
+ * @details    This function is called on the worker thread after every sample.  We hand the sample
+ *             to the recorder, which never blocks, and queue a redraw event unless one is already
+ *             queued, so a slow GUI never fills the event queue and blocks the worker.
+ * @param      sample   The new sample.
+ * @param      context  The context - SonicMeterApp object.
+*/
+static void sonicmeter_worker_sample_callback(const SonicMeterSample* sample, void* context) {
+    SonicMeterApp* app = (SonicMeterApp*)context;
+    sonicmeter_recorder_push(app->recorder, sample);
+    sonicmeter_stats_push(app->stats, sample);
+    if(!atomic_exchange(&app->sample_pending, true)) {
+        view_dispatcher_send_custom_event(app->view_dispatcher, SonicMeterEventIdRedrawScreen);
+    }
+}
 
-    // wait for echo pin to go low if not already there
-    // Just a safeback
-    while(furi_get_tick() - start < timeout_ms && furi_hal_gpio_read(echo_pin)) {
+/**
+ * @brief      Count a sample towards an achieved rate.
+ * @param      rate       The SonicMeterRate object.
+ * @param      timestamp  Timestamp of the sample.
+*/
+static void sonicmeter_rate_update(SonicMeterRate* rate, uint64_t timestamp) {
+    if(rate->window_count == 0) {
+        rate->window_start = timestamp;
+    }
+    rate->window_count++;
+    const uint64_t elapsed = timestamp - rate->window_start;
+    if(elapsed >= SONICMETER_SAMPLE_TIMESTAMP_HZ) {
+        rate->dhz =
+            (uint64_t)(rate->window_count - 1) * SONICMETER_SAMPLE_TIMESTAMP_HZ * 10 / elapsed;
+        rate->window_start = timestamp;
+        rate->window_count = 1;
     }
+}
 
-    // wait for echo pin to go high
-    while(furi_get_tick() - start < timeout_ms && !furi_hal_gpio_read(echo_pin)) {
+/**
+ * @brief      Drain the sample ring into the model.
+ * @details    Only the latest sample is shown, every sample goes into the history of its sensor.
+ * @param      app  The sonicmeter application object.
+*/
+static void sonicmeter_view_measure_drain(SonicMeterApp* app) {
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    SonicMeterRing* ring = sonicmeter_worker_get_ring(app->worker);
+    SonicMeterSample sample;
+    bool have_sample = false;
+
+    atomic_store(&app->sample_pending, false);
+    sonicmeter_memory_mark_stack(SonicMeterMemoryThreadApp);
+    sonicmeter_memory_mark_heap();
+    model->recording = sonicmeter_recorder_is_running(app->recorder);
+    sonicmeter_recorder_get_stats(app->recorder, &model->recorder_stats);
+    sonicmeter_stream_get_stats(app->stream, &model->stream_stats);
+    sonicmeter_worker_get_power_stats(app->worker, &model->power_stats);
+    sonicmeter_worker_get_alarm_stats(app->worker, &model->alarm_stats);
+    sonicmeter_worker_get_schedule_stats(app->worker, &model->schedule_stats);
+    if(furi_get_tick() - app->battery_tick >= furi_ms_to_ticks(SONICMETER_BATTERY_PERIOD_MS)) {
+        app->battery_tick = furi_get_tick();
+        model->battery_mah = furi_hal_power_get_battery_remaining_capacity();
     }
+    while(sonicmeter_ring_read(ring, &app->reader, &sample)) {
+        have_sample = true;
+        sonicmeter_rate_update(&model->rate, sample.timestamp);
+
+        const uint32_t sensor = sample.sensor;
+        sonicmeter_rate_update(&model->sensor_rate[sensor], sample.timestamp);
+        model->sensor_result[sensor] = sample.result;
+        model->sensor_filtered_um[sensor] = sample.filtered_um;
+        model->sensor_alarm[sensor] = sample.flags & SonicMeterSampleFlagAlarm;
+        if(sample.result == SonicMeterCaptureResultOk &&
+           !(sample.flags & SonicMeterSampleFlagRejected)) {
+            // The fit spans a second, the low 32 bits of the timestamp are enough
+            sonicmeter_velocity_add(
+                &model->sensor_velocity[sensor], (uint32_t)sample.timestamp, sample.filtered_um);
+        }
 
-    FuriHalCortexTimer beginTimer = furi_hal_cortex_timer_get(0);
+        // The graph shows the raw distance, flicker is what it is there for
+        if(sample.result == SonicMeterCaptureResultOk) {
+            const uint32_t mm = sample.distance_um / 1000;
+            sonicmeter_history_push(&app->history[sensor], mm > UINT16_MAX ? UINT16_MAX : mm);
+        }
+    }
 
-    // wait for echo pin to go low
-    while(furi_get_tick() - start < timeout_ms && furi_hal_gpio_read(echo_pin)) {
+    if(have_sample) {
+        model->capture_result = sample.result;
+        model->spurious_edges = sample.spurious_edges;
+        model->ticks = sample.ticks;
+        model->echo_us = sample.echo_us;
+        model->distance_um = sample.distance_um;
+        model->filtered_um = sample.filtered_um;
+        model->measurement_made = sample.result == SonicMeterCaptureResultOk;
     }
+}
 
-    FuriHalCortexTimer endTimer = furi_hal_cortex_timer_get(0);
+/**
+ * @brief      Show the model on screen if anything visible changed.
+ * @details    Frames closer together than SONICMETER_FRAME_PERIOD_MS are held back, the frame
+ *             timer comes back for them with whatever is latest by then. The model itself is only
+ *             touched on this thread, the GUI thread gets whole frames through the snapshot.
+ * @param      app  The sonicmeter application object.
+*/
+static void sonicmeter_view_measure_render(SonicMeterApp* app) {
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
 
-    uint32_t duration = endTimer.start - beginTimer.start;
+    sonicmeter_view_measure_format(model, &app->text);
+    sonicmeter_view_measure_format_graph(app->history, model, &app->text);
+    sonicmeter_view_measure_format_stats(app->stats, model, &app->text);
+    sonicmeter_view_measure_format_memory(model, &app->text);
+    bool changed = memcmp(&app->text, &app->shown, sizeof(app->text)) != 0;
+    // The stage timings move with every sample
+    changed |= model->page == SonicMeterMeasurePageProbes;
+    if(!changed) {
+        return;
+    }
 
-    model->ticks = duration;
-    model->echo_us = cpu_ticks_to_us(duration);
-    model->distance_cm = cpu_ticks_to_hc_sr04_cm(duration);
-    model->measurement_made = true;
-    notification_message(app->notifications, &sequence_blink_stop);
+    const uint32_t period = furi_ms_to_ticks(SONICMETER_FRAME_PERIOD_MS);
+    const uint32_t elapsed = furi_get_tick() - app->frame_tick;
+    if(elapsed < period) {
+        if(!furi_timer_is_running(app->frame_timer)) {
+            furi_timer_start(app->frame_timer, period - elapsed);
+        }
+        return;
+    }
 
+    app->frame_tick = furi_get_tick();
+    app->shown = app->text;
+    sonicmeter_snapshot_publish(model->frame, &app->shown);
+    with_view_model(app->view_measure, SonicMeterMeasureModel * _model, { UNUSED(_model); }, true);
+}
+
+/**
+ * @brief      Callback for the frame timer.
+ * @details    Asks for the frame that was held back by the frame rate cap.
+ * @param      context  The context - SonicMeterApp object.
+*/
+static void sonicmeter_frame_timer_callback(void* context) {
+    SonicMeterApp* app = (SonicMeterApp*)context;
     view_dispatcher_send_custom_event(app->view_dispatcher, SonicMeterEventIdRedrawScreen);
 }
 
+/**
+ * @brief      Build the worker configuration from the settings.
+ * @details    Shared by the measure screen and the CLI command, which overrides parts of it.
+ * @param      model   The SonicMeterMeasureModel object.
+ * @param      config  Filled in with the configuration.
+*/
+static void sonicmeter_worker_config_from_settings(
+    const SonicMeterMeasureModel* model,
+    SonicMeterWorkerConfig* config) {
+    const SonicMeterDriver* driver = sonicmeter_driver_get(model->setting_driver_index);
+    *config = (SonicMeterWorkerConfig){
+        .sensor_count = setting_sensors_values[model->setting_sensors_index],
+        .driver = model->setting_driver_index,
+        .backend = setting_capture_values[model->setting_capture_index],
+        .period_ms =
+            model->setting_burst ? 0 : setting_interval_values[model->setting_interval_index],
+        .max_range_cm = setting_range_values[model->setting_range_index],
+        .temperature_c = model->setting_temperature_c,
+        .filter =
+            {
+                .type = setting_filter_values[model->setting_filter_index],
+                .window = setting_window_values[model->setting_window_index],
+                .reject_outliers = model->setting_reject_outliers,
+            },
+        .power = setting_power_values[model->setting_power_index],
+        .alarm =
+            {
+                .enabled = model->setting_alarm_index != 0,
+                .band =
+                    {
+                        .near_mm = setting_alarm_near_values[model->setting_alarm_near_index] * 10,
+                        .far_mm = setting_alarm_far_values[model->setting_alarm_far_index] * 10,
+                        .hysteresis_mm =
+                            setting_hysteresis_values[model->setting_hysteresis_index] * 10,
+                        .debounce = setting_debounce_values[model->setting_debounce_index],
+                    },
+                .outputs = setting_alarm_values[model->setting_alarm_index],
+                .pin = NULL,
+            },
+    };
+
+    if(driver->capabilities & SonicMeterDriverCapabilitySerial) {
+        config->sensor_count = 1;
+    }
+    if(config->sensor_count == 1) {
+        config->sensors[0].trigger_pin = sonicmeter_pins[model->setting_triggerpin_index].gpio;
+        config->sensors[0].echo_pin = sonicmeter_pins[model->setting_echopin_index].gpio;
+    } else {
+        memcpy(config->sensors, sonicmeter_sensor_array, sizeof(config->sensors));
+    }
+    if(model->setting_alarm_pin_index != 0) {
+        config->alarm.pin = sonicmeter_pins[model->setting_alarm_pin_index - 1].gpio;
+        for(uint32_t i = 0; i < config->sensor_count; i++) {
+            const bool serial = driver->capabilities & SonicMeterDriverCapabilitySerial;
+            if(!serial && (config->alarm.pin == config->sensors[i].trigger_pin ||
+                           config->alarm.pin == config->sensors[i].echo_pin)) {
+                FURI_LOG_W(TAG, "Alarm pin in use by sensor %lu", i);
+                config->alarm.pin = NULL;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief      Callback for the configured settings.
+ * @details    This function is called on the CLI thread when a sonicmeter command starts.
+ * @param      config   Filled in with the configuration.
+ * @param      context  The context - SonicMeterApp object.
+*/
+static void sonicmeter_cli_config_callback(SonicMeterWorkerConfig* config, void* context) {
+    SonicMeterApp* app = (SonicMeterApp*)context;
+    sonicmeter_worker_config_from_settings(view_get_model(app->view_measure), config);
+}
+
 /**
  * @brief      Callback when the user starts the measure screen.
- * @details    This function is called when the user enters the measure screen.  We start a timer to
- *             redraw the screen periodically.
+ * @details    This function is called when the user enters the measure screen.  We start the
+ *             worker, which triggers measurements periodically on its own thread.
  * @param      context  The context - SonicMeterApp object.
 */
 static void sonicmeter_view_measure_enter_callback(void* context) {
-    uint32_t period = furi_ms_to_ticks(200);
     SonicMeterApp* app = (SonicMeterApp*)context;
-    furi_assert(app->timer == NULL);
-    app->timer =
-        furi_timer_alloc(sonicmeter_view_measure_timer_callback, FuriTimerTypePeriodic, context);
-    furi_timer_start(app->timer, period);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    SonicMeterWorkerConfig config;
+
+    sonicmeter_worker_config_from_settings(model, &config);
+
+    memset(&model->rate, 0, sizeof(model->rate));
+    memset(model->sensor_rate, 0, sizeof(model->sensor_rate));
+    for(uint32_t i = 0; i < SONICMETER_SAMPLE_SENSORS_MAX; i++) {
+        model->sensor_result[i] = SonicMeterCaptureResultNoEcho;
+        sonicmeter_velocity_reset(&model->sensor_velocity[i]);
+    }
+    model->sensor_count = config.sensor_count;
+    model->driver = config.driver;
+    memset(model->sensor_alarm, 0, sizeof(model->sensor_alarm));
+    memset(&model->alarm_stats, 0, sizeof(model->alarm_stats));
+    memset(&model->schedule_stats, 0, sizeof(model->schedule_stats));
+    model->alarm_enabled = config.alarm.enabled;
+    app->battery_tick = furi_get_tick();
+    model->battery_mah = furi_hal_power_get_battery_remaining_capacity();
+    if(model->graph_sensor >= model->sensor_count) {
+        model->graph_sensor = 0;
+    }
+
+    for(uint32_t i = 0; i < config.sensor_count; i++) {
+        sonicmeter_history_reset(&app->history[i]);
+    }
+
+    sonicmeter_stats_reset(app->stats);
+    // A CLI run has the worker, the screen only says so until it is done
+    model->busy = furi_mutex_acquire(app->sampling, 0) != FuriStatusOk;
+    if(!model->busy) {
+        sonicmeter_ring_reader_init(sonicmeter_worker_get_ring(app->worker), &app->reader);
+        atomic_store(&app->sample_pending, false);
+        sonicmeter_worker_set_callback(app->worker, sonicmeter_worker_sample_callback, app);
+        model->capture_backend = sonicmeter_worker_start(app->worker, &config);
+    }
+
+    if(!model->busy && model->setting_stream_index != 0) {
+        SonicMeterStreamFormat format = model->setting_stream_index == 2 ?
+                                            SonicMeterStreamFormatText :
+                                            SonicMeterStreamFormatBinary;
+        if(!sonicmeter_stream_start(
+               app->stream, sonicmeter_worker_get_ring(app->worker), format)) {
+            notification_message(app->notifications, &sequence_error);
+        }
+    }
+    model->streaming = sonicmeter_stream_is_running(app->stream);
+
+    // First frame right away
+    app->frame_tick = furi_get_tick() - furi_ms_to_ticks(SONICMETER_FRAME_PERIOD_MS);
+    memset(&app->shown, 0, sizeof(app->shown));
+    sonicmeter_view_measure_render(app);
+
+    // The alarm owns the LED when it drives it
+    if(!model->busy &&
+       !(config.alarm.enabled && (config.alarm.outputs & SonicMeterWorkerAlarmOutputLed))) {
+        notification_message(app->notifications, &sequence_blink_start_yellow);
+    }
 }
 
 /**
  * @brief      Callback when the user exits the measure screen.
- * @details    This function is called when the user exits the measure screen.  We stop the timer.
+ * @details    This function is called when the user exits the measure screen.  We stop the worker.
  * @param      context  The context - SonicMeterApp object.
 */
 static void sonicmeter_view_measure_exit_callback(void* context) {
     SonicMeterApp* app = (SonicMeterApp*)context;
-    furi_timer_stop(app->timer);
-    furi_timer_free(app->timer);
-    app->timer = NULL;
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    sonicmeter_stream_stop(app->stream);
+    if(!model->busy) {
+        sonicmeter_worker_stop(app->worker);
+        furi_mutex_release(app->sampling);
+    }
+    sonicmeter_recorder_stop(app->recorder);
+    furi_timer_stop(app->frame_timer);
+    notification_message(app->notifications, &sequence_blink_stop);
+}
+
+/**
+ * @brief      Start or stop recording.
+ * @details    This function is called when the user presses OK on the measure screen.
+ * @param      app  The sonicmeter application object.
+*/
+static void sonicmeter_view_measure_toggle_recording(SonicMeterApp* app) {
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+
+    if(sonicmeter_recorder_is_running(app->recorder)) {
+        sonicmeter_recorder_stop(app->recorder);
+    } else {
+        SonicMeterRecordHeader header = {
+            .cpu_hz = SystemCoreClock,
+            .tick_hz = SONICMETER_SAMPLE_TIMESTAMP_HZ,
+            .temperature_c = model->setting_temperature_c,
+            .max_range_cm = setting_range_values[model->setting_range_index],
+        };
+        if(!sonicmeter_recorder_start(app->recorder, &header)) {
+            notification_message(app->notifications, &sequence_error);
+        }
+    }
+
+    model->recording = sonicmeter_recorder_is_running(app->recorder);
+    sonicmeter_recorder_get_stats(app->recorder, &model->recorder_stats);
+    sonicmeter_view_measure_render(app);
+}
+
+/**
+ * @brief      Save the statistics to the SD card.
+ * @details    Next to the recordings, as statsN.csv.
+ * @param      app  The sonicmeter application object.
+*/
+static void sonicmeter_view_measure_export_stats(SonicMeterApp* app) {
+    Storage* storage = furi_record_open(RECORD_STORAGE);
+    FuriString* name = furi_string_alloc();
+
+    storage_simply_mkdir(storage, SONICMETER_RECORDER_DIR);
+    storage_get_next_filename(storage, SONICMETER_RECORDER_DIR, "stats", ".csv", name, 255);
+    FuriString* path = furi_string_alloc_printf(
+        "%s/%s.csv", SONICMETER_RECORDER_DIR, furi_string_get_cstr(name));
+    const bool ok = sonicmeter_stats_export(app->stats, furi_string_get_cstr(path));
+    notification_message(app->notifications, ok ? &sequence_success : &sequence_error);
+
+    furi_string_free(path);
+    furi_string_free(name);
+    furi_record_close(RECORD_STORAGE);
+}
+
+/**
+ * @brief      Move between the pages of the measure screen.
+ * @details    Up and Down go through the measurement, the graph of every sensor, the statistics
+ *             and, in debug, the memory use and the stage timings. Left and Right zoom the graph
+ *             out and in.
+ * @param      app    The sonicmeter application object.
+ * @param      event  The key event - SonicMeterEventId value.
+*/
+static void sonicmeter_view_measure_navigate(SonicMeterApp* app, uint32_t event) {
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+
+    // Pages in order: main, graph of sensor 0 .. sensor_count - 1, stats, memory, probes
+    uint32_t position = 0;
+    if(model->page == SonicMeterMeasurePageGraph) {
+        position = 1 + model->graph_sensor;
+    } else if(model->page == SonicMeterMeasurePageStats) {
+        position = 1 + model->sensor_count;
+    } else if(model->page == SonicMeterMeasurePageMemory) {
+        position = 2 + model->sensor_count;
+    } else if(model->page == SonicMeterMeasurePageProbes) {
+        position = 3 + model->sensor_count;
+    }
+    uint32_t count = 2 + model->sensor_count;
+    if(model->setting_debug) {
+        count++;
+#if SONICMETER_PROBES
+        count++;
+#endif
+    }
+
+    switch(event) {
+    case SonicMeterEventIdUpPressed:
+        position = (position + count - 1) % count;
+        break;
+    case SonicMeterEventIdDownPressed:
+        position = (position + 1) % count;
+        break;
+    case SonicMeterEventIdLeftPressed:
+        if(model->graph_level + 1 < SONICMETER_HISTORY_LEVELS) {
+            model->graph_level++;
+        }
+        break;
+    case SonicMeterEventIdRightPressed:
+        if(model->graph_level > 0) {
+            model->graph_level--;
+        }
+        break;
+    default:
+        break;
+    }
+
+    if(position == 0) {
+        model->page = SonicMeterMeasurePageMain;
+    } else if(position <= model->sensor_count) {
+        model->page = SonicMeterMeasurePageGraph;
+        model->graph_sensor = position - 1;
+    } else if(position == 1 + model->sensor_count) {
+        model->page = SonicMeterMeasurePageStats;
+    } else if(position == 2 + model->sensor_count) {
+        model->page = SonicMeterMeasurePageMemory;
+    } else {
+        model->page = SonicMeterMeasurePageProbes;
+    }
+    sonicmeter_view_measure_render(app);
 }
 
 /**
@@ -350,17 +1602,28 @@ static bool sonicmeter_view_measure_custom_event_callback(uint32_t event, void*
     SonicMeterApp* app = (SonicMeterApp*)context;
     switch(event) {
     case SonicMeterEventIdRedrawScreen: {
-        bool redraw = true;
-        with_view_model(
-            app->view_measure, SonicMeterMeasureModel * _model, { UNUSED(_model); }, redraw);
+        sonicmeter_view_measure_drain(app);
+        sonicmeter_view_measure_render(app);
         return true;
     }
     case SonicMeterEventIdOkPressed: {
-        // This app doesn't do anything when the OK button is pressed.
-        // return false because we did not handle it.
-        // Change it to true when you want to handle it.
-
-        return false;
+        // OK saves the statistics on their page, and starts and stops recording elsewhere
+        SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+        if(model->busy) {
+            // Nothing is being measured
+        } else if(model->page == SonicMeterMeasurePageStats) {
+            sonicmeter_view_measure_export_stats(app);
+        } else {
+            sonicmeter_view_measure_toggle_recording(app);
+        }
+        return true;
+    }
+    case SonicMeterEventIdUpPressed:
+    case SonicMeterEventIdDownPressed:
+    case SonicMeterEventIdLeftPressed:
+    case SonicMeterEventIdRightPressed: {
+        sonicmeter_view_measure_navigate(app, event);
+        return true;
     }
     default:
         return false;
@@ -381,6 +1644,23 @@ static bool sonicmeter_view_measure_input_callback(InputEvent* event, void* cont
             view_dispatcher_send_custom_event(app->view_dispatcher, SonicMeterEventIdOkPressed);
             return true;
         }
+        if(event->key == InputKeyUp) {
+            view_dispatcher_send_custom_event(app->view_dispatcher, SonicMeterEventIdUpPressed);
+            return true;
+        }
+        if(event->key == InputKeyDown) {
+            view_dispatcher_send_custom_event(app->view_dispatcher, SonicMeterEventIdDownPressed);
+            return true;
+        }
+        if(event->key == InputKeyLeft) {
+            view_dispatcher_send_custom_event(app->view_dispatcher, SonicMeterEventIdLeftPressed);
+            return true;
+        }
+        if(event->key == InputKeyRight) {
+            view_dispatcher_send_custom_event(
+                app->view_dispatcher, SonicMeterEventIdRightPressed);
+            return true;
+        }
     }
 
     return false;
@@ -392,7 +1672,10 @@ static bool sonicmeter_view_measure_input_callback(InputEvent* event, void* cont
  * @return     SonicMeterApp object.
 */
 static SonicMeterApp* sonicmeter_app_alloc() {
+    // First, the heap peak counts from here
+    SonicMeterArena* arena = sonicmeter_memory_start();
     SonicMeterApp* app = (SonicMeterApp*)malloc(sizeof(SonicMeterApp));
+    app->arena = arena;
 
     Gui* gui = furi_record_open(RECORD_GUI);
 
@@ -418,31 +1701,258 @@ static SonicMeterApp* sonicmeter_app_alloc() {
     app->variable_item_list_config = variable_item_list_alloc();
     variable_item_list_reset(app->variable_item_list_config);
 
+    // Setup Sensor
+    VariableItem* driver_item = variable_item_list_add(
+        app->variable_item_list_config,
+        setting_driver_config_label,
+        SonicMeterDriverTypeCount,
+        sonicmeter_setting_driver_change,
+        app);
+
+    uint8_t setting_driver_index = SonicMeterDriverTypeHcSr04;
+    variable_item_set_current_value_index(driver_item, setting_driver_index);
+    variable_item_set_current_value_text(
+        driver_item, sonicmeter_driver_get(setting_driver_index)->name);
+
     // Setup Trigger Pin
     VariableItem* triggerpin_item = variable_item_list_add(
         app->variable_item_list_config,
         setting_triggerpin_config_label,
-        COUNT_OF(setting_triggerpin_values),
+        SONICMETER_PINS_COUNT,
         sonicmeter_setting_triggerpin_change,
         app);
 
-    uint8_t setting_triggerpin_index = 0;
+    uint8_t setting_triggerpin_index = sonicmeter_pins_find(&gpio_ext_pa4);
     variable_item_set_current_value_index(triggerpin_item, setting_triggerpin_index);
     variable_item_set_current_value_text(
-        triggerpin_item, setting_triggerpin_names[setting_triggerpin_index]);
+        triggerpin_item, sonicmeter_pins[setting_triggerpin_index].name);
 
     // Setup Trigger Pin
     VariableItem* echopin_item = variable_item_list_add(
         app->variable_item_list_config,
         setting_echopin_config_label,
-        COUNT_OF(setting_echopin_values),
+        SONICMETER_PINS_COUNT,
         sonicmeter_setting_echopin_change,
         app);
 
-    uint8_t setting_echopin_index = 0;
+    uint8_t setting_echopin_index = sonicmeter_pins_find(&gpio_ext_pb2);
     variable_item_set_current_value_index(echopin_item, setting_echopin_index);
     variable_item_set_current_value_text(
-        echopin_item, setting_echopin_names[setting_echopin_index]);
+        echopin_item, sonicmeter_pins[setting_echopin_index].name);
+
+    // Setup Sensors
+    VariableItem* sensors_item = variable_item_list_add(
+        app->variable_item_list_config,
+        setting_sensors_config_label,
+        COUNT_OF(setting_sensors_values),
+        sonicmeter_setting_sensors_change,
+        app);
+
+    uint8_t setting_sensors_index = 0;
+    variable_item_set_current_value_index(sensors_item, setting_sensors_index);
+    variable_item_set_current_value_text(
+        sensors_item, setting_sensors_names[setting_sensors_index]);
+
+    // Setup Capture
+    VariableItem* capture_item = variable_item_list_add(
+        app->variable_item_list_config,
+        setting_capture_config_label,
+        COUNT_OF(setting_capture_values),
+        sonicmeter_setting_capture_change,
+        app);
+
+    uint8_t setting_capture_index = 0;
+    variable_item_set_current_value_index(capture_item, setting_capture_index);
+    variable_item_set_current_value_text(
+        capture_item, setting_capture_names[setting_capture_index]);
+
+    // Setup Max Range
+    VariableItem* range_item = variable_item_list_add(
+        app->variable_item_list_config,
+        setting_range_config_label,
+        COUNT_OF(setting_range_values),
+        sonicmeter_setting_range_change,
+        app);
+
+    uint8_t setting_range_index = SETTING_RANGE_DEFAULT_INDEX;
+    variable_item_set_current_value_index(range_item, setting_range_index);
+    variable_item_set_current_value_text(range_item, setting_range_names[setting_range_index]);
+
+    // Setup Burst
+    VariableItem* burst_item = variable_item_list_add(
+        app->variable_item_list_config,
+        setting_burst_config_label,
+        COUNT_OF(setting_burst_values),
+        sonicmeter_setting_burst_change,
+        app);
+
+    uint8_t setting_burst_index = 0;
+    variable_item_set_current_value_index(burst_item, setting_burst_index);
+    variable_item_set_current_value_text(burst_item, setting_burst_names[setting_burst_index]);
+
+    // Setup Interval
+    VariableItem* interval_item = variable_item_list_add(
+        app->variable_item_list_config,
+        setting_interval_config_label,
+        COUNT_OF(setting_interval_values),
+        sonicmeter_setting_interval_change,
+        app);
+
+    uint8_t setting_interval_index = 0;
+    variable_item_set_current_value_index(interval_item, setting_interval_index);
+    variable_item_set_current_value_text(
+        interval_item, setting_interval_names[setting_interval_index]);
+
+    // Setup 5V Power
+    VariableItem* power_item = variable_item_list_add(
+        app->variable_item_list_config,
+        setting_power_config_label,
+        COUNT_OF(setting_power_values),
+        sonicmeter_setting_power_change,
+        app);
+
+    uint8_t setting_power_index = 0;
+    variable_item_set_current_value_index(power_item, setting_power_index);
+    variable_item_set_current_value_text(power_item, setting_power_names[setting_power_index]);
+
+    // Setup Temperature
+    VariableItem* temperature_item = variable_item_list_add(
+        app->variable_item_list_config,
+        setting_temperature_config_label,
+        SONICMETER_CONVERT_TEMPERATURE_MAX - SONICMETER_CONVERT_TEMPERATURE_MIN + 1,
+        sonicmeter_setting_temperature_change,
+        app);
+
+    int32_t setting_temperature_c = SONICMETER_CONVERT_TEMPERATURE_DEFAULT;
+    variable_item_set_current_value_index(
+        temperature_item, setting_temperature_c - SONICMETER_CONVERT_TEMPERATURE_MIN);
+    sonicmeter_setting_temperature_set_text(temperature_item, setting_temperature_c);
+
+    // Setup Filter
+    VariableItem* filter_item = variable_item_list_add(
+        app->variable_item_list_config,
+        setting_filter_config_label,
+        COUNT_OF(setting_filter_values),
+        sonicmeter_setting_filter_change,
+        app);
+
+    uint8_t setting_filter_index = 0;
+    variable_item_set_current_value_index(filter_item, setting_filter_index);
+    variable_item_set_current_value_text(filter_item, setting_filter_names[setting_filter_index]);
+
+    // Setup Filter Window
+    VariableItem* window_item = variable_item_list_add(
+        app->variable_item_list_config,
+        setting_window_config_label,
+        COUNT_OF(setting_window_values),
+        sonicmeter_setting_window_change,
+        app);
+
+    uint8_t setting_window_index = 1;
+    variable_item_set_current_value_index(window_item, setting_window_index);
+    variable_item_set_current_value_text(window_item, setting_window_names[setting_window_index]);
+
+    // Setup Outliers
+    VariableItem* outliers_item = variable_item_list_add(
+        app->variable_item_list_config,
+        setting_outliers_config_label,
+        COUNT_OF(setting_outliers_values),
+        sonicmeter_setting_outliers_change,
+        app);
+
+    uint8_t setting_outliers_index = 0;
+    variable_item_set_current_value_index(outliers_item, setting_outliers_index);
+    variable_item_set_current_value_text(
+        outliers_item, setting_outliers_names[setting_outliers_index]);
+
+    // Setup Alarm
+    VariableItem* alarm_item = variable_item_list_add(
+        app->variable_item_list_config,
+        setting_alarm_config_label,
+        COUNT_OF(setting_alarm_values),
+        sonicmeter_setting_alarm_change,
+        app);
+
+    uint8_t setting_alarm_index = 0;
+    variable_item_set_current_value_index(alarm_item, setting_alarm_index);
+    variable_item_set_current_value_text(alarm_item, setting_alarm_names[setting_alarm_index]);
+
+    // Setup Alarm Near
+    VariableItem* alarm_near_item = variable_item_list_add(
+        app->variable_item_list_config,
+        setting_alarm_near_config_label,
+        COUNT_OF(setting_alarm_near_values),
+        sonicmeter_setting_alarm_near_change,
+        app);
+
+    uint8_t setting_alarm_near_index = 0;
+    variable_item_set_current_value_index(alarm_near_item, setting_alarm_near_index);
+    variable_item_set_current_value_text(
+        alarm_near_item, setting_alarm_near_names[setting_alarm_near_index]);
+
+    // Setup Alarm Far
+    VariableItem* alarm_far_item = variable_item_list_add(
+        app->variable_item_list_config,
+        setting_alarm_far_config_label,
+        COUNT_OF(setting_alarm_far_values),
+        sonicmeter_setting_alarm_far_change,
+        app);
+
+    uint8_t setting_alarm_far_index = 2;
+    variable_item_set_current_value_index(alarm_far_item, setting_alarm_far_index);
+    variable_item_set_current_value_text(
+        alarm_far_item, setting_alarm_far_names[setting_alarm_far_index]);
+
+    // Setup Hysteresis
+    VariableItem* hysteresis_item = variable_item_list_add(
+        app->variable_item_list_config,
+        setting_hysteresis_config_label,
+        COUNT_OF(setting_hysteresis_values),
+        sonicmeter_setting_hysteresis_change,
+        app);
+
+    uint8_t setting_hysteresis_index = 2;
+    variable_item_set_current_value_index(hysteresis_item, setting_hysteresis_index);
+    variable_item_set_current_value_text(
+        hysteresis_item, setting_hysteresis_names[setting_hysteresis_index]);
+
+    // Setup Debounce
+    VariableItem* debounce_item = variable_item_list_add(
+        app->variable_item_list_config,
+        setting_debounce_config_label,
+        COUNT_OF(setting_debounce_values),
+        sonicmeter_setting_debounce_change,
+        app);
+
+    uint8_t setting_debounce_index = 0;
+    variable_item_set_current_value_index(debounce_item, setting_debounce_index);
+    variable_item_set_current_value_text(
+        debounce_item, setting_debounce_names[setting_debounce_index]);
+
+    // Setup Alarm Pin
+    VariableItem* alarm_pin_item = variable_item_list_add(
+        app->variable_item_list_config,
+        setting_alarm_pin_config_label,
+        SONICMETER_PINS_COUNT + 1,
+        sonicmeter_setting_alarm_pin_change,
+        app);
+
+    uint8_t setting_alarm_pin_index = 0;
+    variable_item_set_current_value_index(alarm_pin_item, setting_alarm_pin_index);
+    variable_item_set_current_value_text(
+        alarm_pin_item, sonicmeter_setting_alarm_pin_name(setting_alarm_pin_index));
+
+    // Setup USB Stream
+    VariableItem* stream_item = variable_item_list_add(
+        app->variable_item_list_config,
+        setting_stream_config_label,
+        COUNT_OF(setting_stream_values),
+        sonicmeter_setting_stream_change,
+        app);
+
+    uint8_t setting_stream_index = 0;
+    variable_item_set_current_value_index(stream_item, setting_stream_index);
+    variable_item_set_current_value_text(stream_item, setting_stream_names[setting_stream_index]);
 
     // Setup Debug
     VariableItem* debug_item = variable_item_list_add(
@@ -476,8 +1986,44 @@ static SonicMeterApp* sonicmeter_app_alloc() {
     view_allocate_model(app->view_measure, ViewModelTypeLockFree, sizeof(SonicMeterMeasureModel));
     SonicMeterMeasureModel* model = view_get_model(app->view_measure);
 
+    model->setting_driver_index = setting_driver_index;
+    model->driver = setting_driver_index;
     model->setting_triggerpin_index = setting_triggerpin_index;
     model->setting_echopin_index = setting_echopin_index;
+    model->setting_sensors_index = setting_sensors_index;
+    model->setting_capture_index = setting_capture_index;
+    model->setting_range_index = setting_range_index;
+    model->setting_burst = setting_burst_index == 1;
+    model->setting_interval_index = setting_interval_index;
+    model->setting_power_index = setting_power_index;
+    model->setting_temperature_c = setting_temperature_c;
+    model->setting_filter_index = setting_filter_index;
+    model->setting_window_index = setting_window_index;
+    model->setting_reject_outliers = setting_outliers_index == 1;
+    model->setting_alarm_index = setting_alarm_index;
+    model->setting_alarm_near_index = setting_alarm_near_index;
+    model->setting_alarm_far_index = setting_alarm_far_index;
+    model->setting_hysteresis_index = setting_hysteresis_index;
+    model->setting_debounce_index = setting_debounce_index;
+    model->setting_alarm_pin_index = setting_alarm_pin_index;
+    model->setting_stream_index = setting_stream_index;
+    model->busy = false;
+    model->page = SonicMeterMeasurePageMain;
+    model->graph_sensor = 0;
+    model->graph_level = 0;
+    model->frame = sonicmeter_snapshot_alloc(app->arena, sizeof(SonicMeterMeasureText));
+
+    app->worker = sonicmeter_worker_alloc(app->arena);
+    app->recorder = sonicmeter_recorder_alloc(app->arena);
+    app->stats = sonicmeter_stats_alloc(app->arena);
+    app->history = sonicmeter_arena_take(
+        app->arena, sizeof(SonicMeterHistory) * SONICMETER_SAMPLE_SENSORS_MAX);
+    app->stream = sonicmeter_stream_alloc();
+    app->frame_timer =
+        furi_timer_alloc(sonicmeter_frame_timer_callback, FuriTimerTypeOnce, (void*)app);
+    app->sampling = furi_mutex_alloc(FuriMutexTypeNormal);
+    app->cli =
+        sonicmeter_cli_alloc(app->worker, app->sampling, sonicmeter_cli_config_callback, app);
 
     view_dispatcher_add_view(app->view_dispatcher, SonicMeterViewMeasure, app->view_measure);
 
@@ -518,14 +2064,8 @@ void hc_sr04_init(SonicMeterApp* app) {
 
     furi_hal_power_suppress_charge_enter();
 
-    model->have_5v = false;
-
-    if(furi_hal_power_is_otg_enabled() || furi_hal_power_is_charging()) {
-        model->have_5v = true;
-    } else {
-        furi_hal_power_enable_otg();
-        model->have_5v = true;
-    }
+    // The worker switches the 5V rail on while measuring
+    model->have_5v = furi_hal_power_is_otg_enabled() || furi_hal_power_is_charging();
 }
 
 /**
@@ -539,10 +2079,18 @@ static void sonicmeter_app_free(SonicMeterApp* app) {
 #endif
     furi_record_close(RECORD_NOTIFICATION);
 
+    // The CLI is gone already, main_sonicmeter_app stops it before the front end
+    furi_mutex_free(app->sampling);
     view_dispatcher_remove_view(app->view_dispatcher, SonicMeterViewAbout);
     widget_free(app->widget_about);
     view_dispatcher_remove_view(app->view_dispatcher, SonicMeterViewMeasure);
+    SonicMeterMeasureModel* model = view_get_model(app->view_measure);
+    sonicmeter_snapshot_free(model->frame);
     view_free(app->view_measure);
+    sonicmeter_worker_free(app->worker);
+    sonicmeter_recorder_free(app->recorder);
+    sonicmeter_stream_free(app->stream);
+    furi_timer_free(app->frame_timer);
     view_dispatcher_remove_view(app->view_dispatcher, SonicMeterViewConfigure);
     variable_item_list_free(app->variable_item_list_config);
     view_dispatcher_remove_view(app->view_dispatcher, SonicMeterViewSubmenu);
@@ -551,6 +2099,8 @@ static void sonicmeter_app_free(SonicMeterApp* app) {
     furi_record_close(RECORD_GUI);
 
     free(app);
+    // Last, the arena holds buffers of everything above
+    sonicmeter_memory_stop();
 }
 
 /**
@@ -569,11 +2119,16 @@ void hc_sr04_exit(SonicMeterApp* app) {
     furi_hal_power_suppress_charge_exit();
 
     // reset pins
-    const GpioPin* trigger_pin = sonicmeter_get_trigger_pin(model->setting_triggerpin_index);
-    furi_hal_gpio_init(trigger_pin, GpioModeInput, GpioPullNo, GpioSpeedLow);
-
-    const GpioPin* echo_pin = sonicmeter_get_echo_pin(model->setting_echopin_index);
-    furi_hal_gpio_init(echo_pin, GpioModeInput, GpioPullNo, GpioSpeedLow);
+    furi_hal_gpio_init(
+        sonicmeter_pins[model->setting_triggerpin_index].gpio,
+        GpioModeInput,
+        GpioPullNo,
+        GpioSpeedLow);
+    furi_hal_gpio_init(
+        sonicmeter_pins[model->setting_echopin_index].gpio,
+        GpioModeInput,
+        GpioPullNo,
+        GpioSpeedLow);
 }
 
 /**
@@ -591,6 +2146,8 @@ int32_t main_sonicmeter_app(void* _p) {
 
     view_dispatcher_run(app->view_dispatcher);
 
+    // First, a CLI run still uses the worker, the 5V rail and the pins
+    sonicmeter_cli_free(app->cli);
     hc_sr04_exit(app);
     sonicmeter_app_free(app);
     return 0;
@@ -0,0 +1,48 @@
+#include "sonicmeter_alarm.h"
+
+void sonicmeter_alarm_init(SonicMeterAlarm* alarm, const SonicMeterAlarmConfig* config) {
+    alarm->config = *config;
+    if(alarm->config.far_mm < alarm->config.near_mm) {
+        alarm->config.far_mm = config->near_mm;
+        alarm->config.near_mm = config->far_mm;
+    }
+    if(alarm->config.debounce == 0) {
+        alarm->config.debounce = 1;
+    }
+    alarm->raised = false;
+    alarm->streak = 0;
+}
+
+SonicMeterAlarmEvent sonicmeter_alarm_process(
+    SonicMeterAlarm* alarm,
+    SonicMeterCaptureResult result,
+    uint32_t distance_um) {
+    const SonicMeterAlarmConfig* config = &alarm->config;
+    bool inside;
+
+    if(result == SonicMeterCaptureResultOk) {
+        const uint32_t mm = distance_um / 1000;
+        uint32_t near = config->near_mm;
+        uint32_t far = config->far_mm;
+        if(alarm->raised) {
+            near = near > config->hysteresis_mm ? near - config->hysteresis_mm : 0;
+            far += config->hysteresis_mm;
+        }
+        inside = mm >= near && mm <= far;
+    } else if(result == SonicMeterCaptureResultOutOfRange) {
+        inside = false;
+    } else {
+        return SonicMeterAlarmEventNone;
+    }
+
+    if(inside == alarm->raised) {
+        alarm->streak = 0;
+        return SonicMeterAlarmEventNone;
+    }
+    if(++alarm->streak < config->debounce) {
+        return SonicMeterAlarmEventNone;
+    }
+    alarm->raised = inside;
+    alarm->streak = 0;
+    return inside ? SonicMeterAlarmEventRaise : SonicMeterAlarmEventClear;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sonicmeter_capture.h"
+
+/**
+ * Distance band alarm.
+ *
+ * Raised when an object is inside a band of distances, cleared when it leaves. Once raised the
+ * band grows by the hysteresis on both sides, so an object sitting on an edge does not toggle it,
+ * and the alarm only changes state after the debounce count of samples in a row agree. With a
+ * debounce of 1 it follows the first sample that crosses. No HAL, the caller drives the outputs.
+*/
+
+typedef struct {
+    uint32_t near_mm; // Closest distance of the band
+    uint32_t far_mm; // Furthest distance of the band, swapped with near_mm if below it
+    uint32_t hysteresis_mm; // Added on both sides of the band while raised
+    uint32_t debounce; // Samples in a row needed to raise or clear, 0 counts as 1
+} SonicMeterAlarmConfig;
+
+typedef enum {
+    SonicMeterAlarmEventNone, // No change
+    SonicMeterAlarmEventRaise, // An object came into the band
+    SonicMeterAlarmEventClear, // The object left the band
+} SonicMeterAlarmEvent;
+
+typedef struct {
+    SonicMeterAlarmConfig config;
+    bool raised;
+    uint32_t streak; // Samples in a row that disagree with the current state
+} SonicMeterAlarm;
+
+/**
+ * @brief      Configure the alarm and clear it.
+ * @param      alarm   The alarm object.
+ * @param      config  The configuration, copied.
+*/
+void sonicmeter_alarm_init(SonicMeterAlarm* alarm, const SonicMeterAlarmConfig* config);
+
+/**
+ * @brief      Feed a measurement into the alarm.
+ * @details    Out of range counts as nothing in the band. Failed captures carry no distance and
+ *             leave the alarm and the debounce count as they are.
+ * @param      alarm        The alarm object.
+ * @param      result       The capture result.
+ * @param      distance_um  The distance, used when the capture succeeded.
+ * @return     The state change this measurement caused.
+*/
+SonicMeterAlarmEvent sonicmeter_alarm_process(
+    SonicMeterAlarm* alarm,
+    SonicMeterCaptureResult result,
+    uint32_t distance_um);
+
+/**
+ * @brief      Check whether the alarm is raised.
+ * @param      alarm  The alarm object.
+ * @return     true if an object is in the band.
+*/
+static inline bool sonicmeter_alarm_is_raised(const SonicMeterAlarm* alarm) {
+    return alarm->raised;
+}
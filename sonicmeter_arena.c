@@ -0,0 +1,45 @@
+#include "sonicmeter_arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct SonicMeterArena {
+    uint8_t* base;
+    size_t size;
+    size_t used;
+};
+
+SonicMeterArena* sonicmeter_arena_alloc(size_t size) {
+    SonicMeterArena* arena = malloc(sizeof(SonicMeterArena));
+    arena->base = malloc(size);
+    arena->size = size;
+    arena->used = 0;
+    return arena;
+}
+
+void sonicmeter_arena_free(SonicMeterArena* arena) {
+    free(arena->base);
+    free(arena);
+}
+
+void* sonicmeter_arena_take(SonicMeterArena* arena, size_t size) {
+    // The size is checked before it is rounded too, rounding a size near SIZE_MAX wraps to 0
+    const size_t left = arena->size - arena->used;
+    const size_t rounded = SONICMETER_ARENA_ROUND(size);
+    if(size > left || rounded > left) {
+        abort();
+    }
+
+    void* piece = arena->base + arena->used;
+    arena->used += rounded;
+    memset(piece, 0, size);
+    return piece;
+}
+
+size_t sonicmeter_arena_get_size(const SonicMeterArena* arena) {
+    return arena->size;
+}
+
+size_t sonicmeter_arena_get_used(const SonicMeterArena* arena) {
+    return arena->used;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Memory arena.
+ *
+ * One block allocated up front, handed out in pieces that are never given back on their own:
+ * everything goes when the arena is freed. The large buffers of the app come from here, so they
+ * cost one heap allocation of a size known at build time, and a missing piece of RAM shows up
+ * when the app starts rather than half way through a measurement. No HAL.
+*/
+
+#define SONICMETER_ARENA_ALIGN 8 // Alignment of every piece, enough for any type
+// Arena space a piece of a given size takes
+#define SONICMETER_ARENA_ROUND(size) \
+    (((size) + SONICMETER_ARENA_ALIGN - 1) & ~(size_t)(SONICMETER_ARENA_ALIGN - 1))
+
+typedef struct SonicMeterArena SonicMeterArena;
+
+/**
+ * @brief      Allocate an arena.
+ * @param      size  Bytes the pieces can take together.
+ * @return     SonicMeterArena object.
+*/
+SonicMeterArena* sonicmeter_arena_alloc(size_t size);
+
+/**
+ * @brief      Free an arena and every piece taken from it.
+ * @param      arena  The SonicMeterArena object.
+*/
+void sonicmeter_arena_free(SonicMeterArena* arena);
+
+/**
+ * @brief      Take a piece.
+ * @details    Aborts when the arena is exhausted, the memory budget makes sure it never is.
+ * @param      arena  The SonicMeterArena object.
+ * @param      size   Size of the piece.
+ * @return     The piece, zeroed, valid until the arena is freed.
+*/
+void* sonicmeter_arena_take(SonicMeterArena* arena, size_t size);
+
+/**
+ * @brief      Get the size of an arena.
+ * @param      arena  The SonicMeterArena object.
+ * @return     Bytes the pieces can take together.
+*/
+size_t sonicmeter_arena_get_size(const SonicMeterArena* arena);
+
+/**
+ * @brief      Get the space taken.
+ * @param      arena  The SonicMeterArena object.
+ * @return     Bytes taken by the pieces so far, alignment included.
+*/
+size_t sonicmeter_arena_get_used(const SonicMeterArena* arena);
@@ -0,0 +1,266 @@
+#include "sonicmeter_batch.h"
+#include "sonicmeter_text.h"
+
+#include <math.h>
+#include <string.h>
+
+/**
+ * @brief      Parse a decimal number.
+ * @param      text   The digits, nothing else.
+ * @param      size   Number of characters.
+ * @param      value  Set to the number.
+ * @return     false if it is not a number or does not fit.
+*/
+static bool sonicmeter_batch_parse_u32(const char* text, size_t size, uint32_t* value) {
+    uint64_t result = 0;
+    if(size == 0 || size > 10) {
+        return false;
+    }
+    for(size_t i = 0; i < size; i++) {
+        if(text[i] < '0' || text[i] > '9') {
+            return false;
+        }
+        result = result * 10 + (text[i] - '0');
+    }
+    if(result > UINT32_MAX) {
+        return false;
+    }
+    *value = result;
+    return true;
+}
+
+/**
+ * @brief      Copy a name argument.
+ * @param      name  The buffer, SONICMETER_BATCH_NAME_SIZE bytes.
+ * @param      text  The name.
+ * @param      size  Number of characters.
+ * @return     false if it is empty or too long.
+*/
+static bool sonicmeter_batch_parse_name(char* name, const char* text, size_t size) {
+    if(size == 0 || size >= SONICMETER_BATCH_NAME_SIZE) {
+        return false;
+    }
+    memcpy(name, text, size);
+    name[size] = '\0';
+    return true;
+}
+
+/**
+ * @brief      Check a key=value pair for a key.
+ * @param      key   The key of the pair.
+ * @param      size  Number of characters of the key.
+ * @param      name  The key looked for.
+ * @return     true if it is that key.
+*/
+static bool sonicmeter_batch_is_key(const char* key, size_t size, const char* name) {
+    return strlen(name) == size && memcmp(key, name, size) == 0;
+}
+
+bool sonicmeter_batch_parse(const char* text, SonicMeterBatchArgs* args, const char** error) {
+    memset(args, 0, sizeof(SonicMeterBatchArgs));
+    args->count = SONICMETER_BATCH_COUNT_DEFAULT;
+    args->rate_hz = 0;
+    args->output = SonicMeterBatchOutputSummary;
+    *error = NULL;
+
+    while(*text) {
+        if(*text == ' ') {
+            text++;
+            continue;
+        }
+
+        const char* end = strchr(text, ' ');
+        const size_t size = end ? (size_t)(end - text) : strlen(text);
+        const char* equal = memchr(text, '=', size);
+        if(!equal) {
+            *error = "expected key=value";
+            return false;
+        }
+        const char* key = text;
+        const size_t key_size = equal - text;
+        const char* value = equal + 1;
+        const size_t value_size = size - key_size - 1;
+
+        if(sonicmeter_batch_is_key(key, key_size, "n")) {
+            if(!sonicmeter_batch_parse_u32(value, value_size, &args->count) || args->count == 0 ||
+               args->count > SONICMETER_BATCH_COUNT_MAX) {
+                *error = "n must be 1 to 1000000";
+                return false;
+            }
+        } else if(sonicmeter_batch_is_key(key, key_size, "rate")) {
+            if(!sonicmeter_batch_parse_u32(value, value_size, &args->rate_hz) ||
+               args->rate_hz > SONICMETER_BATCH_RATE_MAX) {
+                *error = "rate must be 0 to 16 Hz";
+                return false;
+            }
+        } else if(sonicmeter_batch_is_key(key, key_size, "trig")) {
+            if(!sonicmeter_batch_parse_name(args->trigger, value, value_size)) {
+                *error = "bad trig pin";
+                return false;
+            }
+        } else if(sonicmeter_batch_is_key(key, key_size, "echo")) {
+            if(!sonicmeter_batch_parse_name(args->echo, value, value_size)) {
+                *error = "bad echo pin";
+                return false;
+            }
+        } else if(sonicmeter_batch_is_key(key, key_size, "sensor")) {
+            if(!sonicmeter_batch_parse_name(args->sensor, value, value_size)) {
+                *error = "bad sensor";
+                return false;
+            }
+        } else if(sonicmeter_batch_is_key(key, key_size, "out")) {
+            if(sonicmeter_batch_is_key(value, value_size, "summary")) {
+                args->output = SonicMeterBatchOutputSummary;
+            } else if(sonicmeter_batch_is_key(value, value_size, "raw")) {
+                args->output = SonicMeterBatchOutputRaw;
+            } else {
+                *error = "out must be summary or raw";
+                return false;
+            }
+        } else {
+            *error = "unknown key";
+            return false;
+        }
+
+        text += size;
+    }
+
+    return true;
+}
+
+/**
+ * @brief      Fold a character for name matching.
+ * @param      c     The character.
+ * @return     The upper case character.
+*/
+static inline char sonicmeter_batch_fold(char c) {
+    return (c >= 'a' && c <= 'z') ? c - 'a' + 'A' : c;
+}
+
+bool sonicmeter_batch_name_match(const char* typed, const char* name) {
+    while(true) {
+        while(*typed == '-') {
+            typed++;
+        }
+        while(*name == '-') {
+            name++;
+        }
+        if(sonicmeter_batch_fold(*typed) != sonicmeter_batch_fold(*name)) {
+            return false;
+        }
+        if(*typed == '\0') {
+            return true;
+        }
+        typed++;
+        name++;
+    }
+}
+
+uint32_t sonicmeter_batch_period_ms(uint32_t rate_hz) {
+    return rate_hz ? 1000 / rate_hz : 0;
+}
+
+void sonicmeter_batch_init(SonicMeterBatch* batch, uint32_t requested) {
+    memset(batch, 0, sizeof(SonicMeterBatch));
+    batch->requested = requested;
+    sonicmeter_histogram_reset(&batch->distance);
+}
+
+bool sonicmeter_batch_add(SonicMeterBatch* batch, const SonicMeterSample* sample) {
+    if(sonicmeter_batch_is_done(batch)) {
+        return true;
+    }
+
+    if(batch->samples == 0) {
+        batch->first_timestamp = sample->timestamp;
+    }
+    batch->elapsed_us = sample->timestamp - batch->first_timestamp;
+    batch->samples++;
+    if(sample->result <= SonicMeterCaptureResultLineHigh) {
+        batch->results[sample->result]++;
+    }
+    if(sample->result == SonicMeterCaptureResultOk) {
+        const uint32_t ok = batch->results[SonicMeterCaptureResultOk];
+        const float mm = sample->distance_um / 1000.0f;
+        const float delta = mm - batch->mean_mm;
+        batch->mean_mm += delta / ok;
+        batch->m2 += delta * (mm - batch->mean_mm);
+        sonicmeter_histogram_record(&batch->distance, sample->distance_um / 1000);
+    }
+
+    return sonicmeter_batch_is_done(batch);
+}
+
+void sonicmeter_batch_format_sample(const SonicMeterSample* sample, char* buffer, size_t size) {
+    SonicMeterText t;
+    sonicmeter_text_init(&t, buffer, size);
+    sonicmeter_text_u32(&t, sample->sequence);
+    sonicmeter_text_str(&t, ",");
+    sonicmeter_text_u64(&t, sample->timestamp);
+    sonicmeter_text_str(&t, ",");
+    sonicmeter_text_u32(&t, sample->ticks);
+    sonicmeter_text_str(&t, ",");
+    sonicmeter_text_u32(&t, sample->filtered_um);
+    sonicmeter_text_str(&t, ",");
+    sonicmeter_text_u32(&t, sample->result);
+    sonicmeter_text_str(&t, ",");
+    sonicmeter_text_u32(&t, sample->flags);
+    sonicmeter_text_str(&t, ",");
+    sonicmeter_text_u32(&t, sample->sensor);
+}
+
+void sonicmeter_batch_format_summary(const SonicMeterBatch* batch, char* buffer, size_t size) {
+    SonicMeterText t;
+    sonicmeter_text_init(&t, buffer, size);
+
+    sonicmeter_text_str(&t, "samples ");
+    sonicmeter_text_u32(&t, batch->samples);
+    sonicmeter_text_str(&t, " ok ");
+    sonicmeter_text_u32(&t, batch->results[SonicMeterCaptureResultOk]);
+    sonicmeter_text_str(&t, " no_echo ");
+    sonicmeter_text_u32(&t, batch->results[SonicMeterCaptureResultNoEcho]);
+    sonicmeter_text_str(&t, " out_of_range ");
+    sonicmeter_text_u32(&t, batch->results[SonicMeterCaptureResultOutOfRange]);
+    sonicmeter_text_str(&t, " line_high ");
+    sonicmeter_text_u32(&t, batch->results[SonicMeterCaptureResultLineHigh]);
+    sonicmeter_text_str(&t, " dropped ");
+    sonicmeter_text_u32(&t, batch->dropped);
+    sonicmeter_text_str(&t, "\r\n");
+
+    // Tenths of a sample per second over the whole run
+    sonicmeter_text_str(&t, "rate_hz ");
+    if(batch->samples > 1 && batch->elapsed_us) {
+        sonicmeter_text_fixed(
+            &t,
+            (uint64_t)(batch->samples - 1) * SONICMETER_SAMPLE_TIMESTAMP_HZ * 10 /
+                batch->elapsed_us,
+            1);
+    } else {
+        sonicmeter_text_str(&t, "-");
+    }
+    sonicmeter_text_str(&t, "\r\n");
+
+    const uint32_t ok = batch->results[SonicMeterCaptureResultOk];
+    if(ok == 0) {
+        sonicmeter_text_str(&t, "distance_mm -\r\n");
+        return;
+    }
+    static const uint32_t permille[] = {500, 990};
+    uint32_t values[2];
+    sonicmeter_histogram_get_percentiles(&batch->distance, permille, values, 2);
+    const float deviation = sqrtf(batch->m2 / ok);
+
+    sonicmeter_text_str(&t, "distance_mm min ");
+    sonicmeter_text_u32(&t, batch->distance.min);
+    sonicmeter_text_str(&t, " p50 ");
+    sonicmeter_text_u32(&t, values[0]);
+    sonicmeter_text_str(&t, " p99 ");
+    sonicmeter_text_u32(&t, values[1]);
+    sonicmeter_text_str(&t, " max ");
+    sonicmeter_text_u32(&t, batch->distance.max);
+    sonicmeter_text_str(&t, " mean ");
+    sonicmeter_text_fixed(&t, (uint32_t)(batch->mean_mm * 10 + 0.5f), 1);
+    sonicmeter_text_str(&t, " sd ");
+    sonicmeter_text_fixed(&t, (uint32_t)(deviation * 10 + 0.5f), 1);
+    sonicmeter_text_str(&t, "\r\n");
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sonicmeter_histogram.h"
+#include "sonicmeter_sample.h"
+
+/**
+ * Batch measurement runs.
+ *
+ * The argument parsing and the bookkeeping of the sonicmeter CLI command: how many samples to
+ * take and how to print them, then counting them in and summing them up. No HAL, the command
+ * itself owns the worker and the console.
+*/
+
+#define SONICMETER_BATCH_COUNT_DEFAULT 100
+#define SONICMETER_BATCH_COUNT_MAX 1000000
+// Hz, one trigger per SONICMETER_WORKER_RECOVERY_MS, the worker would slow a faster rate down
+#define SONICMETER_BATCH_RATE_MAX 16
+#define SONICMETER_BATCH_NAME_SIZE 12 // Pin and sensor names, terminator included
+#define SONICMETER_BATCH_SUMMARY_SIZE 256 // Room for the whole summary
+#define SONICMETER_BATCH_LINE_SIZE 80 // Room for one raw sample line
+
+// Arguments of the command, printed when they do not parse
+#define SONICMETER_BATCH_USAGE \
+    "[n=<count>] [rate=<hz>] [trig=<pin>] [echo=<pin>] [sensor=<type>] [out=summary|raw]"
+
+typedef enum {
+    SonicMeterBatchOutputSummary, // Counts and distance statistics once done
+    SonicMeterBatchOutputRaw, // One CSV line per sample as it comes in
+} SonicMeterBatchOutput;
+
+typedef struct {
+    uint32_t count; // Samples to take
+    uint32_t rate_hz; // 0 for as fast as the sensor allows
+    char trigger[SONICMETER_BATCH_NAME_SIZE]; // Pin name, empty for the configured one
+    char echo[SONICMETER_BATCH_NAME_SIZE]; // Pin name, empty for the configured one
+    char sensor[SONICMETER_BATCH_NAME_SIZE]; // Driver name, empty for the configured one
+    SonicMeterBatchOutput output;
+} SonicMeterBatchArgs;
+
+typedef struct {
+    uint32_t requested; // Samples asked for
+    uint32_t samples; // Samples counted in
+    uint32_t results[SonicMeterCaptureResultLineHigh + 1]; // Samples per capture result
+    uint32_t dropped; // Samples the reader lost to ring overwrites
+    uint64_t first_timestamp; // Timestamp of the first sample
+    uint64_t elapsed_us; // First to last sample
+    float mean_mm; // Running mean of the distances of good captures
+    float m2; // Running sum of squared deviations from the mean, Welford
+    SonicMeterHistogram distance; // Distances of good captures, millimeters
+} SonicMeterBatch;
+
+/**
+ * @brief      Parse the command arguments.
+ * @details    Space separated key=value pairs, in any order, every key optional. Names are kept
+ *             as typed, sonicmeter_batch_name_match compares them.
+ * @param      text   The arguments.
+ * @param      args   Filled in with the arguments, defaults for the missing ones.
+ * @param      error  Set to what is wrong when parsing fails.
+ * @return     false if the arguments do not parse.
+*/
+bool sonicmeter_batch_parse(const char* text, SonicMeterBatchArgs* args, const char** error);
+
+/**
+ * @brief      Compare a name typed on the command line with a pin or sensor name.
+ * @details    Case and dashes do not matter, "us100" matches "US-100".
+ * @param      typed  The typed name.
+ * @param      name   The name.
+ * @return     true if they match.
+*/
+bool sonicmeter_batch_name_match(const char* typed, const char* name);
+
+/**
+ * @brief      Get the trigger period of a rate.
+ * @param      rate_hz  The rate, 0 for as fast as possible.
+ * @return     Milliseconds between two triggers, 0 for as fast as possible.
+*/
+uint32_t sonicmeter_batch_period_ms(uint32_t rate_hz);
+
+/**
+ * @brief      Start a run.
+ * @param      batch      The SonicMeterBatch object.
+ * @param      requested  Samples to take.
+*/
+void sonicmeter_batch_init(SonicMeterBatch* batch, uint32_t requested);
+
+/**
+ * @brief      Count a sample in.
+ * @param      batch   The SonicMeterBatch object.
+ * @param      sample  The sample.
+ * @return     true once the requested number of samples is in, later samples are ignored.
+*/
+bool sonicmeter_batch_add(SonicMeterBatch* batch, const SonicMeterSample* sample);
+
+/**
+ * @brief      Check whether the run is complete.
+ * @param      batch  The SonicMeterBatch object.
+ * @return     true once the requested number of samples is in.
+*/
+static inline bool sonicmeter_batch_is_done(const SonicMeterBatch* batch) {
+    return batch->samples >= batch->requested;
+}
+
+/**
+ * @brief      Format a sample as a CSV line.
+ * @details    The columns of the USB text stream: sequence, timestamp, ticks, filtered_um, result,
+ *             flags, sensor. No line ending.
+ * @param      sample  The sample.
+ * @param      buffer  The buffer, SONICMETER_BATCH_LINE_SIZE is always enough.
+ * @param      size    The size of the buffer.
+*/
+void sonicmeter_batch_format_sample(const SonicMeterSample* sample, char* buffer, size_t size);
+
+/**
+ * @brief      Format the summary of a run.
+ * @details    A few lines: sample counts per result, achieved rate, then the distance min, p50,
+ *             p99, max, mean and standard deviation in millimeters. Lines end in CR LF.
+ * @param      batch   The SonicMeterBatch object.
+ * @param      buffer  The buffer, SONICMETER_BATCH_SUMMARY_SIZE is always enough.
+ * @param      size    The size of the buffer.
+*/
+void sonicmeter_batch_format_summary(const SonicMeterBatch* batch, char* buffer, size_t size);
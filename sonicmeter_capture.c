@@ -0,0 +1,126 @@
+#include "sonicmeter_capture.h"
+
+void sonicmeter_capture_reset(SonicMeterCapture* capture) {
+    capture->state = SonicMeterCaptureStateIdle;
+    capture->result = SonicMeterCaptureResultNoEcho;
+    capture->armed_at = 0;
+    capture->rise_at = 0;
+    capture->fall_at = 0;
+    capture->spurious_edges = 0;
+}
+
+bool sonicmeter_capture_arm(SonicMeterCapture* capture, bool level, uint32_t now) {
+    capture->armed_at = now;
+    capture->rise_at = now;
+    capture->fall_at = now;
+
+    if(level) {
+        capture->result = SonicMeterCaptureResultLineHigh;
+        capture->state = SonicMeterCaptureStateDone;
+        return false;
+    }
+
+    capture->state = SonicMeterCaptureStateWaitRise;
+    return true;
+}
+
+bool sonicmeter_capture_edge(SonicMeterCapture* capture, bool level, uint32_t now) {
+    switch(capture->state) {
+    case SonicMeterCaptureStateWaitRise:
+        if(level) {
+            capture->rise_at = now;
+            capture->state = SonicMeterCaptureStateWaitFall;
+        } else {
+            // Glitch, or a pulse too short to be an echo
+            capture->spurious_edges++;
+        }
+        return false;
+    case SonicMeterCaptureStateWaitFall:
+        if(!level) {
+            capture->fall_at = now;
+            capture->result = SonicMeterCaptureResultOk;
+            capture->state = SonicMeterCaptureStateDone;
+            return true;
+        }
+        // We missed the falling edge, or the line bounced, keep the first rising edge
+        capture->spurious_edges++;
+        return false;
+    default:
+        // Nobody asked for an edge
+        capture->spurious_edges++;
+        return false;
+    }
+}
+
+bool sonicmeter_capture_timer(SonicMeterCapture* capture, const SonicMeterCaptureTimerRegs* regs) {
+    if(!(regs->sr & SONICMETER_CAPTURE_TIM_SR_CC1IF)) {
+        return false;
+    }
+
+    if(!sonicmeter_capture_is_busy(capture) || !(regs->sr & SONICMETER_CAPTURE_TIM_SR_CC2IF)) {
+        capture->spurious_edges++;
+        return false;
+    }
+
+    if(regs->sr & (SONICMETER_CAPTURE_TIM_SR_CC1OF | SONICMETER_CAPTURE_TIM_SR_CC2OF)) {
+        capture->spurious_edges++;
+    }
+
+    // The counter is free running, a rise latched after the fall belongs to the next pulse
+    if((int32_t)(regs->ccr_fall - regs->ccr_rise) <= 0) {
+        capture->spurious_edges++;
+        return false;
+    }
+
+    capture->rise_at = regs->ccr_rise;
+    capture->fall_at = regs->ccr_fall;
+    capture->result = SonicMeterCaptureResultOk;
+    capture->state = SonicMeterCaptureStateDone;
+    return true;
+}
+
+bool sonicmeter_capture_expire(SonicMeterCapture* capture, uint32_t now, uint32_t timeout) {
+    if(!sonicmeter_capture_is_busy(capture)) {
+        return false;
+    }
+
+    if(now - capture->armed_at < timeout) {
+        return false;
+    }
+
+    if(capture->state == SonicMeterCaptureStateWaitRise) {
+        capture->result = SonicMeterCaptureResultNoEcho;
+    } else {
+        capture->result = SonicMeterCaptureResultOutOfRange;
+    }
+    capture->fall_at = now;
+    capture->state = SonicMeterCaptureStateDone;
+    return true;
+}
+
+bool sonicmeter_capture_timer_expire(
+    SonicMeterCapture* capture,
+    uint32_t sr,
+    bool level,
+    uint32_t now,
+    uint32_t timeout) {
+    // The line was low when armed, so either means the echo started
+    if(capture->state == SonicMeterCaptureStateWaitRise &&
+       ((sr & SONICMETER_CAPTURE_TIM_SR_CC2IF) || level)) {
+        capture->state = SonicMeterCaptureStateWaitFall;
+    }
+    return sonicmeter_capture_expire(capture, now, timeout);
+}
+
+bool sonicmeter_capture_is_busy(const SonicMeterCapture* capture) {
+    return capture->state == SonicMeterCaptureStateWaitRise ||
+           capture->state == SonicMeterCaptureStateWaitFall;
+}
+
+uint32_t sonicmeter_capture_get_width(const SonicMeterCapture* capture) {
+    if(capture->state != SonicMeterCaptureStateDone ||
+       capture->result != SonicMeterCaptureResultOk) {
+        return 0;
+    }
+    return capture->fall_at - capture->rise_at;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Edge driven echo capture.
+ *
+ * The state machine only deals with line levels and timestamps, it does not touch any HAL. The
+ * caller arms it right before sending the trigger pulse and then feeds it every edge reported by
+ * the echo pin interrupt together with the cycle counter value latched in the interrupt.
+*/
+
+typedef enum {
+    SonicMeterCaptureStateIdle, // Nothing in flight
+    SonicMeterCaptureStateWaitRise, // Trigger sent, waiting for the echo line to go high
+    SonicMeterCaptureStateWaitFall, // Echo line is high, waiting for it to go low
+    SonicMeterCaptureStateDone, // Capture finished, result is valid
+} SonicMeterCaptureState;
+
+typedef enum {
+    SonicMeterCaptureResultOk, // Both edges captured
+    SonicMeterCaptureResultNoEcho, // The rising edge never arrived
+    SonicMeterCaptureResultOutOfRange, // The falling edge did not arrive within range
+    SonicMeterCaptureResultLineHigh, // The echo line was already high when arming
+} SonicMeterCaptureResult;
+
+typedef struct {
+    volatile SonicMeterCaptureState state;
+    SonicMeterCaptureResult result;
+    uint32_t armed_at; // Timestamp of the arm call
+    uint32_t rise_at; // Timestamp of the rising edge
+    uint32_t fall_at; // Timestamp of the falling edge
+    uint32_t spurious_edges; // Edges that did not match the expected level, since reset
+} SonicMeterCapture;
+
+/**
+ * Hardware timer input capture.
+ *
+ * The timer latches the rising edge on one channel and the falling edge on another and raises an
+ * interrupt on the falling edge. The interrupt hands a snapshot of the registers to
+ * sonicmeter_capture_timer. The flags below use the same bit positions as the STM32 TIMx_SR
+ * register so the snapshot can be taken verbatim.
+*/
+#define SONICMETER_CAPTURE_TIM_SR_CC1IF (1U << 1) // Falling edge latched
+#define SONICMETER_CAPTURE_TIM_SR_CC2IF (1U << 2) // Rising edge latched
+#define SONICMETER_CAPTURE_TIM_SR_CC1OF (1U << 9) // Falling edge latched more than once
+#define SONICMETER_CAPTURE_TIM_SR_CC2OF (1U << 10) // Rising edge latched more than once
+
+typedef struct {
+    uint32_t sr; // Status register
+    uint32_t ccr_fall; // Capture register of the falling edge channel
+    uint32_t ccr_rise; // Capture register of the rising edge channel
+} SonicMeterCaptureTimerRegs;
+
+/**
+ * @brief      Reset the capture to idle and clear the counters.
+ * @param      capture  The capture object.
+*/
+void sonicmeter_capture_reset(SonicMeterCapture* capture);
+
+/**
+ * @brief      Arm the capture before sending the trigger pulse.
+ * @details    If the echo line is already high the previous pulse has not finished yet, the
+ *             capture completes immediately with SonicMeterCaptureResultLineHigh.
+ * @param      capture  The capture object.
+ * @param      level    Current level of the echo line.
+ * @param      now      Current timestamp.
+ * @return     true if the capture is waiting for the echo, false otherwise.
+*/
+bool sonicmeter_capture_arm(SonicMeterCapture* capture, bool level, uint32_t now);
+
+/**
+ * @brief      Feed an edge into the capture.
+ * @details    Meant to be called from the echo pin interrupt. Edges that do not match the level
+ *             the state machine expects are counted as spurious and otherwise ignored.
+ * @param      capture  The capture object.
+ * @param      level    Level of the echo line read in the interrupt.
+ * @param      now      Timestamp latched in the interrupt.
+ * @return     true if this edge completed the capture.
+*/
+bool sonicmeter_capture_edge(SonicMeterCapture* capture, bool level, uint32_t now);
+
+/**
+ * @brief      Feed a timer register snapshot into the capture.
+ * @details    Meant to be called from the timer interrupt. A falling edge without a rising edge,
+ *             or a rising edge latched after the falling one, is counted as spurious and the
+ *             capture keeps waiting. Overcaptures are counted as spurious but the latest pair of
+ *             edges is still used.
+ * @param      capture  The capture object.
+ * @param      regs     The register snapshot.
+ * @return     true if this snapshot completed the capture.
+*/
+bool sonicmeter_capture_timer(SonicMeterCapture* capture, const SonicMeterCaptureTimerRegs* regs);
+
+/**
+ * @brief      Expire a capture that has been in flight for too long.
+ * @details    Must not race with sonicmeter_capture_edge, the caller is responsible for masking
+ *             the echo interrupt around it.
+ * @param      capture  The capture object.
+ * @param      now      Current timestamp.
+ * @param      timeout  Timeout, in timestamp units, measured from the arm call.
+ * @return     true if the capture was expired by this call.
+*/
+bool sonicmeter_capture_expire(SonicMeterCapture* capture, uint32_t now, uint32_t timeout);
+
+/**
+ * @brief      Expire a timer capture that has been in flight for too long.
+ * @details    The timer only interrupts on the falling edge, so the state machine is still waiting
+ *             for the rise when the echo started but did not end. The rising edge flag of the
+ *             status register, or the echo line being high, tells the two apart: an echo that
+ *             started and outlasted the timeout is out of range, not missing. Must not race with
+ *             sonicmeter_capture_timer, the caller is responsible for masking the timer interrupt
+ *             around it.
+ * @param      capture  The capture object.
+ * @param      sr       Status register of the timer, the rising edge flag must not have been
+ *                      cleared since the arm call.
+ * @param      level    Current level of the echo line.
+ * @param      now      Current timestamp.
+ * @param      timeout  Timeout, in timestamp units, measured from the arm call.
+ * @return     true if the capture was expired by this call.
+*/
+bool sonicmeter_capture_timer_expire(
+    SonicMeterCapture* capture,
+    uint32_t sr,
+    bool level,
+    uint32_t now,
+    uint32_t timeout);
+
+/**
+ * @brief      Check whether a capture is waiting for an edge.
+ * @param      capture  The capture object.
+ * @return     true if an edge is expected.
+*/
+bool sonicmeter_capture_is_busy(const SonicMeterCapture* capture);
+
+/**
+ * @brief      Get the echo pulse width of a completed capture.
+ * @param      capture  The capture object.
+ * @return     Pulse width in timestamp units, 0 if the capture did not succeed.
+*/
+uint32_t sonicmeter_capture_get_width(const SonicMeterCapture* capture);
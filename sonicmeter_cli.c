@@ -0,0 +1,448 @@
+#include "sonicmeter_cli.h"
+#include "sonicmeter_batch.h"
+#include "sonicmeter_memory.h"
+#include "sonicmeter_pins.h"
+#include "sonicmeter_probe.h"
+#include "sonicmeter_recorder.h"
+#include "sonicmeter_replay.h"
+
+#include <cli/cli.h>
+#include <storage/storage.h>
+#include <toolbox/args.h>
+
+#define TAG "SonicMeterCli"
+
+// How often the run looks for new samples, the ring holds 64 so this keeps up with any rate
+#define SONICMETER_CLI_POLL_MS 20
+// Mismatches a replay prints before it only counts them
+#define SONICMETER_CLI_REPLAY_LINES 20
+
+_Static_assert(
+    1000 / SONICMETER_BATCH_RATE_MAX >= SONICMETER_WORKER_RECOVERY_MS,
+    "the worker must take batch runs at the rate asked for");
+
+struct SonicMeterCli {
+    Cli* cli;
+    SonicMeterWorker* worker;
+    FuriMutex* sampling;
+    FuriMutex* replaying; // Held by a replay, which runs without the worker
+    SonicMeterCliConfigCallback callback;
+    void* context;
+    volatile bool stopping; // The app is closing, a run or replay in progress ends early
+};
+
+/**
+ * @brief      Find a pin by name.
+ * @param      name  The name as typed.
+ * @return     The pin, NULL if there is no such pin.
+*/
+static const GpioPin* sonicmeter_cli_find_pin(const char* name) {
+    for(uint32_t i = 0; i < SONICMETER_PINS_COUNT; i++) {
+        if(sonicmeter_batch_name_match(name, sonicmeter_pins[i].name)) {
+            return sonicmeter_pins[i].gpio;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief      Apply the arguments to the configured settings.
+ * @param      args    The parsed arguments.
+ * @param      config  The configured settings, turned into the settings of the run.
+ * @return     NULL if the run can go ahead, else what is wrong.
+*/
+static const char*
+    sonicmeter_cli_configure(const SonicMeterBatchArgs* args, SonicMeterWorkerConfig* config) {
+    if(args->sensor[0]) {
+        uint32_t type = 0;
+        while(type < SonicMeterDriverTypeCount &&
+              !sonicmeter_batch_name_match(args->sensor, sonicmeter_driver_get(type)->name)) {
+            type++;
+        }
+        if(type == SonicMeterDriverTypeCount) {
+            return "unknown sensor";
+        }
+        config->driver = type;
+    }
+    if(args->trigger[0]) {
+        config->sensors[0].trigger_pin = sonicmeter_cli_find_pin(args->trigger);
+        if(!config->sensors[0].trigger_pin) {
+            return "unknown trig pin";
+        }
+    }
+    if(args->echo[0]) {
+        config->sensors[0].echo_pin = sonicmeter_cli_find_pin(args->echo);
+        if(!config->sensors[0].echo_pin) {
+            return "unknown echo pin";
+        }
+    }
+
+    const SonicMeterDriver* driver = sonicmeter_driver_get(config->driver);
+    if((driver->capabilities & SonicMeterDriverCapabilityEchoPin) &&
+       config->sensors[0].trigger_pin == config->sensors[0].echo_pin) {
+        return "trig and echo must differ";
+    }
+
+    // One sensor on the given pins, measuring only
+    config->sensor_count = 1;
+    config->period_ms = sonicmeter_batch_period_ms(args->rate_hz);
+    config->alarm.enabled = false;
+    return NULL;
+}
+
+/**
+ * @brief      Take the samples and print them.
+ * @param      cli       The SonicMeterCli object.
+ * @param      console   The CLI session, for Ctrl+C.
+ * @param      args      The parsed arguments.
+ * @param      config    The settings of the run.
+*/
+static void sonicmeter_cli_run(
+    SonicMeterCli* cli,
+    Cli* console,
+    const SonicMeterBatchArgs* args,
+    const SonicMeterWorkerConfig* config) {
+    SonicMeterRing* ring = sonicmeter_worker_get_ring(cli->worker);
+    SonicMeterBatch* batch = malloc(sizeof(SonicMeterBatch));
+    SonicMeterRingReader reader;
+    SonicMeterSample sample;
+    char line[SONICMETER_BATCH_LINE_SIZE];
+    bool done = false;
+
+    sonicmeter_batch_init(batch, args->count);
+    sonicmeter_ring_reader_init(ring, &reader);
+    // Samples are read from the ring, nothing else needs to hear about them
+    sonicmeter_worker_set_callback(cli->worker, NULL, NULL);
+    sonicmeter_worker_start(cli->worker, config);
+
+    while(!done) {
+        furi_delay_ms(SONICMETER_CLI_POLL_MS);
+        while(!done && sonicmeter_ring_read(ring, &reader, &sample)) {
+            done = sonicmeter_batch_add(batch, &sample);
+            if(args->output == SonicMeterBatchOutputRaw) {
+                sonicmeter_batch_format_sample(&sample, line, sizeof(line));
+                printf("%s\r\n", line);
+            }
+        }
+        if(cli_cmd_interrupt_received(console) || cli->stopping) {
+            break;
+        }
+    }
+
+    sonicmeter_worker_stop(cli->worker);
+    batch->dropped = reader.dropped;
+    if(args->output == SonicMeterBatchOutputSummary) {
+        char summary[SONICMETER_BATCH_SUMMARY_SIZE];
+        sonicmeter_batch_format_summary(batch, summary, sizeof(summary));
+        printf("%s", summary);
+
+        SonicMeterScheduleStats schedule;
+        sonicmeter_worker_get_schedule_stats(cli->worker, &schedule);
+        printf(
+            "late_us mean %lu max %lu overruns %lu skipped %lu\r\n",
+            schedule.fired ? (uint32_t)(schedule.late_sum_us / schedule.fired) : 0,
+            schedule.late_max_us,
+            schedule.overruns,
+            schedule.skipped);
+#if SONICMETER_PROBES
+        FuriString* probes = furi_string_alloc();
+        sonicmeter_probe_cat_csv(probes, "\r\n");
+        printf("%s", furi_string_get_cstr(probes));
+        furi_string_free(probes);
+#endif
+    }
+    if(!done) {
+        printf("Interrupted after %lu of %lu samples\r\n", batch->samples, batch->requested);
+    }
+    FURI_LOG_I(TAG, "Run of %lu samples, %lu dropped", batch->samples, batch->dropped);
+    free(batch);
+}
+
+typedef struct {
+    SonicMeterCli* cli;
+    File* file;
+    Cli* console; // For Ctrl+C
+    bool interrupted;
+} SonicMeterCliReplayFile;
+
+typedef struct {
+    uint32_t lines; // Mismatches left to print
+} SonicMeterCliReplayPrint;
+
+/**
+ * @brief      Read the next bytes of a recording.
+ * @details    Ctrl+C or the app closing ends the recording early, the replay then stops at the
+ *             next read.
+ * @param      context  The SonicMeterCliReplayFile object.
+ * @param      buffer   The buffer.
+ * @param      size     The size of the buffer.
+ * @return     Bytes read, 0 at the end.
+*/
+static size_t sonicmeter_cli_replay_read(void* context, uint8_t* buffer, size_t size) {
+    SonicMeterCliReplayFile* file = context;
+    if(file->cli->stopping || (file->console && cli_cmd_interrupt_received(file->console))) {
+        file->interrupted = true;
+    }
+    return file->interrupted ? 0 : storage_file_read(file->file, buffer, size);
+}
+
+/**
+ * @brief      Print the first few mismatches.
+ * @param      replayed   The sample out of the processing.
+ * @param      reference  The sample it is compared with.
+ * @param      match      The two agree.
+ * @param      context    The SonicMeterCliReplayPrint object.
+*/
+static void sonicmeter_cli_replay_callback(
+    const SonicMeterSample* replayed,
+    const SonicMeterSample* reference,
+    bool match,
+    void* context) {
+    SonicMeterCliReplayPrint* print = context;
+    if(!match && print->lines) {
+        char line[SONICMETER_REPLAY_LINE_SIZE];
+        sonicmeter_replay_format_mismatch(replayed, reference, line, sizeof(line));
+        printf("%s\r\n", line);
+        print->lines--;
+    }
+}
+
+/**
+ * @brief      Open a recording for the replay.
+ * @details    Names without a directory are looked up in the recordings directory.
+ * @param      storage  The storage.
+ * @param      name     The name as typed.
+ * @param      file     Filled in with the file, to be freed by the caller even on failure.
+ * @param      stream   The stream to open.
+ * @param      header   Filled in with the header.
+ * @return     false if there is no such recording.
+*/
+static bool sonicmeter_cli_replay_open(
+    Storage* storage,
+    FuriString* name,
+    SonicMeterCliReplayFile* file,
+    SonicMeterReplayStream* stream,
+    SonicMeterRecordHeader* header) {
+    if(furi_string_get_cstr(name)[0] != '/') {
+        FuriString* path = furi_string_alloc_printf(
+            "%s/%s", SONICMETER_RECORDER_DIR, furi_string_get_cstr(name));
+        furi_string_set(name, path);
+        furi_string_free(path);
+    }
+    file->file = storage_file_alloc(storage);
+    if(!storage_file_open(file->file, furi_string_get_cstr(name), FSAM_READ, FSOM_OPEN_EXISTING)) {
+        printf("Cannot open %s\r\n", furi_string_get_cstr(name));
+        return false;
+    }
+    if(!sonicmeter_replay_stream_open(stream, sonicmeter_cli_replay_read, file, header)) {
+        printf("%s is not a recording\r\n", furi_string_get_cstr(name));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief      Replay a recording with the configured settings.
+ * @details    Does not need the worker, it runs next to the measure screen too. One replay at a
+ *             time, the app waits for it before it goes away.
+ * @param      cli      The SonicMeterCli object.
+ * @param      console  The CLI session, for Ctrl+C.
+ * @param      text     The arguments after the replay keyword.
+*/
+static void sonicmeter_cli_replay(SonicMeterCli* cli, Cli* console, FuriString* text) {
+    if(cli->stopping || furi_mutex_acquire(cli->replaying, 0) != FuriStatusOk) {
+        printf("Busy, a replay is running\r\n");
+        return;
+    }
+
+    FuriString* input_name = furi_string_alloc();
+    FuriString* reference_name = furi_string_alloc();
+    if(!args_read_string_and_trim(text, input_name)) {
+        cli_print_usage(SONICMETER_CLI_COMMAND, SONICMETER_CLI_REPLAY_USAGE, "");
+        furi_string_free(reference_name);
+        furi_string_free(input_name);
+        furi_mutex_release(cli->replaying);
+        return;
+    }
+    const bool compare = args_read_string_and_trim(text, reference_name);
+
+    Storage* storage = furi_record_open(RECORD_STORAGE);
+    SonicMeterReplayStream* input = malloc(sizeof(SonicMeterReplayStream));
+    SonicMeterReplayStream* reference = compare ? malloc(sizeof(SonicMeterReplayStream)) : NULL;
+    SonicMeterCliReplayFile input_file = {.cli = cli, .console = console};
+    SonicMeterCliReplayFile reference_file = {.cli = cli, .console = NULL};
+    SonicMeterRecordHeader header;
+    SonicMeterRecordHeader reference_header;
+
+    if(sonicmeter_cli_replay_open(storage, input_name, &input_file, input, &header) &&
+       (!compare || sonicmeter_cli_replay_open(
+                        storage, reference_name, &reference_file, reference, &reference_header))) {
+        // The processing under test is the one in the settings
+        SonicMeterWorkerConfig settings;
+        cli->callback(&settings, cli->context);
+        const SonicMeterReplayConfig config = {
+            .temperature_c = settings.temperature_c,
+            .max_range_cm = settings.max_range_cm,
+            .filter = settings.filter,
+        };
+        SonicMeterCliReplayPrint print = {.lines = SONICMETER_CLI_REPLAY_LINES};
+        SonicMeterReplay* replay = sonicmeter_replay_alloc();
+        char summary[SONICMETER_REPLAY_SUMMARY_SIZE];
+
+        const uint32_t start = furi_get_tick();
+        const SonicMeterReplayDiff* diff = sonicmeter_replay_run(
+            replay,
+            &config,
+            input,
+            header.cpu_hz,
+            reference,
+            sonicmeter_cli_replay_callback,
+            &print);
+        const uint64_t elapsed_us =
+            (uint64_t)(furi_get_tick() - start) * 1000000 / furi_kernel_get_tick_frequency();
+
+        sonicmeter_replay_format_summary(diff, elapsed_us, summary, sizeof(summary));
+        printf("%s", summary);
+        if(input_file.interrupted || reference_file.interrupted) {
+            printf("Interrupted\r\n");
+        }
+        FURI_LOG_I(TAG, "Replayed %lu samples, %lu mismatches", diff->samples, diff->mismatches);
+        sonicmeter_replay_free(replay);
+    }
+
+    if(reference_file.file) {
+        storage_file_free(reference_file.file);
+    }
+    storage_file_free(input_file.file);
+    free(reference);
+    free(input);
+    furi_record_close(RECORD_STORAGE);
+    furi_string_free(reference_name);
+    furi_string_free(input_name);
+    furi_mutex_release(cli->replaying);
+}
+
+/**
+ * @brief      Print the memory report.
+*/
+static void sonicmeter_cli_memory(void) {
+    SonicMeterMemoryStats stats;
+    sonicmeter_memory_get_stats(&stats);
+
+    printf("%-10s %6s %6s\r\n", "bytes", "size", "used");
+    for(uint32_t i = 0; i < SonicMeterMemoryThreadCount; i++) {
+        printf(
+            "%-10s %6lu %6lu\r\n",
+            sonicmeter_memory_get_thread_name(i),
+            stats.stack_size[i],
+            stats.stack_used[i]);
+    }
+    printf("%-10s %6lu %6lu\r\n", "arena", stats.arena_size, stats.arena_used);
+    printf(
+        "budget %d, heap peak %lu free %lu low %lu\r\n",
+        SONICMETER_MEMORY_BUDGET,
+        stats.heap_peak,
+        stats.heap_free,
+        stats.heap_low);
+}
+
+/**
+ * @brief      Check the first word of the arguments, and drop it if it matches.
+ * @param      text     The arguments.
+ * @param      keyword  The word.
+ * @return     true if the first word is the keyword.
+*/
+static bool sonicmeter_cli_keyword(FuriString* text, const char* keyword) {
+    const size_t length = args_get_first_word_length(text);
+    if(length != strlen(keyword) || strncmp(furi_string_get_cstr(text), keyword, length) != 0) {
+        return false;
+    }
+
+    FuriString* word = furi_string_alloc();
+    args_read_string_and_trim(text, word);
+    furi_string_free(word);
+    return true;
+}
+
+/**
+ * @brief      The command.
+ * @param      console  The CLI session.
+ * @param      text     The arguments.
+ * @param      context  The SonicMeterCli object.
+*/
+static void sonicmeter_cli_command(Cli* console, FuriString* text, void* context) {
+    SonicMeterCli* cli = context;
+    SonicMeterBatchArgs args;
+    const char* error;
+
+    if(sonicmeter_cli_keyword(text, SONICMETER_CLI_REPLAY)) {
+        sonicmeter_cli_replay(cli, console, text);
+        return;
+    }
+    if(sonicmeter_cli_keyword(text, SONICMETER_CLI_MEMORY)) {
+        sonicmeter_cli_memory();
+        return;
+    }
+    if(!sonicmeter_batch_parse(furi_string_get_cstr(text), &args, &error)) {
+        printf("%s\r\n", error);
+        cli_print_usage(
+            SONICMETER_CLI_COMMAND, SONICMETER_BATCH_USAGE, furi_string_get_cstr(text));
+        printf("   or: %s %s\r\n", SONICMETER_CLI_COMMAND, SONICMETER_CLI_REPLAY_USAGE);
+        printf("   or: %s %s\r\n", SONICMETER_CLI_COMMAND, SONICMETER_CLI_MEMORY);
+        return;
+    }
+    if(cli->stopping || furi_mutex_acquire(cli->sampling, 0) != FuriStatusOk) {
+        printf("Busy, close the measure screen first\r\n");
+        return;
+    }
+    // The app may have started closing while the mutex was taken, the front end goes next
+    if(cli->stopping) {
+        furi_mutex_release(cli->sampling);
+        return;
+    }
+
+    SonicMeterWorkerConfig config;
+    cli->callback(&config, cli->context);
+    error = sonicmeter_cli_configure(&args, &config);
+    if(error) {
+        printf("%s\r\n", error);
+    } else {
+        sonicmeter_cli_run(cli, console, &args, &config);
+    }
+
+    furi_mutex_release(cli->sampling);
+}
+
+SonicMeterCli* sonicmeter_cli_alloc(
+    SonicMeterWorker* worker,
+    FuriMutex* sampling,
+    SonicMeterCliConfigCallback callback,
+    void* context) {
+    SonicMeterCli* cli = malloc(sizeof(SonicMeterCli));
+    cli->worker = worker;
+    cli->sampling = sampling;
+    cli->replaying = furi_mutex_alloc(FuriMutexTypeNormal);
+    cli->callback = callback;
+    cli->context = context;
+    cli->stopping = false;
+
+    cli->cli = furi_record_open(RECORD_CLI);
+    cli_add_command(
+        cli->cli, SONICMETER_CLI_COMMAND, CliCommandFlagParallelSafe, sonicmeter_cli_command, cli);
+    return cli;
+}
+
+void sonicmeter_cli_free(SonicMeterCli* cli) {
+    cli->stopping = true;
+    cli_delete_command(cli->cli, SONICMETER_CLI_COMMAND);
+    furi_record_close(RECORD_CLI);
+
+    // A run in progress sees stopping within a poll and gives the worker back, a replay at its
+    // next read
+    furi_mutex_acquire(cli->sampling, FuriWaitForever);
+    furi_mutex_release(cli->sampling);
+    furi_mutex_acquire(cli->replaying, FuriWaitForever);
+    furi_mutex_release(cli->replaying);
+    furi_mutex_free(cli->replaying);
+    free(cli);
+}
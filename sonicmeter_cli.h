@@ -0,0 +1,55 @@
+#pragma once
+
+#include <furi.h>
+#include "sonicmeter_worker.h"
+
+/**
+ * The sonicmeter CLI command.
+ *
+ * Takes a batch of samples through the same worker as the measure screen and prints them, or a
+ * summary of them, on the CLI. The summary ends with the stage timings of the run when the probes
+ * are built in. The command is there while the app runs. The worker is shared: a
+ * run only starts while the sampling mutex is free and holds it until done, the measure screen
+ * takes the same mutex.
+ *
+ * "sonicmeter replay" runs a recording through the sample processing with the configured settings
+ * and prints how its output differs from the recording, or from a reference recording. It leaves
+ * the worker alone, one replay runs at a time.
+ *
+ * "sonicmeter mem" prints the memory report: stack use of every thread, the arena and the heap.
+*/
+
+#define SONICMETER_CLI_COMMAND "sonicmeter"
+#define SONICMETER_CLI_REPLAY "replay"
+#define SONICMETER_CLI_REPLAY_USAGE "replay <recording> [<reference>]"
+#define SONICMETER_CLI_MEMORY "mem"
+
+/**
+ * @brief      Callback filling in the configured worker settings.
+ * @details    The command starts from these and overrides what its arguments give.
+*/
+typedef void (*SonicMeterCliConfigCallback)(SonicMeterWorkerConfig* config, void* context);
+
+typedef struct SonicMeterCli SonicMeterCli;
+
+/**
+ * @brief      Register the command.
+ * @param      worker    The worker to sample with.
+ * @param      sampling  The mutex owning the worker.
+ * @param      callback  Fills in the configured settings.
+ * @param      context   The callback context.
+ * @return     SonicMeterCli object.
+*/
+SonicMeterCli* sonicmeter_cli_alloc(
+    SonicMeterWorker* worker,
+    FuriMutex* sampling,
+    SonicMeterCliConfigCallback callback,
+    void* context);
+
+/**
+ * @brief      Unregister the command.
+ * @details    Stops a run or a replay in progress and waits for it. Call it before the worker, the
+ *             5V rail or the pins go away, a run uses them until it returns.
+ * @param      cli   The SonicMeterCli object.
+*/
+void sonicmeter_cli_free(SonicMeterCli* cli);
@@ -0,0 +1,47 @@
+#include "sonicmeter_convert.h"
+
+// Speed of sound in dry air, 331.3 * sqrt(1 + T / 273.15) m/s, in mm/s for every degree
+static const uint32_t sonicmeter_convert_speed_table[] = {
+    318941, 319570, 320198, 320825, 321450, 322075, 322698, 323320, // -20 .. -13
+    323941, 324561, 325179, 325796, 326412, 327027, 327641, 328254, // -12 .. -5
+    328865, 329476, 330085, 330693, 331300, 331906, 332511, 333114, // -4 .. 3
+    333717, 334318, 334919, 335518, 336117, 336714, 337310, 337905, // 4 .. 11
+    338499, 339092, 339684, 340275, 340865, 341454, 342042, 342629, // 12 .. 19
+    343215, 343800, 344383, 344966, 345548, 346129, 346709, 347288, // 20 .. 27
+    347866, 348443, 349019, 349595, 350169, 350742, 351315, 351886, // 28 .. 35
+    352456, 353026, 353595, 354162, 354729, 355295, 355860, 356424, // 36 .. 43
+    356988, 357550, 358111, 358672, 359232, 359791, 360349, // 44 .. 50
+};
+
+_Static_assert(
+    sizeof(sonicmeter_convert_speed_table) / sizeof(sonicmeter_convert_speed_table[0]) ==
+        SONICMETER_CONVERT_TEMPERATURE_MAX - SONICMETER_CONVERT_TEMPERATURE_MIN + 1,
+    "Speed of sound table does not cover the temperature range");
+
+uint32_t sonicmeter_convert_speed_of_sound(int32_t temperature_c) {
+    if(temperature_c < SONICMETER_CONVERT_TEMPERATURE_MIN) {
+        temperature_c = SONICMETER_CONVERT_TEMPERATURE_MIN;
+    } else if(temperature_c > SONICMETER_CONVERT_TEMPERATURE_MAX) {
+        temperature_c = SONICMETER_CONVERT_TEMPERATURE_MAX;
+    }
+    return sonicmeter_convert_speed_table[temperature_c - SONICMETER_CONVERT_TEMPERATURE_MIN];
+}
+
+void sonicmeter_convert_init(SonicMeterConvert* convert, uint32_t cpu_hz, int32_t temperature_c) {
+    convert->cpu_hz = cpu_hz;
+    convert->speed_mm_s = sonicmeter_convert_speed_of_sound(temperature_c);
+
+    // The echo covers the distance twice: um/tick = speed_mm_s * 1000 / (2 * cpu_hz)
+    const uint64_t numerator = ((uint64_t)convert->speed_mm_s * 1000) << 24;
+    const uint64_t denominator = (uint64_t)cpu_hz * 2;
+    convert->um_per_tick_q24 = (numerator + denominator / 2) / denominator;
+}
+
+uint32_t sonicmeter_convert_um_to_ticks(const SonicMeterConvert* convert, uint32_t um) {
+    const uint64_t numerator = (uint64_t)um << 24;
+    return (numerator + convert->um_per_tick_q24 - 1) / convert->um_per_tick_q24;
+}
+
+uint32_t sonicmeter_convert_ticks_to_us(const SonicMeterConvert* convert, uint32_t ticks) {
+    return ((uint64_t)ticks * 1000000 + convert->cpu_hz / 2) / convert->cpu_hz;
+}
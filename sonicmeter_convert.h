@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Echo pulse width to distance conversion.
+ *
+ * Integer only. The per-tick factor is derived once from the CPU clock and the speed of sound at
+ * the configured temperature, so a conversion is a single 32x32->64 multiply and a shift.
+*/
+
+#define SONICMETER_CONVERT_TEMPERATURE_MIN (-20) // Lowest temperature in the lookup table, C
+#define SONICMETER_CONVERT_TEMPERATURE_MAX (50) // Highest temperature in the lookup table, C
+#define SONICMETER_CONVERT_TEMPERATURE_DEFAULT (20) // Temperature the app used to assume, C
+
+typedef struct {
+    uint32_t cpu_hz; // CPU ticks per second
+    uint32_t speed_mm_s; // Speed of sound, millimeters per second
+    uint32_t um_per_tick_q24; // Distance per CPU tick of echo, micrometers, Q8.24
+} SonicMeterConvert;
+
+/**
+ * @brief      Get the speed of sound in air.
+ * @param      temperature_c  Air temperature in Celsius, clamped to the lookup table.
+ * @return     Speed of sound in millimeters per second.
+*/
+uint32_t sonicmeter_convert_speed_of_sound(int32_t temperature_c);
+
+/**
+ * @brief      Precompute the conversion constants.
+ * @param      convert        The SonicMeterConvert object.
+ * @param      cpu_hz         CPU clock, SystemCoreClock on the device.
+ * @param      temperature_c  Air temperature in Celsius.
+*/
+void sonicmeter_convert_init(SonicMeterConvert* convert, uint32_t cpu_hz, int32_t temperature_c);
+
+/**
+ * @brief      Convert an HC-SR04 echo pulse width to a distance.
+ * @param      convert  The SonicMeterConvert object.
+ * @param      ticks    Echo pulse width in CPU ticks.
+ * @return     Distance in micrometers.
+*/
+static inline uint32_t
+    sonicmeter_convert_ticks_to_um(const SonicMeterConvert* convert, uint32_t ticks) {
+    return ((uint64_t)ticks * convert->um_per_tick_q24 + (1U << 23)) >> 24;
+}
+
+/**
+ * @brief      Convert a distance to an HC-SR04 echo pulse width.
+ * @param      convert  The SonicMeterConvert object.
+ * @param      um       Distance in micrometers.
+ * @return     Echo pulse width in CPU ticks, rounded up.
+*/
+uint32_t sonicmeter_convert_um_to_ticks(const SonicMeterConvert* convert, uint32_t um);
+
+/**
+ * @brief      Convert CPU ticks to microseconds.
+ * @param      convert  The SonicMeterConvert object.
+ * @param      ticks    CPU ticks.
+ * @return     Microseconds, rounded to nearest.
+*/
+uint32_t sonicmeter_convert_ticks_to_us(const SonicMeterConvert* convert, uint32_t ticks);
@@ -0,0 +1,13 @@
+#include "sonicmeter_driver.h"
+
+static const SonicMeterDriver* const sonicmeter_drivers[SonicMeterDriverTypeCount] = {
+    [SonicMeterDriverTypeHcSr04] = &sonicmeter_driver_hcsr04,
+    [SonicMeterDriverTypePing] = &sonicmeter_driver_ping,
+    [SonicMeterDriverTypeUs100] = &sonicmeter_driver_us100,
+    [SonicMeterDriverTypeJsn] = &sonicmeter_driver_jsn,
+};
+
+const SonicMeterDriver* sonicmeter_driver_get(SonicMeterDriverType type) {
+    furi_check(type < SonicMeterDriverTypeCount);
+    return sonicmeter_drivers[type];
+}
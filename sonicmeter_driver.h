@@ -0,0 +1,117 @@
+#pragma once
+
+#include <furi_hal.h>
+#include "sonicmeter_capture.h"
+#include "sonicmeter_echo.h"
+
+/**
+ * Sensor drivers.
+ *
+ * The worker schedules measurements, a driver takes them. Every driver goes through the same
+ * steps: init claims the pins or the peripheral once per session, start kicks off one measurement,
+ * the driver calls the done callback from its interrupt when the reading is in, complete collects
+ * the reading (expiring it if it never came) and deinit gives everything back.
+ *
+ * Echo drivers time the echo pulse of a HC-SR04 style sensor and report its width, the worker
+ * converts it to a distance. Serial drivers get the distance from the module itself, all the CPU
+ * does per sample is send one byte and parse a few.
+*/
+
+typedef enum {
+    SonicMeterDriverTypeHcSr04, // Trigger and echo pins, HC-SR04 and JSN-SR04T in pulse mode
+    SonicMeterDriverTypePing, // One pin for trigger and echo, Parallax PING))) style
+    SonicMeterDriverTypeUs100, // US-100 in serial mode
+    SonicMeterDriverTypeJsn, // JSN-SR04T in serial mode
+    SonicMeterDriverTypeCount,
+} SonicMeterDriverType;
+
+typedef enum {
+    SonicMeterDriverCapabilityEchoWidth = (1 << 0), // Reports the echo width, in CPU cycles
+    SonicMeterDriverCapabilityDistance = (1 << 1), // Reports the distance
+    SonicMeterDriverCapabilityEchoPin = (1 << 2), // Needs an echo pin besides the trigger pin
+    SonicMeterDriverCapabilityBackend = (1 << 3), // Uses a SonicMeterEchoBackend
+    SonicMeterDriverCapabilitySerial = (1 << 4), // Uses the USART on pins 13 and 14, one sensor
+} SonicMeterDriverCapability;
+
+/**
+ * @brief      Callback for a finished measurement.
+ * @details    Called from interrupt context, only ISR safe calls are allowed.
+*/
+typedef void (*SonicMeterDriverCallback)(void* context);
+
+typedef struct {
+    const GpioPin* trigger_pin; // Also the echo pin of single pin sensors, unused by serial ones
+    const GpioPin* echo_pin; // SonicMeterDriverCapabilityEchoPin drivers only
+    SonicMeterEchoBackend backend; // SonicMeterDriverCapabilityBackend drivers only
+    SonicMeterDriverCallback callback;
+    void* context;
+} SonicMeterDriverConfig;
+
+typedef struct {
+    SonicMeterCaptureResult result;
+    uint32_t ticks; // Echo width in CPU cycles, SonicMeterDriverCapabilityEchoWidth only
+    uint32_t distance_um; // SonicMeterDriverCapabilityDistance only
+    uint32_t spurious; // Edges or bytes that did not fit, since init
+} SonicMeterDriverReading;
+
+typedef struct {
+    const char* name;
+    uint32_t capabilities; // SonicMeterDriverCapability bits
+    uint32_t latency_ms; // Time from start to the reading, on top of the echo itself
+    uint32_t max_mm; // Largest distance the module reports, 0 if only the range setting caps it
+
+    /**
+     * @brief      Allocate the driver state.
+     * @return     The driver state.
+    */
+    void* (*alloc)(void);
+
+    /**
+     * @brief      Free the driver state.
+     * @param      driver  The driver state, deinitialized.
+    */
+    void (*free)(void* driver);
+
+    /**
+     * @brief      Claim and configure the pins or the peripheral.
+     * @param      driver  The driver state.
+     * @param      config  The configuration.
+     * @return     The backend in use, drivers fall back to the interrupt one where the configured
+     *             one is not available. Any value for drivers without a backend.
+    */
+    SonicMeterEchoBackend (*init)(void* driver, const SonicMeterDriverConfig* config);
+
+    /**
+     * @brief      Release the pins or the peripheral.
+     * @param      driver  The driver state.
+    */
+    void (*deinit)(void* driver);
+
+    /**
+     * @brief      Start a measurement.
+     * @param      driver  The driver state.
+     * @return     true if the reading is on its way, false if it completed right away.
+    */
+    bool (*start)(void* driver);
+
+    /**
+     * @brief      Collect the reading of the last start.
+     * @details    Called after the done callback or once the wait for it timed out, whatever is
+     *             still in flight is expired.
+     * @param      driver   The driver state.
+     * @param      reading  Filled in with the reading.
+    */
+    void (*complete)(void* driver, SonicMeterDriverReading* reading);
+} SonicMeterDriver;
+
+extern const SonicMeterDriver sonicmeter_driver_hcsr04;
+extern const SonicMeterDriver sonicmeter_driver_ping;
+extern const SonicMeterDriver sonicmeter_driver_us100;
+extern const SonicMeterDriver sonicmeter_driver_jsn;
+
+/**
+ * @brief      Get a driver.
+ * @param      type  The driver type.
+ * @return     The driver.
+*/
+const SonicMeterDriver* sonicmeter_driver_get(SonicMeterDriverType type);
@@ -0,0 +1,153 @@
+#include "sonicmeter_driver.h"
+#include "sonicmeter_hal.h"
+#include "sonicmeter_probe.h"
+
+#define TAG "SonicMeterDriverEcho"
+
+typedef struct {
+    SonicMeterEcho* echo;
+    SonicMeterHalPin trigger; // The trigger pin, resolved for the pulse
+    const GpioPin* trigger_pin;
+    uint32_t trigger_cycles; // Length of the trigger pulse
+    SonicMeterEchoBackend backend; // Backend in use, after falling back
+    bool single; // Trigger and echo share the pin
+} SonicMeterDriverEcho;
+
+static void* sonicmeter_driver_echo_alloc(void) {
+    SonicMeterDriverEcho* driver = malloc(sizeof(SonicMeterDriverEcho));
+    driver->echo = sonicmeter_echo_alloc();
+    driver->single = false;
+    return driver;
+}
+
+static void* sonicmeter_driver_echo_alloc_single(void) {
+    SonicMeterDriverEcho* driver = sonicmeter_driver_echo_alloc();
+    driver->single = true;
+    return driver;
+}
+
+static void sonicmeter_driver_echo_free(void* context) {
+    SonicMeterDriverEcho* driver = context;
+    sonicmeter_echo_free(driver->echo);
+    free(driver);
+}
+
+static SonicMeterEchoBackend
+    sonicmeter_driver_echo_init(void* context, const SonicMeterDriverConfig* config) {
+    SonicMeterDriverEcho* driver = context;
+    const GpioPin* echo_pin = driver->single ? config->trigger_pin : config->echo_pin;
+
+    // The only time the pins go through the GPIO HAL, the measurements use the registers
+    driver->trigger_pin = config->trigger_pin;
+    furi_hal_gpio_write(config->trigger_pin, false);
+    if(!driver->single) {
+        furi_hal_gpio_init(
+            config->trigger_pin, GpioModeOutputPushPull, GpioPullNo, GpioSpeedVeryHigh);
+    }
+    sonicmeter_hal_pin_init(&driver->trigger, config->trigger_pin);
+    driver->trigger_cycles = furi_hal_cortex_instructions_per_microsecond() *
+                             (driver->single ? SONICMETER_HAL_TRIGGER_SINGLE_US :
+                                               SONICMETER_HAL_TRIGGER_US);
+
+    // The timer backend needs the echo on a TIM2 pin, and the pin to itself
+    driver->backend = config->backend;
+    if(driver->single && driver->backend == SonicMeterEchoBackendTimer) {
+        driver->backend = SonicMeterEchoBackendIrq;
+    }
+    if(!sonicmeter_echo_start(
+           driver->echo, driver->backend, echo_pin, config->callback, config->context)) {
+        FURI_LOG_W(TAG, "Capture backend %d unavailable", driver->backend);
+        driver->backend = SonicMeterEchoBackendIrq;
+        bool started = sonicmeter_echo_start(
+            driver->echo, driver->backend, echo_pin, config->callback, config->context);
+        furi_check(started);
+    }
+
+    return driver->backend;
+}
+
+static void sonicmeter_driver_echo_deinit(void* context) {
+    SonicMeterDriverEcho* driver = context;
+    sonicmeter_echo_stop(driver->echo);
+    furi_hal_gpio_init(driver->trigger_pin, GpioModeInput, GpioPullNo, GpioSpeedLow);
+}
+
+static bool sonicmeter_driver_echo_start(void* context) {
+    SonicMeterDriverEcho* driver = context;
+
+    if(driver->single) {
+        // The pulse goes out on the echo pin, the capture must not be waiting for it yet
+        SONICMETER_PROBE_BEGIN(trigger_start);
+        sonicmeter_hal_trigger_single(&driver->trigger, driver->trigger_cycles);
+        SONICMETER_PROBE_END(SonicMeterProbeStageTrigger, trigger_start);
+
+        SONICMETER_PROBE_BEGIN(arm_start);
+        const bool armed = sonicmeter_echo_arm(driver->echo);
+        SONICMETER_PROBE_END(SonicMeterProbeStageArm, arm_start);
+        return armed;
+    }
+
+    SONICMETER_PROBE_BEGIN(arm_start);
+    const bool armed = sonicmeter_echo_arm(driver->echo);
+    SONICMETER_PROBE_END(SonicMeterProbeStageArm, arm_start);
+    if(armed) {
+        SONICMETER_PROBE_BEGIN(trigger_start);
+        sonicmeter_hal_trigger(&driver->trigger, driver->trigger_cycles);
+        SONICMETER_PROBE_END(SonicMeterProbeStageTrigger, trigger_start);
+    }
+    return armed;
+}
+
+static void sonicmeter_driver_echo_complete(void* context, SonicMeterDriverReading* reading) {
+    SonicMeterDriverEcho* driver = context;
+
+    // Anything still in flight at this point has timed out
+    bool busy;
+    sonicmeter_echo_expire(driver->echo, 0, &busy);
+
+    SonicMeterCapture* capture = sonicmeter_echo_get_capture(driver->echo);
+#if SONICMETER_PROBES
+    if(capture->result == SonicMeterCaptureResultOk) {
+        // Timer backend edges are timer counts, not comparable to the arm timestamp
+        if(driver->backend != SonicMeterEchoBackendTimer) {
+            SONICMETER_PROBE_RECORD(
+                SonicMeterProbeStageRise, capture->rise_at - capture->armed_at);
+        }
+        SONICMETER_PROBE_RECORD(
+            SonicMeterProbeStagePulse, sonicmeter_capture_get_width(capture));
+    }
+#endif
+
+    reading->result = capture->result;
+    reading->ticks = sonicmeter_capture_get_width(capture);
+    reading->distance_um = 0;
+    reading->spurious = capture->spurious_edges;
+    capture->state = SonicMeterCaptureStateIdle;
+}
+
+const SonicMeterDriver sonicmeter_driver_hcsr04 = {
+    .name = "HC-SR04",
+    .capabilities = SonicMeterDriverCapabilityEchoWidth | SonicMeterDriverCapabilityEchoPin |
+                    SonicMeterDriverCapabilityBackend,
+    .latency_ms = 0,
+    .max_mm = 0,
+    .alloc = sonicmeter_driver_echo_alloc,
+    .free = sonicmeter_driver_echo_free,
+    .init = sonicmeter_driver_echo_init,
+    .deinit = sonicmeter_driver_echo_deinit,
+    .start = sonicmeter_driver_echo_start,
+    .complete = sonicmeter_driver_echo_complete,
+};
+
+const SonicMeterDriver sonicmeter_driver_ping = {
+    .name = "PING",
+    .capabilities = SonicMeterDriverCapabilityEchoWidth | SonicMeterDriverCapabilityBackend,
+    .latency_ms = 1, // 750 us holdoff before the echo goes high
+    .max_mm = 0,
+    .alloc = sonicmeter_driver_echo_alloc_single,
+    .free = sonicmeter_driver_echo_free,
+    .init = sonicmeter_driver_echo_init,
+    .deinit = sonicmeter_driver_echo_deinit,
+    .start = sonicmeter_driver_echo_start,
+    .complete = sonicmeter_driver_echo_complete,
+};
@@ -0,0 +1,163 @@
+#include "sonicmeter_driver.h"
+#include "sonicmeter_uart_parser.h"
+
+#define TAG "SonicMeterDriverUart"
+
+typedef struct {
+    SonicMeterUartProtocol protocol;
+    uint32_t max_mm; // Anything above is the module saying it got no echo
+    FuriHalSerialHandle* serial;
+    SonicMeterUartParser parser; // Fed from the receive interrupt
+    volatile bool done; // A frame arrived since the last start
+    uint32_t mm; // Distance of that frame
+    SonicMeterDriverCallback callback;
+    void* context;
+} SonicMeterDriverUart;
+
+static void*
+    sonicmeter_driver_uart_alloc(const SonicMeterDriver* type, SonicMeterUartProtocol protocol) {
+    SonicMeterDriverUart* driver = malloc(sizeof(SonicMeterDriverUart));
+    driver->protocol = protocol;
+    driver->max_mm = type->max_mm;
+    driver->serial = NULL;
+    return driver;
+}
+
+static void* sonicmeter_driver_uart_alloc_us100(void) {
+    return sonicmeter_driver_uart_alloc(&sonicmeter_driver_us100, SonicMeterUartProtocolUs100);
+}
+
+static void* sonicmeter_driver_uart_alloc_jsn(void) {
+    return sonicmeter_driver_uart_alloc(&sonicmeter_driver_jsn, SonicMeterUartProtocolJsn);
+}
+
+static void sonicmeter_driver_uart_free(void* context) {
+    SonicMeterDriverUart* driver = context;
+    furi_assert(driver->serial == NULL);
+    free(driver);
+}
+
+/**
+ * @brief      Receive interrupt.
+ * @details    Bytes after a complete frame are still parsed, and counted as bad if they do not
+ *             make another one before the next start.
+ * @param      handle   The serial handle.
+ * @param      event    The receive event.
+ * @param      context  The SonicMeterDriverUart object.
+*/
+static void sonicmeter_driver_uart_rx_isr(
+    FuriHalSerialHandle* handle,
+    FuriHalSerialRxEvent event,
+    void* context) {
+    SonicMeterDriverUart* driver = context;
+    uint32_t mm;
+
+    if(!(event & FuriHalSerialRxEventData)) {
+        return;
+    }
+    const uint8_t byte = furi_hal_serial_async_rx(handle);
+    if(sonicmeter_uart_parser_feed(&driver->parser, byte, &mm) && !driver->done) {
+        driver->mm = mm;
+        driver->done = true;
+        driver->callback(driver->context);
+    }
+}
+
+static SonicMeterEchoBackend
+    sonicmeter_driver_uart_init(void* context, const SonicMeterDriverConfig* config) {
+    SonicMeterDriverUart* driver = context;
+
+    driver->callback = config->callback;
+    driver->context = config->context;
+    driver->done = false;
+    sonicmeter_uart_parser_init(&driver->parser, driver->protocol);
+
+    // Without the USART every measurement just times out
+    driver->serial = furi_hal_serial_control_acquire(FuriHalSerialIdUsart);
+    if(driver->serial) {
+        furi_hal_serial_init(driver->serial, SONICMETER_UART_PARSER_BAUD);
+        furi_hal_serial_async_rx_start(
+            driver->serial, sonicmeter_driver_uart_rx_isr, driver, false);
+    } else {
+        FURI_LOG_W(TAG, "USART is in use");
+    }
+    return config->backend;
+}
+
+static void sonicmeter_driver_uart_deinit(void* context) {
+    SonicMeterDriverUart* driver = context;
+
+    if(driver->serial) {
+        furi_hal_serial_async_rx_stop(driver->serial);
+        furi_hal_serial_deinit(driver->serial);
+        furi_hal_serial_control_release(driver->serial);
+        driver->serial = NULL;
+    }
+}
+
+static bool sonicmeter_driver_uart_start(void* context) {
+    SonicMeterDriverUart* driver = context;
+    const uint8_t request = SONICMETER_UART_PARSER_REQUEST;
+
+    if(!driver->serial) {
+        return false;
+    }
+
+    FURI_CRITICAL_ENTER();
+    sonicmeter_uart_parser_reset(&driver->parser);
+    driver->done = false;
+    FURI_CRITICAL_EXIT();
+
+    furi_hal_serial_tx(driver->serial, &request, 1);
+    return true;
+}
+
+static void sonicmeter_driver_uart_complete(void* context, SonicMeterDriverReading* reading) {
+    SonicMeterDriverUart* driver = context;
+    bool done;
+    uint32_t mm;
+
+    FURI_CRITICAL_ENTER();
+    done = driver->done;
+    mm = driver->mm;
+    driver->done = true; // Late frames belong to nobody
+    FURI_CRITICAL_EXIT();
+
+    reading->ticks = 0;
+    reading->distance_um = 0;
+    reading->spurious = driver->parser.bad_frames;
+    if(!done) {
+        reading->result = SonicMeterCaptureResultNoEcho;
+    } else if(mm == 0 || mm > driver->max_mm) {
+        reading->result = SonicMeterCaptureResultOutOfRange;
+    } else {
+        reading->result = SonicMeterCaptureResultOk;
+        reading->distance_um = mm * 1000;
+    }
+}
+
+const SonicMeterDriver sonicmeter_driver_us100 = {
+    .name = "US-100",
+    .capabilities = SonicMeterDriverCapabilityDistance | SonicMeterDriverCapabilitySerial,
+    .latency_ms = 10, // Request and two bytes at 9600 baud, plus processing in the module
+    .max_mm = 4500,
+    .alloc = sonicmeter_driver_uart_alloc_us100,
+    .free = sonicmeter_driver_uart_free,
+    .init = sonicmeter_driver_uart_init,
+    .deinit = sonicmeter_driver_uart_deinit,
+    .start = sonicmeter_driver_uart_start,
+    .complete = sonicmeter_driver_uart_complete,
+};
+
+const SonicMeterDriver sonicmeter_driver_jsn = {
+    .name = "JSN-SR04T",
+    .capabilities = SonicMeterDriverCapabilityDistance | SonicMeterDriverCapabilitySerial,
+    .latency_ms = 15, // Request and four bytes at 9600 baud, plus processing in the module
+    .max_mm = 6000,
+    .alloc = sonicmeter_driver_uart_alloc_jsn,
+    .free = sonicmeter_driver_uart_free,
+    .init = sonicmeter_driver_uart_init,
+    .deinit = sonicmeter_driver_uart_deinit,
+    .start = sonicmeter_driver_uart_start,
+    .complete = sonicmeter_driver_uart_complete,
+};
@@ -0,0 +1,263 @@
+#include "sonicmeter_echo.h"
+#include "sonicmeter_hal.h"
+#include "sonicmeter_sim.h"
+
+#include <stm32wbxx_ll_tim.h>
+
+#define TAG "SonicMeterEcho"
+
+// TIM2 runs from the 64MHz timer clock, same rate as the cycle counter
+#define SONICMETER_ECHO_TIMER TIM2
+
+struct SonicMeterEcho {
+    SonicMeterEchoBackend backend;
+    const GpioPin* pin;
+    SonicMeterHalPin line; // The echo pin, for reading it in the interrupt
+    SonicMeterEchoCallback callback;
+    void* context;
+    bool running;
+    SonicMeterCapture capture;
+    SonicMeterSim sim;
+};
+
+SonicMeterEcho* sonicmeter_echo_alloc(void) {
+    SonicMeterEcho* echo = malloc(sizeof(SonicMeterEcho));
+    echo->running = false;
+    sonicmeter_capture_reset(&echo->capture);
+    return echo;
+}
+
+void sonicmeter_echo_free(SonicMeterEcho* echo) {
+    furi_assert(!echo->running);
+    free(echo);
+}
+
+bool sonicmeter_echo_is_supported(SonicMeterEchoBackend backend, const GpioPin* pin) {
+    switch(backend) {
+    case SonicMeterEchoBackendIrq:
+        return pin != NULL;
+    case SonicMeterEchoBackendTimer:
+        // PB3 is TIM2_CH2, no other echo pin is routed to a 32 bit timer
+        return pin == &gpio_ext_pb3;
+    case SonicMeterEchoBackendSim:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief      EXTI callback for the echo pin.
+ * @details    Latches the cycle counter as early as possible and lets the capture decide what the
+ *             edge means.
+ * @param      context  The SonicMeterEcho object.
+*/
+static void sonicmeter_echo_irq_isr(void* context) {
+    SonicMeterEcho* echo = context;
+    const uint32_t now = sonicmeter_hal_cycles();
+    const bool level = sonicmeter_hal_echo_read(&echo->line);
+
+    if(sonicmeter_capture_edge(&echo->capture, level, now)) {
+        echo->callback(echo->context);
+    }
+}
+
+/**
+ * @brief      TIM2 interrupt, raised by the falling edge capture.
+ * @details    Reading the capture registers clears their flags, overcapture flags are cleared
+ *             explicitly.
+ * @param      context  The SonicMeterEcho object.
+*/
+static void sonicmeter_echo_timer_isr(void* context) {
+    SonicMeterEcho* echo = context;
+    SonicMeterCaptureTimerRegs regs;
+
+    regs.sr = SONICMETER_ECHO_TIMER->SR;
+    regs.ccr_fall = LL_TIM_IC_GetCaptureCH1(SONICMETER_ECHO_TIMER);
+    regs.ccr_rise = LL_TIM_IC_GetCaptureCH2(SONICMETER_ECHO_TIMER);
+    SONICMETER_ECHO_TIMER->SR = ~(TIM_SR_CC1OF | TIM_SR_CC2OF);
+
+    if(sonicmeter_capture_timer(&echo->capture, &regs)) {
+        echo->callback(echo->context);
+    }
+}
+
+static bool sonicmeter_echo_timer_start(SonicMeterEcho* echo) {
+    if(furi_hal_bus_is_enabled(FuriHalBusTIM2)) {
+        FURI_LOG_W(TAG, "TIM2 is in use");
+        return false;
+    }
+    furi_hal_bus_enable(FuriHalBusTIM2);
+
+    LL_TIM_SetPrescaler(SONICMETER_ECHO_TIMER, 0);
+    LL_TIM_SetAutoReload(SONICMETER_ECHO_TIMER, 0xFFFFFFFF);
+    LL_TIM_SetCounterMode(SONICMETER_ECHO_TIMER, LL_TIM_COUNTERMODE_UP);
+
+    // CH2 sees TI2 directly and latches the rising edge
+    LL_TIM_IC_SetActiveInput(
+        SONICMETER_ECHO_TIMER, LL_TIM_CHANNEL_CH2, LL_TIM_ACTIVEINPUT_DIRECTTI);
+    LL_TIM_IC_SetPolarity(SONICMETER_ECHO_TIMER, LL_TIM_CHANNEL_CH2, LL_TIM_IC_POLARITY_RISING);
+    LL_TIM_IC_SetPrescaler(SONICMETER_ECHO_TIMER, LL_TIM_CHANNEL_CH2, LL_TIM_ICPSC_DIV1);
+    LL_TIM_IC_SetFilter(SONICMETER_ECHO_TIMER, LL_TIM_CHANNEL_CH2, LL_TIM_IC_FILTER_FDIV1_N2);
+
+    // CH1 sees TI2 indirectly and latches the falling edge
+    LL_TIM_IC_SetActiveInput(
+        SONICMETER_ECHO_TIMER, LL_TIM_CHANNEL_CH1, LL_TIM_ACTIVEINPUT_INDIRECTTI);
+    LL_TIM_IC_SetPolarity(SONICMETER_ECHO_TIMER, LL_TIM_CHANNEL_CH1, LL_TIM_IC_POLARITY_FALLING);
+    LL_TIM_IC_SetPrescaler(SONICMETER_ECHO_TIMER, LL_TIM_CHANNEL_CH1, LL_TIM_ICPSC_DIV1);
+    LL_TIM_IC_SetFilter(SONICMETER_ECHO_TIMER, LL_TIM_CHANNEL_CH1, LL_TIM_IC_FILTER_FDIV1_N2);
+
+    LL_TIM_CC_EnableChannel(SONICMETER_ECHO_TIMER, LL_TIM_CHANNEL_CH1 | LL_TIM_CHANNEL_CH2);
+    furi_hal_interrupt_set_isr(FuriHalInterruptIdTIM2, sonicmeter_echo_timer_isr, echo);
+    LL_TIM_EnableIT_CC1(SONICMETER_ECHO_TIMER);
+
+    furi_hal_gpio_init_ex(
+        echo->pin, GpioModeAltFunctionPushPull, GpioPullNo, GpioSpeedVeryHigh, GpioAltFn1TIM2);
+
+    LL_TIM_SetCounter(SONICMETER_ECHO_TIMER, 0);
+    LL_TIM_EnableCounter(SONICMETER_ECHO_TIMER);
+    return true;
+}
+
+static void sonicmeter_echo_timer_stop(SonicMeterEcho* echo) {
+    LL_TIM_DisableCounter(SONICMETER_ECHO_TIMER);
+    LL_TIM_DisableIT_CC1(SONICMETER_ECHO_TIMER);
+    LL_TIM_CC_DisableChannel(SONICMETER_ECHO_TIMER, LL_TIM_CHANNEL_CH1 | LL_TIM_CHANNEL_CH2);
+    furi_hal_interrupt_set_isr(FuriHalInterruptIdTIM2, NULL, NULL);
+    furi_hal_bus_disable(FuriHalBusTIM2);
+    furi_hal_gpio_init(echo->pin, GpioModeInput, GpioPullNo, GpioSpeedLow);
+}
+
+/**
+ * @brief      Arm the capture and play the next simulated echo into it.
+ * @details    The edges are fed with timestamps in the future, the capture only looks at their
+ *             difference. A missing echo leaves the capture waiting, it times out like a real one.
+ * @param      echo  The SonicMeterEcho object.
+ * @return     true if the capture is waiting for the echo or completed by the echo.
+*/
+static bool sonicmeter_echo_sim_arm(SonicMeterEcho* echo) {
+    SonicMeterSimEcho sim_echo;
+    const uint32_t now = sonicmeter_hal_cycles();
+
+    sonicmeter_sim_next(&echo->sim, sonicmeter_hal_ticks(), &sim_echo);
+    if(!sonicmeter_capture_arm(&echo->capture, sim_echo.line_high, now)) {
+        return false;
+    }
+
+    for(uint32_t i = 0; i < sim_echo.glitches; i++) {
+        sonicmeter_capture_edge(&echo->capture, false, now + i);
+    }
+    if(sim_echo.width_ticks) {
+        const uint32_t rise_at = now + sim_echo.rise_ticks;
+        sonicmeter_capture_edge(&echo->capture, true, rise_at);
+        if(sonicmeter_capture_edge(&echo->capture, false, rise_at + sim_echo.width_ticks)) {
+            echo->callback(echo->context);
+        }
+    }
+
+    return true;
+}
+
+bool sonicmeter_echo_start(
+    SonicMeterEcho* echo,
+    SonicMeterEchoBackend backend,
+    const GpioPin* pin,
+    SonicMeterEchoCallback callback,
+    void* context) {
+    furi_assert(!echo->running);
+    furi_assert(callback);
+
+    if(!sonicmeter_echo_is_supported(backend, pin)) {
+        return false;
+    }
+
+    echo->backend = backend;
+    echo->pin = pin;
+    if(pin) {
+        sonicmeter_hal_pin_init(&echo->line, pin);
+    }
+    echo->callback = callback;
+    echo->context = context;
+    sonicmeter_capture_reset(&echo->capture);
+
+    if(backend == SonicMeterEchoBackendTimer) {
+        if(!sonicmeter_echo_timer_start(echo)) {
+            return false;
+        }
+    } else if(backend == SonicMeterEchoBackendSim) {
+        sonicmeter_sim_init(
+            &echo->sim, SystemCoreClock, sonicmeter_hal_cycles(), sonicmeter_hal_ticks());
+    } else {
+        furi_hal_gpio_init(pin, GpioModeInterruptRiseFall, GpioPullNo, GpioSpeedVeryHigh);
+        furi_hal_gpio_add_int_callback(pin, sonicmeter_echo_irq_isr, echo);
+    }
+
+    echo->running = true;
+    return true;
+}
+
+void sonicmeter_echo_stop(SonicMeterEcho* echo) {
+    if(!echo->running) {
+        return;
+    }
+
+    if(echo->backend == SonicMeterEchoBackendTimer) {
+        sonicmeter_echo_timer_stop(echo);
+    } else if(echo->backend == SonicMeterEchoBackendSim) {
+        // Nothing attached
+    } else {
+        furi_hal_gpio_remove_int_callback(echo->pin);
+        furi_hal_gpio_init(echo->pin, GpioModeInput, GpioPullNo, GpioSpeedLow);
+    }
+
+    sonicmeter_capture_reset(&echo->capture);
+    echo->running = false;
+}
+
+bool sonicmeter_echo_arm(SonicMeterEcho* echo) {
+    furi_assert(echo->running);
+    bool armed;
+
+    if(echo->backend == SonicMeterEchoBackendSim) {
+        return sonicmeter_echo_sim_arm(echo);
+    }
+
+    FURI_CRITICAL_ENTER();
+    if(echo->backend == SonicMeterEchoBackendTimer) {
+        // Drop whatever was latched since the last capture
+        LL_TIM_IC_GetCaptureCH1(SONICMETER_ECHO_TIMER);
+        LL_TIM_IC_GetCaptureCH2(SONICMETER_ECHO_TIMER);
+        SONICMETER_ECHO_TIMER->SR = ~(TIM_SR_CC1OF | TIM_SR_CC2OF);
+    }
+    armed = sonicmeter_capture_arm(
+        &echo->capture, sonicmeter_hal_echo_read(&echo->line), sonicmeter_hal_cycles());
+    FURI_CRITICAL_EXIT();
+
+    return armed;
+}
+
+bool sonicmeter_echo_expire(SonicMeterEcho* echo, uint32_t timeout, bool* busy) {
+    bool expired;
+
+    FURI_CRITICAL_ENTER();
+    const uint32_t now = sonicmeter_hal_cycles();
+    if(echo->backend == SonicMeterEchoBackendTimer) {
+        // Arming read the rise capture register, so its flag is only set by this echo
+        expired = sonicmeter_capture_timer_expire(
+            &echo->capture,
+            SONICMETER_ECHO_TIMER->SR,
+            sonicmeter_hal_echo_read(&echo->line),
+            now,
+            timeout);
+    } else {
+        expired = sonicmeter_capture_expire(&echo->capture, now, timeout);
+    }
+    *busy = sonicmeter_capture_is_busy(&echo->capture);
+    FURI_CRITICAL_EXIT();
+
+    return expired;
+}
+
+SonicMeterCapture* sonicmeter_echo_get_capture(SonicMeterEcho* echo) {
+    return &echo->capture;
+}
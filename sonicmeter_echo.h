@@ -0,0 +1,96 @@
+#pragma once
+
+#include <furi_hal.h>
+#include "sonicmeter_capture.h"
+
+/**
+ * Echo pulse measurement backends.
+ *
+ * All backends feed the same SonicMeterCapture. The interrupt backend latches the cycle counter
+ * in the echo pin EXTI callback and works on any pin. The timer backend latches both edges in TIM2
+ * input capture registers, independent of interrupt latency, but needs the echo on a TIM2 pin.
+ * The simulated backend does not use the echo pin at all, it plays the edges of a SonicMeterSim
+ * into the capture so the rest of the app can be exercised without a sensor.
+*/
+
+typedef enum {
+    SonicMeterEchoBackendIrq, // EXTI on both edges, cycle counter timestamps
+    SonicMeterEchoBackendTimer, // TIM2 input capture on both edges
+    SonicMeterEchoBackendSim, // Scripted echoes, no sensor needed
+} SonicMeterEchoBackend;
+
+/**
+ * @brief      Callback for a finished capture.
+ * @details    Called from interrupt context, only ISR safe calls are allowed. The simulated
+ *             backend calls it from sonicmeter_echo_arm.
+*/
+typedef void (*SonicMeterEchoCallback)(void* context);
+
+typedef struct SonicMeterEcho SonicMeterEcho;
+
+/**
+ * @brief      Allocate the echo measurement.
+ * @return     SonicMeterEcho object.
+*/
+SonicMeterEcho* sonicmeter_echo_alloc(void);
+
+/**
+ * @brief      Free the echo measurement.
+ * @param      echo  The SonicMeterEcho object, must be stopped.
+*/
+void sonicmeter_echo_free(SonicMeterEcho* echo);
+
+/**
+ * @brief      Check whether a backend can be used on a pin.
+ * @param      backend  The backend.
+ * @param      pin      The echo pin.
+ * @return     true if the backend can capture on this pin.
+*/
+bool sonicmeter_echo_is_supported(SonicMeterEchoBackend backend, const GpioPin* pin);
+
+/**
+ * @brief      Configure the echo pin and attach the interrupt of the backend.
+ * @param      echo      The SonicMeterEcho object.
+ * @param      backend   The backend to use.
+ * @param      pin       The echo pin.
+ * @param      callback  Called from interrupt context when a capture completes.
+ * @param      context   The callback context.
+ * @return     true on success, false if the backend is not available on this pin or is in use.
+*/
+bool sonicmeter_echo_start(
+    SonicMeterEcho* echo,
+    SonicMeterEchoBackend backend,
+    const GpioPin* pin,
+    SonicMeterEchoCallback callback,
+    void* context);
+
+/**
+ * @brief      Detach the interrupt and release the echo pin.
+ * @details    Any capture in flight is dropped.
+ * @param      echo  The SonicMeterEcho object.
+*/
+void sonicmeter_echo_stop(SonicMeterEcho* echo);
+
+/**
+ * @brief      Arm the capture right before sending the trigger pulse.
+ * @param      echo  The SonicMeterEcho object.
+ * @return     true if the capture is waiting for the echo, false if it completed right away.
+*/
+bool sonicmeter_echo_arm(SonicMeterEcho* echo);
+
+/**
+ * @brief      Expire a capture that is waiting for too long.
+ * @param      echo     The SonicMeterEcho object.
+ * @param      timeout  Timeout in CPU ticks.
+ * @param      busy     Set to true if the capture is still in flight after the call.
+ * @return     true if the capture was expired by this call.
+*/
+bool sonicmeter_echo_expire(SonicMeterEcho* echo, uint32_t timeout, bool* busy);
+
+/**
+ * @brief      Get the capture.
+ * @details    Only read it when it is not busy.
+ * @param      echo  The SonicMeterEcho object.
+ * @return     The capture.
+*/
+SonicMeterCapture* sonicmeter_echo_get_capture(SonicMeterEcho* echo);
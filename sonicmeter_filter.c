@@ -0,0 +1,277 @@
+#include "sonicmeter_filter.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Outlier gate
+#define SONICMETER_FILTER_GATE_ALPHA (1.0f / 16.0f) // Weight of a new sample in mean and variance
+#define SONICMETER_FILTER_GATE_WARMUP 8 // Samples accepted unconditionally after a reset
+#define SONICMETER_FILTER_GATE_Z 3.5f // Samples further than this many deviations are dropped
+#define SONICMETER_FILTER_GATE_SIGMA_MIN_UM 2000.0f // Deviation floor, keeps a still target usable
+#define SONICMETER_FILTER_GATE_REJECT_MAX 4 // After this many drops in a row the target moved
+
+// Kalman, measurement noise of an HC-SR04 is a few millimeters
+#define SONICMETER_FILTER_KALMAN_R (3000.0f * 3000.0f) // Measurement variance, um^2
+
+typedef struct {
+    void (*reset)(void* state);
+    bool (*process)(void* state, uint32_t* value);
+} SonicMeterFilterStage;
+
+typedef struct {
+    uint32_t count;
+    uint32_t rejected;
+    float mean;
+    float variance;
+} SonicMeterFilterGate;
+
+typedef struct {
+    uint32_t window;
+    uint32_t count;
+    uint32_t head;
+    uint32_t history[SONICMETER_FILTER_WINDOW_MAX]; // Arrival order
+    uint32_t sorted[SONICMETER_FILTER_WINDOW_MAX]; // Same values, ascending
+} SonicMeterFilterMedian;
+
+typedef struct {
+    float alpha;
+    bool primed;
+    float value;
+} SonicMeterFilterEma;
+
+typedef struct {
+    float q; // Process variance per sample
+    bool primed;
+    float x; // Estimate
+    float p; // Estimate variance
+} SonicMeterFilterKalman;
+
+struct SonicMeterFilter {
+    const SonicMeterFilterStage* stages[2];
+    void* states[2];
+    uint32_t count;
+
+    SonicMeterFilterGate gate;
+    SonicMeterFilterMedian median;
+    SonicMeterFilterEma ema;
+    SonicMeterFilterKalman kalman;
+};
+
+static void sonicmeter_filter_gate_reset(void* state) {
+    SonicMeterFilterGate* gate = state;
+    gate->count = 0;
+    gate->rejected = 0;
+    gate->mean = 0.0f;
+    gate->variance = 0.0f;
+}
+
+static bool sonicmeter_filter_gate_process(void* state, uint32_t* value) {
+    SonicMeterFilterGate* gate = state;
+    const float x = (float)*value;
+
+    if(gate->count >= SONICMETER_FILTER_GATE_WARMUP) {
+        float sigma = sqrtf(gate->variance);
+        if(sigma < SONICMETER_FILTER_GATE_SIGMA_MIN_UM) {
+            sigma = SONICMETER_FILTER_GATE_SIGMA_MIN_UM;
+        }
+        if(fabsf(x - gate->mean) > SONICMETER_FILTER_GATE_Z * sigma) {
+            if(++gate->rejected <= SONICMETER_FILTER_GATE_REJECT_MAX) {
+                return false;
+            }
+            // Not a ghost, the target moved: start over from here
+            sonicmeter_filter_gate_reset(gate);
+        }
+    }
+
+    // Exponentially weighted mean and variance, the first sample seeds the mean
+    if(gate->count == 0) {
+        gate->mean = x;
+    } else {
+        const float delta = x - gate->mean;
+        gate->mean += SONICMETER_FILTER_GATE_ALPHA * delta;
+        gate->variance = (1.0f - SONICMETER_FILTER_GATE_ALPHA) *
+                         (gate->variance + SONICMETER_FILTER_GATE_ALPHA * delta * delta);
+    }
+    gate->count++;
+    gate->rejected = 0;
+    return true;
+}
+
+static const SonicMeterFilterStage sonicmeter_filter_gate = {
+    .reset = sonicmeter_filter_gate_reset,
+    .process = sonicmeter_filter_gate_process,
+};
+
+static void sonicmeter_filter_median_reset(void* state) {
+    SonicMeterFilterMedian* median = state;
+    median->count = 0;
+    median->head = 0;
+}
+
+static bool sonicmeter_filter_median_process(void* state, uint32_t* value) {
+    SonicMeterFilterMedian* median = state;
+    uint32_t* sorted = median->sorted;
+    uint32_t count = median->count;
+
+    // Evict the oldest value from the sorted copy
+    if(count == median->window) {
+        const uint32_t oldest = median->history[median->head];
+        uint32_t i = 0;
+        while(sorted[i] != oldest) {
+            i++;
+        }
+        memmove(&sorted[i], &sorted[i + 1], (count - i - 1) * sizeof(uint32_t));
+        count--;
+    }
+
+    // Insert the new one in order
+    uint32_t i = count;
+    while(i > 0 && sorted[i - 1] > *value) {
+        sorted[i] = sorted[i - 1];
+        i--;
+    }
+    sorted[i] = *value;
+    count++;
+
+    median->history[median->head] = *value;
+    median->head = (median->head + 1) % median->window;
+    median->count = count;
+
+    if(count & 1) {
+        *value = sorted[count / 2];
+    } else {
+        *value = (sorted[count / 2 - 1] + sorted[count / 2] + 1) / 2;
+    }
+    return true;
+}
+
+static const SonicMeterFilterStage sonicmeter_filter_median = {
+    .reset = sonicmeter_filter_median_reset,
+    .process = sonicmeter_filter_median_process,
+};
+
+static void sonicmeter_filter_ema_reset(void* state) {
+    SonicMeterFilterEma* ema = state;
+    ema->primed = false;
+}
+
+static bool sonicmeter_filter_ema_process(void* state, uint32_t* value) {
+    SonicMeterFilterEma* ema = state;
+    if(!ema->primed) {
+        ema->value = (float)*value;
+        ema->primed = true;
+    } else {
+        ema->value += ema->alpha * ((float)*value - ema->value);
+    }
+    *value = (uint32_t)(ema->value + 0.5f);
+    return true;
+}
+
+static const SonicMeterFilterStage sonicmeter_filter_ema = {
+    .reset = sonicmeter_filter_ema_reset,
+    .process = sonicmeter_filter_ema_process,
+};
+
+static void sonicmeter_filter_kalman_reset(void* state) {
+    SonicMeterFilterKalman* kalman = state;
+    kalman->primed = false;
+}
+
+static bool sonicmeter_filter_kalman_process(void* state, uint32_t* value) {
+    SonicMeterFilterKalman* kalman = state;
+    const float z = (float)*value;
+
+    if(!kalman->primed) {
+        kalman->x = z;
+        kalman->p = SONICMETER_FILTER_KALMAN_R;
+        kalman->primed = true;
+    } else {
+        // Predict: the target stays where it was, with some uncertainty added
+        kalman->p += kalman->q;
+        // Update
+        const float k = kalman->p / (kalman->p + SONICMETER_FILTER_KALMAN_R);
+        kalman->x += k * (z - kalman->x);
+        kalman->p *= 1.0f - k;
+    }
+    *value = (uint32_t)(kalman->x + 0.5f);
+    return true;
+}
+
+static const SonicMeterFilterStage sonicmeter_filter_kalman = {
+    .reset = sonicmeter_filter_kalman_reset,
+    .process = sonicmeter_filter_kalman_process,
+};
+
+SonicMeterFilter* sonicmeter_filter_alloc(void) {
+    SonicMeterFilter* filter = malloc(sizeof(SonicMeterFilter));
+    filter->count = 0;
+    return filter;
+}
+
+void sonicmeter_filter_free(SonicMeterFilter* filter) {
+    free(filter);
+}
+
+static void sonicmeter_filter_add_stage(
+    SonicMeterFilter* filter,
+    const SonicMeterFilterStage* stage,
+    void* state) {
+    filter->stages[filter->count] = stage;
+    filter->states[filter->count] = state;
+    filter->count++;
+}
+
+void sonicmeter_filter_configure(SonicMeterFilter* filter, const SonicMeterFilterConfig* config) {
+    uint32_t window = config->window;
+    if(window < 1) {
+        window = 1;
+    } else if(window > SONICMETER_FILTER_WINDOW_MAX) {
+        window = SONICMETER_FILTER_WINDOW_MAX;
+    }
+
+    filter->count = 0;
+    if(config->reject_outliers) {
+        sonicmeter_filter_add_stage(filter, &sonicmeter_filter_gate, &filter->gate);
+    }
+
+    switch(config->type) {
+    case SonicMeterFilterTypeMedian:
+        filter->median.window = window;
+        sonicmeter_filter_add_stage(filter, &sonicmeter_filter_median, &filter->median);
+        break;
+    case SonicMeterFilterTypeEma:
+        filter->ema.alpha = 2.0f / (float)(window + 1);
+        sonicmeter_filter_add_stage(filter, &sonicmeter_filter_ema, &filter->ema);
+        break;
+    case SonicMeterFilterTypeKalman:
+        // Longer windows trust the model more, settling time grows roughly with the window
+        filter->kalman.q = SONICMETER_FILTER_KALMAN_R / (float)(window * window);
+        sonicmeter_filter_add_stage(filter, &sonicmeter_filter_kalman, &filter->kalman);
+        break;
+    default:
+        break;
+    }
+
+    sonicmeter_filter_reset(filter);
+}
+
+void sonicmeter_filter_reset(SonicMeterFilter* filter) {
+    for(uint32_t i = 0; i < filter->count; i++) {
+        filter->stages[i]->reset(filter->states[i]);
+    }
+}
+
+bool sonicmeter_filter_process(
+    SonicMeterFilter* filter,
+    uint32_t distance_um,
+    uint32_t* filtered_um) {
+    uint32_t value = distance_um;
+    for(uint32_t i = 0; i < filter->count; i++) {
+        if(!filter->stages[i]->process(filter->states[i], &value)) {
+            return false;
+        }
+    }
+    *filtered_um = value;
+    return true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Streaming distance filter.
+ *
+ * A chain of incremental stages run on every valid sample. The optional outlier gate comes first
+ * and can drop a sample, the smoothing stage follows. Every stage works in O(1) or O(window) time
+ * and fixed memory, all state is allocated once with the filter.
+*/
+
+#define SONICMETER_FILTER_WINDOW_MAX 15
+
+typedef enum {
+    SonicMeterFilterTypeNone, // Pass the raw distance through
+    SonicMeterFilterTypeMedian, // Sliding median over the window
+    SonicMeterFilterTypeEma, // Exponential moving average, alpha = 2 / (window + 1)
+    SonicMeterFilterTypeKalman, // 1-D constant position Kalman filter
+} SonicMeterFilterType;
+
+typedef struct {
+    SonicMeterFilterType type;
+    uint32_t window; // Window size of the smoothing stage, 1 to SONICMETER_FILTER_WINDOW_MAX
+    bool reject_outliers; // Put the z-score outlier gate in front of the smoothing stage
+} SonicMeterFilterConfig;
+
+typedef struct SonicMeterFilter SonicMeterFilter;
+
+/**
+ * @brief      Allocate the filter, initially a pass through.
+ * @return     SonicMeterFilter object.
+*/
+SonicMeterFilter* sonicmeter_filter_alloc(void);
+
+/**
+ * @brief      Free the filter.
+ * @param      filter  The SonicMeterFilter object.
+*/
+void sonicmeter_filter_free(SonicMeterFilter* filter);
+
+/**
+ * @brief      Build the stage chain and reset every stage.
+ * @param      filter  The SonicMeterFilter object.
+ * @param      config  The filter configuration.
+*/
+void sonicmeter_filter_configure(SonicMeterFilter* filter, const SonicMeterFilterConfig* config);
+
+/**
+ * @brief      Reset every stage, forgetting all history.
+ * @param      filter  The SonicMeterFilter object.
+*/
+void sonicmeter_filter_reset(SonicMeterFilter* filter);
+
+/**
+ * @brief      Run a distance through the chain.
+ * @param      filter       The SonicMeterFilter object.
+ * @param      distance_um  The raw distance.
+ * @param      filtered_um  Set to the filter output. Left untouched if the sample is dropped.
+ * @return     false if a stage dropped the sample.
+*/
+bool sonicmeter_filter_process(
+    SonicMeterFilter* filter,
+    uint32_t distance_um,
+    uint32_t* filtered_um);
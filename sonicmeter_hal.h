@@ -0,0 +1,168 @@
+#pragma once
+
+#include <furi.h>
+#include <furi_hal.h>
+
+/**
+ * Hardware access of the measurement path.
+ *
+ * The echo capture and the worker only touch the hardware through these few calls, the timer
+ * backend being the one exception as it programs TIM2 directly. Keeping them in one place means
+ * the path runs off the device: the host build in tests/ compiles this header unchanged against a
+ * register model of the GPIO, EXTI and cycle counter registers, see tests/host/furi_hal.h. On the
+ * device the simulated backend bypasses the echo pin altogether.
+*/
+
+/**
+ * @brief      Get the cycle counter.
+ * @details    Timestamps of echo edges, wraps every 67 s at 64 MHz. Read straight from the DWT,
+ *             the furi_hal_cortex timer is a function call around the same register.
+ * @return     CPU cycles.
+*/
+static inline uint32_t sonicmeter_hal_cycles(void) {
+    return DWT->CYCCNT;
+}
+
+/**
+ * @brief      Get the system time.
+ * @return     Kernel ticks.
+*/
+static inline uint32_t sonicmeter_hal_ticks(void) {
+    return furi_get_tick();
+}
+
+// Length of the trigger pulse, the HC-SR04 asks for at least 10 us
+#define SONICMETER_HAL_TRIGGER_US 10
+// Length of the trigger pulse of single pin sensors, the PING))) wants 2 to 5 us
+#define SONICMETER_HAL_TRIGGER_SINGLE_US 5
+
+/**
+ * Port and bit of a pin, resolved once when the measurement starts so the hot path is a single
+ * register access.
+*/
+typedef struct {
+    GPIO_TypeDef* port;
+    uint32_t mask;
+} SonicMeterHalPin;
+
+/**
+ * @brief      Resolve a pin for direct register access.
+ * @param      line  Filled in with the port and bit.
+ * @param      pin   The pin.
+*/
+static inline void sonicmeter_hal_pin_init(SonicMeterHalPin* line, const GpioPin* pin) {
+    line->port = pin->port;
+    line->mask = pin->pin;
+}
+
+/**
+ * @brief      Read the echo line.
+ * @param      line  The echo pin.
+ * @return     Level of the line.
+*/
+static inline bool sonicmeter_hal_echo_read(const SonicMeterHalPin* line) {
+    return (line->port->IDR & line->mask) != 0;
+}
+
+/**
+ * @brief      Drive an output line.
+ * @param      line   The pin, configured as output.
+ * @param      level  The level.
+*/
+static inline void sonicmeter_hal_pin_write(const SonicMeterHalPin* line, bool level) {
+    if(level) {
+        line->port->BSRR = line->mask;
+    } else {
+        line->port->BRR = line->mask;
+    }
+}
+
+/**
+ * @brief      Send the trigger pulse.
+ * @details    Busy waits on the cycle counter with interrupts masked, so the pulse is as long as
+ *             asked for and an interrupt cannot stretch it.
+ * @param      line          The trigger pin, configured as output.
+ * @param      pulse_cycles  Length of the pulse in CPU cycles.
+*/
+static inline void sonicmeter_hal_trigger(const SonicMeterHalPin* line, uint32_t pulse_cycles) {
+    FURI_CRITICAL_ENTER();
+    const uint32_t start = sonicmeter_hal_cycles();
+    line->port->BSRR = line->mask;
+    while(sonicmeter_hal_cycles() - start < pulse_cycles) {
+    }
+    line->port->BRR = line->mask;
+    FURI_CRITICAL_EXIT();
+}
+
+/**
+ * @brief      Send the trigger pulse of a single pin sensor and turn the pin around.
+ * @details    The pin is an input with its EXTI armed. It is driven only for the pulse, through
+ *             the mode register, and the EXTI pending bit the pulse raised is cleared, so the echo
+ *             interrupt never sees our own edges.
+ * @param      line          The pin.
+ * @param      pulse_cycles  Length of the pulse in CPU cycles.
+*/
+static inline void
+    sonicmeter_hal_trigger_single(const SonicMeterHalPin* line, uint32_t pulse_cycles) {
+    const uint32_t shift = 2 * __builtin_ctz(line->mask);
+
+    FURI_CRITICAL_ENTER();
+    const uint32_t input = line->port->MODER & ~(3U << shift);
+    line->port->BSRR = line->mask;
+    line->port->MODER = input | (1U << shift);
+    const uint32_t start = sonicmeter_hal_cycles();
+    while(sonicmeter_hal_cycles() - start < pulse_cycles) {
+    }
+    line->port->BRR = line->mask;
+    line->port->MODER = input;
+    EXTI->PR1 = line->mask;
+    FURI_CRITICAL_EXIT();
+}
+
+/**
+ * @brief      Check whether the sensor has 5V.
+ * @return     true if OTG or a charger powers the 5V pin.
+*/
+static inline bool sonicmeter_hal_sensor_powered(void) {
+    return furi_hal_power_is_otg_enabled() || furi_hal_power_is_charging();
+}
+
+/**
+ * @brief      Check whether the 5V pin is fed from USB.
+ * @details    The rail is then on whatever the OTG booster does, switching it saves nothing.
+ * @return     true if a charger powers the 5V pin.
+*/
+static inline bool sonicmeter_hal_sensor_power_external(void) {
+    return furi_hal_power_is_charging();
+}
+
+/**
+ * @brief      Switch the OTG booster feeding the 5V pin.
+ * @param      on    true to power the sensor.
+*/
+static inline void sonicmeter_hal_sensor_power(bool on) {
+    if(on && !furi_hal_power_is_otg_enabled()) {
+        furi_hal_power_enable_otg();
+    } else if(!on && furi_hal_power_is_otg_enabled()) {
+        furi_hal_power_disable_otg();
+    }
+}
+
+/**
+ * @brief      Switch the vibration motor.
+ * @details    A GPIO write, it does not go through the notification service queue.
+ * @param      on    true to vibrate.
+*/
+static inline void sonicmeter_hal_vibro(bool on) {
+    furi_hal_vibro_on(on);
+}
+
+/**
+ * @brief      Switch the red LED.
+ * @details    An I2C transfer to the LED driver, a lot slower than a GPIO write. Whatever the
+ *             notification service shows on the LED is overwritten.
+ * @param      on    true to light it.
+*/
+static inline void sonicmeter_hal_led(bool on) {
+    furi_hal_light_set(LightRed, on ? 0xFF : 0);
+}
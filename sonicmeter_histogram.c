@@ -0,0 +1,44 @@
+#include "sonicmeter_histogram.h"
+
+#include <string.h>
+
+_Static_assert(
+    SONICMETER_HISTOGRAM_VALUE_BITS > SONICMETER_HISTOGRAM_SUB_BITS + 1,
+    "the histogram must cover more than the linear buckets");
+
+void sonicmeter_histogram_reset(SonicMeterHistogram* histogram) {
+    memset(histogram, 0, sizeof(SonicMeterHistogram));
+}
+
+void sonicmeter_histogram_bucket_range(uint32_t index, uint32_t* lower, uint32_t* upper) {
+    // The first two rows of SUB_BUCKETS are linear, every row after that is twice as wide
+    const uint32_t row = index >> SONICMETER_HISTOGRAM_SUB_BITS;
+    const uint32_t shift = row > 0 ? row - 1 : 0;
+    *lower = (index - (shift << SONICMETER_HISTOGRAM_SUB_BITS)) << shift;
+    *upper = *lower + (1UL << shift) - 1;
+}
+
+void sonicmeter_histogram_get_percentiles(
+    const SonicMeterHistogram* histogram,
+    const uint32_t* permille,
+    uint32_t* values,
+    size_t count) {
+    size_t next = 0;
+    uint64_t seen = 0;
+
+    for(uint32_t index = 0; index < SONICMETER_HISTOGRAM_BUCKETS && next < count; index++) {
+        seen += histogram->counts[index];
+        // Rank of the percentile, rounded up so p100 is the last value and p0 the first
+        while(next < count &&
+              seen * 1000 >= (uint64_t)permille[next] * histogram->total && seen > 0) {
+            uint32_t lower;
+            uint32_t upper;
+            sonicmeter_histogram_bucket_range(index, &lower, &upper);
+            upper = upper < histogram->max ? upper : histogram->max;
+            values[next++] = upper > histogram->min ? upper : histogram->min;
+        }
+    }
+    while(next < count) {
+        values[next++] = 0;
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Log bucketed histogram.
+ *
+ * HDR style: values below 2 * SONICMETER_HISTOGRAM_SUB_BUCKETS get a bucket each, above that
+ * every power of two is split into SONICMETER_HISTOGRAM_SUB_BUCKETS buckets, so a bucket is never
+ * as wide as 1/32 of the values in it and a percentile is high by less than that, 3.1%. The
+ * memory is fixed whatever the number of samples, recording is a count leading zeros, a shift and
+ * an increment. No HAL, no allocation.
+*/
+
+#define SONICMETER_HISTOGRAM_SUB_BITS 5
+#define SONICMETER_HISTOGRAM_SUB_BUCKETS (1 << SONICMETER_HISTOGRAM_SUB_BITS)
+// Values from 0 to 2^20 - 1, larger ones land in the top bucket and are counted as overflow
+#define SONICMETER_HISTOGRAM_VALUE_BITS 20
+#define SONICMETER_HISTOGRAM_VALUE_MAX ((1UL << SONICMETER_HISTOGRAM_VALUE_BITS) - 1)
+#define SONICMETER_HISTOGRAM_BUCKETS \
+    ((SONICMETER_HISTOGRAM_VALUE_BITS - SONICMETER_HISTOGRAM_SUB_BITS + 1) \
+     << SONICMETER_HISTOGRAM_SUB_BITS)
+
+typedef struct {
+    uint32_t counts[SONICMETER_HISTOGRAM_BUCKETS];
+    uint32_t total; // Values recorded
+    uint32_t overflow; // Values above SONICMETER_HISTOGRAM_VALUE_MAX
+    uint32_t min; // Smallest value, exact
+    uint32_t max; // Largest value, exact
+    uint64_t sum; // For the mean
+} SonicMeterHistogram;
+
+/**
+ * @brief      Get the bucket of a value.
+ * @param      value  The value, at most SONICMETER_HISTOGRAM_VALUE_MAX.
+ * @return     The bucket index.
+*/
+static inline uint32_t sonicmeter_histogram_index(uint32_t value) {
+    // Values up to 2 * SUB_BUCKETS - 1 have a bucket each, after that drop as many low bits as
+    // it takes to bring the value into [SUB_BUCKETS, 2 * SUB_BUCKETS)
+    const uint32_t msb = 31 - __builtin_clz(value | 1);
+    const uint32_t shift =
+        msb > SONICMETER_HISTOGRAM_SUB_BITS ? msb - SONICMETER_HISTOGRAM_SUB_BITS : 0;
+    return (shift << SONICMETER_HISTOGRAM_SUB_BITS) + (value >> shift);
+}
+
+/**
+ * @brief      Clear the histogram.
+ * @param      histogram  The SonicMeterHistogram object.
+*/
+void sonicmeter_histogram_reset(SonicMeterHistogram* histogram);
+
+/**
+ * @brief      Add a value.
+ * @param      histogram  The SonicMeterHistogram object.
+ * @param      value      The value.
+*/
+static inline void sonicmeter_histogram_record(SonicMeterHistogram* histogram, uint32_t value) {
+    if(histogram->total == 0 || value < histogram->min) {
+        histogram->min = value;
+    }
+    if(value > histogram->max) {
+        histogram->max = value;
+    }
+    histogram->sum += value;
+    histogram->total++;
+    if(value > SONICMETER_HISTOGRAM_VALUE_MAX) {
+        histogram->overflow++;
+        value = SONICMETER_HISTOGRAM_VALUE_MAX;
+    }
+    histogram->counts[sonicmeter_histogram_index(value)]++;
+}
+
+/**
+ * @brief      Get the range of values of a bucket.
+ * @param      index  The bucket index.
+ * @param      lower  Filled in with the smallest value of the bucket.
+ * @param      upper  Filled in with the largest value of the bucket.
+*/
+void sonicmeter_histogram_bucket_range(uint32_t index, uint32_t* lower, uint32_t* upper);
+
+/**
+ * @brief      Get percentiles.
+ * @details    One pass over the buckets for all of them. A percentile is the largest value of the
+ *             bucket it falls in, clamped to the exact min and max.
+ * @param      histogram  The SonicMeterHistogram object.
+ * @param      permille   The percentiles in tenths of a percent, ascending: 500 for p50, 999 for
+ *                        p99.9.
+ * @param      values     Filled in with the value of every percentile, 0 if the histogram is
+ *                        empty.
+ * @param      count      Number of percentiles.
+*/
+void sonicmeter_histogram_get_percentiles(
+    const SonicMeterHistogram* histogram,
+    const uint32_t* permille,
+    uint32_t* values,
+    size_t count);
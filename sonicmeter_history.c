@@ -0,0 +1,164 @@
+#include "sonicmeter_history.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#define SONICMETER_HISTORY_MASK (SONICMETER_HISTORY_SIZE - 1)
+
+_Static_assert(
+    (SONICMETER_HISTORY_SIZE & SONICMETER_HISTORY_MASK) == 0,
+    "history size must be a power of two");
+_Static_assert(
+    SONICMETER_HISTORY_PLOT_WIDTH <= SONICMETER_HISTORY_SIZE,
+    "a plot must fit in the history");
+
+static inline void sonicmeter_history_merge(
+    SonicMeterHistoryBucket* into,
+    const SonicMeterHistoryBucket* bucket) {
+    if(bucket->min < into->min) {
+        into->min = bucket->min;
+    }
+    if(bucket->max > into->max) {
+        into->max = bucket->max;
+    }
+}
+
+void sonicmeter_history_reset(SonicMeterHistory* history) {
+    memset(history, 0, sizeof(SonicMeterHistory));
+}
+
+void sonicmeter_history_push(SonicMeterHistory* history, uint16_t mm) {
+    const SonicMeterHistoryBucket sample = {.min = mm, .max = mm};
+
+    history->buckets[0][history->count[0] & SONICMETER_HISTORY_MASK] = sample;
+    history->count[0]++;
+
+    // Every sample goes straight into the pending bucket of each level, so the newest column is
+    // up to date at every zoom level
+    uint32_t scale = 1;
+    for(uint32_t level = 1; level < SONICMETER_HISTORY_LEVELS; level++) {
+        scale *= SONICMETER_HISTORY_FACTOR;
+        if(history->pending_count[level] == 0) {
+            history->pending[level] = sample;
+        } else {
+            sonicmeter_history_merge(&history->pending[level], &sample);
+        }
+        if(++history->pending_count[level] == scale) {
+            history->buckets[level][history->count[level] & SONICMETER_HISTORY_MASK] =
+                history->pending[level];
+            history->count[level]++;
+            history->pending_count[level] = 0;
+        }
+    }
+}
+
+/**
+ * @brief      Count the buckets of a level that can be read back.
+ * @param      history  The SonicMeterHistory object.
+ * @param      level    The level.
+ * @return     Buckets in the ring plus the pending one, if any.
+*/
+static size_t sonicmeter_history_available(const SonicMeterHistory* history, uint32_t level) {
+    const uint32_t completed = history->count[level];
+    size_t available = completed < SONICMETER_HISTORY_SIZE ? completed : SONICMETER_HISTORY_SIZE;
+    if(level > 0 && history->pending_count[level] > 0) {
+        available = available < SONICMETER_HISTORY_SIZE ? available + 1 : available;
+    }
+    return available;
+}
+
+/**
+ * @brief      Get one of the latest buckets of a level.
+ * @param      history  The SonicMeterHistory object.
+ * @param      level    The level.
+ * @param      age      0 for the newest bucket, counting back from there.
+ * @return     The bucket.
+*/
+static const SonicMeterHistoryBucket*
+    sonicmeter_history_at(const SonicMeterHistory* history, uint32_t level, size_t age) {
+    if(level > 0 && history->pending_count[level] > 0) {
+        if(age == 0) {
+            return &history->pending[level];
+        }
+        age--;
+    }
+    return &history->buckets[level][(history->count[level] - 1 - age) & SONICMETER_HISTORY_MASK];
+}
+
+size_t sonicmeter_history_get(
+    const SonicMeterHistory* history,
+    uint32_t level,
+    SonicMeterHistoryBucket* out,
+    size_t count) {
+    if(level >= SONICMETER_HISTORY_LEVELS) {
+        return 0;
+    }
+
+    const size_t available = sonicmeter_history_available(history, level);
+    if(count > available) {
+        count = available;
+    }
+    for(size_t i = 0; i < count; i++) {
+        out[i] = *sonicmeter_history_at(history, level, count - 1 - i);
+    }
+    return count;
+}
+
+size_t sonicmeter_history_plot(
+    const SonicMeterHistory* history,
+    uint32_t level,
+    SonicMeterHistoryPlot* plot,
+    uint8_t height) {
+    const size_t width = SONICMETER_HISTORY_PLOT_WIDTH;
+    memset(plot->top, SONICMETER_HISTORY_EMPTY, sizeof(plot->top));
+    memset(plot->bottom, SONICMETER_HISTORY_EMPTY, sizeof(plot->bottom));
+    plot->low_mm = 0;
+    plot->high_mm = 0;
+    if(level >= SONICMETER_HISTORY_LEVELS || height < 2) {
+        return 0;
+    }
+
+    size_t count = sonicmeter_history_available(history, level);
+    if(count > width) {
+        count = width;
+    }
+    if(count == 0) {
+        return 0;
+    }
+
+    // First pass for the scale, second pass maps every bucket to one column
+    uint32_t low = UINT16_MAX;
+    uint32_t high = 0;
+    for(size_t age = 0; age < count; age++) {
+        const SonicMeterHistoryBucket* bucket = sonicmeter_history_at(history, level, age);
+        low = bucket->min < low ? bucket->min : low;
+        high = bucket->max > high ? bucket->max : high;
+    }
+    if(high - low < SONICMETER_HISTORY_SPAN_MIN_MM) {
+        // Keep a flat line in the middle instead of blowing noise up to full height
+        const uint32_t half = SONICMETER_HISTORY_SPAN_MIN_MM / 2;
+        const uint32_t middle = (low + high) / 2;
+        low = middle > half ? middle - half : 0;
+        high = low + SONICMETER_HISTORY_SPAN_MIN_MM;
+    }
+    plot->low_mm = low;
+    plot->high_mm = high;
+
+    const uint32_t span = high - low;
+    const uint32_t rows = height - 1;
+    for(size_t age = 0; age < count; age++) {
+        const SonicMeterHistoryBucket* bucket = sonicmeter_history_at(history, level, age);
+        const size_t x = width - 1 - age;
+        plot->top[x] = rows - (bucket->max - low) * rows / span;
+        plot->bottom[x] = rows - (bucket->min - low) * rows / span;
+    }
+    return count;
+}
+
+uint32_t sonicmeter_history_get_scale(uint32_t level) {
+    uint32_t scale = 1;
+    while(level--) {
+        scale *= SONICMETER_HISTORY_FACTOR;
+    }
+    return scale;
+}
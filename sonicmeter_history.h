@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Distance history for the graph.
+ *
+ * A pyramid of min/max buckets. Level 0 holds single samples, every level above holds buckets
+ * SONICMETER_HISTORY_FACTOR times as wide as the level below, so each zoom level of the graph is
+ * already decimated and drawing a frame costs one bucket per column whatever the zoom. Memory is
+ * fixed, the top level covers SONICMETER_HISTORY_SIZE * 64 samples. No HAL, no allocation.
+*/
+
+#define SONICMETER_HISTORY_LEVELS 4 // 1, 4, 16 and 64 samples per bucket
+#define SONICMETER_HISTORY_FACTOR 4 // Bucket width ratio between neighbouring levels
+#define SONICMETER_HISTORY_SIZE 256 // Buckets kept per level, power of two
+#define SONICMETER_HISTORY_PLOT_WIDTH 128 // Columns of a plot, one bucket each
+#define SONICMETER_HISTORY_SPAN_MIN_MM 20 // Smallest vertical span of a plot
+#define SONICMETER_HISTORY_EMPTY 0xFF // Row of a plot column without a bucket
+
+typedef struct {
+    uint16_t min; // Millimeters
+    uint16_t max; // Millimeters
+} SonicMeterHistoryBucket;
+
+typedef struct {
+    SonicMeterHistoryBucket buckets[SONICMETER_HISTORY_LEVELS][SONICMETER_HISTORY_SIZE];
+    uint32_t count[SONICMETER_HISTORY_LEVELS]; // Buckets ever completed per level
+    SonicMeterHistoryBucket pending[SONICMETER_HISTORY_LEVELS]; // Bucket being filled per level
+    uint32_t pending_count[SONICMETER_HISTORY_LEVELS]; // Samples in it
+} SonicMeterHistory;
+
+typedef struct {
+    uint8_t top[SONICMETER_HISTORY_PLOT_WIDTH]; // Row of the bucket max, 0 is the top row
+    uint8_t bottom[SONICMETER_HISTORY_PLOT_WIDTH]; // Row of the bucket min
+    uint16_t low_mm; // Distance at the bottom row
+    uint16_t high_mm; // Distance at the top row
+} SonicMeterHistoryPlot;
+
+/**
+ * @brief      Clear the history.
+ * @param      history  The SonicMeterHistory object.
+*/
+void sonicmeter_history_reset(SonicMeterHistory* history);
+
+/**
+ * @brief      Add a sample.
+ * @details    Constant cost, one min/max update per level.
+ * @param      history  The SonicMeterHistory object.
+ * @param      mm       The distance in millimeters.
+*/
+void sonicmeter_history_push(SonicMeterHistory* history, uint16_t mm);
+
+/**
+ * @brief      Get the latest buckets of a level.
+ * @details    The bucket still being filled is included as the newest one, so recent samples show
+ *             up at every zoom level right away.
+ * @param      history  The SonicMeterHistory object.
+ * @param      level    The level, 0 to SONICMETER_HISTORY_LEVELS - 1.
+ * @param      out      Filled in oldest first.
+ * @param      count    Buckets wanted, at most SONICMETER_HISTORY_SIZE.
+ * @return     Buckets filled in, fewer than count while the history is short.
+*/
+size_t sonicmeter_history_get(
+    const SonicMeterHistory* history,
+    uint32_t level,
+    SonicMeterHistoryBucket* out,
+    size_t count);
+
+/**
+ * @brief      Plot the latest buckets of a level.
+ * @details    One bucket per column, newest in the rightmost column, scaled so the buckets shown
+ *             fill the height. Columns without a bucket are SONICMETER_HISTORY_EMPTY. Costs two
+ *             passes over SONICMETER_HISTORY_PLOT_WIDTH buckets, however many samples they cover.
+ * @param      history  The SonicMeterHistory object.
+ * @param      level    The level, sets how many samples a column covers.
+ * @param      plot     Filled in with the rows of every column.
+ * @param      height   Rows of the plot, at least 2.
+ * @return     Columns with a bucket.
+*/
+size_t sonicmeter_history_plot(
+    const SonicMeterHistory* history,
+    uint32_t level,
+    SonicMeterHistoryPlot* plot,
+    uint8_t height);
+
+/**
+ * @brief      Get the number of samples in a bucket of a level.
+ * @param      level  The level.
+ * @return     Samples per bucket.
+*/
+uint32_t sonicmeter_history_get_scale(uint32_t level);
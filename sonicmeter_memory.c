@@ -0,0 +1,77 @@
+#include "sonicmeter_memory.h"
+
+#include <furi.h>
+
+static SonicMeterArena* sonicmeter_memory_arena;
+static uint32_t sonicmeter_memory_heap_start; // Free heap when the app started
+static uint32_t sonicmeter_memory_heap_min; // Least free heap marked since
+static uint32_t sonicmeter_memory_stack_free[SonicMeterMemoryThreadCount]; // UINT32_MAX until run
+
+static const uint32_t sonicmeter_memory_stack_sizes[SonicMeterMemoryThreadCount] = {
+    [SonicMeterMemoryThreadApp] = SONICMETER_MEMORY_STACK_APP,
+    [SonicMeterMemoryThreadWorker] = SONICMETER_MEMORY_STACK_WORKER,
+    [SonicMeterMemoryThreadRecorder] = SONICMETER_MEMORY_STACK_RECORDER,
+    [SonicMeterMemoryThreadStream] = SONICMETER_MEMORY_STACK_STREAM,
+};
+
+static const char* const sonicmeter_memory_thread_names[SonicMeterMemoryThreadCount] = {
+    [SonicMeterMemoryThreadApp] = "app",
+    [SonicMeterMemoryThreadWorker] = "worker",
+    [SonicMeterMemoryThreadRecorder] = "recorder",
+    [SonicMeterMemoryThreadStream] = "stream",
+};
+
+SonicMeterArena* sonicmeter_memory_start(void) {
+    sonicmeter_memory_heap_start = memmgr_get_free_heap();
+    sonicmeter_memory_heap_min = sonicmeter_memory_heap_start;
+    for(uint32_t i = 0; i < SonicMeterMemoryThreadCount; i++) {
+        sonicmeter_memory_stack_free[i] = UINT32_MAX;
+    }
+
+    sonicmeter_memory_arena = sonicmeter_arena_alloc(SONICMETER_MEMORY_ARENA);
+    return sonicmeter_memory_arena;
+}
+
+void sonicmeter_memory_stop(void) {
+    sonicmeter_arena_free(sonicmeter_memory_arena);
+    sonicmeter_memory_arena = NULL;
+}
+
+void sonicmeter_memory_mark_stack(SonicMeterMemoryThread thread) {
+    furi_assert(thread < SonicMeterMemoryThreadCount);
+    // The kernel keeps the high-water mark of the thread, this only outlives it
+    const uint32_t free = furi_thread_get_stack_space(furi_thread_get_current_id());
+    if(free < sonicmeter_memory_stack_free[thread]) {
+        sonicmeter_memory_stack_free[thread] = free;
+    }
+}
+
+void sonicmeter_memory_mark_heap(void) {
+    const uint32_t free = memmgr_get_free_heap();
+    if(free < sonicmeter_memory_heap_min) {
+        sonicmeter_memory_heap_min = free;
+    }
+}
+
+void sonicmeter_memory_get_stats(SonicMeterMemoryStats* stats) {
+    sonicmeter_memory_mark_heap();
+
+    for(uint32_t i = 0; i < SonicMeterMemoryThreadCount; i++) {
+        const uint32_t free = sonicmeter_memory_stack_free[i];
+        const uint32_t size = sonicmeter_memory_stack_sizes[i];
+        stats->stack_size[i] = size;
+        stats->stack_used[i] = free == UINT32_MAX ? 0 : size > free ? size - free : 0;
+    }
+    stats->arena_size = sonicmeter_arena_get_size(sonicmeter_memory_arena);
+    stats->arena_used = sonicmeter_arena_get_used(sonicmeter_memory_arena);
+    stats->heap_peak = sonicmeter_memory_heap_start > sonicmeter_memory_heap_min ?
+                           sonicmeter_memory_heap_start - sonicmeter_memory_heap_min :
+                           0;
+    stats->heap_free = memmgr_get_free_heap();
+    stats->heap_low = memmgr_get_minimum_free_heap();
+}
+
+const char* sonicmeter_memory_get_thread_name(SonicMeterMemoryThread thread) {
+    furi_assert(thread < SonicMeterMemoryThreadCount);
+    return sonicmeter_memory_thread_names[thread];
+}
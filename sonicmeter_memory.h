@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include "sonicmeter_arena.h"
+
+/**
+ * Memory budget and usage report.
+ *
+ * The budget is fixed at build time: a stack size for every thread and an arena share for every
+ * large buffer. Each module asserts at compile time that its buffers fit their share, and the
+ * total is asserted against SONICMETER_MEMORY_BUDGET, so growing a buffer past its share breaks
+ * the build instead of a device low on RAM.
+ *
+ * At run time each thread marks the deepest its stack went, and the free heap is sampled against
+ * what it was when the app started. The heap is shared with the rest of the system, the peak
+ * includes whatever others allocated meanwhile, and is only as fine as the samples. Marks come
+ * from several threads without a lock, a report may be a mark behind.
+*/
+
+// Thread stacks
+#define SONICMETER_MEMORY_STACK_APP (4 * 1024) // Has to match stack_size in application.fam
+#define SONICMETER_MEMORY_STACK_WORKER (2 * 1024)
+#define SONICMETER_MEMORY_STACK_RECORDER (2 * 1024)
+#define SONICMETER_MEMORY_STACK_STREAM (2 * 1024)
+
+// Arena shares
+#define SONICMETER_MEMORY_RING (3 * 1024) // Worker sample ring
+#define SONICMETER_MEMORY_RECORDER (4 * 1024) // Recorder double buffer
+#define SONICMETER_MEMORY_STATS (6656) // Long run statistics
+#define SONICMETER_MEMORY_HISTORY (17 * 1024) // Graph history of every sensor
+#define SONICMETER_MEMORY_FRAMES (3 * 1024) // Frames of the measure screen
+
+#define SONICMETER_MEMORY_ARENA                                                     \
+    (SONICMETER_MEMORY_RING + SONICMETER_MEMORY_RECORDER + SONICMETER_MEMORY_STATS + \
+     SONICMETER_MEMORY_HISTORY + SONICMETER_MEMORY_FRAMES)
+#define SONICMETER_MEMORY_STACKS                                          \
+    (SONICMETER_MEMORY_STACK_APP + SONICMETER_MEMORY_STACK_WORKER +       \
+     SONICMETER_MEMORY_STACK_RECORDER + SONICMETER_MEMORY_STACK_STREAM)
+
+// Arena and stacks together, what the app can count on having
+#define SONICMETER_MEMORY_BUDGET (48 * 1024)
+
+_Static_assert(
+    SONICMETER_MEMORY_ARENA + SONICMETER_MEMORY_STACKS <= SONICMETER_MEMORY_BUDGET,
+    "Memory budget exceeded");
+
+typedef enum {
+    SonicMeterMemoryThreadApp, // GUI and event loop
+    SonicMeterMemoryThreadWorker,
+    SonicMeterMemoryThreadRecorder,
+    SonicMeterMemoryThreadStream,
+    SonicMeterMemoryThreadCount,
+} SonicMeterMemoryThread;
+
+typedef struct {
+    uint32_t stack_size[SonicMeterMemoryThreadCount];
+    uint32_t stack_used[SonicMeterMemoryThreadCount]; // Deepest the stack went, 0 until it ran
+    uint32_t arena_size;
+    uint32_t arena_used;
+    uint32_t heap_peak; // Most the free heap went down by since the app started
+    uint32_t heap_free; // Free heap now
+    uint32_t heap_low; // Least free heap since boot, for the whole system
+} SonicMeterMemoryStats;
+
+/**
+ * @brief      Take the heap baseline and allocate the arena.
+ * @details    Call before anything else is allocated, the heap peak counts from here.
+ * @return     The arena, SONICMETER_MEMORY_ARENA bytes.
+*/
+SonicMeterArena* sonicmeter_memory_start(void);
+
+/**
+ * @brief      Free the arena.
+*/
+void sonicmeter_memory_stop(void);
+
+/**
+ * @brief      Note how deep the stack of the calling thread went.
+ * @details    Scans the unused part of the stack, keep it out of time critical paths.
+ * @param      thread  The calling thread.
+*/
+void sonicmeter_memory_mark_stack(SonicMeterMemoryThread thread);
+
+/**
+ * @brief      Note the free heap.
+*/
+void sonicmeter_memory_mark_heap(void);
+
+/**
+ * @brief      Get the report, marking the heap first.
+ * @param      stats  Filled in with the report.
+*/
+void sonicmeter_memory_get_stats(SonicMeterMemoryStats* stats);
+
+/**
+ * @brief      Get the name of a thread.
+ * @param      thread  The thread.
+ * @return     Short name.
+*/
+const char* sonicmeter_memory_get_thread_name(SonicMeterMemoryThread thread);
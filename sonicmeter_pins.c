@@ -0,0 +1,21 @@
+#include "sonicmeter_pins.h"
+
+const SonicMeterPin sonicmeter_pins[SONICMETER_PINS_COUNT] = {
+    {.gpio = &gpio_ext_pa7, .name = "A7", .header = 2},
+    {.gpio = &gpio_ext_pa6, .name = "A6", .header = 3},
+    {.gpio = &gpio_ext_pa4, .name = "A4", .header = 4},
+    {.gpio = &gpio_ext_pb3, .name = "B3", .header = 5},
+    {.gpio = &gpio_ext_pb2, .name = "B2", .header = 6},
+    {.gpio = &gpio_ext_pc3, .name = "C3", .header = 7},
+    {.gpio = &gpio_ext_pc1, .name = "C1", .header = 15},
+    {.gpio = &gpio_ext_pc0, .name = "C0", .header = 16},
+};
+
+uint32_t sonicmeter_pins_find(const GpioPin* gpio) {
+    for(uint32_t i = 0; i < SONICMETER_PINS_COUNT; i++) {
+        if(sonicmeter_pins[i].gpio == gpio) {
+            return i;
+        }
+    }
+    return SONICMETER_PINS_COUNT;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <furi_hal.h>
+
+/**
+ * External GPIO pins.
+ *
+ * Every header pin the sensor can be wired to, in header order. Settings store an index into this
+ * table, so a pin only has to be added here to become selectable.
+*/
+
+typedef struct {
+    const GpioPin* gpio;
+    const char* name; // Label on the Flipper case
+    uint8_t header; // Header pin number
+} SonicMeterPin;
+
+#define SONICMETER_PINS_COUNT 8
+
+/** All usable external pins. */
+extern const SonicMeterPin sonicmeter_pins[SONICMETER_PINS_COUNT];
+
+/**
+ * @brief      Find the table index of a pin.
+ * @param      gpio  The pin.
+ * @return     Index into sonicmeter_pins, SONICMETER_PINS_COUNT if it is not an external pin.
+*/
+uint32_t sonicmeter_pins_find(const GpioPin* gpio);
@@ -0,0 +1,42 @@
+#include "sonicmeter_pipeline.h"
+
+void sonicmeter_pipeline_init(
+    SonicMeterPipeline* pipeline,
+    uint32_t cpu_hz,
+    int32_t temperature_c,
+    uint32_t max_range_cm) {
+    sonicmeter_convert_init(&pipeline->convert, cpu_hz, temperature_c);
+    pipeline->max_width_ticks =
+        sonicmeter_convert_um_to_ticks(&pipeline->convert, max_range_cm * 10000);
+}
+
+uint32_t
+    sonicmeter_pipeline_get_timeout_ms(const SonicMeterPipeline* pipeline, uint32_t latency_ms) {
+    const uint32_t max_width_us =
+        sonicmeter_convert_ticks_to_us(&pipeline->convert, pipeline->max_width_ticks);
+    return (max_width_us + SONICMETER_PIPELINE_RISE_MARGIN_US + 999) / 1000 + latency_ms;
+}
+
+void sonicmeter_pipeline_convert(const SonicMeterPipeline* pipeline, SonicMeterSample* sample) {
+    if(sample->result == SonicMeterCaptureResultOk && sample->ticks > pipeline->max_width_ticks) {
+        // The timeout is rounded up to whole milliseconds, the range is not
+        sample->result = SonicMeterCaptureResultOutOfRange;
+    }
+    if(sample->result != SonicMeterCaptureResultOk) {
+        sample->ticks = 0;
+    }
+    sample->echo_us = sonicmeter_convert_ticks_to_us(&pipeline->convert, sample->ticks);
+    sample->distance_um = sonicmeter_convert_ticks_to_um(&pipeline->convert, sample->ticks);
+    sample->flags = 0;
+}
+
+void sonicmeter_pipeline_filter(
+    SonicMeterFilter* filter,
+    uint32_t* filtered_um,
+    SonicMeterSample* sample) {
+    if(sample->result == SonicMeterCaptureResultOk &&
+       !sonicmeter_filter_process(filter, sample->distance_um, filtered_um)) {
+        sample->flags |= SonicMeterSampleFlagRejected;
+    }
+    sample->filtered_um = *filtered_um;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include "sonicmeter_convert.h"
+#include "sonicmeter_filter.h"
+#include "sonicmeter_sample.h"
+
+/**
+ * Sample processing.
+ *
+ * What happens to a reading between the sensor and the ring: the range check, the conversion of
+ * the echo width and the filter. The worker runs it live, the replay runs it on recorded samples,
+ * so both give the same output for the same echo widths. No HAL.
+*/
+
+// Time from the end of the trigger to the rising edge of the echo, the sensor pings first
+#define SONICMETER_PIPELINE_RISE_MARGIN_US 1000
+
+typedef struct {
+    SonicMeterConvert convert; // Clock of the echo widths and air of the distances
+    uint32_t max_width_ticks; // Echo pulse width of the range limit
+} SonicMeterPipeline;
+
+/**
+ * @brief      Precompute the conversion and the range limit.
+ * @param      pipeline       The SonicMeterPipeline object.
+ * @param      cpu_hz         Unit of the echo widths.
+ * @param      temperature_c  Air temperature in Celsius.
+ * @param      max_range_cm   Echoes from further away are out of range.
+*/
+void sonicmeter_pipeline_init(
+    SonicMeterPipeline* pipeline,
+    uint32_t cpu_hz,
+    int32_t temperature_c,
+    uint32_t max_range_cm);
+
+/**
+ * @brief      Get how long to wait for an echo.
+ * @details    An echo from the range limit is in by then, one still going is out of range.
+ * @param      pipeline    The SonicMeterPipeline object.
+ * @param      latency_ms  Time the sensor adds on top of the echo.
+ * @return     Timeout from the trigger, whole milliseconds.
+*/
+uint32_t
+    sonicmeter_pipeline_get_timeout_ms(const SonicMeterPipeline* pipeline, uint32_t latency_ms);
+
+/**
+ * @brief      Range check and convert a reading.
+ * @details    Takes the result and the echo width of the sample. A good capture beyond the range
+ *             becomes out of range, a failed capture has no width. Fills in echo_us and
+ *             distance_um, and clears the flags.
+ * @param      pipeline  The SonicMeterPipeline object.
+ * @param      sample    The sample.
+*/
+void sonicmeter_pipeline_convert(const SonicMeterPipeline* pipeline, SonicMeterSample* sample);
+
+/**
+ * @brief      Filter the distance of a converted sample.
+ * @details    Only good captures go through the filter. Sets filtered_um to the filter output,
+ *             held at the last one when the sample is not used, and flags a rejected sample.
+ * @param      filter       The filter of the sensor.
+ * @param      filtered_um  Last filter output of the sensor, updated.
+ * @param      sample       The sample.
+*/
+void sonicmeter_pipeline_filter(
+    SonicMeterFilter* filter,
+    uint32_t* filtered_um,
+    SonicMeterSample* sample);
@@ -0,0 +1,92 @@
+#include "sonicmeter_probe.h"
+
+#if SONICMETER_PROBES
+
+#include <furi.h>
+#include <furi_hal.h>
+#include <storage/storage.h>
+
+#define TAG "SonicMeterProbe"
+
+static SonicMeterProbeStats sonicmeter_probe_stats[SonicMeterProbeStageCount];
+
+static const char* const sonicmeter_probe_names[SonicMeterProbeStageCount] = {
+    [SonicMeterProbeStageSetup] = "Setup",
+    [SonicMeterProbeStageArm] = "Arm",
+    [SonicMeterProbeStageTrigger] = "Trig",
+    [SonicMeterProbeStageRise] = "Rise",
+    [SonicMeterProbeStagePulse] = "Pulse",
+    [SonicMeterProbeStageProcess] = "Proc",
+    [SonicMeterProbeStagePublish] = "Pub",
+    [SonicMeterProbeStageDraw] = "Draw",
+};
+
+void sonicmeter_probe_reset(void) {
+    memset(sonicmeter_probe_stats, 0, sizeof(sonicmeter_probe_stats));
+}
+
+void sonicmeter_probe_record(SonicMeterProbeStage stage, uint32_t cycles) {
+    furi_assert(stage < SonicMeterProbeStageCount);
+    SonicMeterProbeStats* stats = &sonicmeter_probe_stats[stage];
+
+    if(stats->count == 0 || cycles < stats->min) {
+        stats->min = cycles;
+    }
+    if(cycles > stats->max) {
+        stats->max = cycles;
+    }
+    stats->sum += cycles;
+    stats->count++;
+}
+
+void sonicmeter_probe_get(SonicMeterProbeStage stage, SonicMeterProbeStats* stats) {
+    furi_assert(stage < SonicMeterProbeStageCount);
+    *stats = sonicmeter_probe_stats[stage];
+}
+
+const char* sonicmeter_probe_get_name(SonicMeterProbeStage stage) {
+    furi_assert(stage < SonicMeterProbeStageCount);
+    return sonicmeter_probe_names[stage];
+}
+
+void sonicmeter_probe_cat_csv(FuriString* lines, const char* newline) {
+    furi_string_cat_printf(lines, "stage,count,min,mean,max,cpu_hz%s", newline);
+    for(uint32_t i = 0; i < SonicMeterProbeStageCount; i++) {
+        SonicMeterProbeStats stats;
+        sonicmeter_probe_get(i, &stats);
+        furi_string_cat_printf(
+            lines,
+            "%s,%lu,%lu,%lu,%lu,%lu%s",
+            sonicmeter_probe_names[i],
+            stats.count,
+            stats.min,
+            stats.count ? (uint32_t)(stats.sum / stats.count) : 0,
+            stats.max,
+            SystemCoreClock,
+            newline);
+    }
+}
+
+bool sonicmeter_probe_export(const char* path) {
+    Storage* storage = furi_record_open(RECORD_STORAGE);
+    File* file = storage_file_alloc(storage);
+    FuriString* line = furi_string_alloc();
+    bool ok = storage_file_open(file, path, FSAM_WRITE, FSOM_CREATE_ALWAYS);
+
+    if(ok) {
+        sonicmeter_probe_cat_csv(line, "\n");
+        const size_t size = furi_string_size(line);
+        ok = storage_file_write(file, furi_string_get_cstr(line), size) == size;
+        storage_file_close(file);
+    }
+    if(!ok) {
+        FURI_LOG_E(TAG, "Failed to write %s", path);
+    }
+
+    furi_string_free(line);
+    storage_file_free(file);
+    furi_record_close(RECORD_STORAGE);
+    return ok;
+}
+
+#endif
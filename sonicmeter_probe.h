@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Cycle counter probes.
+ *
+ * Each stage of the measurement and draw path accumulates how many CPU cycles it took: min, max
+ * and mean since the last reset. A stage is only ever recorded from one thread, readers may see a
+ * stage half way through an update, which is good enough for a debug page.
+ *
+ * Build with SONICMETER_PROBES=0 to compile the probes out entirely.
+*/
+
+#ifndef SONICMETER_PROBES
+#define SONICMETER_PROBES 1
+#endif
+
+typedef enum {
+    SonicMeterProbeStageSetup, // Pin and capture setup when sampling starts
+    SonicMeterProbeStageArm, // Arming the capture
+    SonicMeterProbeStageTrigger, // The trigger pulse
+    SonicMeterProbeStageRise, // Arming to the rising edge of the echo, interrupt backends only
+    SonicMeterProbeStagePulse, // The echo pulse
+    SonicMeterProbeStageProcess, // Range check, conversion and filter
+    SonicMeterProbeStagePublish, // Ring write and sample callback
+    SonicMeterProbeStageDraw, // Drawing the measure screen
+    SonicMeterProbeStageCount,
+} SonicMeterProbeStage;
+
+typedef struct {
+    uint32_t count; // Times the stage was recorded
+    uint32_t min; // Cycles
+    uint32_t max; // Cycles
+    uint64_t sum; // Cycles
+} SonicMeterProbeStats;
+
+#if SONICMETER_PROBES
+
+#include <furi.h>
+#include "sonicmeter_hal.h"
+
+// Start timing a stage in the current scope
+#define SONICMETER_PROBE_BEGIN(name) const uint32_t name = sonicmeter_hal_cycles()
+// Record the stage started by SONICMETER_PROBE_BEGIN
+#define SONICMETER_PROBE_END(stage, name) \
+    sonicmeter_probe_record(stage, sonicmeter_hal_cycles() - (name))
+// Record a duration measured by other means
+#define SONICMETER_PROBE_RECORD(stage, cycles) sonicmeter_probe_record(stage, cycles)
+
+/**
+ * @brief      Clear all stages.
+*/
+void sonicmeter_probe_reset(void);
+
+/**
+ * @brief      Add a duration to a stage.
+ * @param      stage   The stage.
+ * @param      cycles  The duration in CPU cycles.
+*/
+void sonicmeter_probe_record(SonicMeterProbeStage stage, uint32_t cycles);
+
+/**
+ * @brief      Get the statistics of a stage.
+ * @param      stage  The stage.
+ * @param      stats  Filled in with the statistics.
+*/
+void sonicmeter_probe_get(SonicMeterProbeStage stage, SonicMeterProbeStats* stats);
+
+/**
+ * @brief      Get the short name of a stage.
+ * @param      stage  The stage.
+ * @return     The name.
+*/
+const char* sonicmeter_probe_get_name(SonicMeterProbeStage stage);
+
+/**
+ * @brief      Append all stages as CSV.
+ * @details    A header line, then one line per stage: name, count, min, mean and max cycles, then
+ *             the CPU clock so the cycles can be turned into time.
+ * @param      lines    Appended to.
+ * @param      newline  Line ending, "\n" for files, "\r\n" for the CLI.
+*/
+void sonicmeter_probe_cat_csv(FuriString* lines, const char* newline);
+
+/**
+ * @brief      Write all stages as CSV.
+ * @details    The lines of sonicmeter_probe_cat_csv.
+ * @param      path  The file to create.
+ * @return     false if the file could not be written.
+*/
+bool sonicmeter_probe_export(const char* path);
+
+#else
+
+#define SONICMETER_PROBE_BEGIN(name)
+#define SONICMETER_PROBE_END(stage, name)
+#define SONICMETER_PROBE_RECORD(stage, cycles)
+
+#endif
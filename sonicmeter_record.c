@@ -0,0 +1,158 @@
+#include "sonicmeter_record.h"
+
+#include <string.h>
+
+static size_t sonicmeter_record_put_u32(uint8_t* out, uint32_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+    return 4;
+}
+
+static uint32_t sonicmeter_record_get_u32(const uint8_t* in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static size_t sonicmeter_record_put_varint(uint8_t* out, uint64_t value) {
+    size_t size = 0;
+    while(value >= 0x80) {
+        out[size++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    out[size++] = value;
+    return size;
+}
+
+/**
+ * @brief      Read a varint.
+ * @param      in     Encoded data.
+ * @param      size   Bytes available.
+ * @param      limit  Most bytes the varint may take, 5 for 32 bit values, 10 for 64 bit ones.
+ * @param      value  Filled in on success.
+ * @return     Number of bytes consumed, 0 if the data is truncated or the varint too long.
+*/
+static size_t sonicmeter_record_get_varint(
+    const uint8_t* in,
+    size_t size,
+    size_t limit,
+    uint64_t* value) {
+    uint64_t result = 0;
+    for(size_t i = 0; i < size && i < limit; i++) {
+        result |= (uint64_t)(in[i] & 0x7F) << (7 * i);
+        if(!(in[i] & 0x80)) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static inline uint32_t sonicmeter_record_zigzag(uint32_t delta) {
+    return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+}
+
+static inline uint32_t sonicmeter_record_unzigzag(uint32_t value) {
+    return (value >> 1) ^ -(value & 1);
+}
+
+void sonicmeter_record_codec_reset(SonicMeterRecordCodec* codec) {
+    memset(&codec->previous, 0, sizeof(codec->previous));
+    memset(codec->previous_ticks, 0, sizeof(codec->previous_ticks));
+    memset(codec->previous_filtered_um, 0, sizeof(codec->previous_filtered_um));
+}
+
+size_t sonicmeter_record_header_encode(const SonicMeterRecordHeader* header, uint8_t* out) {
+    size_t size = 0;
+    size += sonicmeter_record_put_u32(out + size, SONICMETER_RECORD_MAGIC);
+    size += sonicmeter_record_put_u32(out + size, SONICMETER_RECORD_VERSION);
+    size += sonicmeter_record_put_u32(out + size, header->cpu_hz);
+    size += sonicmeter_record_put_u32(out + size, header->tick_hz);
+    size += sonicmeter_record_put_u32(out + size, (uint32_t)header->temperature_c);
+    size += sonicmeter_record_put_u32(out + size, header->max_range_cm);
+    return size;
+}
+
+bool sonicmeter_record_header_decode(
+    const uint8_t* in,
+    size_t size,
+    SonicMeterRecordHeader* header) {
+    if(size < SONICMETER_RECORD_HEADER_SIZE ||
+       sonicmeter_record_get_u32(in) != SONICMETER_RECORD_MAGIC ||
+       sonicmeter_record_get_u32(in + 4) == 0 ||
+       sonicmeter_record_get_u32(in + 4) > SONICMETER_RECORD_VERSION) {
+        return false;
+    }
+    header->cpu_hz = sonicmeter_record_get_u32(in + 8);
+    header->tick_hz = sonicmeter_record_get_u32(in + 12);
+    header->temperature_c = (int32_t)sonicmeter_record_get_u32(in + 16);
+    header->max_range_cm = sonicmeter_record_get_u32(in + 20);
+    return true;
+}
+
+size_t sonicmeter_record_encode(
+    SonicMeterRecordCodec* codec,
+    const SonicMeterSample* sample,
+    uint8_t* out) {
+    SonicMeterSample* previous = &codec->previous;
+    const uint32_t sensor = sample->sensor % SONICMETER_SAMPLE_SENSORS_MAX;
+    size_t size = 0;
+
+    size += sonicmeter_record_put_varint(out + size, sample->sequence - previous->sequence);
+    size += sonicmeter_record_put_varint(out + size, sample->timestamp - previous->timestamp);
+    size += sonicmeter_record_put_varint(
+        out + size, sonicmeter_record_zigzag(sample->ticks - codec->previous_ticks[sensor]));
+    size += sonicmeter_record_put_varint(
+        out + size,
+        sonicmeter_record_zigzag(sample->filtered_um - codec->previous_filtered_um[sensor]));
+    size += sonicmeter_record_put_varint(
+        out + size,
+        sample->result | (sample->flags << SONICMETER_RECORD_FLAGS_SHIFT) |
+            (sensor << SONICMETER_RECORD_SENSOR_SHIFT));
+
+    *previous = *sample;
+    codec->previous_ticks[sensor] = sample->ticks;
+    codec->previous_filtered_um[sensor] = sample->filtered_um;
+    return size;
+}
+
+size_t sonicmeter_record_decode(
+    SonicMeterRecordCodec* codec,
+    const uint8_t* in,
+    size_t size,
+    SonicMeterSample* sample) {
+    uint64_t fields[5];
+    size_t offset = 0;
+
+    for(size_t i = 0; i < 5; i++) {
+        // The timestamp is the only 64 bit field
+        const size_t limit = i == 1 ? 10 : 5;
+        size_t used = sonicmeter_record_get_varint(in + offset, size - offset, limit, &fields[i]);
+        if(used == 0) {
+            return 0;
+        }
+        offset += used;
+    }
+
+    if((fields[4] >> SONICMETER_RECORD_SENSOR_SHIFT) >= SONICMETER_SAMPLE_SENSORS_MAX) {
+        return 0;
+    }
+    const uint32_t sensor = fields[4] >> SONICMETER_RECORD_SENSOR_SHIFT;
+
+    SonicMeterSample* previous = &codec->previous;
+    memset(sample, 0, sizeof(SonicMeterSample));
+    sample->sequence = previous->sequence + fields[0];
+    sample->sensor = sensor;
+    sample->timestamp = previous->timestamp + fields[1];
+    sample->ticks = codec->previous_ticks[sensor] + sonicmeter_record_unzigzag(fields[2]);
+    sample->filtered_um =
+        codec->previous_filtered_um[sensor] + sonicmeter_record_unzigzag(fields[3]);
+    sample->result = fields[4] & ((1 << SONICMETER_RECORD_FLAGS_SHIFT) - 1);
+    sample->flags = (fields[4] >> SONICMETER_RECORD_FLAGS_SHIFT) &
+                    ((1 << (SONICMETER_RECORD_SENSOR_SHIFT - SONICMETER_RECORD_FLAGS_SHIFT)) - 1);
+
+    *previous = *sample;
+    codec->previous_ticks[sensor] = sample->ticks;
+    codec->previous_filtered_um[sensor] = sample->filtered_um;
+    return offset;
+}
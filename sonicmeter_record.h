@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stddef.h>
+#include "sonicmeter_sample.h"
+
+/**
+ * Recording file format.
+ *
+ * A fixed little endian header followed by one record per sample. A record is five LEB128
+ * varints, each a delta against the previous record in the file:
+ *  - sequence delta, more than 1 means samples were dropped
+ *  - timestamp delta, 64 bit
+ *  - raw ticks delta, zigzag encoded
+ *  - filtered distance delta, zigzag encoded
+ *  - capture result | sample flags << 4 | sensor << 8, not a delta
+ * The ticks and filtered distance deltas are against the previous record of the same sensor, so
+ * interleaving sensors does not blow up the deltas. A steady stream costs 7 to 10 bytes per
+ * sample, most of it the microsecond timestamp delta.
+ *
+ * Version 2 added the sensor. A version 1 file decodes the same way, all of its records are from
+ * sensor 0. Version 3 made the timestamp 64 bit, it no longer wraps every 71 minutes. Older files
+ * decode the same way too: their 32 bit timestamp deltas were taken across the wrap, summed up
+ * they give the same monotonic time.
+*/
+
+#define SONICMETER_RECORD_MAGIC 0x524D5353 // "SSMR"
+#define SONICMETER_RECORD_VERSION 3
+#define SONICMETER_RECORD_HEADER_SIZE 24
+#define SONICMETER_RECORD_SIZE_MAX 30 // Four varints of up to five bytes, the timestamp of ten
+#define SONICMETER_RECORD_FLAGS_SHIFT 4
+#define SONICMETER_RECORD_SENSOR_SHIFT 8
+
+typedef struct {
+    uint32_t cpu_hz; // Unit of the raw ticks
+    uint32_t tick_hz; // Unit of the timestamps
+    int32_t temperature_c; // Temperature used for the filtered distance
+    uint32_t max_range_cm; // Range limit in effect
+} SonicMeterRecordHeader;
+
+typedef struct {
+    SonicMeterSample previous; // Last sample encoded or decoded
+    uint32_t previous_ticks[SONICMETER_SAMPLE_SENSORS_MAX]; // Last raw ticks of each sensor
+    uint32_t previous_filtered_um[SONICMETER_SAMPLE_SENSORS_MAX]; // Last filtered distance
+} SonicMeterRecordCodec;
+
+/**
+ * @brief      Reset the delta state, for the start of a file.
+ * @param      codec  The codec.
+*/
+void sonicmeter_record_codec_reset(SonicMeterRecordCodec* codec);
+
+/**
+ * @brief      Serialize the file header.
+ * @param      header  The header.
+ * @param      out     At least SONICMETER_RECORD_HEADER_SIZE bytes.
+ * @return     Number of bytes written.
+*/
+size_t sonicmeter_record_header_encode(const SonicMeterRecordHeader* header, uint8_t* out);
+
+/**
+ * @brief      Parse the file header.
+ * @param      in      Start of the file.
+ * @param      size    Bytes available.
+ * @param      header  Filled in on success.
+ * @return     false if the magic does not match or the version is not supported.
+*/
+bool sonicmeter_record_header_decode(
+    const uint8_t* in,
+    size_t size,
+    SonicMeterRecordHeader* header);
+
+/**
+ * @brief      Encode a sample.
+ * @param      codec   The codec.
+ * @param      sample  The sample.
+ * @param      out     At least SONICMETER_RECORD_SIZE_MAX bytes.
+ * @return     Number of bytes written.
+*/
+size_t sonicmeter_record_encode(
+    SonicMeterRecordCodec* codec,
+    const SonicMeterSample* sample,
+    uint8_t* out);
+
+/**
+ * @brief      Decode a sample.
+ * @details    Fills in sequence, sensor, timestamp, ticks, filtered_um, result and flags. The
+ *             rest of the sample is left for the caller to derive.
+ * @param      codec   The codec.
+ * @param      in      Encoded data.
+ * @param      size    Bytes available.
+ * @param      sample  Filled in on success.
+ * @return     Number of bytes consumed, 0 if the data is truncated or malformed.
+*/
+size_t sonicmeter_record_decode(
+    SonicMeterRecordCodec* codec,
+    const uint8_t* in,
+    size_t size,
+    SonicMeterSample* sample);
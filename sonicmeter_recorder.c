@@ -0,0 +1,291 @@
+#include "sonicmeter_recorder.h"
+#include "sonicmeter_probe.h"
+#include "sonicmeter_memory.h"
+
+#include <furi_hal.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <storage/storage.h>
+
+#define TAG "SonicMeterRecorder"
+
+#define SONICMETER_RECORDER_BUFFER_SIZE (2 * 1024)
+
+_Static_assert(
+    2 * SONICMETER_ARENA_ROUND(SONICMETER_RECORDER_BUFFER_SIZE) <= SONICMETER_MEMORY_RECORDER,
+    "Recorder buffers over their memory budget");
+
+typedef enum {
+    SonicMeterRecorderEventStop = (1 << 0),
+    SonicMeterRecorderEventBufferFull = (1 << 1),
+} SonicMeterRecorderEvent;
+
+#define SONICMETER_RECORDER_EVENT_ALL \
+    (SonicMeterRecorderEventStop | SonicMeterRecorderEventBufferFull)
+
+struct SonicMeterRecorder {
+    FuriThread* thread;
+    FuriMutex* mutex; // Serializes push against start and stop, push only tries it
+    Storage* storage;
+    File* file;
+    FuriString* path; // The current or last recording
+    bool running;
+
+    SonicMeterRecordCodec codec;
+    uint8_t* buffers[2];
+    size_t fill[2];
+    atomic_bool busy[2]; // Handed to the recorder thread and not written yet
+    uint32_t active; // Buffer the sampling thread fills
+
+    SonicMeterRecorderStats stats;
+    uint64_t write_cycles; // CPU cycles spent in storage writes
+    uint32_t encoded_bytes; // Bytes produced, header included
+    uint32_t start_tick;
+};
+
+/**
+ * @brief      Write a buffer to the card.
+ * @details    Runs on the recorder thread.
+ * @param      recorder  The SonicMeterRecorder object.
+ * @param      index     The buffer to write.
+*/
+static void sonicmeter_recorder_write(SonicMeterRecorder* recorder, uint32_t index) {
+    const size_t size = recorder->fill[index];
+
+    const uint32_t start = furi_hal_cortex_timer_get(0).start;
+    size_t written = storage_file_write(recorder->file, recorder->buffers[index], size);
+    recorder->write_cycles += furi_hal_cortex_timer_get(0).start - start;
+
+    recorder->stats.bytes_written += written;
+    if(written != size) {
+        recorder->stats.write_errors++;
+    }
+    if(recorder->write_cycles) {
+        recorder->stats.write_bps =
+            (uint64_t)recorder->stats.bytes_written * SystemCoreClock / recorder->write_cycles;
+    }
+
+    atomic_store(&recorder->busy[index], false);
+}
+
+static int32_t sonicmeter_recorder_thread(void* context) {
+    SonicMeterRecorder* recorder = context;
+
+    while(true) {
+        uint32_t flags = furi_thread_flags_wait(
+            SONICMETER_RECORDER_EVENT_ALL, FuriFlagWaitAny, FuriWaitForever);
+        if(flags & FuriFlagError) {
+            continue;
+        }
+
+        // At most one buffer is in flight at a time, write it before honouring a stop
+        for(uint32_t i = 0; i < 2; i++) {
+            if(atomic_load(&recorder->busy[i])) {
+                sonicmeter_recorder_write(recorder, i);
+                sonicmeter_memory_mark_stack(SonicMeterMemoryThreadRecorder);
+            }
+        }
+
+        if(flags & SonicMeterRecorderEventStop) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief      Hand the active buffer to the recorder thread and switch to the other one.
+ * @details    The caller holds the mutex.
+ * @param      recorder  The SonicMeterRecorder object.
+ * @return     false if the other buffer is still being written.
+*/
+static bool sonicmeter_recorder_swap(SonicMeterRecorder* recorder) {
+    const uint32_t other = recorder->active ^ 1;
+    if(atomic_load(&recorder->busy[other])) {
+        return false;
+    }
+
+    atomic_store(&recorder->busy[recorder->active], true);
+    recorder->active = other;
+    recorder->fill[other] = 0;
+    furi_thread_flags_set(furi_thread_get_id(recorder->thread), SonicMeterRecorderEventBufferFull);
+    return true;
+}
+
+SonicMeterRecorder* sonicmeter_recorder_alloc(SonicMeterArena* arena) {
+    SonicMeterRecorder* recorder = malloc(sizeof(SonicMeterRecorder));
+
+    recorder->thread = furi_thread_alloc_ex(
+        "SonicMeterRecorder",
+        SONICMETER_MEMORY_STACK_RECORDER,
+        sonicmeter_recorder_thread,
+        recorder);
+    recorder->mutex = furi_mutex_alloc(FuriMutexTypeNormal);
+    recorder->storage = furi_record_open(RECORD_STORAGE);
+    recorder->file = NULL;
+    recorder->path = furi_string_alloc();
+    recorder->running = false;
+    for(uint32_t i = 0; i < 2; i++) {
+        recorder->buffers[i] = sonicmeter_arena_take(arena, SONICMETER_RECORDER_BUFFER_SIZE);
+        recorder->fill[i] = 0;
+        atomic_init(&recorder->busy[i], false);
+    }
+    memset(&recorder->stats, 0, sizeof(recorder->stats));
+
+    return recorder;
+}
+
+void sonicmeter_recorder_free(SonicMeterRecorder* recorder) {
+    furi_assert(!recorder->running);
+
+    furi_string_free(recorder->path);
+    furi_record_close(RECORD_STORAGE);
+    furi_mutex_free(recorder->mutex);
+    furi_thread_free(recorder->thread);
+    free(recorder);
+}
+
+bool sonicmeter_recorder_start(
+    SonicMeterRecorder* recorder,
+    const SonicMeterRecordHeader* header) {
+    furi_assert(!recorder->running);
+
+    storage_simply_mkdir(recorder->storage, SONICMETER_RECORDER_DIR);
+    FuriString* name = furi_string_alloc();
+    FuriString* path = recorder->path;
+    storage_get_next_filename(
+        recorder->storage,
+        SONICMETER_RECORDER_DIR,
+        "sonicmeter",
+        SONICMETER_RECORDER_EXTENSION,
+        name,
+        255);
+    furi_string_printf(
+        path,
+        "%s/%s%s",
+        SONICMETER_RECORDER_DIR,
+        furi_string_get_cstr(name),
+        SONICMETER_RECORDER_EXTENSION);
+
+    recorder->file = storage_file_alloc(recorder->storage);
+    bool opened = storage_file_open(
+        recorder->file, furi_string_get_cstr(path), FSAM_WRITE, FSOM_CREATE_ALWAYS);
+    if(opened) {
+        FURI_LOG_I(TAG, "Recording to %s", furi_string_get_cstr(path));
+    } else {
+        FURI_LOG_E(TAG, "Failed to create %s", furi_string_get_cstr(path));
+        storage_file_free(recorder->file);
+        recorder->file = NULL;
+    }
+    furi_string_free(name);
+    if(!opened) {
+        return false;
+    }
+
+    memset(&recorder->stats, 0, sizeof(recorder->stats));
+    recorder->write_cycles = 0;
+    recorder->start_tick = furi_get_tick();
+    sonicmeter_record_codec_reset(&recorder->codec);
+
+    // The header goes in front of the first buffer
+    recorder->active = 0;
+    recorder->fill[0] = sonicmeter_record_header_encode(header, recorder->buffers[0]);
+    recorder->fill[1] = 0;
+    recorder->encoded_bytes = recorder->fill[0];
+
+    furi_thread_start(recorder->thread);
+
+    furi_mutex_acquire(recorder->mutex, FuriWaitForever);
+    recorder->running = true;
+    furi_mutex_release(recorder->mutex);
+    return true;
+}
+
+void sonicmeter_recorder_stop(SonicMeterRecorder* recorder) {
+    furi_mutex_acquire(recorder->mutex, FuriWaitForever);
+    if(!recorder->running) {
+        furi_mutex_release(recorder->mutex);
+        return;
+    }
+    recorder->running = false;
+
+    // Flush the partial buffer once the other one is on the card
+    if(recorder->fill[recorder->active] > 0) {
+        while(!sonicmeter_recorder_swap(recorder)) {
+            furi_delay_tick(1);
+        }
+    }
+    furi_mutex_release(recorder->mutex);
+
+    furi_thread_flags_set(furi_thread_get_id(recorder->thread), SonicMeterRecorderEventStop);
+    furi_thread_join(recorder->thread);
+
+    storage_file_close(recorder->file);
+    storage_file_free(recorder->file);
+    recorder->file = NULL;
+
+#if SONICMETER_PROBES
+    // Stage timings of the session go next to the recording, sonicmeterN_probes.csv
+    FuriString* probe_path = furi_string_alloc_printf("%s", furi_string_get_cstr(recorder->path));
+    furi_string_left(
+        probe_path, furi_string_size(probe_path) - strlen(SONICMETER_RECORDER_EXTENSION));
+    furi_string_cat_str(probe_path, "_probes.csv");
+    sonicmeter_probe_export(furi_string_get_cstr(probe_path));
+    furi_string_free(probe_path);
+#endif
+
+    FURI_LOG_I(
+        TAG,
+        "Recorded %lu samples, %lu dropped, %lu bytes",
+        recorder->stats.samples,
+        recorder->stats.dropped,
+        recorder->stats.bytes_written);
+}
+
+bool sonicmeter_recorder_is_running(SonicMeterRecorder* recorder) {
+    return recorder->running;
+}
+
+void sonicmeter_recorder_push(SonicMeterRecorder* recorder, const SonicMeterSample* sample) {
+    if(!recorder->running) {
+        return;
+    }
+
+    // Start and stop hold the mutex only briefly, skip the sample rather than wait
+    if(furi_mutex_acquire(recorder->mutex, 0) != FuriStatusOk) {
+        recorder->stats.dropped++;
+        return;
+    }
+
+    if(recorder->running) {
+        const size_t limit = SONICMETER_RECORDER_BUFFER_SIZE - SONICMETER_RECORD_SIZE_MAX;
+        if(recorder->fill[recorder->active] > limit) {
+            sonicmeter_recorder_swap(recorder);
+        }
+
+        const uint32_t active = recorder->active;
+        if(recorder->fill[active] <= limit) {
+            const size_t size = sonicmeter_record_encode(
+                &recorder->codec, sample, recorder->buffers[active] + recorder->fill[active]);
+            recorder->fill[active] += size;
+            recorder->encoded_bytes += size;
+            recorder->stats.samples++;
+        } else {
+            // Both buffers full, the card is not keeping up
+            recorder->stats.dropped++;
+        }
+
+        const uint32_t elapsed = furi_get_tick() - recorder->start_tick;
+        if(elapsed) {
+            recorder->stats.data_bps =
+                (uint64_t)recorder->encoded_bytes * furi_kernel_get_tick_frequency() / elapsed;
+        }
+    }
+
+    furi_mutex_release(recorder->mutex);
+}
+
+void sonicmeter_recorder_get_stats(SonicMeterRecorder* recorder, SonicMeterRecorderStats* stats) {
+    *stats = recorder->stats;
+}
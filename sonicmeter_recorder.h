@@ -0,0 +1,78 @@
+#pragma once
+
+#include <furi.h>
+#include "sonicmeter_arena.h"
+#include "sonicmeter_record.h"
+
+/**
+ * Session recorder.
+ *
+ * Samples are encoded into one of two RAM buffers on the sampling thread. A full buffer is handed
+ * to the recorder thread, which writes it to the SD card while the other one fills up. Pushing a
+ * sample never waits for storage: if both buffers are full the sample is dropped and counted.
+*/
+
+#define SONICMETER_RECORDER_DIR EXT_PATH("apps_data/sonicmeter")
+#define SONICMETER_RECORDER_EXTENSION ".smr"
+
+typedef struct {
+    uint32_t samples; // Samples encoded
+    uint32_t dropped; // Samples lost because both buffers were full
+    uint32_t bytes_written; // Bytes on the card, header included
+    uint32_t write_errors; // Short writes
+    uint32_t write_bps; // Throughput while writing, bytes per second
+    uint32_t data_bps; // Recording data rate since start, bytes per second
+} SonicMeterRecorderStats;
+
+typedef struct SonicMeterRecorder SonicMeterRecorder;
+
+/**
+ * @brief      Allocate the recorder.
+ * @param      arena  The arena the buffers come from.
+ * @return     SonicMeterRecorder object.
+*/
+SonicMeterRecorder* sonicmeter_recorder_alloc(SonicMeterArena* arena);
+
+/**
+ * @brief      Free the recorder.
+ * @param      recorder  The SonicMeterRecorder object, must be stopped.
+*/
+void sonicmeter_recorder_free(SonicMeterRecorder* recorder);
+
+/**
+ * @brief      Create a new recording and start accepting samples.
+ * @param      recorder  The SonicMeterRecorder object.
+ * @param      header    Written at the start of the file.
+ * @return     false if the file could not be created.
+*/
+bool sonicmeter_recorder_start(
+    SonicMeterRecorder* recorder,
+    const SonicMeterRecordHeader* header);
+
+/**
+ * @brief      Flush the buffers and close the recording.
+ * @param      recorder  The SonicMeterRecorder object.
+*/
+void sonicmeter_recorder_stop(SonicMeterRecorder* recorder);
+
+/**
+ * @brief      Check whether a recording is open.
+ * @param      recorder  The SonicMeterRecorder object.
+ * @return     true if samples are being recorded.
+*/
+bool sonicmeter_recorder_is_running(SonicMeterRecorder* recorder);
+
+/**
+ * @brief      Record a sample.
+ * @details    Called on the sampling thread, never blocks. Ignored when not recording.
+ * @param      recorder  The SonicMeterRecorder object.
+ * @param      sample    The sample.
+*/
+void sonicmeter_recorder_push(SonicMeterRecorder* recorder, const SonicMeterSample* sample);
+
+/**
+ * @brief      Get the recording statistics.
+ * @param      recorder  The SonicMeterRecorder object.
+ * @param      stats     Filled in with the statistics of the current or last recording.
+*/
+void sonicmeter_recorder_get_stats(SonicMeterRecorder* recorder, SonicMeterRecorderStats* stats);
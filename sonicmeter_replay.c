@@ -0,0 +1,273 @@
+#include "sonicmeter_replay.h"
+#include "sonicmeter_text.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct SonicMeterReplay {
+    SonicMeterPipeline pipeline;
+    SonicMeterFilter* filters[SONICMETER_SAMPLE_SENSORS_MAX];
+    uint32_t filtered_um[SONICMETER_SAMPLE_SENSORS_MAX]; // Last filter output of each sensor
+    SonicMeterReplayDiff diff;
+};
+
+static const char* const sonicmeter_replay_result_names[] = {
+    [SonicMeterCaptureResultOk] = "ok",
+    [SonicMeterCaptureResultNoEcho] = "no_echo",
+    [SonicMeterCaptureResultOutOfRange] = "out_of_range",
+    [SonicMeterCaptureResultLineHigh] = "line_high",
+};
+
+/**
+ * @brief      Move the undecoded bytes to the front and read up to a full buffer.
+ * @param      stream  The SonicMeterReplayStream object.
+*/
+static void sonicmeter_replay_stream_fill(SonicMeterReplayStream* stream) {
+    memmove(stream->buffer, stream->buffer + stream->head, stream->tail - stream->head);
+    stream->tail -= stream->head;
+    stream->head = 0;
+    while(!stream->end && stream->tail < SONICMETER_REPLAY_BUFFER_SIZE) {
+        const size_t size = stream->read(
+            stream->context,
+            stream->buffer + stream->tail,
+            SONICMETER_REPLAY_BUFFER_SIZE - stream->tail);
+        stream->end = size == 0;
+        stream->tail += size;
+    }
+}
+
+bool sonicmeter_replay_stream_open(
+    SonicMeterReplayStream* stream,
+    SonicMeterReplayRead read,
+    void* context,
+    SonicMeterRecordHeader* header) {
+    stream->read = read;
+    stream->context = context;
+    stream->head = 0;
+    stream->tail = 0;
+    stream->end = false;
+    stream->truncated = false;
+    stream->malformed = false;
+    sonicmeter_record_codec_reset(&stream->codec);
+
+    sonicmeter_replay_stream_fill(stream);
+    if(!sonicmeter_record_header_decode(stream->buffer, stream->tail, header)) {
+        return false;
+    }
+    stream->head = SONICMETER_RECORD_HEADER_SIZE;
+    stream->bytes = SONICMETER_RECORD_HEADER_SIZE;
+    return true;
+}
+
+bool sonicmeter_replay_stream_next(SonicMeterReplayStream* stream, SonicMeterSample* sample) {
+    size_t available = stream->tail - stream->head;
+    if(available < SONICMETER_RECORD_SIZE_MAX && !stream->end) {
+        sonicmeter_replay_stream_fill(stream);
+        available = stream->tail;
+    }
+    if(available == 0) {
+        return false;
+    }
+
+    const size_t used =
+        sonicmeter_record_decode(&stream->codec, stream->buffer + stream->head, available, sample);
+    if(used == 0) {
+        // Short of a whole record at the end the recording was cut, the recorder stopped mid way
+        if(available < SONICMETER_RECORD_SIZE_MAX) {
+            stream->truncated = true;
+        } else {
+            stream->malformed = true;
+        }
+        return false;
+    }
+    stream->head += used;
+    stream->bytes += used;
+    return true;
+}
+
+SonicMeterReplay* sonicmeter_replay_alloc(void) {
+    SonicMeterReplay* replay = malloc(sizeof(SonicMeterReplay));
+    for(uint32_t i = 0; i < SONICMETER_SAMPLE_SENSORS_MAX; i++) {
+        replay->filters[i] = sonicmeter_filter_alloc();
+    }
+    memset(&replay->diff, 0, sizeof(replay->diff));
+    return replay;
+}
+
+void sonicmeter_replay_free(SonicMeterReplay* replay) {
+    for(uint32_t i = 0; i < SONICMETER_SAMPLE_SENSORS_MAX; i++) {
+        sonicmeter_filter_free(replay->filters[i]);
+    }
+    free(replay);
+}
+
+/**
+ * @brief      Compare a replayed sample with its reference.
+ * @param      diff       Updated with the outcome.
+ * @param      replayed   The sample out of the processing.
+ * @param      reference  The sample it is compared with.
+ * @return     true if they agree.
+*/
+static bool sonicmeter_replay_compare(
+    SonicMeterReplayDiff* diff,
+    const SonicMeterSample* replayed,
+    const SonicMeterSample* reference) {
+    const uint32_t delta = replayed->filtered_um > reference->filtered_um ?
+                               replayed->filtered_um - reference->filtered_um :
+                               reference->filtered_um - replayed->filtered_um;
+    const bool match =
+        replayed->sequence == reference->sequence && replayed->sensor == reference->sensor &&
+        replayed->result == reference->result && delta == 0 &&
+        (replayed->flags & SonicMeterSampleFlagRejected) ==
+            (reference->flags & SonicMeterSampleFlagRejected);
+
+    diff->compared++;
+    diff->sum_diff_um += delta;
+    if(delta > diff->max_diff_um) {
+        diff->max_diff_um = delta;
+    }
+    if(!match) {
+        if(diff->mismatches == 0) {
+            diff->first_mismatch = replayed->sequence;
+        }
+        diff->mismatches++;
+    }
+    return match;
+}
+
+const SonicMeterReplayDiff* sonicmeter_replay_run(
+    SonicMeterReplay* replay,
+    const SonicMeterReplayConfig* config,
+    SonicMeterReplayStream* input,
+    uint32_t cpu_hz,
+    SonicMeterReplayStream* reference,
+    SonicMeterReplayCallback callback,
+    void* context) {
+    SonicMeterReplayDiff* diff = &replay->diff;
+    SonicMeterSample sample;
+    SonicMeterSample expected;
+    bool have_reference = true;
+
+    sonicmeter_pipeline_init(
+        &replay->pipeline, cpu_hz, config->temperature_c, config->max_range_cm);
+    for(uint32_t i = 0; i < SONICMETER_SAMPLE_SENSORS_MAX; i++) {
+        sonicmeter_filter_configure(replay->filters[i], &config->filter);
+        replay->filtered_um[i] = 0;
+    }
+    memset(diff, 0, sizeof(SonicMeterReplayDiff));
+
+    while(sonicmeter_replay_stream_next(input, &sample)) {
+        if(!reference) {
+            expected = sample;
+        } else if(have_reference) {
+            have_reference = sonicmeter_replay_stream_next(reference, &expected);
+        }
+
+        // Recorded samples are the ones out of the range check, rechecking them is harmless
+        sonicmeter_pipeline_convert(&replay->pipeline, &sample);
+        sonicmeter_pipeline_filter(
+            replay->filters[sample.sensor], &replay->filtered_um[sample.sensor], &sample);
+        diff->samples++;
+
+        const bool match = !have_reference || sonicmeter_replay_compare(diff, &sample, &expected);
+        if(callback) {
+            callback(&sample, have_reference ? &expected : NULL, match, context);
+        }
+    }
+
+    diff->bytes = input->bytes;
+    diff->truncated = input->truncated || (reference && reference->truncated);
+    diff->malformed = input->malformed || (reference && reference->malformed);
+    return diff;
+}
+
+/**
+ * @brief      Append the result, filtered distance and rejection of a sample.
+ * @param      t       The text.
+ * @param      sample  The sample.
+*/
+static void sonicmeter_replay_format_output(SonicMeterText* t, const SonicMeterSample* sample) {
+    if(sample->result <= SonicMeterCaptureResultLineHigh) {
+        sonicmeter_text_str(t, sonicmeter_replay_result_names[sample->result]);
+    } else {
+        sonicmeter_text_u32(t, sample->result);
+    }
+    sonicmeter_text_str(t, " ");
+    sonicmeter_text_u32(t, sample->filtered_um);
+    if(sample->flags & SonicMeterSampleFlagRejected) {
+        sonicmeter_text_str(t, " rejected");
+    }
+}
+
+void sonicmeter_replay_format_mismatch(
+    const SonicMeterSample* replayed,
+    const SonicMeterSample* reference,
+    char* buffer,
+    size_t size) {
+    SonicMeterText t;
+    sonicmeter_text_init(&t, buffer, size);
+
+    sonicmeter_text_str(&t, "#");
+    sonicmeter_text_u32(&t, replayed->sequence);
+    sonicmeter_text_str(&t, " s");
+    sonicmeter_text_u32(&t, replayed->sensor);
+    sonicmeter_text_str(&t, " ref ");
+    sonicmeter_replay_format_output(&t, reference);
+    sonicmeter_text_str(&t, " replay ");
+    sonicmeter_replay_format_output(&t, replayed);
+}
+
+void sonicmeter_replay_format_summary(
+    const SonicMeterReplayDiff* diff,
+    uint64_t elapsed_us,
+    char* buffer,
+    size_t size) {
+    SonicMeterText t;
+    sonicmeter_text_init(&t, buffer, size);
+
+    sonicmeter_text_str(&t, "samples ");
+    sonicmeter_text_u32(&t, diff->samples);
+    sonicmeter_text_str(&t, " kbytes ");
+    sonicmeter_text_u32(&t, diff->bytes / 1024);
+    sonicmeter_text_str(&t, " ms ");
+    sonicmeter_text_u32(&t, elapsed_us / 1000);
+    sonicmeter_text_str(&t, "\r\n");
+
+    // Bytes per microsecond are megabytes per second
+    sonicmeter_text_str(&t, "samples_s ");
+    if(elapsed_us) {
+        sonicmeter_text_u32(&t, (uint64_t)diff->samples * 1000000 / elapsed_us);
+        sonicmeter_text_str(&t, " mb_s ");
+        sonicmeter_text_fixed(&t, diff->bytes * 10 / elapsed_us, 1);
+    } else {
+        sonicmeter_text_str(&t, "- mb_s -");
+    }
+    sonicmeter_text_str(&t, "\r\n");
+
+    sonicmeter_text_str(&t, "compared ");
+    sonicmeter_text_u32(&t, diff->compared);
+    sonicmeter_text_str(&t, " mismatches ");
+    sonicmeter_text_u32(&t, diff->mismatches);
+    if(diff->mismatches) {
+        sonicmeter_text_str(&t, " first #");
+        sonicmeter_text_u32(&t, diff->first_mismatch);
+    }
+    sonicmeter_text_str(&t, "\r\n");
+
+    sonicmeter_text_str(&t, "diff_um max ");
+    sonicmeter_text_u32(&t, diff->max_diff_um);
+    sonicmeter_text_str(&t, " mean ");
+    if(diff->compared) {
+        sonicmeter_text_fixed(&t, diff->sum_diff_um * 10 / diff->compared, 1);
+    } else {
+        sonicmeter_text_str(&t, "-");
+    }
+    sonicmeter_text_str(&t, "\r\n");
+
+    if(diff->truncated) {
+        sonicmeter_text_str(&t, "truncated\r\n");
+    }
+    if(diff->malformed) {
+        sonicmeter_text_str(&t, "malformed\r\n");
+    }
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sonicmeter_pipeline.h"
+#include "sonicmeter_record.h"
+
+/**
+ * Recording replay.
+ *
+ * Runs the raw echo widths of a recording through the sample processing again, as fast as the
+ * data comes in, and compares the output with a reference: the filtered distances stored in the
+ * recording itself, or those of a second recording, such as an earlier replay. Conversion and
+ * filter settings can differ from those of the recording, that is what a replay is for.
+ *
+ * No HAL. The caller supplies the bytes through a read callback, the same code replays on the
+ * device from the SD card and on the host from a file.
+*/
+
+#define SONICMETER_REPLAY_BUFFER_SIZE 4096 // Bytes read at a time
+#define SONICMETER_REPLAY_SUMMARY_SIZE 256 // Room for the whole summary
+#define SONICMETER_REPLAY_LINE_SIZE 96 // Room for one mismatch line
+
+/**
+ * @brief      Callback reading the next bytes of a recording.
+ * @return     Bytes read, 0 at the end.
+*/
+typedef size_t (*SonicMeterReplayRead)(void* context, uint8_t* buffer, size_t size);
+
+typedef struct {
+    SonicMeterReplayRead read;
+    void* context;
+    SonicMeterRecordCodec codec;
+    uint8_t buffer[SONICMETER_REPLAY_BUFFER_SIZE];
+    size_t head; // Next byte to decode
+    size_t tail; // End of the bytes read
+    bool end; // The read callback has nothing more
+    bool truncated; // The recording ended in the middle of a record
+    bool malformed; // A record did not decode
+    uint64_t bytes; // Bytes decoded, header included
+} SonicMeterReplayStream;
+
+typedef struct {
+    int32_t temperature_c; // Air temperature of the conversion
+    uint32_t max_range_cm; // Range limit
+    SonicMeterFilterConfig filter; // Filter of every sensor
+} SonicMeterReplayConfig;
+
+typedef struct {
+    uint32_t samples; // Samples replayed
+    uint32_t compared; // Samples with a reference
+    uint32_t mismatches; // Samples whose result, filtered distance or rejection differs
+    uint32_t first_mismatch; // Sequence of the first mismatch
+    uint32_t max_diff_um; // Largest filtered distance difference
+    uint64_t sum_diff_um; // Sum of the filtered distance differences, for the mean
+    bool truncated; // A recording ended in the middle of a record
+    bool malformed; // A record did not decode, the recording was not replayed past it
+    uint64_t bytes; // Bytes of the replayed recording decoded
+} SonicMeterReplayDiff;
+
+/**
+ * @brief      Callback for a replayed sample.
+ * @param      replayed   The sample out of the processing.
+ * @param      reference  The sample it is compared with, NULL once the reference ran out.
+ * @param      match      The two agree.
+ * @param      context    The callback context.
+*/
+typedef void (*SonicMeterReplayCallback)(
+    const SonicMeterSample* replayed,
+    const SonicMeterSample* reference,
+    bool match,
+    void* context);
+
+typedef struct SonicMeterReplay SonicMeterReplay;
+
+/**
+ * @brief      Start reading a recording.
+ * @param      stream   The SonicMeterReplayStream object.
+ * @param      read     The read callback.
+ * @param      context  The read callback context.
+ * @param      header   Filled in with the header of the recording.
+ * @return     false if it is not a recording.
+*/
+bool sonicmeter_replay_stream_open(
+    SonicMeterReplayStream* stream,
+    SonicMeterReplayRead read,
+    void* context,
+    SonicMeterRecordHeader* header);
+
+/**
+ * @brief      Decode the next sample.
+ * @param      stream  The SonicMeterReplayStream object.
+ * @param      sample  Filled in with the sample.
+ * @return     false at the end of the recording, or at a record that does not decode.
+*/
+bool sonicmeter_replay_stream_next(SonicMeterReplayStream* stream, SonicMeterSample* sample);
+
+/**
+ * @brief      Allocate the replay.
+ * @return     SonicMeterReplay object.
+*/
+SonicMeterReplay* sonicmeter_replay_alloc(void);
+
+/**
+ * @brief      Free the replay.
+ * @param      replay  The SonicMeterReplay object.
+*/
+void sonicmeter_replay_free(SonicMeterReplay* replay);
+
+/**
+ * @brief      Replay a whole recording.
+ * @param      replay     The SonicMeterReplay object.
+ * @param      config     The processing to replay with.
+ * @param      input      The recording, opened.
+ * @param      cpu_hz     Unit of the echo widths, from the header of the recording.
+ * @param      reference  The reference recording, opened, NULL to compare with the input itself.
+ * @param      callback   Called for every sample, can be NULL.
+ * @param      context    The callback context.
+ * @return     What differs, valid until the next replay.
+*/
+const SonicMeterReplayDiff* sonicmeter_replay_run(
+    SonicMeterReplay* replay,
+    const SonicMeterReplayConfig* config,
+    SonicMeterReplayStream* input,
+    uint32_t cpu_hz,
+    SonicMeterReplayStream* reference,
+    SonicMeterReplayCallback callback,
+    void* context);
+
+/**
+ * @brief      Format a mismatch.
+ * @details    Sequence, sensor, then result, filtered distance and rejection of the reference and
+ *             of the replay. No line ending.
+ * @param      replayed   The sample out of the processing.
+ * @param      reference  The sample it was compared with.
+ * @param      buffer     The buffer, SONICMETER_REPLAY_LINE_SIZE is always enough.
+ * @param      size       The size of the buffer.
+*/
+void sonicmeter_replay_format_mismatch(
+    const SonicMeterSample* replayed,
+    const SonicMeterSample* reference,
+    char* buffer,
+    size_t size);
+
+/**
+ * @brief      Format the summary of a replay.
+ * @details    Samples and throughput, then the mismatch count and the filtered distance
+ *             differences. Lines end in CR LF.
+ * @param      diff        The outcome of the replay.
+ * @param      elapsed_us  Time the replay took.
+ * @param      buffer      The buffer, SONICMETER_REPLAY_SUMMARY_SIZE is always enough.
+ * @param      size        The size of the buffer.
+*/
+void sonicmeter_replay_format_summary(
+    const SonicMeterReplayDiff* diff,
+    uint64_t elapsed_us,
+    char* buffer,
+    size_t size);
@@ -0,0 +1,65 @@
+#include "sonicmeter_ring.h"
+
+#include <stdlib.h>
+
+SonicMeterRing* sonicmeter_ring_alloc(SonicMeterArena* arena, size_t capacity) {
+    // Power of two, so the slot index is a mask of the free running counters
+    if(capacity < 2 || (capacity & (capacity - 1)) != 0) {
+        abort();
+    }
+
+    SonicMeterRing* ring = malloc(sizeof(SonicMeterRing));
+    ring->slots = sonicmeter_arena_take(arena, sizeof(SonicMeterSample) * capacity);
+    ring->mask = capacity - 1;
+    atomic_init(&ring->head, 0);
+    return ring;
+}
+
+void sonicmeter_ring_free(SonicMeterRing* ring) {
+    free(ring);
+}
+
+void sonicmeter_ring_write(SonicMeterRing* ring, const SonicMeterSample* sample) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring->slots[head & ring->mask] = *sample;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void sonicmeter_ring_reader_init(SonicMeterRing* ring, SonicMeterRingReader* reader) {
+    reader->tail = atomic_load_explicit(&ring->head, memory_order_acquire);
+    reader->dropped = 0;
+}
+
+bool sonicmeter_ring_read(
+    SonicMeterRing* ring,
+    SonicMeterRingReader* reader,
+    SonicMeterSample* sample) {
+    const uint32_t capacity = ring->mask + 1;
+
+    while(true) {
+        uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if(head == reader->tail) {
+            return false;
+        }
+
+        // The slot of index head may be in the middle of a write, so only capacity - 1 samples
+        // behind head are safe to read.
+        if(head - reader->tail >= capacity) {
+            uint32_t oldest = head - capacity + 1;
+            reader->dropped += oldest - reader->tail;
+            reader->tail = oldest;
+        }
+
+        *sample = ring->slots[reader->tail & ring->mask];
+
+        // If the producer got around to this slot while we were copying, the copy may be torn
+        atomic_thread_fence(memory_order_acquire);
+        head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        if(head - reader->tail >= capacity) {
+            continue;
+        }
+
+        reader->tail++;
+        return true;
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include "sonicmeter_arena.h"
+#include "sonicmeter_sample.h"
+
+/**
+ * Lock-free sample ring.
+ *
+ * One producer, any number of readers. Each reader keeps its own position, so every consumer
+ * drains the ring at its own pace. The producer never waits: a reader that falls more than a ring
+ * behind skips the samples that were overwritten and counts them as dropped. The ring only depends
+ * on C11 atomics, its slots come from an arena.
+*/
+
+typedef struct {
+    SonicMeterSample* slots;
+    uint32_t mask; // Capacity - 1, capacity is a power of two
+    atomic_uint_fast32_t head; // Number of samples ever written
+} SonicMeterRing;
+
+typedef struct {
+    uint32_t tail; // Number of samples consumed or dropped by this reader
+    uint32_t dropped; // Samples this reader lost to overwrites
+} SonicMeterRingReader;
+
+/**
+ * @brief      Allocate a ring.
+ * @param      arena     The arena the slots come from.
+ * @param      capacity  Number of samples, must be a power of two.
+ * @return     SonicMeterRing object.
+*/
+SonicMeterRing* sonicmeter_ring_alloc(SonicMeterArena* arena, size_t capacity);
+
+/**
+ * @brief      Free a ring.
+ * @details    The slots stay with the arena.
+ * @param      ring  The SonicMeterRing object.
+*/
+void sonicmeter_ring_free(SonicMeterRing* ring);
+
+/**
+ * @brief      Publish a sample, overwriting the oldest one when full.
+ * @details    Must only be called from the producer thread.
+ * @param      ring    The SonicMeterRing object.
+ * @param      sample  The sample to publish.
+*/
+void sonicmeter_ring_write(SonicMeterRing* ring, const SonicMeterSample* sample);
+
+/**
+ * @brief      Start a reader at the current head, skipping everything already written.
+ * @param      ring    The SonicMeterRing object.
+ * @param      reader  The reader to initialize.
+*/
+void sonicmeter_ring_reader_init(SonicMeterRing* ring, SonicMeterRingReader* reader);
+
+/**
+ * @brief      Read the next sample for a reader.
+ * @param      ring    The SonicMeterRing object.
+ * @param      reader  The reader.
+ * @param      sample  Where to copy the sample.
+ * @return     true if a sample was read, false if the reader is caught up.
+*/
+bool sonicmeter_ring_read(
+    SonicMeterRing* ring,
+    SonicMeterRingReader* reader,
+    SonicMeterSample* sample);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sonicmeter_capture.h"
+
+typedef enum {
+    SonicMeterSampleFlagRejected = (1 << 0), // The outlier gate dropped this distance
+    SonicMeterSampleFlagAlarm = (1 << 1), // The alarm of the sensor is raised after this sample
+} SonicMeterSampleFlag;
+
+#define SONICMETER_SAMPLE_SENSORS_MAX 4 // Sensors one worker can drive
+#define SONICMETER_SAMPLE_TIMESTAMP_HZ 1000000 // Unit of the timestamps, microseconds
+
+/**
+ * A single measurement as produced by the worker.
+*/
+typedef struct {
+    uint32_t sequence; // Sample number since the worker started, counting all sensors
+    uint32_t sensor; // Index of the sensor that took the sample
+    uint64_t timestamp; // Trigger time since the worker started, microseconds
+    uint32_t ticks; // Echo pulse width in CPU ticks, 0 if the capture failed
+    uint32_t echo_us; // Echo pulse width in microseconds
+    uint32_t distance_um; // Distance to the object, micrometers
+    uint32_t filtered_um; // Filter output, held at the last value when the sample is not used
+    uint32_t flags; // SonicMeterSampleFlag bits
+    SonicMeterCaptureResult result; // The capture result
+    uint32_t spurious_edges; // Edges the capture did not expect, since the worker started
+} SonicMeterSample;
@@ -0,0 +1,77 @@
+#include "sonicmeter_schedule.h"
+
+void sonicmeter_clock_init(SonicMeterClock* clock, uint32_t cpu_hz, uint32_t cycles) {
+    clock->cycles_per_us = cpu_hz / 1000000;
+    clock->last_cycles = cycles;
+    clock->cycles = 0;
+}
+
+uint64_t sonicmeter_clock_update(SonicMeterClock* clock, uint32_t cycles) {
+    clock->cycles += cycles - clock->last_cycles;
+    clock->last_cycles = cycles;
+    return clock->cycles / clock->cycles_per_us;
+}
+
+void sonicmeter_schedule_fire(
+    uint64_t* due_us,
+    uint32_t period_us,
+    uint64_t target_us,
+    uint64_t now_us,
+    SonicMeterScheduleStats* stats) {
+    const uint64_t late_us = now_us > target_us ? now_us - target_us : 0;
+    stats->fired++;
+    stats->late_last_us = late_us > UINT32_MAX ? UINT32_MAX : late_us;
+    if(stats->late_last_us > stats->late_max_us) {
+        stats->late_max_us = stats->late_last_us;
+    }
+    stats->late_sum_us += late_us;
+
+    // The sensors taking turns is not lateness, the grid of this sensor starts over from there
+    const uint64_t base_us = target_us > *due_us ? target_us : *due_us;
+    uint64_t next_us = base_us + period_us;
+    if(next_us <= now_us) {
+        const uint64_t skipped = (now_us - base_us) / period_us;
+        next_us = base_us + (skipped + 1) * period_us;
+        stats->overruns++;
+        stats->skipped += skipped;
+    }
+    *due_us = next_us;
+}
+
+void sonicmeter_schedule_turns_init(
+    SonicMeterScheduleTurns* turns,
+    uint32_t count,
+    uint32_t period_us,
+    uint32_t stagger_us) {
+    turns->count = count;
+    turns->index = 0;
+    turns->period_us = period_us;
+    turns->stagger_us = stagger_us;
+    turns->quiet_us = 0;
+    for(uint32_t i = 0; i < SONICMETER_SAMPLE_SENSORS_MAX; i++) {
+        turns->due_us[i] = 0;
+    }
+}
+
+uint64_t sonicmeter_schedule_turns_get_target(const SonicMeterScheduleTurns* turns) {
+    const uint64_t due_us = turns->due_us[turns->index];
+    return due_us > turns->quiet_us ? due_us : turns->quiet_us;
+}
+
+void sonicmeter_schedule_turns_fire(
+    SonicMeterScheduleTurns* turns,
+    uint64_t target_us,
+    uint64_t now_us,
+    SonicMeterScheduleStats* stats) {
+    sonicmeter_schedule_fire(
+        &turns->due_us[turns->index], turns->period_us, target_us, now_us, stats);
+}
+
+void sonicmeter_schedule_turns_quiet(SonicMeterScheduleTurns* turns, uint64_t echo_us) {
+    turns->quiet_us = echo_us + turns->stagger_us;
+}
+
+uint32_t sonicmeter_schedule_turns_next(SonicMeterScheduleTurns* turns) {
+    turns->index = (turns->index + 1) % turns->count;
+    return turns->index;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdint.h>
+#include "sonicmeter_sample.h"
+
+/**
+ * Deadline scheduling.
+ *
+ * The triggers of a sensor are due on a fixed grid of absolute times, one period apart. A late
+ * trigger does not push the later ones back, so the rate holds over any length of run. A
+ * trigger so late that whole periods went by skips them instead of catching up in a burst.
+ *
+ * Several sensors take turns in a fixed order, one ping in the air at a time: the next one fires
+ * when it is due and the echo of the previous one is in, plus a stagger for the ping to die out.
+ *
+ * Time is in microseconds since start, extended from the 32 bit cycle counter. No HAL, the
+ * caller reads the counter.
+*/
+
+typedef struct {
+    uint32_t cycles_per_us;
+    uint32_t last_cycles; // Counter at the last update
+    uint64_t cycles; // Cycles since start, past any number of counter wraps
+} SonicMeterClock;
+
+typedef struct {
+    uint32_t fired; // Deadlines acted on
+    uint32_t late_last_us; // Deadline to trigger of the last one
+    uint32_t late_max_us; // The same, worst since start
+    uint64_t late_sum_us; // The same, summed for the mean
+    uint32_t overruns; // Deadlines missed by more than a period
+    uint32_t skipped; // Periods skipped by those
+} SonicMeterScheduleStats;
+
+typedef struct {
+    uint32_t count; // Sensors taking turns
+    uint32_t index; // Sensor whose turn it is
+    uint32_t period_us; // Time between two triggers of a sensor
+    uint32_t stagger_us; // Time from an echo to the next trigger of any sensor
+    uint64_t quiet_us; // No ping of any sensor in the air after this
+    uint64_t due_us[SONICMETER_SAMPLE_SENSORS_MAX]; // Next deadline of each sensor
+} SonicMeterScheduleTurns;
+
+/**
+ * @brief      Start the clock at 0.
+ * @param      clock   The SonicMeterClock object.
+ * @param      cpu_hz  Cycle counter frequency, a whole number of MHz.
+ * @param      cycles  Current cycle counter.
+*/
+void sonicmeter_clock_init(SonicMeterClock* clock, uint32_t cpu_hz, uint32_t cycles);
+
+/**
+ * @brief      Get the time.
+ * @details    Has to be called at least once per wrap of the counter, every 67 s at 64 MHz.
+ * @param      clock   The SonicMeterClock object.
+ * @param      cycles  Current cycle counter.
+ * @return     Microseconds since the clock was started.
+*/
+uint64_t sonicmeter_clock_update(SonicMeterClock* clock, uint32_t cycles);
+
+/**
+ * @brief      Account for a deadline and move on to the next one.
+ * @details    Lateness counts from the target, which is the deadline unless something else held
+ *             the trigger up past it. A held up trigger moves the grid along with it, a late one
+ *             does not.
+ * @param      due_us     The deadline, moved to the next one.
+ * @param      period_us  Time between two deadlines.
+ * @param      target_us  Time the trigger was meant to go out.
+ * @param      now_us     Time it went out.
+ * @param      stats      Updated with the lateness and the skipped periods.
+*/
+void sonicmeter_schedule_fire(
+    uint64_t* due_us,
+    uint32_t period_us,
+    uint64_t target_us,
+    uint64_t now_us,
+    SonicMeterScheduleStats* stats);
+
+/**
+ * @brief      Start the turns at the first sensor, every sensor due right away.
+ * @param      turns       The SonicMeterScheduleTurns object.
+ * @param      count       Sensors taking turns, 1 to SONICMETER_SAMPLE_SENSORS_MAX.
+ * @param      period_us   Time between two triggers of a sensor.
+ * @param      stagger_us  Time from an echo to the next trigger of any sensor.
+*/
+void sonicmeter_schedule_turns_init(
+    SonicMeterScheduleTurns* turns,
+    uint32_t count,
+    uint32_t period_us,
+    uint32_t stagger_us);
+
+/**
+ * @brief      Get when the sensor whose turn it is may fire.
+ * @param      turns  The SonicMeterScheduleTurns object.
+ * @return     Its deadline, or later if the last ping may still be in the air.
+*/
+uint64_t sonicmeter_schedule_turns_get_target(const SonicMeterScheduleTurns* turns);
+
+/**
+ * @brief      Account for the trigger of the sensor whose turn it is.
+ * @param      turns      The SonicMeterScheduleTurns object.
+ * @param      target_us  Time the trigger was meant to go out, from the get_target call.
+ * @param      now_us     Time it went out.
+ * @param      stats      Updated with the lateness and the skipped periods.
+*/
+void sonicmeter_schedule_turns_fire(
+    SonicMeterScheduleTurns* turns,
+    uint64_t target_us,
+    uint64_t now_us,
+    SonicMeterScheduleStats* stats);
+
+/**
+ * @brief      Hold the next trigger of any sensor until a ping died out.
+ * @param      turns    The SonicMeterScheduleTurns object.
+ * @param      echo_us  Time the echo came in, or the wait for it ended.
+*/
+void sonicmeter_schedule_turns_quiet(SonicMeterScheduleTurns* turns, uint64_t echo_us);
+
+/**
+ * @brief      Pass the turn to the next sensor.
+ * @param      turns  The SonicMeterScheduleTurns object.
+ * @return     The sensor whose turn it is now.
+*/
+uint32_t sonicmeter_schedule_turns_next(SonicMeterScheduleTurns* turns);
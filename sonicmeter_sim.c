@@ -0,0 +1,83 @@
+#include "sonicmeter_sim.h"
+
+// Script phases, milliseconds from the start of the script
+#define SONICMETER_SIM_RAMP_MS 20000 // 20 cm -> 300 cm -> 20 cm
+#define SONICMETER_SIM_FAR_MS 25000 // Beyond range
+#define SONICMETER_SIM_STUCK_MS 26000 // Echo line stuck high, still target afterwards
+
+#define SONICMETER_SIM_RAMP_NEAR_UM 200000
+#define SONICMETER_SIM_RAMP_FAR_UM 3000000
+#define SONICMETER_SIM_FAR_UM 5000000
+#define SONICMETER_SIM_STILL_UM 1000000
+
+#define SONICMETER_SIM_NOISE_UM 2000 // Peak noise, triangular distribution
+#define SONICMETER_SIM_MISSING_PER_MILLE 20 // Echoes that never arrive
+#define SONICMETER_SIM_GLITCH_PER_MILLE 10 // Echoes preceded by glitches
+#define SONICMETER_SIM_GLITCH_MAX 3 // Glitches on the line at most
+
+// Eight 40 kHz cycles of ping plus the sensor's own processing
+#define SONICMETER_SIM_RISE_US 450
+
+/**
+ * @brief      Next random number.
+ * @details    Numerical Recipes LCG, only the upper bits are used.
+ * @param      sim   The SonicMeterSim object.
+ * @return     16 random bits.
+*/
+static uint32_t sonicmeter_sim_random(SonicMeterSim* sim) {
+    sim->seed = sim->seed * 1664525U + 1013904223U;
+    return sim->seed >> 16;
+}
+
+static uint32_t sonicmeter_sim_random_below(SonicMeterSim* sim, uint32_t n) {
+    return (sonicmeter_sim_random(sim) * n) >> 16;
+}
+
+void sonicmeter_sim_init(SonicMeterSim* sim, uint32_t cpu_hz, uint32_t seed, uint32_t start_ms) {
+    sonicmeter_convert_init(&sim->convert, cpu_hz, SONICMETER_CONVERT_TEMPERATURE_DEFAULT);
+    sim->rise_ticks = (uint32_t)((uint64_t)cpu_hz * SONICMETER_SIM_RISE_US / 1000000);
+    sim->start_ms = start_ms;
+    sim->seed = seed;
+}
+
+void sonicmeter_sim_next(SonicMeterSim* sim, uint32_t now_ms, SonicMeterSimEcho* echo) {
+    const uint32_t t = (now_ms - sim->start_ms) % SONICMETER_SIM_SCRIPT_MS;
+
+    echo->line_high = false;
+    echo->glitches = 0;
+    echo->rise_ticks = 0;
+    echo->width_ticks = 0;
+
+    if(t < SONICMETER_SIM_RAMP_MS) {
+        const uint32_t half = SONICMETER_SIM_RAMP_MS / 2;
+        const uint32_t phase = t < half ? t : SONICMETER_SIM_RAMP_MS - t;
+        echo->distance_um =
+            SONICMETER_SIM_RAMP_NEAR_UM +
+            (uint32_t)((uint64_t)(SONICMETER_SIM_RAMP_FAR_UM - SONICMETER_SIM_RAMP_NEAR_UM) *
+                       phase / half);
+    } else if(t < SONICMETER_SIM_FAR_MS) {
+        echo->distance_um = SONICMETER_SIM_FAR_UM;
+    } else if(t < SONICMETER_SIM_STUCK_MS) {
+        echo->distance_um = 0;
+        echo->line_high = true;
+        return;
+    } else {
+        echo->distance_um = SONICMETER_SIM_STILL_UM;
+    }
+
+    if(sonicmeter_sim_random_below(sim, 1000) < SONICMETER_SIM_MISSING_PER_MILLE) {
+        return;
+    }
+    if(sonicmeter_sim_random_below(sim, 1000) < SONICMETER_SIM_GLITCH_PER_MILLE) {
+        echo->glitches = 1 + sonicmeter_sim_random_below(sim, SONICMETER_SIM_GLITCH_MAX);
+    }
+
+    // Sum of two uniform values, more likely close to the target than far off
+    const int32_t noise = (int32_t)sonicmeter_sim_random_below(sim, SONICMETER_SIM_NOISE_UM + 1) +
+                          (int32_t)sonicmeter_sim_random_below(sim, SONICMETER_SIM_NOISE_UM + 1) -
+                          SONICMETER_SIM_NOISE_UM;
+    const uint32_t distance_um = (uint32_t)((int32_t)echo->distance_um + noise);
+
+    echo->rise_ticks = sim->rise_ticks;
+    echo->width_ticks = sonicmeter_convert_um_to_ticks(&sim->convert, distance_um);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sonicmeter_convert.h"
+
+/**
+ * Simulated HC-SR04.
+ *
+ * Generates the echo an HC-SR04 would produce for a scripted target, without touching any HAL.
+ * The script repeats every SONICMETER_SIM_SCRIPT_MS:
+ *  - a target ramping from 20 cm out to 300 cm and back, with a few millimeters of noise
+ *  - a target beyond 4 m, the echo is longer than any range setting allows
+ *  - the echo line stuck high, as if the sensor locked up
+ *  - a still target at 1 m
+ * Throughout the script some echoes go missing and some are preceded by glitches on the line.
+ * The sequence only depends on the seed and the time, so runs are reproducible.
+*/
+
+#define SONICMETER_SIM_SCRIPT_MS 30000 // Length of the script, it repeats after that
+
+typedef struct {
+    bool line_high; // The echo line is high already when the capture is armed
+    uint32_t glitches; // Spurious edges on the line before the echo
+    uint32_t rise_ticks; // Time from the trigger to the rising edge, CPU ticks, 0 if no echo
+    uint32_t width_ticks; // Echo pulse width, CPU ticks, 0 if no echo
+    uint32_t distance_um; // Scripted distance, before noise
+} SonicMeterSimEcho;
+
+typedef struct {
+    SonicMeterConvert convert; // Air of the simulation, default temperature
+    uint32_t rise_ticks; // Trigger to echo delay of the sensor
+    uint32_t start_ms; // Start of the script
+    uint32_t seed; // Random state
+} SonicMeterSim;
+
+/**
+ * @brief      Start the script.
+ * @param      sim       The SonicMeterSim object.
+ * @param      cpu_hz    CPU clock, the echo is produced in CPU ticks.
+ * @param      seed      Seed of the random noise, missing echoes and glitches.
+ * @param      start_ms  Current time, the script starts here.
+*/
+void sonicmeter_sim_init(SonicMeterSim* sim, uint32_t cpu_hz, uint32_t seed, uint32_t start_ms);
+
+/**
+ * @brief      Produce the echo for a trigger.
+ * @param      sim      The SonicMeterSim object.
+ * @param      now_ms   Time of the trigger.
+ * @param      echo     Filled in with the echo.
+*/
+void sonicmeter_sim_next(SonicMeterSim* sim, uint32_t now_ms, SonicMeterSimEcho* echo);
@@ -0,0 +1,41 @@
+#include "sonicmeter_snapshot.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Set in middle when the writer put a copy there the reader has not taken yet
+#define SONICMETER_SNAPSHOT_FRESH 0x4U
+#define SONICMETER_SNAPSHOT_INDEX 0x3U
+
+SonicMeterSnapshot* sonicmeter_snapshot_alloc(SonicMeterArena* arena, size_t size) {
+    SonicMeterSnapshot* snapshot = malloc(sizeof(SonicMeterSnapshot));
+    snapshot->buffers = sonicmeter_arena_take(arena, 3 * size);
+    snapshot->size = size;
+    snapshot->back = 0;
+    atomic_init(&snapshot->middle, 1);
+    snapshot->front = 2;
+    return snapshot;
+}
+
+void sonicmeter_snapshot_free(SonicMeterSnapshot* snapshot) {
+    free(snapshot);
+}
+
+void sonicmeter_snapshot_publish(SonicMeterSnapshot* snapshot, const void* value) {
+    memcpy(snapshot->buffers + snapshot->back * snapshot->size, value, snapshot->size);
+
+    // Release makes the copy visible before its index, acquire takes over whatever the reader
+    // left in the middle
+    const uint32_t previous = atomic_exchange_explicit(
+        &snapshot->middle, snapshot->back | SONICMETER_SNAPSHOT_FRESH, memory_order_acq_rel);
+    snapshot->back = previous & SONICMETER_SNAPSHOT_INDEX;
+}
+
+const void* sonicmeter_snapshot_read(SonicMeterSnapshot* snapshot) {
+    if(atomic_load_explicit(&snapshot->middle, memory_order_relaxed) & SONICMETER_SNAPSHOT_FRESH) {
+        const uint32_t previous =
+            atomic_exchange_explicit(&snapshot->middle, snapshot->front, memory_order_acq_rel);
+        snapshot->front = previous & SONICMETER_SNAPSHOT_INDEX;
+    }
+    return snapshot->buffers + snapshot->front * snapshot->size;
+}
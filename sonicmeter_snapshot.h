@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sonicmeter_arena.h"
+
+/**
+ * Lock-free snapshot, triple buffered.
+ *
+ * One writer publishes whole copies of a value, one reader always gets the latest complete copy.
+ * The writer fills a back buffer and swaps it with the middle one, the reader swaps its front
+ * buffer with the middle one when a newer copy is there. Neither side ever waits or retries, which
+ * matters when the reader runs at a higher priority than the writer: a seqlock reader spinning on
+ * a preempted writer would never let it finish. Only depends on C11 atomics, the copies come from
+ * an arena.
+*/
+
+typedef struct {
+    uint8_t* buffers; // Three copies
+    size_t size; // Size of one copy
+    uint32_t back; // Written by the writer, owned by the writer
+    uint32_t front; // Read by the reader, owned by the reader
+    atomic_uint_fast32_t middle; // Index of the spare copy, plus SONICMETER_SNAPSHOT_FRESH
+} SonicMeterSnapshot;
+
+/**
+ * @brief      Allocate a snapshot.
+ * @details    All three copies start zeroed.
+ * @param      arena  The arena the copies come from, 3 * size of it.
+ * @param      size   Size of the value.
+ * @return     SonicMeterSnapshot object.
+*/
+SonicMeterSnapshot* sonicmeter_snapshot_alloc(SonicMeterArena* arena, size_t size);
+
+/**
+ * @brief      Free a snapshot.
+ * @details    The copies stay with the arena.
+ * @param      snapshot  The SonicMeterSnapshot object.
+*/
+void sonicmeter_snapshot_free(SonicMeterSnapshot* snapshot);
+
+/**
+ * @brief      Publish a new copy.
+ * @details    Must only be called from the writer thread.
+ * @param      snapshot  The SonicMeterSnapshot object.
+ * @param      value     The value, size bytes are copied.
+*/
+void sonicmeter_snapshot_publish(SonicMeterSnapshot* snapshot, const void* value);
+
+/**
+ * @brief      Get the latest published copy.
+ * @details    Must only be called from the reader thread. The copy stays valid and unchanged
+ *             until the next call.
+ * @param      snapshot  The SonicMeterSnapshot object.
+ * @return     The copy.
+*/
+const void* sonicmeter_snapshot_read(SonicMeterSnapshot* snapshot);
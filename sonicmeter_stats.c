@@ -0,0 +1,154 @@
+#include "sonicmeter_stats.h"
+#include "sonicmeter_memory.h"
+#include "sonicmeter_probe.h"
+
+#include <furi.h>
+#include <storage/storage.h>
+
+#define TAG "SonicMeterStats"
+
+// Export lines are collected up to this size before they go to the card
+#define SONICMETER_STATS_EXPORT_CHUNK 1024
+
+struct SonicMeterStats {
+    SonicMeterHistogram series[SonicMeterStatsSeriesCount];
+    uint64_t previous[SONICMETER_SAMPLE_SENSORS_MAX]; // Timestamp of the last sample of a sensor
+    uint32_t seen; // Sensors with a previous sample, one bit each
+};
+
+_Static_assert(
+    SONICMETER_ARENA_ROUND(sizeof(SonicMeterStats)) <= SONICMETER_MEMORY_STATS,
+    "Statistics over their memory budget");
+
+static const char* const sonicmeter_stats_names[SonicMeterStatsSeriesCount] = {
+    [SonicMeterStatsSeriesWidth] = "width_us",
+    [SonicMeterStatsSeriesDistance] = "distance_mm",
+    [SonicMeterStatsSeriesInterval] = "interval_ms",
+};
+
+// Percentiles of the summary, tenths of a percent
+static const uint32_t sonicmeter_stats_permille[] = {500, 990, 999};
+
+SonicMeterStats* sonicmeter_stats_alloc(SonicMeterArena* arena) {
+    SonicMeterStats* stats = sonicmeter_arena_take(arena, sizeof(SonicMeterStats));
+    sonicmeter_stats_reset(stats);
+    return stats;
+}
+
+void sonicmeter_stats_reset(SonicMeterStats* stats) {
+    for(uint32_t i = 0; i < SonicMeterStatsSeriesCount; i++) {
+        sonicmeter_histogram_reset(&stats->series[i]);
+    }
+    stats->seen = 0;
+}
+
+void sonicmeter_stats_push(SonicMeterStats* stats, const SonicMeterSample* sample) {
+    const uint32_t bit = 1U << sample->sensor;
+
+    if(stats->seen & bit) {
+        const uint64_t interval = sample->timestamp - stats->previous[sample->sensor];
+        const uint64_t interval_ms = interval / (SONICMETER_SAMPLE_TIMESTAMP_HZ / 1000);
+        sonicmeter_histogram_record(
+            &stats->series[SonicMeterStatsSeriesInterval],
+            interval_ms > UINT32_MAX ? UINT32_MAX : interval_ms);
+    }
+    stats->previous[sample->sensor] = sample->timestamp;
+    stats->seen |= bit;
+
+    if(sample->result == SonicMeterCaptureResultOk) {
+        sonicmeter_histogram_record(&stats->series[SonicMeterStatsSeriesWidth], sample->echo_us);
+        sonicmeter_histogram_record(
+            &stats->series[SonicMeterStatsSeriesDistance], sample->distance_um / 1000);
+    }
+}
+
+const SonicMeterHistogram*
+    sonicmeter_stats_get(const SonicMeterStats* stats, SonicMeterStatsSeries series) {
+    furi_assert(series < SonicMeterStatsSeriesCount);
+    return &stats->series[series];
+}
+
+const char* sonicmeter_stats_get_name(SonicMeterStatsSeries series) {
+    furi_assert(series < SonicMeterStatsSeriesCount);
+    return sonicmeter_stats_names[series];
+}
+
+/**
+ * @brief      Write the collected lines once there are enough of them.
+ * @param      file   The file.
+ * @param      lines  The lines, emptied once written.
+ * @param      force  Write whatever there is.
+ * @return     false on a short write.
+*/
+static bool sonicmeter_stats_flush(File* file, FuriString* lines, bool force) {
+    const size_t size = furi_string_size(lines);
+    if(size == 0 || (!force && size < SONICMETER_STATS_EXPORT_CHUNK)) {
+        return true;
+    }
+    const bool ok = storage_file_write(file, furi_string_get_cstr(lines), size) == size;
+    furi_string_reset(lines);
+    return ok;
+}
+
+bool sonicmeter_stats_export(const SonicMeterStats* stats, const char* path) {
+    Storage* storage = furi_record_open(RECORD_STORAGE);
+    File* file = storage_file_alloc(storage);
+    FuriString* lines = furi_string_alloc();
+    bool ok = storage_file_open(file, path, FSAM_WRITE, FSOM_CREATE_ALWAYS);
+
+    if(ok) {
+        furi_string_printf(lines, "series,count,min,p50,p99,p99.9,max,overflow\n");
+        for(uint32_t i = 0; i < SonicMeterStatsSeriesCount; i++) {
+            const SonicMeterHistogram* histogram = &stats->series[i];
+            uint32_t values[COUNT_OF(sonicmeter_stats_permille)];
+            sonicmeter_histogram_get_percentiles(
+                histogram, sonicmeter_stats_permille, values, COUNT_OF(values));
+            furi_string_cat_printf(
+                lines,
+                "%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n",
+                sonicmeter_stats_names[i],
+                histogram->total,
+                histogram->min,
+                values[0],
+                values[1],
+                values[2],
+                histogram->max,
+                histogram->overflow);
+        }
+
+        furi_string_cat_printf(lines, "\nseries,lower,upper,count\n");
+        for(uint32_t i = 0; i < SonicMeterStatsSeriesCount && ok; i++) {
+            const SonicMeterHistogram* histogram = &stats->series[i];
+            for(uint32_t index = 0; index < SONICMETER_HISTOGRAM_BUCKETS && ok; index++) {
+                if(histogram->counts[index] == 0) {
+                    continue;
+                }
+                uint32_t lower;
+                uint32_t upper;
+                sonicmeter_histogram_bucket_range(index, &lower, &upper);
+                furi_string_cat_printf(
+                    lines,
+                    "%s,%lu,%lu,%lu\n",
+                    sonicmeter_stats_names[i],
+                    lower,
+                    upper,
+                    histogram->counts[index]);
+                ok = sonicmeter_stats_flush(file, lines, false);
+            }
+        }
+#if SONICMETER_PROBES
+        furi_string_cat_str(lines, "\n");
+        sonicmeter_probe_cat_csv(lines, "\n");
+#endif
+        ok = ok && sonicmeter_stats_flush(file, lines, true);
+        storage_file_close(file);
+    }
+    if(!ok) {
+        FURI_LOG_E(TAG, "Failed to write %s", path);
+    }
+
+    furi_string_free(lines);
+    storage_file_free(file);
+    furi_record_close(RECORD_STORAGE);
+    return ok;
+}
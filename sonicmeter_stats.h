@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include "sonicmeter_arena.h"
+#include "sonicmeter_histogram.h"
+#include "sonicmeter_sample.h"
+
+/**
+ * Long run statistics.
+ *
+ * Histograms of the echo width, the distance and the time between two samples of the same
+ * sensor, over every sample since the last reset. Memory does not grow with the run, so a soak
+ * test can go for days. Pushed from the worker thread, read from anywhere: a reader may see a
+ * sample half way in, which only shifts a percentile by one sample.
+*/
+
+typedef enum {
+    SonicMeterStatsSeriesWidth, // Echo width of good captures, microseconds
+    SonicMeterStatsSeriesDistance, // Raw distance of good captures, millimeters
+    SonicMeterStatsSeriesInterval, // Time between two samples of a sensor, milliseconds
+    SonicMeterStatsSeriesCount,
+} SonicMeterStatsSeries;
+
+typedef struct SonicMeterStats SonicMeterStats;
+
+/**
+ * @brief      Allocate the statistics, empty.
+ * @details    Nothing to free, they go with the arena.
+ * @param      arena  The arena they come from.
+ * @return     SonicMeterStats object.
+*/
+SonicMeterStats* sonicmeter_stats_alloc(SonicMeterArena* arena);
+
+/**
+ * @brief      Clear every histogram.
+ * @param      stats  The SonicMeterStats object.
+*/
+void sonicmeter_stats_reset(SonicMeterStats* stats);
+
+/**
+ * @brief      Add a sample.
+ * @details    A few increments, cheap enough for the worker thread.
+ * @param      stats   The SonicMeterStats object.
+ * @param      sample  The sample.
+*/
+void sonicmeter_stats_push(SonicMeterStats* stats, const SonicMeterSample* sample);
+
+/**
+ * @brief      Get the histogram of a series.
+ * @param      stats   The SonicMeterStats object.
+ * @param      series  The series.
+ * @return     The histogram, valid for the lifetime of the statistics.
+*/
+const SonicMeterHistogram*
+    sonicmeter_stats_get(const SonicMeterStats* stats, SonicMeterStatsSeries series);
+
+/**
+ * @brief      Get the short name of a series, with its unit.
+ * @param      series  The series.
+ * @return     The name.
+*/
+const char* sonicmeter_stats_get_name(SonicMeterStatsSeries series);
+
+/**
+ * @brief      Write every histogram as CSV.
+ * @details    A summary first, one line per series with the count, min, p50, p99, p99.9, max and
+ *             overflow, then after a blank line every non-empty bucket: series, lower and upper
+ *             value, count. With the probes built in, the stage timings since the worker last
+ *             started follow after another blank line, as sonicmeter_probe_export writes them.
+ * @param      stats  The SonicMeterStats object.
+ * @param      path   The file to create.
+ * @return     false if the file could not be written.
+*/
+bool sonicmeter_stats_export(const SonicMeterStats* stats, const char* path);
@@ -0,0 +1,312 @@
+#include "sonicmeter_stream.h"
+#include "sonicmeter_record.h"
+#include "sonicmeter_memory.h"
+
+#include <furi_hal.h>
+
+#define TAG "SonicMeterStream"
+
+#define SONICMETER_STREAM_CDC_CHANNEL 1
+#define SONICMETER_STREAM_PACKET_SIZE 64
+#define SONICMETER_STREAM_PERIOD_MS 20 // Batching interval
+#define SONICMETER_STREAM_TX_TIMEOUT_MS 50 // A host that does not read for this long has stalled
+#define SONICMETER_STREAM_FRAME_HEADER_SIZE 9
+#define SONICMETER_STREAM_FRAME_SIZE_MAX                                          \
+    (SONICMETER_STREAM_FRAME_HEADER_SIZE +                                        \
+     SONICMETER_STREAM_BATCH_MAX * SONICMETER_RECORD_SIZE_MAX + 2)
+#define SONICMETER_STREAM_TEXT_LINE_MAX 72 // Every number at its largest, the timestamp 64 bit
+
+typedef enum {
+    SonicMeterStreamEventStop = (1 << 0),
+} SonicMeterStreamEvent;
+
+struct SonicMeterStream {
+    FuriThread* thread;
+    FuriSemaphore* tx_done; // Released when the IN endpoint is free again
+    FuriHalUsbInterface* usb_previous;
+    bool running;
+
+    SonicMeterRing* ring;
+    SonicMeterRingReader reader;
+    SonicMeterStreamFormat format;
+
+    uint16_t frame_sequence;
+    uint32_t dropped_pending; // Dropped samples not reported in a frame yet
+    volatile bool connected;
+    SonicMeterStreamStats stats;
+    uint8_t frame[SONICMETER_STREAM_FRAME_SIZE_MAX];
+};
+
+static uint16_t sonicmeter_stream_crc16(const uint8_t* data, size_t size) {
+    uint16_t crc = 0xFFFF;
+    for(size_t i = 0; i < size; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for(uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static void sonicmeter_stream_tx_callback(void* context) {
+    SonicMeterStream* stream = context;
+    furi_semaphore_release(stream->tx_done);
+}
+
+static void sonicmeter_stream_ctrl_line_callback(void* context, CdcCtrlLine state) {
+    SonicMeterStream* stream = context;
+    // The host sets DTR when it opens the port
+    stream->connected = state & CdcCtrlLineDTR;
+}
+
+static CdcCallbacks sonicmeter_stream_cdc_callbacks = {
+    .tx_ep_callback = sonicmeter_stream_tx_callback,
+    .rx_ep_callback = NULL,
+    .state_callback = NULL,
+    .ctrl_line_callback = sonicmeter_stream_ctrl_line_callback,
+    .config_callback = NULL,
+};
+
+/**
+ * @brief      Send a buffer, one USB packet at a time.
+ * @param      stream  The SonicMeterStream object.
+ * @param      data    The data.
+ * @param      size    The size.
+ * @return     false if the host stopped reading, the rest of the buffer is dropped.
+*/
+static bool sonicmeter_stream_send(SonicMeterStream* stream, uint8_t* data, size_t size) {
+    const uint32_t timeout = furi_ms_to_ticks(SONICMETER_STREAM_TX_TIMEOUT_MS);
+
+    while(size > 0) {
+        // The packet in flight is released by the TX callback once the host picks it up
+        if(furi_semaphore_acquire(stream->tx_done, timeout) != FuriStatusOk) {
+            return false;
+        }
+        const uint16_t chunk = MIN(size, (size_t)SONICMETER_STREAM_PACKET_SIZE);
+        furi_hal_cdc_send(SONICMETER_STREAM_CDC_CHANNEL, data, chunk);
+        stream->stats.bytes += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+/**
+ * @brief      Send a batch of samples as one binary frame.
+ * @param      stream   The SonicMeterStream object.
+ * @param      samples  The samples.
+ * @param      count    Number of samples.
+ * @return     false if the frame was dropped.
+*/
+static bool sonicmeter_stream_send_binary(
+    SonicMeterStream* stream,
+    const SonicMeterSample* samples,
+    size_t count) {
+    uint8_t* frame = stream->frame;
+    SonicMeterRecordCodec codec;
+    size_t payload = 0;
+
+    sonicmeter_record_codec_reset(&codec);
+    for(size_t i = 0; i < count; i++) {
+        payload += sonicmeter_record_encode(
+            &codec, &samples[i], frame + SONICMETER_STREAM_FRAME_HEADER_SIZE + payload);
+    }
+
+    const uint16_t dropped = MIN(stream->dropped_pending, 0xFFFFU);
+    frame[0] = SONICMETER_STREAM_SYNC_0;
+    frame[1] = SONICMETER_STREAM_SYNC_1;
+    frame[2] = stream->frame_sequence;
+    frame[3] = stream->frame_sequence >> 8;
+    frame[4] = dropped;
+    frame[5] = dropped >> 8;
+    frame[6] = count;
+    frame[7] = payload;
+    frame[8] = payload >> 8;
+
+    size_t size = SONICMETER_STREAM_FRAME_HEADER_SIZE + payload;
+    const uint16_t crc = sonicmeter_stream_crc16(frame + 2, size - 2);
+    frame[size++] = crc;
+    frame[size++] = crc >> 8;
+
+    stream->frame_sequence++;
+    if(!sonicmeter_stream_send(stream, frame, size)) {
+        return false;
+    }
+    stream->dropped_pending = 0;
+    stream->stats.frames++;
+    return true;
+}
+
+/**
+ * @brief      Send a batch of samples as text lines.
+ * @param      stream   The SonicMeterStream object.
+ * @param      samples  The samples.
+ * @param      count    Number of samples.
+ * @return     false if the batch was dropped.
+*/
+static bool sonicmeter_stream_send_text(
+    SonicMeterStream* stream,
+    const SonicMeterSample* samples,
+    size_t count) {
+    char* text = (char*)stream->frame;
+    size_t size = 0;
+
+    for(size_t i = 0; i < count; i++) {
+        const SonicMeterSample* sample = &samples[i];
+        size += snprintf(
+            text + size,
+            sizeof(stream->frame) - size,
+            "%lu,%llu,%lu,%lu,%u,%lu,%lu\n",
+            sample->sequence,
+            (unsigned long long)sample->timestamp,
+            sample->ticks,
+            sample->filtered_um,
+            sample->result,
+            sample->flags,
+            sample->sensor);
+    }
+
+    if(!sonicmeter_stream_send(stream, stream->frame, size)) {
+        return false;
+    }
+    stream->stats.frames++;
+    return true;
+}
+
+static int32_t sonicmeter_stream_thread(void* context) {
+    SonicMeterStream* stream = context;
+    SonicMeterSample batch[SONICMETER_STREAM_BATCH_MAX];
+    // Text lines are longer than binary records, keep a text batch within the frame buffer
+    const size_t batch_max = stream->format == SonicMeterStreamFormatText ?
+                                 sizeof(stream->frame) / SONICMETER_STREAM_TEXT_LINE_MAX :
+                                 SONICMETER_STREAM_BATCH_MAX;
+
+    while(true) {
+        uint32_t flags = furi_thread_flags_wait(
+            SonicMeterStreamEventStop,
+            FuriFlagWaitAny,
+            furi_ms_to_ticks(SONICMETER_STREAM_PERIOD_MS));
+        if(!(flags & FuriFlagError) && (flags & SonicMeterStreamEventStop)) {
+            break;
+        }
+
+        while(true) {
+            size_t count = 0;
+            uint32_t ring_dropped = stream->reader.dropped;
+            while(count < batch_max &&
+                  sonicmeter_ring_read(stream->ring, &stream->reader, &batch[count])) {
+                count++;
+            }
+            stream->dropped_pending += stream->reader.dropped - ring_dropped;
+            stream->stats.dropped += stream->reader.dropped - ring_dropped;
+            if(count == 0) {
+                break;
+            }
+
+            bool sent = false;
+            if(stream->connected) {
+                sent = stream->format == SonicMeterStreamFormatText ?
+                           sonicmeter_stream_send_text(stream, batch, count) :
+                           sonicmeter_stream_send_binary(stream, batch, count);
+            }
+            if(sent) {
+                stream->stats.samples += count;
+            } else {
+                stream->dropped_pending += count;
+                stream->stats.dropped += count;
+            }
+            stream->stats.connected = stream->connected;
+            sonicmeter_memory_mark_stack(SonicMeterMemoryThreadStream);
+        }
+    }
+
+    return 0;
+}
+
+SonicMeterStream* sonicmeter_stream_alloc(void) {
+    SonicMeterStream* stream = malloc(sizeof(SonicMeterStream));
+
+    stream->thread = furi_thread_alloc_ex(
+        "SonicMeterStream", SONICMETER_MEMORY_STACK_STREAM, sonicmeter_stream_thread, stream);
+    stream->tx_done = furi_semaphore_alloc(1, 1);
+    stream->running = false;
+    memset(&stream->stats, 0, sizeof(stream->stats));
+
+    return stream;
+}
+
+void sonicmeter_stream_free(SonicMeterStream* stream) {
+    furi_assert(!stream->running);
+
+    furi_semaphore_free(stream->tx_done);
+    furi_thread_free(stream->thread);
+    free(stream);
+}
+
+bool sonicmeter_stream_start(
+    SonicMeterStream* stream,
+    SonicMeterRing* ring,
+    SonicMeterStreamFormat format) {
+    furi_assert(!stream->running);
+
+    if(furi_hal_usb_is_locked()) {
+        FURI_LOG_W(TAG, "USB is locked");
+        return false;
+    }
+
+    stream->usb_previous = furi_hal_usb_get_config();
+    if(stream->usb_previous != &usb_cdc_dual &&
+       !furi_hal_usb_set_config(&usb_cdc_dual, NULL)) {
+        FURI_LOG_E(TAG, "Failed to switch USB to dual CDC");
+        return false;
+    }
+
+    stream->ring = ring;
+    stream->format = format;
+    stream->frame_sequence = 0;
+    stream->dropped_pending = 0;
+    stream->connected = false;
+    memset(&stream->stats, 0, sizeof(stream->stats));
+    sonicmeter_ring_reader_init(ring, &stream->reader);
+
+    // Drain a stale release so the first packet waits for a free endpoint only once
+    furi_semaphore_acquire(stream->tx_done, 0);
+    furi_semaphore_release(stream->tx_done);
+    furi_hal_cdc_set_callbacks(
+        SONICMETER_STREAM_CDC_CHANNEL, &sonicmeter_stream_cdc_callbacks, stream);
+
+    furi_thread_start(stream->thread);
+    stream->running = true;
+    return true;
+}
+
+void sonicmeter_stream_stop(SonicMeterStream* stream) {
+    if(!stream->running) {
+        return;
+    }
+
+    furi_thread_flags_set(furi_thread_get_id(stream->thread), SonicMeterStreamEventStop);
+    furi_thread_join(stream->thread);
+
+    furi_hal_cdc_set_callbacks(SONICMETER_STREAM_CDC_CHANNEL, NULL, NULL);
+    if(stream->usb_previous != &usb_cdc_dual) {
+        furi_hal_usb_set_config(stream->usb_previous, NULL);
+    }
+
+    stream->running = false;
+    FURI_LOG_I(
+        TAG,
+        "Streamed %lu samples in %lu frames, %lu dropped",
+        stream->stats.samples,
+        stream->stats.frames,
+        stream->stats.dropped);
+}
+
+bool sonicmeter_stream_is_running(SonicMeterStream* stream) {
+    return stream->running;
+}
+
+void sonicmeter_stream_get_stats(SonicMeterStream* stream, SonicMeterStreamStats* stats) {
+    *stats = stream->stats;
+    stats->connected = stream->connected;
+}
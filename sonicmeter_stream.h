@@ -0,0 +1,88 @@
+#pragma once
+
+#include <furi.h>
+#include "sonicmeter_ring.h"
+
+/**
+ * Live sample stream over the second USB CDC channel.
+ *
+ * The stream is one more reader of the worker ring, running on its own thread. It batches the
+ * samples into frames and sends them when the host drains the endpoint. If the host is not
+ * connected or not reading, frames are dropped and counted, the sampler never waits.
+ *
+ * Binary frame, little endian:
+ *  - 0xA5 0x5A sync
+ *  - u16 frame sequence
+ *  - u16 samples dropped since the previous frame, saturating
+ *  - u8  sample count
+ *  - u16 payload size
+ *  - payload, sonicmeter_record encoded samples, delta state reset at every frame, so the first
+ *    timestamp of a frame is absolute
+ *  - u16 CRC-16/CCITT-FALSE of everything after the sync
+ *
+ * Text: one "sequence,timestamp,ticks,filtered_um,result,flags,sensor" line per sample, the
+ * timestamp in microseconds.
+*/
+
+#define SONICMETER_STREAM_SYNC_0 0xA5
+#define SONICMETER_STREAM_SYNC_1 0x5A
+#define SONICMETER_STREAM_BATCH_MAX 16 // Samples per frame
+
+typedef enum {
+    SonicMeterStreamFormatBinary,
+    SonicMeterStreamFormatText,
+} SonicMeterStreamFormat;
+
+typedef struct {
+    uint32_t frames; // Frames handed to USB
+    uint32_t bytes; // Bytes handed to USB
+    uint32_t samples; // Samples sent
+    uint32_t dropped; // Samples lost to a slow or absent host, or to the ring
+    bool connected; // Host has the port open
+} SonicMeterStreamStats;
+
+typedef struct SonicMeterStream SonicMeterStream;
+
+/**
+ * @brief      Allocate the stream.
+ * @return     SonicMeterStream object.
+*/
+SonicMeterStream* sonicmeter_stream_alloc(void);
+
+/**
+ * @brief      Free the stream.
+ * @param      stream  The SonicMeterStream object, must be stopped.
+*/
+void sonicmeter_stream_free(SonicMeterStream* stream);
+
+/**
+ * @brief      Switch USB to dual CDC and start streaming samples from the ring.
+ * @param      stream  The SonicMeterStream object.
+ * @param      ring    The ring to read, must outlive the stream.
+ * @param      format  The wire format.
+ * @return     false if the USB configuration could not be changed.
+*/
+bool sonicmeter_stream_start(
+    SonicMeterStream* stream,
+    SonicMeterRing* ring,
+    SonicMeterStreamFormat format);
+
+/**
+ * @brief      Stop streaming and restore the previous USB configuration.
+ * @param      stream  The SonicMeterStream object.
+*/
+void sonicmeter_stream_stop(SonicMeterStream* stream);
+
+/**
+ * @brief      Check whether the stream is running.
+ * @param      stream  The SonicMeterStream object.
+ * @return     true if streaming.
+*/
+bool sonicmeter_stream_is_running(SonicMeterStream* stream);
+
+/**
+ * @brief      Get the stream statistics.
+ * @param      stream  The SonicMeterStream object.
+ * @param      stats   Filled in with the statistics.
+*/
+void sonicmeter_stream_get_stats(SonicMeterStream* stream, SonicMeterStreamStats* stats);
@@ -0,0 +1,86 @@
+#include "sonicmeter_text.h"
+
+static const uint32_t sonicmeter_text_pow10[] = {
+    1,
+    10,
+    100,
+    1000,
+    10000,
+    100000,
+    1000000,
+    10000000,
+    100000000,
+    1000000000,
+};
+
+static void sonicmeter_text_char(SonicMeterText* text, char c) {
+    if(text->length + 1 < text->size) {
+        text->buffer[text->length++] = c;
+        text->buffer[text->length] = '\0';
+    }
+}
+
+/**
+ * @brief      Append the digits of a number.
+ * @param      text    The SonicMeterText object.
+ * @param      value   The number.
+ * @param      digits  Minimum number of digits, zero padded.
+*/
+static void sonicmeter_text_digits(SonicMeterText* text, uint32_t value, uint32_t digits) {
+    char reversed[10];
+    uint32_t count = 0;
+
+    do {
+        reversed[count++] = '0' + value % 10;
+        value /= 10;
+    } while(value);
+    while(count < digits) {
+        reversed[count++] = '0';
+    }
+    while(count) {
+        sonicmeter_text_char(text, reversed[--count]);
+    }
+}
+
+void sonicmeter_text_init(SonicMeterText* text, char* buffer, size_t size) {
+    text->buffer = buffer;
+    text->size = size;
+    text->length = 0;
+    buffer[0] = '\0';
+}
+
+void sonicmeter_text_str(SonicMeterText* text, const char* str) {
+    while(*str) {
+        sonicmeter_text_char(text, *str++);
+    }
+}
+
+void sonicmeter_text_u32(SonicMeterText* text, uint32_t value) {
+    sonicmeter_text_digits(text, value, 1);
+}
+
+void sonicmeter_text_u64(SonicMeterText* text, uint64_t value) {
+    // In parts of nine digits, the digits themselves are done in 32 bits
+    const uint32_t low_scale = sonicmeter_text_pow10[9];
+    if(value <= UINT32_MAX) {
+        sonicmeter_text_digits(text, value, 1);
+        return;
+    }
+    const uint64_t high = value / low_scale;
+    sonicmeter_text_u64(text, high);
+    sonicmeter_text_digits(text, value - high * low_scale, 9);
+}
+
+void sonicmeter_text_fixed(SonicMeterText* text, uint32_t value, uint32_t decimals) {
+    if(decimals == 0) {
+        sonicmeter_text_digits(text, value, 1);
+        return;
+    }
+    if(decimals > 9) {
+        decimals = 9;
+    }
+    const uint32_t scale = sonicmeter_text_pow10[decimals];
+    sonicmeter_text_digits(text, value / scale, 1);
+    sonicmeter_text_char(text, '.');
+    sonicmeter_text_digits(text, value % scale, decimals);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Text formatting for the screen.
+ *
+ * Appends to a caller owned buffer with integer arithmetic only, no printf and no allocation.
+ * Output that does not fit is cut off, the buffer is always terminated.
+*/
+
+typedef struct {
+    char* buffer;
+    size_t size;
+    size_t length;
+} SonicMeterText;
+
+/**
+ * @brief      Start a text in a buffer.
+ * @param      text    The SonicMeterText object.
+ * @param      buffer  The buffer, must hold at least one character.
+ * @param      size    The size of the buffer.
+*/
+void sonicmeter_text_init(SonicMeterText* text, char* buffer, size_t size);
+
+/**
+ * @brief      Append a string.
+ * @param      text  The SonicMeterText object.
+ * @param      str   The string.
+*/
+void sonicmeter_text_str(SonicMeterText* text, const char* str);
+
+/**
+ * @brief      Append an unsigned number.
+ * @param      text   The SonicMeterText object.
+ * @param      value  The number.
+*/
+void sonicmeter_text_u32(SonicMeterText* text, uint32_t value);
+
+/**
+ * @brief      Append an unsigned 64 bit number.
+ * @param      text   The SonicMeterText object.
+ * @param      value  The number.
+*/
+void sonicmeter_text_u64(SonicMeterText* text, uint64_t value);
+
+/**
+ * @brief      Append a fixed point number.
+ * @details    sonicmeter_text_fixed(text, 12345, 2) appends "123.45".
+ * @param      text      The SonicMeterText object.
+ * @param      value     The number, scaled by 10^decimals.
+ * @param      decimals  Digits after the point, at most 9.
+*/
+void sonicmeter_text_fixed(SonicMeterText* text, uint32_t value, uint32_t decimals);
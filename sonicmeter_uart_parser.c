@@ -0,0 +1,64 @@
+#include "sonicmeter_uart_parser.h"
+
+#define SONICMETER_UART_PARSER_JSN_HEADER 0xFF
+
+void sonicmeter_uart_parser_init(SonicMeterUartParser* parser, SonicMeterUartProtocol protocol) {
+    parser->protocol = protocol;
+    parser->length = 0;
+    parser->bad_frames = 0;
+}
+
+void sonicmeter_uart_parser_reset(SonicMeterUartParser* parser) {
+    if(parser->length) {
+        parser->bad_frames++;
+        parser->length = 0;
+    }
+}
+
+/**
+ * @brief      Look for the next JSN header after a bad frame.
+ * @details    The header byte can also be a distance or checksum byte, so the bytes after the
+ *             first one are searched for another header instead of being thrown away.
+ * @param      parser  The SonicMeterUartParser object.
+*/
+static void sonicmeter_uart_parser_resync(SonicMeterUartParser* parser) {
+    uint8_t from = 1;
+    while(from < parser->length && parser->frame[from] != SONICMETER_UART_PARSER_JSN_HEADER) {
+        from++;
+    }
+    for(uint8_t i = from; i < parser->length; i++) {
+        parser->frame[i - from] = parser->frame[i];
+    }
+    parser->length -= from;
+    parser->bad_frames++;
+}
+
+bool sonicmeter_uart_parser_feed(SonicMeterUartParser* parser, uint8_t byte, uint32_t* mm) {
+    if(parser->protocol == SonicMeterUartProtocolUs100) {
+        parser->frame[parser->length++] = byte;
+        if(parser->length < 2) {
+            return false;
+        }
+        *mm = (uint32_t)parser->frame[0] << 8 | parser->frame[1];
+        parser->length = 0;
+        return true;
+    }
+
+    if(parser->length == 0 && byte != SONICMETER_UART_PARSER_JSN_HEADER) {
+        parser->bad_frames++;
+        return false;
+    }
+    parser->frame[parser->length++] = byte;
+    if(parser->length < 4) {
+        return false;
+    }
+
+    const uint8_t sum = parser->frame[0] + parser->frame[1] + parser->frame[2];
+    if(sum != parser->frame[3]) {
+        sonicmeter_uart_parser_resync(parser);
+        return false;
+    }
+    *mm = (uint32_t)parser->frame[1] << 8 | parser->frame[2];
+    parser->length = 0;
+    return true;
+}
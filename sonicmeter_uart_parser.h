@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Frame parser of serial mode ultrasonic sensors.
+ *
+ * Both supported modules measure when they receive SONICMETER_UART_PARSER_REQUEST and answer with
+ * the distance in millimeters. The US-100 sends the two bytes of the distance, big endian, with no
+ * framing at all, so the parser must be reset before every request. The JSN-SR04T and its A0x
+ * cousins send a 0xFF header, the distance, and a checksum, which lets the parser find the frame
+ * again after a lost byte. Pure byte handling, no HAL, so recorded byte streams can be replayed
+ * through it anywhere.
+*/
+
+#define SONICMETER_UART_PARSER_REQUEST 0x55 // Byte that starts a measurement
+#define SONICMETER_UART_PARSER_BAUD 9600 // Both modules
+
+typedef enum {
+    SonicMeterUartProtocolUs100, // High, low
+    SonicMeterUartProtocolJsn, // 0xFF, high, low, sum of the three
+} SonicMeterUartProtocol;
+
+typedef struct {
+    SonicMeterUartProtocol protocol;
+    uint8_t frame[4]; // Bytes of the frame so far
+    uint8_t length; // Number of bytes in frame
+    uint32_t bad_frames; // Bytes or frames thrown away, since init
+} SonicMeterUartParser;
+
+/**
+ * @brief      Initialize the parser.
+ * @param      parser    The SonicMeterUartParser object.
+ * @param      protocol  The protocol of the module.
+*/
+void sonicmeter_uart_parser_init(SonicMeterUartParser* parser, SonicMeterUartProtocol protocol);
+
+/**
+ * @brief      Drop a partial frame.
+ * @details    Called before every request, a byte that arrived late must not start the next frame.
+ *             A dropped partial frame counts as bad.
+ * @param      parser  The SonicMeterUartParser object.
+*/
+void sonicmeter_uart_parser_reset(SonicMeterUartParser* parser);
+
+/**
+ * @brief      Feed one received byte.
+ * @param      parser  The SonicMeterUartParser object.
+ * @param      byte    The byte.
+ * @param      mm      Set to the distance in millimeters when a frame completes.
+ * @return     true if this byte completed a valid frame.
+*/
+bool sonicmeter_uart_parser_feed(SonicMeterUartParser* parser, uint8_t byte, uint32_t* mm);
@@ -0,0 +1,66 @@
+#include "sonicmeter_velocity.h"
+
+void sonicmeter_velocity_reset(SonicMeterVelocity* velocity) {
+    velocity->head = 0;
+    velocity->count = 0;
+}
+
+void sonicmeter_velocity_add(
+    SonicMeterVelocity* velocity,
+    uint32_t timestamp_us,
+    uint32_t distance_um) {
+    if(velocity->count) {
+        const uint32_t last =
+            (velocity->head + velocity->count - 1) % SONICMETER_VELOCITY_POINTS;
+        if(timestamp_us - velocity->timestamp_us[last] > SONICMETER_VELOCITY_WINDOW_US) {
+            sonicmeter_velocity_reset(velocity);
+        }
+    }
+
+    if(velocity->count == SONICMETER_VELOCITY_POINTS) {
+        velocity->head = (velocity->head + 1) % SONICMETER_VELOCITY_POINTS;
+        velocity->count--;
+    }
+    const uint32_t slot = (velocity->head + velocity->count) % SONICMETER_VELOCITY_POINTS;
+    velocity->timestamp_us[slot] = timestamp_us;
+    velocity->distance_um[slot] = distance_um;
+    velocity->count++;
+
+    while(timestamp_us - velocity->timestamp_us[velocity->head] >
+          SONICMETER_VELOCITY_WINDOW_US) {
+        velocity->head = (velocity->head + 1) % SONICMETER_VELOCITY_POINTS;
+        velocity->count--;
+    }
+}
+
+bool sonicmeter_velocity_get(const SonicMeterVelocity* velocity, int32_t* mm_s) {
+    if(velocity->count < SONICMETER_VELOCITY_POINTS_MIN) {
+        return false;
+    }
+
+    // Relative to the oldest point, the sums stay well inside 64 bits
+    const uint32_t t0 = velocity->timestamp_us[velocity->head];
+    const uint32_t d0 = velocity->distance_um[velocity->head];
+    const int64_t n = velocity->count;
+    int64_t sum_t = 0;
+    int64_t sum_d = 0;
+    int64_t sum_tt = 0;
+    int64_t sum_td = 0;
+    for(uint32_t i = 0; i < velocity->count; i++) {
+        const uint32_t slot = (velocity->head + i) % SONICMETER_VELOCITY_POINTS;
+        const int64_t t = velocity->timestamp_us[slot] - t0;
+        const int64_t d = (int64_t)velocity->distance_um[slot] - d0;
+        sum_t += t;
+        sum_d += d;
+        sum_tt += t * t;
+        sum_td += t * d;
+    }
+
+    const int64_t denominator = n * sum_tt - sum_t * sum_t;
+    if(denominator == 0) {
+        return false;
+    }
+    // Micrometers per microsecond are meters per second
+    *mm_s = (n * sum_td - sum_t * sum_d) * 1000 / denominator;
+    return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Velocity estimate.
+ *
+ * Least squares slope of the distance over the last few good samples of a sensor, so a single
+ * noisy reading only tilts it a little. Points older than the window fall out, and a gap longer
+ * than the window starts over: the object may not be the same one any more. No HAL, the caller
+ * picks which samples count.
+*/
+
+#define SONICMETER_VELOCITY_POINTS 8 // Samples in the fit, at most
+#define SONICMETER_VELOCITY_POINTS_MIN 3 // Samples needed for an estimate
+#define SONICMETER_VELOCITY_WINDOW_US 2000000 // Oldest sample in the fit, behind the newest
+
+typedef struct {
+    uint32_t timestamp_us[SONICMETER_VELOCITY_POINTS];
+    uint32_t distance_um[SONICMETER_VELOCITY_POINTS];
+    uint32_t head; // Oldest point
+    uint32_t count; // Points in the fit
+} SonicMeterVelocity;
+
+/**
+ * @brief      Forget all points.
+ * @param      velocity  The SonicMeterVelocity object.
+*/
+void sonicmeter_velocity_reset(SonicMeterVelocity* velocity);
+
+/**
+ * @brief      Add a point.
+ * @param      velocity      The SonicMeterVelocity object.
+ * @param      timestamp_us  Sample timestamp, microseconds.
+ * @param      distance_um   Distance to the object.
+*/
+void sonicmeter_velocity_add(
+    SonicMeterVelocity* velocity,
+    uint32_t timestamp_us,
+    uint32_t distance_um);
+
+/**
+ * @brief      Get the estimate.
+ * @param      velocity  The SonicMeterVelocity object.
+ * @param      mm_s      Set to the speed in millimeters per second, negative when approaching.
+ * @return     false if there are too few points for an estimate.
+*/
+bool sonicmeter_velocity_get(const SonicMeterVelocity* velocity, int32_t* mm_s);
@@ -0,0 +1,570 @@
+#include "sonicmeter_worker.h"
+#include "sonicmeter_pipeline.h"
+#include "sonicmeter_schedule.h"
+#include "sonicmeter_hal.h"
+#include "sonicmeter_probe.h"
+#include "sonicmeter_memory.h"
+
+#define TAG "SonicMeterWorker"
+
+#define SONICMETER_WORKER_RING_SIZE 64
+
+_Static_assert(
+    SONICMETER_ARENA_ROUND(sizeof(SonicMeterSample) * SONICMETER_WORKER_RING_SIZE) <=
+        SONICMETER_MEMORY_RING,
+    "Sample ring over its memory budget");
+
+typedef enum {
+    SonicMeterWorkerEventStop = (1 << 0),
+    SonicMeterWorkerEventCaptureDone = (1 << 1),
+} SonicMeterWorkerEvent;
+
+#define SONICMETER_WORKER_EVENT_ALL \
+    (SonicMeterWorkerEventStop | SonicMeterWorkerEventCaptureDone)
+
+// Longest sleep in one go, the clock has to be read at least once per cycle counter wrap
+#define SONICMETER_WORKER_SLEEP_MAX_MS 10000
+
+typedef struct {
+    const SonicMeterDriver* driver;
+    void* driver_state; // Allocated while sampling
+    SonicMeterFilter* filter;
+    SonicMeterEchoBackend backend; // Backend in use, after falling back
+    uint32_t filtered_um; // Last filter output, held while captures fail
+    SonicMeterAlarm alarm;
+} SonicMeterWorkerSensorState;
+
+struct SonicMeterWorker {
+    FuriThread* thread;
+    SonicMeterRing* ring;
+    SonicMeterWorkerConfig config;
+    SonicMeterPipeline pipeline; // Conversion and range limit of max_range_cm
+    SonicMeterWorkerSensorState sensors[SONICMETER_SAMPLE_SENSORS_MAX];
+
+    uint32_t timeout_ms; // Time to wait for the echo to complete
+    uint32_t period_ms; // Effective time between two triggers of a sensor
+
+    bool rail_on; // The 5V rail is up, always when it comes from USB
+    uint32_t rail_on_at; // Tick the rail last came up
+    uint32_t rail_on_ticks; // Ticks the rail was up before that
+    uint32_t started_at; // Tick sampling started
+    uint32_t settle_ticks; // Measured sensor wake-up time, 0 until measured
+    SonicMeterWorkerPowerStats power;
+    SonicMeterClock clock; // Microseconds since sampling started
+    SonicMeterScheduleTurns turns; // Which sensor fires next, and when
+    SonicMeterScheduleStats schedule;
+
+    volatile uint32_t done_at; // Cycle counter when the driver reported the last reading
+    bool done; // The last reading was reported by the driver, done_at is valid
+    SonicMeterHalPin alarm_pin; // Resolved alarm output, when there is one
+    uint32_t alarm_raised; // Sensors whose alarm is raised, one bit each
+    FuriTimer* vibro_timer; // Ends the vibration
+    SonicMeterWorkerAlarmStats alarm;
+
+    SonicMeterWorkerCallback callback;
+    void* context;
+};
+
+/**
+ * @brief      Callback for a finished measurement.
+ * @details    Called from the driver interrupt, wakes up the worker thread.
+ * @param      context  The SonicMeterWorker object.
+*/
+static void sonicmeter_worker_capture_done_callback(void* context) {
+    SonicMeterWorker* worker = context;
+    worker->done_at = sonicmeter_hal_cycles();
+    furi_thread_flags_set(furi_thread_get_id(worker->thread), SonicMeterWorkerEventCaptureDone);
+}
+
+/**
+ * @brief      Sleep, waking up early only to stop.
+ * @param      ticks  Time to sleep.
+ * @return     false if the worker was asked to stop.
+*/
+static bool sonicmeter_worker_sleep(uint32_t ticks) {
+    uint32_t flags = furi_thread_flags_wait(SonicMeterWorkerEventStop, FuriFlagWaitAny, ticks);
+    return (flags & FuriFlagError) || !(flags & SonicMeterWorkerEventStop);
+}
+
+/**
+ * @brief      Get the time.
+ * @param      worker  The SonicMeterWorker object.
+ * @return     Microseconds since sampling started.
+*/
+static inline uint64_t sonicmeter_worker_now_us(SonicMeterWorker* worker) {
+    return sonicmeter_clock_update(&worker->clock, sonicmeter_hal_cycles());
+}
+
+/**
+ * @brief      Sleep until a deadline, waking up early only to stop.
+ * @details    Sleeps the whole kernel ticks and spins the rest on the cycle counter, a tick is
+ *             too coarse to hold a deadline to. Checks for a stop once even when the deadline has
+ *             already passed.
+ * @param      worker       The SonicMeterWorker object.
+ * @param      deadline_us  The deadline.
+ * @return     false if the worker was asked to stop.
+*/
+static bool sonicmeter_worker_wait_until(SonicMeterWorker* worker, uint64_t deadline_us) {
+    const uint32_t tick_us = 1000000 / furi_kernel_get_tick_frequency();
+    const uint32_t sleep_max = furi_ms_to_ticks(SONICMETER_WORKER_SLEEP_MAX_MS);
+    uint64_t now_us = sonicmeter_worker_now_us(worker);
+
+    // A sleep of n ticks ends on the n-th tick interrupt, at most n ticks later
+    while(deadline_us >= now_us + tick_us) {
+        if(!sonicmeter_worker_sleep(MIN((deadline_us - now_us) / tick_us, (uint64_t)sleep_max))) {
+            return false;
+        }
+        now_us = sonicmeter_worker_now_us(worker);
+    }
+    while(now_us < deadline_us) {
+        now_us = sonicmeter_worker_now_us(worker);
+    }
+    return sonicmeter_worker_sleep(0);
+}
+
+/**
+ * @brief      Take a reading from a sensor.
+ * @param      worker   The SonicMeterWorker object.
+ * @param      index    The sensor.
+ * @param      reading  Filled in with the reading.
+ * @return     false if the worker was asked to stop while waiting for the reading.
+*/
+static bool sonicmeter_worker_ping(
+    SonicMeterWorker* worker,
+    uint32_t index,
+    SonicMeterDriverReading* reading) {
+    SonicMeterWorkerSensorState* state = &worker->sensors[index];
+    bool running = true;
+
+    // Drop a completion left over from an expired measurement
+    furi_thread_flags_clear(SonicMeterWorkerEventCaptureDone);
+
+    worker->done = false;
+    if(state->driver->start(state->driver_state)) {
+        uint32_t flags = furi_thread_flags_wait(
+            SONICMETER_WORKER_EVENT_ALL,
+            FuriFlagWaitAny,
+            furi_ms_to_ticks(worker->timeout_ms) + 1);
+        if(!(flags & FuriFlagError) && (flags & SonicMeterWorkerEventStop)) {
+            running = false;
+        }
+        worker->done = !(flags & FuriFlagError) && (flags & SonicMeterWorkerEventCaptureDone);
+    }
+    state->driver->complete(state->driver_state, reading);
+
+    return running;
+}
+
+/**
+ * @brief      Callback for the vibro timer.
+ * @param      context  The SonicMeterWorker object.
+*/
+static void sonicmeter_worker_vibro_callback(void* context) {
+    UNUSED(context);
+    sonicmeter_hal_vibro(false);
+}
+
+/**
+ * @brief      Switch the alarm outputs.
+ * @details    The GPIO and the vibration motor go first, they are register writes, the time to
+ *             them is the alarm latency. The LED is an I2C transfer and comes after.
+ * @param      worker  The SonicMeterWorker object.
+ * @param      raise   true to raise the alarm, false to clear it.
+*/
+static void sonicmeter_worker_alarm_output(SonicMeterWorker* worker, bool raise) {
+    const SonicMeterWorkerAlarm* alarm = &worker->config.alarm;
+
+    if(alarm->pin) {
+        sonicmeter_hal_pin_write(&worker->alarm_pin, raise);
+    }
+    if(raise && (alarm->outputs & SonicMeterWorkerAlarmOutputVibro)) {
+        sonicmeter_hal_vibro(true);
+    }
+
+    if(raise) {
+        if(worker->done) {
+            const uint32_t cycles = sonicmeter_hal_cycles() - worker->done_at;
+            worker->alarm.last_us = cycles / furi_hal_cortex_instructions_per_microsecond();
+            worker->alarm.max_us = MAX(worker->alarm.max_us, worker->alarm.last_us);
+        }
+        worker->alarm.count++;
+    }
+
+    if(raise && (alarm->outputs & SonicMeterWorkerAlarmOutputVibro)) {
+        furi_timer_start(worker->vibro_timer, furi_ms_to_ticks(SONICMETER_WORKER_VIBRO_MS));
+    }
+    if(alarm->outputs & SonicMeterWorkerAlarmOutputLed) {
+        sonicmeter_hal_led(raise);
+    }
+    worker->alarm.raised = raise;
+}
+
+/**
+ * @brief      Feed a reading into the alarm of its sensor.
+ * @param      worker  The SonicMeterWorker object.
+ * @param      index   The sensor.
+ * @param      sample  The sample, flagged if the alarm of the sensor is raised.
+*/
+static void
+    sonicmeter_worker_alarm(SonicMeterWorker* worker, uint32_t index, SonicMeterSample* sample) {
+    SonicMeterWorkerSensorState* state = &worker->sensors[index];
+
+    const SonicMeterAlarmEvent event =
+        sonicmeter_alarm_process(&state->alarm, sample->result, sample->distance_um);
+    const uint32_t raised = worker->alarm_raised;
+    if(event == SonicMeterAlarmEventRaise) {
+        worker->alarm_raised |= 1U << index;
+    } else if(event == SonicMeterAlarmEventClear) {
+        worker->alarm_raised &= ~(1U << index);
+    }
+    if(!raised != !worker->alarm_raised) {
+        sonicmeter_worker_alarm_output(worker, worker->alarm_raised != 0);
+    }
+    if(sonicmeter_alarm_is_raised(&state->alarm)) {
+        sample->flags |= SonicMeterSampleFlagAlarm;
+    }
+}
+
+/**
+ * @brief      Take one measurement.
+ * @param      worker  The SonicMeterWorker object.
+ * @param      index   The sensor.
+ * @param      sample  Filled in with the result.
+ * @return     false if the worker was asked to stop while waiting for the echo.
+*/
+static bool
+    sonicmeter_worker_measure(SonicMeterWorker* worker, uint32_t index, SonicMeterSample* sample) {
+    SonicMeterWorkerSensorState* state = &worker->sensors[index];
+
+    SonicMeterDriverReading reading;
+    sample->timestamp = sonicmeter_worker_now_us(worker);
+    const bool running = sonicmeter_worker_ping(worker, index, &reading);
+
+    SONICMETER_PROBE_BEGIN(process_start);
+    sample->sensor = index;
+    sample->result = reading.result;
+    if(state->driver->capabilities & SonicMeterDriverCapabilityDistance) {
+        // Keep the echo width in the sample as if it had been timed, recordings store that
+        sample->ticks =
+            sonicmeter_convert_um_to_ticks(&worker->pipeline.convert, reading.distance_um);
+    } else {
+        sample->ticks = reading.ticks;
+    }
+    sonicmeter_pipeline_convert(&worker->pipeline, sample);
+    if(worker->config.alarm.enabled) {
+        sonicmeter_worker_alarm(worker, index, sample);
+    }
+    sonicmeter_pipeline_filter(state->filter, &state->filtered_um, sample);
+    sample->spurious_edges = reading.spurious;
+    SONICMETER_PROBE_END(SonicMeterProbeStageProcess, process_start);
+
+    return running;
+}
+
+/**
+ * @brief      Switch the 5V rail and account for the time it was up.
+ * @param      worker  The SonicMeterWorker object.
+ * @param      on      true to power the sensors.
+*/
+static void sonicmeter_worker_rail(SonicMeterWorker* worker, bool on) {
+    if(worker->power.external || worker->rail_on == on) {
+        return;
+    }
+
+    const uint32_t now = sonicmeter_hal_ticks();
+    if(on) {
+        worker->rail_on_at = now;
+    } else {
+        worker->rail_on_ticks += now - worker->rail_on_at;
+    }
+    sonicmeter_hal_sensor_power(on);
+    worker->rail_on = on;
+}
+
+/**
+ * @brief      Update the share of time the rail was up.
+ * @param      worker  The SonicMeterWorker object.
+*/
+static void sonicmeter_worker_update_duty(SonicMeterWorker* worker) {
+    const uint32_t now = sonicmeter_hal_ticks();
+    const uint32_t elapsed = now - worker->started_at;
+    uint32_t on_ticks = worker->rail_on_ticks;
+    if(worker->power.external) {
+        on_ticks = elapsed;
+    } else if(worker->rail_on) {
+        on_ticks += now - worker->rail_on_at;
+    }
+    worker->power.duty_permille = elapsed ? (uint64_t)on_ticks * 1000 / elapsed : 1000;
+}
+
+/**
+ * @brief      Wait for the sensors to wake up after the rail came up.
+ * @details    The first time, pings the first sensor until it answers and keeps the time that took
+ *             as the settle time. Later power ups just wait that long.
+ * @param      worker  The SonicMeterWorker object.
+ * @return     false if the worker was asked to stop.
+*/
+static bool sonicmeter_worker_settle(SonicMeterWorker* worker) {
+    if(worker->settle_ticks) {
+        return sonicmeter_worker_sleep(worker->settle_ticks);
+    }
+
+    const uint32_t on_at = sonicmeter_hal_ticks();
+    const uint32_t limit = furi_ms_to_ticks(SONICMETER_WORKER_SETTLE_MAX_MS);
+    SonicMeterDriverReading reading;
+    while(sonicmeter_hal_ticks() - on_at < limit) {
+        if(!sonicmeter_worker_ping(worker, 0, &reading)) {
+            return false;
+        }
+        if(reading.result == SonicMeterCaptureResultOk ||
+           reading.result == SonicMeterCaptureResultOutOfRange) {
+            break;
+        }
+        if(!sonicmeter_worker_sleep(furi_ms_to_ticks(SONICMETER_WORKER_SETTLE_STEP_MS))) {
+            return false;
+        }
+    }
+
+    worker->settle_ticks = MAX(sonicmeter_hal_ticks() - on_at, 1UL);
+    worker->power.settle_ms = worker->settle_ticks * 1000 / furi_kernel_get_tick_frequency();
+    FURI_LOG_I(TAG, "Sensor settles in %lu ms", worker->power.settle_ms);
+
+    // The ping that answered may still be in the air
+    return sonicmeter_worker_sleep(furi_ms_to_ticks(SONICMETER_WORKER_RECOVERY_MS));
+}
+
+static int32_t sonicmeter_worker_thread(void* context) {
+    SonicMeterWorker* worker = context;
+    SonicMeterSample sample = {0};
+    uint32_t index = 0;
+
+    FURI_LOG_I(TAG, "Start, %lu sensors", worker->config.sensor_count);
+
+    sonicmeter_schedule_turns_init(
+        &worker->turns,
+        worker->config.sensor_count,
+        worker->period_ms * 1000,
+        SONICMETER_WORKER_STAGGER_MS * 1000);
+    worker->started_at = sonicmeter_hal_ticks();
+
+    while(true) {
+        SonicMeterWorkerSensorState* state = &worker->sensors[index];
+
+        // Fire when this sensor is due and the previous ping has died out
+        uint64_t target_us = sonicmeter_schedule_turns_get_target(&worker->turns);
+        const uint64_t now_us = sonicmeter_worker_now_us(worker);
+        const uint64_t wait_us = target_us > now_us ? target_us - now_us : 0;
+        const uint64_t settle_us =
+            (uint64_t)worker->settle_ticks * 1000000 / furi_kernel_get_tick_frequency();
+
+        // Drop the rail for the wait unless it would have to come back up right away, and wake
+        // up early enough for the sensors to settle
+        if(worker->config.power == SonicMeterWorkerPowerDutyCycle && wait_us > settle_us) {
+            sonicmeter_worker_rail(worker, false);
+        }
+        sonicmeter_worker_update_duty(worker);
+        // Ahead of the wait, the stack scan does not hold up a trigger
+        sonicmeter_memory_mark_stack(SonicMeterMemoryThreadWorker);
+        if(!worker->rail_on) {
+            const bool measure_settle = worker->settle_ticks == 0;
+            if(!sonicmeter_worker_wait_until(worker, MAX(target_us, settle_us) - settle_us)) {
+                break;
+            }
+            sonicmeter_worker_rail(worker, true);
+            if(!sonicmeter_worker_settle(worker)) {
+                break;
+            }
+            // Measuring the wake-up time is not lateness, the sensor could not fire any earlier
+            if(measure_settle) {
+                target_us = MAX(target_us, sonicmeter_worker_now_us(worker));
+            }
+        }
+        if(!sonicmeter_worker_wait_until(worker, target_us)) {
+            break;
+        }
+
+        sonicmeter_schedule_turns_fire(
+            &worker->turns, target_us, sonicmeter_worker_now_us(worker), &worker->schedule);
+
+        // The simulated sensor does not need the 5V
+        if(sonicmeter_hal_sensor_powered() || state->backend == SonicMeterEchoBackendSim) {
+            if(!sonicmeter_worker_measure(worker, index, &sample)) {
+                break;
+            }
+            sonicmeter_schedule_turns_quiet(&worker->turns, sonicmeter_worker_now_us(worker));
+
+            SONICMETER_PROBE_BEGIN(publish_start);
+            sonicmeter_ring_write(worker->ring, &sample);
+            sample.sequence++;
+
+            if(worker->callback) {
+                worker->callback(&sample, worker->context);
+            }
+            SONICMETER_PROBE_END(SonicMeterProbeStagePublish, publish_start);
+        }
+
+        index = sonicmeter_schedule_turns_next(&worker->turns);
+    }
+
+    sonicmeter_worker_rail(worker, false);
+    if(worker->alarm_raised) {
+        sonicmeter_worker_alarm_output(worker, false);
+    }
+    FURI_LOG_I(TAG, "Stop");
+    return 0;
+}
+
+SonicMeterWorker* sonicmeter_worker_alloc(SonicMeterArena* arena) {
+    SonicMeterWorker* worker = malloc(sizeof(SonicMeterWorker));
+
+    worker->thread = furi_thread_alloc_ex(
+        "SonicMeterWorker", SONICMETER_MEMORY_STACK_WORKER, sonicmeter_worker_thread, worker);
+    furi_thread_set_priority(worker->thread, FuriThreadPriorityHigh);
+    worker->ring = sonicmeter_ring_alloc(arena, SONICMETER_WORKER_RING_SIZE);
+    worker->vibro_timer =
+        furi_timer_alloc(sonicmeter_worker_vibro_callback, FuriTimerTypeOnce, worker);
+    for(uint32_t i = 0; i < SONICMETER_SAMPLE_SENSORS_MAX; i++) {
+        worker->sensors[i].driver_state = NULL;
+        worker->sensors[i].filter = sonicmeter_filter_alloc();
+    }
+    worker->config.sensor_count = 0;
+    worker->callback = NULL;
+    worker->context = NULL;
+
+    return worker;
+}
+
+void sonicmeter_worker_free(SonicMeterWorker* worker) {
+    for(uint32_t i = 0; i < SONICMETER_SAMPLE_SENSORS_MAX; i++) {
+        sonicmeter_filter_free(worker->sensors[i].filter);
+    }
+    furi_timer_free(worker->vibro_timer);
+    sonicmeter_ring_free(worker->ring);
+    furi_thread_free(worker->thread);
+    free(worker);
+}
+
+void sonicmeter_worker_set_callback(
+    SonicMeterWorker* worker,
+    SonicMeterWorkerCallback callback,
+    void* context) {
+    worker->callback = callback;
+    worker->context = context;
+}
+
+/**
+ * @brief      Set up the driver of a sensor.
+ * @param      worker  The SonicMeterWorker object.
+ * @param      index   The sensor.
+*/
+static void sonicmeter_worker_sensor_start(SonicMeterWorker* worker, uint32_t index) {
+    const SonicMeterWorkerSensor* sensor = &worker->config.sensors[index];
+    SonicMeterWorkerSensorState* state = &worker->sensors[index];
+    const SonicMeterDriverConfig driver_config = {
+        .trigger_pin = sensor->trigger_pin,
+        .echo_pin = sensor->echo_pin,
+        .backend = worker->config.backend,
+        .callback = sonicmeter_worker_capture_done_callback,
+        .context = worker,
+    };
+
+    state->driver = sonicmeter_driver_get(worker->config.driver);
+    state->driver_state = state->driver->alloc();
+    state->backend = state->driver->init(state->driver_state, &driver_config);
+    if(state->backend != worker->config.backend) {
+        FURI_LOG_W(
+            TAG, "Capture backend %d unavailable on sensor %lu", worker->config.backend, index);
+    }
+
+    sonicmeter_filter_configure(state->filter, &worker->config.filter);
+    state->filtered_um = 0;
+    sonicmeter_alarm_init(&state->alarm, &worker->config.alarm.band);
+}
+
+SonicMeterEchoBackend
+    sonicmeter_worker_start(SonicMeterWorker* worker, const SonicMeterWorkerConfig* config) {
+    furi_check(config->sensor_count >= 1 && config->sensor_count <= SONICMETER_SAMPLE_SENSORS_MAX);
+    furi_check(
+        config->sensor_count == 1 ||
+        !(sonicmeter_driver_get(config->driver)->capabilities & SonicMeterDriverCapabilitySerial));
+    worker->config = *config;
+
+    sonicmeter_pipeline_init(
+        &worker->pipeline, SystemCoreClock, config->temperature_c, config->max_range_cm);
+
+    // Only wait as long as an echo from max range can take
+    worker->timeout_ms = sonicmeter_pipeline_get_timeout_ms(
+        &worker->pipeline, sonicmeter_driver_get(config->driver)->latency_ms);
+    worker->period_ms = MAX(config->period_ms, SONICMETER_WORKER_RECOVERY_MS);
+    worker->period_ms = MAX(worker->period_ms, worker->timeout_ms);
+
+    worker->power.external = sonicmeter_hal_sensor_power_external();
+    worker->power.settle_ms = 0;
+    worker->power.duty_permille = 0;
+    worker->rail_on = worker->power.external;
+    worker->rail_on_ticks = 0;
+    worker->settle_ticks = 0;
+    sonicmeter_clock_init(&worker->clock, SystemCoreClock, sonicmeter_hal_cycles());
+    memset(&worker->schedule, 0, sizeof(worker->schedule));
+
+    worker->alarm_raised = 0;
+    memset(&worker->alarm, 0, sizeof(worker->alarm));
+    if(config->alarm.enabled && config->alarm.pin) {
+        furi_hal_gpio_write(config->alarm.pin, false);
+        furi_hal_gpio_init(
+            config->alarm.pin, GpioModeOutputPushPull, GpioPullNo, GpioSpeedVeryHigh);
+        sonicmeter_hal_pin_init(&worker->alarm_pin, config->alarm.pin);
+    }
+
+#if SONICMETER_PROBES
+    sonicmeter_probe_reset();
+#endif
+    SONICMETER_PROBE_BEGIN(setup_start);
+    for(uint32_t i = 0; i < config->sensor_count; i++) {
+        sonicmeter_worker_sensor_start(worker, i);
+    }
+    SONICMETER_PROBE_END(SonicMeterProbeStageSetup, setup_start);
+
+    furi_thread_start(worker->thread);
+    return worker->sensors[0].backend;
+}
+
+void sonicmeter_worker_stop(SonicMeterWorker* worker) {
+    furi_thread_flags_set(furi_thread_get_id(worker->thread), SonicMeterWorkerEventStop);
+    furi_thread_join(worker->thread);
+
+    for(uint32_t i = 0; i < worker->config.sensor_count; i++) {
+        SonicMeterWorkerSensorState* state = &worker->sensors[i];
+        state->driver->deinit(state->driver_state);
+        state->driver->free(state->driver_state);
+        state->driver_state = NULL;
+    }
+
+    furi_timer_stop(worker->vibro_timer);
+    sonicmeter_hal_vibro(false);
+    if(worker->config.alarm.enabled && worker->config.alarm.pin) {
+        furi_hal_gpio_init(worker->config.alarm.pin, GpioModeInput, GpioPullNo, GpioSpeedLow);
+    }
+}
+
+void sonicmeter_worker_get_power_stats(
+    SonicMeterWorker* worker,
+    SonicMeterWorkerPowerStats* stats) {
+    *stats = worker->power;
+}
+
+void sonicmeter_worker_get_alarm_stats(
+    SonicMeterWorker* worker,
+    SonicMeterWorkerAlarmStats* stats) {
+    *stats = worker->alarm;
+}
+
+void sonicmeter_worker_get_schedule_stats(
+    SonicMeterWorker* worker,
+    SonicMeterScheduleStats* stats) {
+    *stats = worker->schedule;
+}
+
+SonicMeterRing* sonicmeter_worker_get_ring(SonicMeterWorker* worker) {
+    return worker->ring;
+}
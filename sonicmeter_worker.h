@@ -0,0 +1,177 @@
+#pragma once
+
+#include <furi_hal.h>
+#include "sonicmeter_driver.h"
+#include "sonicmeter_ring.h"
+#include "sonicmeter_filter.h"
+#include "sonicmeter_alarm.h"
+#include "sonicmeter_schedule.h"
+
+/**
+ * Measurement worker.
+ *
+ * Runs on its own thread: starts a measurement through the sensor driver, waits for the reading,
+ * converts it and publishes a SonicMeterSample into the ring. Consumers read the ring at their
+ * own pace and never hold up the next trigger.
+ *
+ * With several sensors only one ping is in the air at a time, so a sensor never hears another
+ * one's ping. The sensors take turns round-robin: the next one fires as soon as the previous
+ * echo is in, plus a short guard for the tail of the ping to die out. Each sensor's own recovery
+ * time runs while the others measure, so the aggregate rate grows with the number of sensors
+ * until the echoes themselves fill the time.
+ *
+ * The worker owns the 5V rail. It powers it up when sampling starts and, when duty cycling, only
+ * keeps it up around each round of measurements: the booster and the sensors are off while the
+ * thread sleeps, which is also when the MCU idles. The sensor wake-up time is measured on the
+ * first power up by pinging until an echo comes back.
+ *
+ * Triggers are scheduled on deadlines in microseconds off the cycle counter, so a late trigger
+ * does not shift the ones after it and the rate holds over long runs. The sample timestamps come
+ * from the same clock.
+ *
+ * The distance alarm is evaluated on the worker thread as soon as a reading is in, before the
+ * filter and the ring, and drives its outputs from there: the GUI only hears about it through the
+ * sample flags. Every sensor has its own alarm, the outputs are on while any of them is raised.
+*/
+
+typedef enum {
+    SonicMeterWorkerPowerAlwaysOn, // 5V stays up from start to stop
+    SonicMeterWorkerPowerDutyCycle, // 5V is switched off between rounds
+} SonicMeterWorkerPower;
+
+typedef enum {
+    SonicMeterWorkerAlarmOutputVibro = (1 << 0), // Vibrate for SONICMETER_WORKER_VIBRO_MS
+    SonicMeterWorkerAlarmOutputLed = (1 << 1), // Red LED on while raised
+} SonicMeterWorkerAlarmOutput;
+
+typedef struct {
+    bool enabled;
+    SonicMeterAlarmConfig band; // Thresholds, hysteresis and debounce of every sensor
+    uint32_t outputs; // SonicMeterWorkerAlarmOutput bits
+    const GpioPin* pin; // Driven high while raised, NULL for none
+} SonicMeterWorkerAlarm;
+
+typedef struct {
+    const GpioPin* trigger_pin; // Unused by serial drivers
+    const GpioPin* echo_pin; // Each sensor needs its own EXTI line, PB3 and PC3 share one
+} SonicMeterWorkerSensor;
+
+typedef struct {
+    SonicMeterWorkerSensor sensors[SONICMETER_SAMPLE_SENSORS_MAX];
+    uint32_t sensor_count; // 1 for serial drivers
+    SonicMeterDriverType driver; // Driver of all sensors
+    SonicMeterEchoBackend backend; // Sensors that cannot use it fall back to the interrupt one
+    uint32_t period_ms; // Time between two triggers of a sensor, 0 for as fast as it allows
+    uint32_t max_range_cm; // Echoes from further away are reported as out of range
+    int32_t temperature_c; // Air temperature, sets the speed of sound
+    SonicMeterFilterConfig filter; // Post processing of the distance
+    SonicMeterWorkerPower power; // What to do with the 5V rail between rounds
+    SonicMeterWorkerAlarm alarm; // Distance alarm
+} SonicMeterWorkerConfig;
+
+typedef struct {
+    bool external; // 5V comes from USB and is not switched
+    uint32_t settle_ms; // Measured time from power up to the first echo, 0 until measured
+    uint32_t duty_permille; // Share of the time since start the rail was up
+} SonicMeterWorkerPowerStats;
+
+typedef struct {
+    bool raised; // Any sensor's alarm is raised
+    uint32_t count; // Times the alarm was raised since start
+    uint32_t last_us; // Reading interrupt to the outputs switched, for the last raise
+    uint32_t max_us; // The same, worst since start
+} SonicMeterWorkerAlarmStats;
+
+// HC-SR04 datasheet: allow 60ms between triggers so the previous ping dies out
+#define SONICMETER_WORKER_RECOVERY_MS 60
+// Quiet time between one sensor's echo and the next sensor's trigger, about 1.7m of extra travel
+#define SONICMETER_WORKER_STAGGER_MS 5
+// Ping interval while waiting for a freshly powered sensor to answer
+#define SONICMETER_WORKER_SETTLE_STEP_MS 10
+// Give up measuring the wake-up time after this, and use it as the settle time
+#define SONICMETER_WORKER_SETTLE_MAX_MS 500
+// Length of the vibration when the alarm is raised
+#define SONICMETER_WORKER_VIBRO_MS 200
+
+/**
+ * @brief      Callback for a published sample.
+ * @details    Called on the worker thread after every sample, must not block.
+*/
+typedef void (*SonicMeterWorkerCallback)(const SonicMeterSample* sample, void* context);
+
+typedef struct SonicMeterWorker SonicMeterWorker;
+
+/**
+ * @brief      Allocate the worker.
+ * @param      arena  The arena the sample ring comes from.
+ * @return     SonicMeterWorker object.
+*/
+SonicMeterWorker* sonicmeter_worker_alloc(SonicMeterArena* arena);
+
+/**
+ * @brief      Free the worker.
+ * @param      worker  The SonicMeterWorker object, must be stopped.
+*/
+void sonicmeter_worker_free(SonicMeterWorker* worker);
+
+/**
+ * @brief      Set the callback for published samples.
+ * @param      worker    The SonicMeterWorker object.
+ * @param      callback  The callback.
+ * @param      context   The callback context.
+*/
+void sonicmeter_worker_set_callback(
+    SonicMeterWorker* worker,
+    SonicMeterWorkerCallback callback,
+    void* context);
+
+/**
+ * @brief      Configure the pins and start sampling.
+ * @details    Falls back to the interrupt backend for every sensor the configured one is not
+ *             available on.
+ * @param      worker  The SonicMeterWorker object.
+ * @param      config  The configuration, copied.
+ * @return     The echo backend in use by the first sensor.
+*/
+SonicMeterEchoBackend
+    sonicmeter_worker_start(SonicMeterWorker* worker, const SonicMeterWorkerConfig* config);
+
+/**
+ * @brief      Stop sampling and release the pins.
+ * @param      worker  The SonicMeterWorker object.
+*/
+void sonicmeter_worker_stop(SonicMeterWorker* worker);
+
+/**
+ * @brief      Get the state of the 5V rail.
+ * @param      worker  The SonicMeterWorker object.
+ * @param      stats   Filled in with the rail statistics.
+*/
+void sonicmeter_worker_get_power_stats(
+    SonicMeterWorker* worker,
+    SonicMeterWorkerPowerStats* stats);
+
+/**
+ * @brief      Get the state of the distance alarm.
+ * @param      worker  The SonicMeterWorker object.
+ * @param      stats   Filled in with the alarm statistics.
+*/
+void sonicmeter_worker_get_alarm_stats(
+    SonicMeterWorker* worker,
+    SonicMeterWorkerAlarmStats* stats);
+
+/**
+ * @brief      Get the timing of the triggers.
+ * @param      worker  The SonicMeterWorker object.
+ * @param      stats   Filled in with the lateness and overruns since start.
+*/
+void sonicmeter_worker_get_schedule_stats(
+    SonicMeterWorker* worker,
+    SonicMeterScheduleStats* stats);
+
+/**
+ * @brief      Get the sample ring.
+ * @param      worker  The SonicMeterWorker object.
+ * @return     The ring, valid for the lifetime of the worker.
+*/
+SonicMeterRing* sonicmeter_worker_get_ring(SonicMeterWorker* worker);
@@ -0,0 +1,247 @@
+/**
+ * Host benchmarks of the measurement path, per echo backend.
+ *
+ * Plays a run of the simulated sensor through each backend the way it happens on the device:
+ *  - irq: the echo pin interrupt reads the line through sonicmeter_hal.h and feeds the edge to
+ *    the capture
+ *  - timer: the timer interrupt hands the capture a snapshot of the capture registers
+ *  - sim: the arm call plays the whole echo into the capture
+ * Every sample then goes through the range check, the conversion and the filter of the worker.
+ * Per backend the table has, in host cycles per sample:
+ *  - latency: the interrupt completing the capture, the arm call for the simulated backend
+ *  - convert: range check and conversion
+ *  - filter: median of 5 behind the outlier gate
+ * and the samples per second the whole path sustains.
+ *
+ * Host figures compare the backends and catch regressions, the probes give the device figures.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "sonicmeter_hal.h"
+#include "sonicmeter_pipeline.h"
+#include "sonicmeter_sim.h"
+
+#define BENCH_SAMPLES 100000
+#define BENCH_CPU_HZ 64000000
+#define BENCH_PERIOD_MS 10 // Time between two echoes of the simulated sensor
+#define BENCH_RANGE_CM 400
+#define BENCH_SEED 1
+
+typedef enum {
+    BenchBackendIrq,
+    BenchBackendTimer,
+    BenchBackendSim,
+    BenchBackendCount,
+} BenchBackend;
+
+static const char* const bench_backend_names[BenchBackendCount] = {"irq", "timer", "sim"};
+
+typedef struct {
+    SonicMeterSimEcho echo;
+    uint32_t armed_at;
+    SonicMeterCaptureTimerRegs regs;
+    SonicMeterCapture capture;
+    SonicMeterSample sample;
+} BenchSlot;
+
+typedef struct {
+    uint64_t latency_cycles;
+    uint64_t convert_cycles;
+    uint64_t filter_cycles;
+    uint64_t ns;
+    uint32_t results[SonicMeterCaptureResultLineHigh + 1];
+} BenchResult;
+
+static GPIO_TypeDef bench_port;
+
+/**
+ * @brief      Generate the echoes of the run and arm the captures.
+ * @details    Leaves each capture the way it is right before the completing interrupt.
+ * @param      slots    The samples.
+ * @param      backend  The backend.
+*/
+static void bench_prepare(BenchSlot* slots, BenchBackend backend) {
+    SonicMeterSim sim;
+    sonicmeter_sim_init(&sim, BENCH_CPU_HZ, BENCH_SEED, 0);
+
+    for(uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        BenchSlot* slot = &slots[i];
+        sonicmeter_sim_next(&sim, i * BENCH_PERIOD_MS, &slot->echo);
+        slot->armed_at = i * (BENCH_CPU_HZ / 1000 * BENCH_PERIOD_MS);
+        sonicmeter_capture_reset(&slot->capture);
+        if(backend == BenchBackendSim) {
+            continue;
+        }
+
+        if(!sonicmeter_capture_arm(&slot->capture, slot->echo.line_high, slot->armed_at)) {
+            continue;
+        }
+        const uint32_t rise_at = slot->armed_at + slot->echo.rise_ticks;
+        if(backend == BenchBackendIrq) {
+            for(uint32_t g = 0; g < slot->echo.glitches; g++) {
+                sonicmeter_capture_edge(&slot->capture, false, slot->armed_at + g);
+            }
+            if(slot->echo.width_ticks) {
+                sonicmeter_capture_edge(&slot->capture, true, rise_at);
+            }
+        } else {
+            // The timer filters the glitches out and only interrupts on the fall
+            slot->regs.sr = slot->echo.width_ticks ? SONICMETER_CAPTURE_TIM_SR_CC1IF |
+                                                         SONICMETER_CAPTURE_TIM_SR_CC2IF :
+                                                     0;
+            slot->regs.ccr_rise = rise_at;
+            slot->regs.ccr_fall = rise_at + slot->echo.width_ticks;
+        }
+    }
+}
+
+/**
+ * @brief      Run the completing interrupts, or the arm calls of the simulated backend.
+ * @param      slots    The samples.
+ * @param      backend  The backend.
+*/
+static void bench_capture(BenchSlot* slots, BenchBackend backend) {
+    SonicMeterHalPin line = {.port = &bench_port, .mask = 1U << 3};
+    SonicMeterSim sim;
+    sonicmeter_sim_init(&sim, BENCH_CPU_HZ, BENCH_SEED, 0);
+
+    for(uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        BenchSlot* slot = &slots[i];
+        switch(backend) {
+        case BenchBackendIrq:
+            // The counter is latched at the edge, a single load on the device
+            if(slot->echo.width_ticks) {
+                sonicmeter_capture_edge(
+                    &slot->capture,
+                    sonicmeter_hal_echo_read(&line),
+                    slot->capture.rise_at + slot->echo.width_ticks);
+            }
+            break;
+        case BenchBackendTimer:
+            sonicmeter_capture_timer(&slot->capture, &slot->regs);
+            break;
+        default: {
+            // What sonicmeter_echo_arm does for the simulated backend
+            SonicMeterSimEcho echo;
+            const uint32_t now = slot->armed_at;
+            sonicmeter_sim_next(&sim, i * BENCH_PERIOD_MS, &echo);
+            if(!sonicmeter_capture_arm(&slot->capture, echo.line_high, now)) {
+                break;
+            }
+            for(uint32_t g = 0; g < echo.glitches; g++) {
+                sonicmeter_capture_edge(&slot->capture, false, now + g);
+            }
+            if(echo.width_ticks) {
+                const uint32_t rise_at = now + echo.rise_ticks;
+                sonicmeter_capture_edge(&slot->capture, true, rise_at);
+                sonicmeter_capture_edge(&slot->capture, false, rise_at + echo.width_ticks);
+            }
+            break;
+        }
+        }
+    }
+}
+
+/**
+ * @brief      Expire what is still in flight and fill in the samples, as the worker does.
+ * @param      slots    The samples.
+ * @param      backend  The backend.
+*/
+static void bench_complete(BenchSlot* slots, BenchBackend backend) {
+    for(uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        BenchSlot* slot = &slots[i];
+        if(backend == BenchBackendTimer) {
+            sonicmeter_capture_timer_expire(&slot->capture, 0, false, slot->armed_at, 0);
+        } else {
+            sonicmeter_capture_expire(&slot->capture, slot->armed_at, 0);
+        }
+        memset(&slot->sample, 0, sizeof(SonicMeterSample));
+        slot->sample.sequence = i;
+        slot->sample.result = slot->capture.result;
+        slot->sample.ticks = sonicmeter_capture_get_width(&slot->capture);
+    }
+}
+
+static void bench_backend(BenchSlot* slots, BenchBackend backend, BenchResult* result) {
+    SonicMeterPipeline pipeline;
+    sonicmeter_pipeline_init(
+        &pipeline, BENCH_CPU_HZ, SONICMETER_CONVERT_TEMPERATURE_DEFAULT, BENCH_RANGE_CM);
+    SonicMeterFilter* filter = sonicmeter_filter_alloc();
+    const SonicMeterFilterConfig config = {
+        .type = SonicMeterFilterTypeMedian,
+        .window = 5,
+        .reject_outliers = true,
+    };
+    sonicmeter_filter_configure(filter, &config);
+    uint32_t filtered_um = 0;
+
+    bench_prepare(slots, backend);
+
+    const uint64_t start_ns = test_ns();
+    uint64_t start = test_cycles();
+    bench_capture(slots, backend);
+    result->latency_cycles = test_cycles() - start;
+
+    uint64_t ns = test_ns() - start_ns;
+    bench_complete(slots, backend);
+
+    const uint64_t convert_ns = test_ns();
+    start = test_cycles();
+    for(uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        sonicmeter_pipeline_convert(&pipeline, &slots[i].sample);
+    }
+    result->convert_cycles = test_cycles() - start;
+
+    start = test_cycles();
+    for(uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        sonicmeter_pipeline_filter(filter, &filtered_um, &slots[i].sample);
+    }
+    result->filter_cycles = test_cycles() - start;
+    result->ns = ns + test_ns() - convert_ns;
+
+    memset(result->results, 0, sizeof(result->results));
+    for(uint32_t i = 0; i < BENCH_SAMPLES; i++) {
+        result->results[slots[i].sample.result]++;
+    }
+
+    sonicmeter_filter_free(filter);
+}
+
+int main(void) {
+    BenchSlot* slots = calloc(BENCH_SAMPLES, sizeof(BenchSlot));
+    host_gpio_attach(&bench_port);
+
+    printf("%u samples of the simulated sensor, host cycles per sample\n", BENCH_SAMPLES);
+    printf(
+        "%-6s %7s %7s %7s %7s %8s %8s %8s %11s\n",
+        "",
+        "ok",
+        "noecho",
+        "range",
+        "high",
+        "latency",
+        "convert",
+        "filter",
+        "samples/s");
+    for(BenchBackend backend = 0; backend < BenchBackendCount; backend++) {
+        BenchResult result;
+        bench_backend(slots, backend, &result);
+        printf(
+            "%-6s %7" PRIu32 " %7" PRIu32 " %7" PRIu32 " %7" PRIu32 " %8.1f %8.1f %8.1f %11.0f\n",
+            bench_backend_names[backend],
+            result.results[SonicMeterCaptureResultOk],
+            result.results[SonicMeterCaptureResultNoEcho],
+            result.results[SonicMeterCaptureResultOutOfRange],
+            result.results[SonicMeterCaptureResultLineHigh],
+            (double)result.latency_cycles / BENCH_SAMPLES,
+            (double)result.convert_cycles / BENCH_SAMPLES,
+            (double)result.filter_cycles / BENCH_SAMPLES,
+            BENCH_SAMPLES * 1e9 / result.ns);
+    }
+
+    free(slots);
+    return 0;
+}
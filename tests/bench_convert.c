@@ -0,0 +1,104 @@
+/**
+ * Host benchmark of the echo width to distance conversion.
+ *
+ * Converts every tick value up to the longest range setting four ways:
+ *  - fixed: sonicmeter_convert_ticks_to_um, the multiply and shift of the worker
+ *  - old: the single precision path it replaced, ticks to microseconds, then 0.0343 cm/us at
+ *    20 C, halved, its error is mostly the 1.5888 us per 100 ticks that is not 64 MHz
+ *  - float: single precision with the factor of the fixed path, the rounding alone
+ *  - double: the reference the tests sweep against
+ * and prints host cycles per conversion and the largest error against the reference. The device
+ * has a single precision FPU, so the float path is not a software emulation there either, the
+ * cycle ratio is what carries over.
+*/
+
+#include <math.h>
+
+#include "test.h"
+#include "sonicmeter_convert.h"
+
+#define BENCH_CPU_HZ 64000000
+#define BENCH_RANGE_UM 4000000
+#define BENCH_ROUNDS 5
+
+// Keeps the compiler from dropping the conversions
+static volatile uint32_t bench_convert_sink;
+
+static uint32_t bench_convert_float_um(uint32_t ticks) {
+    // The old path: 1.5888 us per 100 ticks, then 0.0343 cm/us for the return trip
+    const float us = (float)ticks * 1.5888f / 1e2f;
+    return (uint32_t)(us * 0.0343f / 2.0f * 1e4f + 0.5f);
+}
+
+static uint32_t bench_convert_single_um(float um_per_tick, uint32_t ticks) {
+    return (uint32_t)((float)ticks * um_per_tick + 0.5f);
+}
+
+static double bench_convert_reference_um(const SonicMeterConvert* convert, uint32_t ticks) {
+    return (double)ticks * convert->speed_mm_s * 1000.0 / (2.0 * convert->cpu_hz);
+}
+
+int main(void) {
+    SonicMeterConvert convert;
+    sonicmeter_convert_init(&convert, BENCH_CPU_HZ, SONICMETER_CONVERT_TEMPERATURE_DEFAULT);
+    const uint32_t max_ticks = sonicmeter_convert_um_to_ticks(&convert, BENCH_RANGE_UM);
+    const uint64_t conversions = (uint64_t)(max_ticks + 1) * BENCH_ROUNDS;
+
+    uint64_t start = test_cycles();
+    for(uint32_t round = 0; round < BENCH_ROUNDS; round++) {
+        for(uint32_t ticks = 0; ticks <= max_ticks; ticks++) {
+            bench_convert_sink = sonicmeter_convert_ticks_to_um(&convert, ticks);
+        }
+    }
+    const uint64_t fixed_cycles = test_cycles() - start;
+
+    start = test_cycles();
+    for(uint32_t round = 0; round < BENCH_ROUNDS; round++) {
+        for(uint32_t ticks = 0; ticks <= max_ticks; ticks++) {
+            bench_convert_sink = bench_convert_float_um(ticks);
+        }
+    }
+    const uint64_t old_cycles = test_cycles() - start;
+
+    const float um_per_tick = convert.speed_mm_s * 1000.0f / (2.0f * convert.cpu_hz);
+    start = test_cycles();
+    for(uint32_t round = 0; round < BENCH_ROUNDS; round++) {
+        for(uint32_t ticks = 0; ticks <= max_ticks; ticks++) {
+            bench_convert_sink = bench_convert_single_um(um_per_tick, ticks);
+        }
+    }
+    const uint64_t float_cycles = test_cycles() - start;
+
+    start = test_cycles();
+    for(uint32_t round = 0; round < BENCH_ROUNDS; round++) {
+        for(uint32_t ticks = 0; ticks <= max_ticks; ticks++) {
+            bench_convert_sink = bench_convert_reference_um(&convert, ticks) + 0.5;
+        }
+    }
+    const uint64_t double_cycles = test_cycles() - start;
+
+    double fixed_error = 0;
+    double old_error = 0;
+    double float_error = 0;
+    for(uint32_t ticks = 0; ticks <= max_ticks; ticks++) {
+        const double reference_um = bench_convert_reference_um(&convert, ticks);
+        const uint32_t fixed_um = sonicmeter_convert_ticks_to_um(&convert, ticks);
+        fixed_error = fmax(fixed_error, fabs(fixed_um - reference_um));
+        old_error = fmax(old_error, fabs(bench_convert_float_um(ticks) - reference_um));
+        float_error =
+            fmax(float_error, fabs(bench_convert_single_um(um_per_tick, ticks) - reference_um));
+    }
+
+    printf(
+        "%" PRIu32 " echo widths up to %u mm at %d C, host cycles per conversion\n",
+        max_ticks + 1,
+        BENCH_RANGE_UM / 1000,
+        SONICMETER_CONVERT_TEMPERATURE_DEFAULT);
+    printf("%-7s %7s %14s\n", "", "cycles", "max error um");
+    printf("%-7s %7.2f %14.4f\n", "fixed", (double)fixed_cycles / conversions, fixed_error);
+    printf("%-7s %7.2f %14.4f\n", "old", (double)old_cycles / conversions, old_error);
+    printf(
+        "%-7s %7.2f %14.4f\n", "float", (double)float_cycles / conversions, float_error);
+    printf("%-7s %7.2f %14s\n", "double", (double)double_cycles / conversions, "-");
+    return 0;
+}
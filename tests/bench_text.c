@@ -0,0 +1,223 @@
+/**
+ * Host benchmark of formatting a frame of the measure screen.
+ *
+ * The lines of the main page in debug, recording and streaming, formatted four ways:
+ *  - old: a furi_string allocated per frame and one printf per line, the distance through
+ *    "%0.2f" of a float the way the screen first had it
+ *  - int printf: the same with the distance as "%lu.%02lu", what the screen had just before
+ *    sonicmeter_text
+ *  - text: sonicmeter_text into the buffers of the frame, no allocation and no printf
+ *  - unchanged: text for a sample that rounds to the frame on screen, plus the memcmp that finds
+ *    no redraw is needed
+ * and prints host cycles per frame. furi_string_printf is vsnprintf into a heap buffer, here
+ * without the furi_string around it, so the old paths are if anything a little cheap. The device
+ * has no double precision FPU, so "%0.2f" goes through software doubles there and the gap to the
+ * integer paths is wider than on the host.
+*/
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "sonicmeter_text.h"
+
+#define BENCH_FRAMES 200000
+
+// The lines of the frame, sized as on the device
+typedef struct {
+    char rate[12];
+    char recording[28];
+    char link[12];
+    char distance[28];
+    char ticks[28];
+    char time[24];
+    char trigger_pin[20];
+    char echo_pin[16];
+} BenchTextFrame;
+
+typedef struct {
+    uint32_t rate_dhz;
+    uint32_t bytes_written;
+    uint32_t write_bps;
+    uint32_t dropped;
+    uint32_t filtered_um;
+    uint32_t ticks;
+    uint32_t echo_us;
+} BenchTextModel;
+
+// Stands in for drawing, keeps the compiler from dropping the formatting
+static volatile uint32_t bench_text_sink;
+
+static void bench_text_draw(const char* str) {
+    bench_text_sink += (uint8_t)str[0];
+}
+
+// A heap string grown by printf, what furi_string_printf does underneath
+typedef struct {
+    char* data;
+    size_t size;
+} BenchTextString;
+
+static void bench_text_printf(BenchTextString* string, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(string->data, string->size, format, args);
+    va_end(args);
+    if((size_t)length >= string->size) {
+        string->size = length + 1;
+        string->data = realloc(string->data, string->size);
+        va_start(args, format);
+        vsnprintf(string->data, string->size, format, args);
+        va_end(args);
+    }
+}
+
+static void bench_text_old(const BenchTextModel* m, bool float_distance) {
+    BenchTextString xstr = {.data = malloc(16), .size = 16};
+
+    bench_text_printf(&xstr, "%" PRIu32 ".%" PRIu32 "/s", m->rate_dhz / 10, m->rate_dhz % 10);
+    bench_text_draw(xstr.data);
+    bench_text_printf(
+        &xstr,
+        "REC %" PRIu32 "K %" PRIu32 "K/s d%" PRIu32,
+        m->bytes_written / 1024,
+        m->write_bps / 1024,
+        m->dropped);
+    bench_text_draw(xstr.data);
+    bench_text_printf(&xstr, "USB d%" PRIu32, m->dropped);
+    bench_text_draw(xstr.data);
+    if(float_distance) {
+        const float distance_cm = m->filtered_um / 10000.0f;
+        bench_text_printf(&xstr, "Distance %0.2f cm", (double)distance_cm);
+    } else {
+        bench_text_printf(
+            &xstr,
+            "Distance %" PRIu32 ".%02" PRIu32 " cm",
+            m->filtered_um / 10000,
+            m->filtered_um / 100 % 100);
+    }
+    bench_text_draw(xstr.data);
+    bench_text_printf(&xstr, "Ticks: %" PRIu32 " %s", m->ticks, "IRQ");
+    bench_text_draw(xstr.data);
+    bench_text_printf(&xstr, "Time: %" PRIu32 " us", m->echo_us);
+    bench_text_draw(xstr.data);
+    bench_text_printf(&xstr, "Trigger pin: %s", "PA7");
+    bench_text_draw(xstr.data);
+    bench_text_printf(&xstr, "Echo pin: %s", "PB2");
+    bench_text_draw(xstr.data);
+    free(xstr.data);
+}
+
+// The lines of sonicmeter_view_measure_format for the same page
+static void bench_text_format(const BenchTextModel* m, BenchTextFrame* frame) {
+    SonicMeterText t;
+
+    sonicmeter_text_init(&t, frame->rate, sizeof(frame->rate));
+    sonicmeter_text_fixed(&t, m->rate_dhz, 1);
+    sonicmeter_text_str(&t, "/s");
+
+    sonicmeter_text_init(&t, frame->recording, sizeof(frame->recording));
+    sonicmeter_text_str(&t, "REC ");
+    sonicmeter_text_u32(&t, m->bytes_written / 1024);
+    sonicmeter_text_str(&t, "K ");
+    sonicmeter_text_u32(&t, m->write_bps / 1024);
+    sonicmeter_text_str(&t, "K/s d");
+    sonicmeter_text_u32(&t, m->dropped);
+
+    sonicmeter_text_init(&t, frame->link, sizeof(frame->link));
+    sonicmeter_text_str(&t, "USB d");
+    sonicmeter_text_u32(&t, m->dropped);
+
+    sonicmeter_text_init(&t, frame->distance, sizeof(frame->distance));
+    sonicmeter_text_str(&t, "Distance ");
+    sonicmeter_text_fixed(&t, m->filtered_um / 100, 2);
+    sonicmeter_text_str(&t, " cm");
+
+    sonicmeter_text_init(&t, frame->ticks, sizeof(frame->ticks));
+    sonicmeter_text_str(&t, "Ticks: ");
+    sonicmeter_text_u32(&t, m->ticks);
+    sonicmeter_text_str(&t, " ");
+    sonicmeter_text_str(&t, "IRQ");
+
+    sonicmeter_text_init(&t, frame->time, sizeof(frame->time));
+    sonicmeter_text_str(&t, "Time: ");
+    sonicmeter_text_u32(&t, m->echo_us);
+    sonicmeter_text_str(&t, " us");
+
+    sonicmeter_text_init(&t, frame->trigger_pin, sizeof(frame->trigger_pin));
+    sonicmeter_text_str(&t, "Trigger pin: ");
+    sonicmeter_text_str(&t, "PA7");
+
+    sonicmeter_text_init(&t, frame->echo_pin, sizeof(frame->echo_pin));
+    sonicmeter_text_str(&t, "Echo pin: ");
+    sonicmeter_text_str(&t, "PB2");
+}
+
+static void bench_text_new(const BenchTextModel* m, BenchTextFrame* frame) {
+    bench_text_format(m, frame);
+    bench_text_draw(frame->rate);
+    bench_text_draw(frame->recording);
+    bench_text_draw(frame->link);
+    bench_text_draw(frame->distance);
+    bench_text_draw(frame->ticks);
+    bench_text_draw(frame->time);
+    bench_text_draw(frame->trigger_pin);
+    bench_text_draw(frame->echo_pin);
+}
+
+static BenchTextModel bench_text_model(uint32_t frame) {
+    // A target moving anywhere up to 4 m, a new value every frame
+    const uint32_t filtered_um = 20000 + frame * 7919 % 3980000;
+    return (BenchTextModel){
+        .rate_dhz = 160 + frame % 7,
+        .bytes_written = 1000000 + frame * 9,
+        .write_bps = 1200,
+        .dropped = frame / 1000,
+        .filtered_um = filtered_um,
+        .ticks = filtered_um * 10 / 53,
+        .echo_us = filtered_um / 172,
+    };
+}
+
+int main(void) {
+    static BenchTextFrame frame;
+    static BenchTextFrame shown;
+    const char* const names[] = {"old", "int printf", "text", "unchanged"};
+    uint64_t cycles[COUNT_OF(names)] = {0};
+    uint32_t redraws = 0;
+
+    for(uint32_t i = 0; i < BENCH_FRAMES; i++) {
+        const BenchTextModel m = bench_text_model(i);
+
+        uint64_t start = test_cycles();
+        bench_text_old(&m, true);
+        cycles[0] += test_cycles() - start;
+
+        start = test_cycles();
+        bench_text_old(&m, false);
+        cycles[1] += test_cycles() - start;
+
+        start = test_cycles();
+        bench_text_new(&m, &frame);
+        cycles[2] += test_cycles() - start;
+        shown = frame;
+
+        // The same sample again: formatted and compared, not drawn
+        start = test_cycles();
+        bench_text_format(&m, &frame);
+        if(memcmp(&frame, &shown, sizeof(frame)) != 0) {
+            redraws++;
+            bench_text_new(&m, &frame);
+        }
+        cycles[3] += test_cycles() - start;
+    }
+
+    printf("%u frames of 8 lines, host cycles per frame\n", BENCH_FRAMES);
+    for(size_t i = 0; i < COUNT_OF(names); i++) {
+        printf("%-11s %8.1f\n", names[i], (double)cycles[i] / BENCH_FRAMES);
+    }
+    printf("%" PRIu32 " redraws of unchanged frames\n", redraws);
+    return 0;
+}
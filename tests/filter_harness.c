@@ -0,0 +1,281 @@
+/**
+ * Filter harness: noisy traces with a known truth through every filter configuration.
+ *
+ * Each trace is a run of echo widths and the distance they should measure:
+ *  - still: a target at 1 m with the few millimeters of noise of an HC-SR04
+ *  - ramp: a target moving from 20 cm away at 5 cm/s and back, 20 samples per second
+ *  - step: a target at 1 m replaced by one at 2 m
+ *  - ghosts: the still target with an echo from 30 to 60 cm further every 25 samples or so
+ *  - sim: one script of the simulated sensor, missing echoes, range and stuck line included
+ * The echo widths go through the conversion and the filter of the worker. Per trace and filter
+ * the table has the RMS and largest error of the filter output against the truth, the samples
+ * the outlier gate dropped and the host cycles per sample of the filter.
+ *
+ * The checks hold what the stages are for: every smoothing stage beats the raw distance on the
+ * still target, the median and the gate keep the ghosts out, the gate lets a real step through.
+ *
+ *     filter_harness
+*/
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include "sonicmeter_pipeline.h"
+#include "sonicmeter_sim.h"
+
+#define HARNESS_CPU_HZ 64000000
+#define HARNESS_RANGE_CM 400
+#define HARNESS_SAMPLES 2000 // Samples of a synthetic trace
+#define HARNESS_PERIOD_MS 50 // Time between two samples of a synthetic trace
+#define HARNESS_SIM_PERIOD_MS 10 // Time between two triggers of the simulated sensor
+#define HARNESS_NOISE_UM 2000 // Peak noise of the synthetic traces, triangular
+#define HARNESS_STILL_UM 1000000
+#define HARNESS_STEP_UM 2000000
+#define HARNESS_RAMP_UM_PER_MS 50 // 5 cm/s
+#define HARNESS_GHOST_EVERY 25 // Samples between two ghosts, on average
+#define HARNESS_GHOST_MIN_UM 300000
+#define HARNESS_GHOST_MAX_UM 600000
+#define HARNESS_SEED 1
+#define HARNESS_GATE_REJECT_MAX 4 // Drops in a row before the gate takes a new target
+#define HARNESS_ROUNDS 5 // Runs of a trace through a filter, the fastest one is timed
+
+typedef enum {
+    HarnessTraceStill,
+    HarnessTraceRamp,
+    HarnessTraceStep,
+    HarnessTraceGhosts,
+    HarnessTraceSim,
+    HarnessTraceCount,
+} HarnessTrace;
+
+static const char* const harness_trace_names[HarnessTraceCount] = {
+    "still",
+    "ramp",
+    "step",
+    "ghosts",
+    "sim",
+};
+
+typedef struct {
+    const char* name;
+    SonicMeterFilterConfig config;
+} HarnessFilter;
+
+static const HarnessFilter harness_filters[] = {
+    {"none", {.type = SonicMeterFilterTypeNone, .window = 1}},
+    {"gate", {.type = SonicMeterFilterTypeNone, .window = 1, .reject_outliers = true}},
+    {"median 5", {.type = SonicMeterFilterTypeMedian, .window = 5}},
+    {"median 5 gate", {.type = SonicMeterFilterTypeMedian, .window = 5, .reject_outliers = true}},
+    {"median 15", {.type = SonicMeterFilterTypeMedian, .window = 15}},
+    {"ema 5", {.type = SonicMeterFilterTypeEma, .window = 5}},
+    {"ema 5 gate", {.type = SonicMeterFilterTypeEma, .window = 5, .reject_outliers = true}},
+    {"kalman 5", {.type = SonicMeterFilterTypeKalman, .window = 5}},
+    {"kalman 5 gate", {.type = SonicMeterFilterTypeKalman, .window = 5, .reject_outliers = true}},
+};
+
+typedef struct {
+    SonicMeterSample* samples;
+    uint32_t* truth_um; // Distance of the target, 0 where there is nothing to measure
+    uint32_t count;
+} HarnessRun;
+
+typedef struct {
+    double rms_um;
+    uint32_t max_um;
+    uint32_t dropped;
+    uint32_t last_um; // Error at the end of the trace
+    double cycles; // Per sample, fastest round
+} HarnessResult;
+
+static uint32_t harness_seed = HARNESS_SEED;
+
+// Same generator as the simulated sensor, 16 random bits
+static uint32_t harness_random_below(uint32_t n) {
+    harness_seed = harness_seed * 1664525U + 1013904223U;
+    return ((harness_seed >> 16) * n) >> 16;
+}
+
+static uint32_t harness_noisy(uint32_t distance_um) {
+    return distance_um + harness_random_below(HARNESS_NOISE_UM + 1) +
+           harness_random_below(HARNESS_NOISE_UM + 1) - HARNESS_NOISE_UM;
+}
+
+/**
+ * @brief      Record an echo as the worker would have.
+ * @param      run       The trace.
+ * @param      sim       Conversion of the sensor.
+ * @param      measured  Distance the echo comes from, 0 if there is no echo.
+ * @param      truth     Distance of the target.
+*/
+static void
+    harness_add(HarnessRun* run, const SonicMeterSim* sim, uint32_t measured, uint32_t truth) {
+    SonicMeterSample* sample = &run->samples[run->count];
+    sample->sequence = run->count;
+    sample->result = measured ? SonicMeterCaptureResultOk : SonicMeterCaptureResultNoEcho;
+    sample->ticks = measured ? sonicmeter_convert_um_to_ticks(&sim->convert, measured) : 0;
+    run->truth_um[run->count] = truth;
+    run->count++;
+}
+
+static void harness_trace(HarnessRun* run, HarnessTrace trace) {
+    SonicMeterSim sim;
+    sonicmeter_sim_init(&sim, HARNESS_CPU_HZ, HARNESS_SEED, 0);
+    run->count = 0;
+
+    if(trace == HarnessTraceSim) {
+        for(uint32_t now_ms = 0; now_ms < SONICMETER_SIM_SCRIPT_MS;
+            now_ms += HARNESS_SIM_PERIOD_MS) {
+            SonicMeterSimEcho echo;
+            sonicmeter_sim_next(&sim, now_ms, &echo);
+            SonicMeterSample* sample = &run->samples[run->count];
+            sample->sequence = run->count;
+            sample->result = echo.line_high   ? SonicMeterCaptureResultLineHigh :
+                             echo.width_ticks ? SonicMeterCaptureResultOk :
+                                                SonicMeterCaptureResultNoEcho;
+            sample->ticks = echo.width_ticks;
+            run->truth_um[run->count] = echo.distance_um;
+            run->count++;
+        }
+        return;
+    }
+
+    uint32_t next_ghost = HARNESS_GHOST_EVERY;
+    for(uint32_t i = 0; i < HARNESS_SAMPLES; i++) {
+        const uint32_t t_ms = i * HARNESS_PERIOD_MS;
+        uint32_t truth = HARNESS_STILL_UM;
+        if(trace == HarnessTraceRamp) {
+            const uint32_t half_ms = HARNESS_SAMPLES * HARNESS_PERIOD_MS / 2;
+            const uint32_t phase_ms = t_ms < half_ms ? t_ms : 2 * half_ms - t_ms;
+            truth = HARNESS_STILL_UM / 5 + phase_ms * HARNESS_RAMP_UM_PER_MS;
+        } else if(trace == HarnessTraceStep && i >= HARNESS_SAMPLES / 2) {
+            truth = HARNESS_STEP_UM;
+        }
+
+        uint32_t measured = harness_noisy(truth);
+        if(trace == HarnessTraceGhosts && i == next_ghost) {
+            measured += HARNESS_GHOST_MIN_UM +
+                        harness_random_below(HARNESS_GHOST_MAX_UM - HARNESS_GHOST_MIN_UM);
+            next_ghost += HARNESS_GHOST_EVERY / 2 + harness_random_below(HARNESS_GHOST_EVERY);
+        }
+        harness_add(run, &sim, measured, truth);
+    }
+}
+
+static void harness_run(
+    const HarnessRun* trace,
+    const SonicMeterFilterConfig* config,
+    HarnessResult* result) {
+    SonicMeterPipeline pipeline;
+    sonicmeter_pipeline_init(
+        &pipeline, HARNESS_CPU_HZ, SONICMETER_CONVERT_TEMPERATURE_DEFAULT, HARNESS_RANGE_CM);
+    SonicMeterFilter* filter = sonicmeter_filter_alloc();
+
+    result->cycles = INFINITY;
+    for(uint32_t round = 0; round < HARNESS_ROUNDS; round++) {
+        for(uint32_t i = 0; i < trace->count; i++) {
+            sonicmeter_pipeline_convert(&pipeline, &trace->samples[i]);
+        }
+        sonicmeter_filter_configure(filter, config);
+        uint32_t filtered_um = 0;
+
+        const uint64_t start = test_cycles();
+        for(uint32_t i = 0; i < trace->count; i++) {
+            sonicmeter_pipeline_filter(filter, &filtered_um, &trace->samples[i]);
+        }
+        result->cycles = fmin(result->cycles, (double)(test_cycles() - start) / trace->count);
+    }
+
+    // Only the samples the filter saw, the output is held through everything else
+    double sum_sq = 0;
+    uint32_t scored = 0;
+    result->max_um = 0;
+    result->dropped = 0;
+    for(uint32_t i = 0; i < trace->count; i++) {
+        const SonicMeterSample* sample = &trace->samples[i];
+        if(sample->result != SonicMeterCaptureResultOk) {
+            continue;
+        }
+        if(sample->flags & SonicMeterSampleFlagRejected) {
+            result->dropped++;
+        }
+        const uint32_t error = abs((int32_t)(sample->filtered_um - trace->truth_um[i]));
+        sum_sq += (double)error * error;
+        scored++;
+        result->last_um = error;
+        if(error > result->max_um) {
+            result->max_um = error;
+        }
+    }
+    result->rms_um = scored ? sqrt(sum_sq / scored) : 0;
+
+    sonicmeter_filter_free(filter);
+}
+
+int main(void) {
+    const uint32_t capacity = SONICMETER_SIM_SCRIPT_MS / HARNESS_SIM_PERIOD_MS;
+    HarnessRun run = {
+        .samples = calloc(capacity, sizeof(SonicMeterSample)),
+        .truth_um = calloc(capacity, sizeof(uint32_t)),
+    };
+    HarnessResult results[HarnessTraceCount][COUNT_OF(harness_filters)];
+
+    printf(
+        "%-7s %-14s %9s %9s %8s %7s\n",
+        "trace",
+        "filter",
+        "rms mm",
+        "max mm",
+        "dropped",
+        "cycles");
+    for(HarnessTrace trace = 0; trace < HarnessTraceCount; trace++) {
+        harness_seed = HARNESS_SEED;
+        harness_trace(&run, trace);
+        for(size_t f = 0; f < COUNT_OF(harness_filters); f++) {
+            HarnessResult* result = &results[trace][f];
+            harness_run(&run, &harness_filters[f].config, result);
+            printf(
+                "%-7s %-14s %9.3f %9.3f %8" PRIu32 " %7.1f\n",
+                harness_trace_names[trace],
+                harness_filters[f].name,
+                result->rms_um / 1000,
+                result->max_um / 1000.0,
+                result->dropped,
+                result->cycles);
+        }
+    }
+
+    // Rows of harness_filters
+    const HarnessResult* still = results[HarnessTraceStill];
+    const HarnessResult* ghosts = results[HarnessTraceGhosts];
+    const HarnessResult* step = results[HarnessTraceStep];
+
+    // Smoothing lowers the noise on a still target, the gate alone does not touch it
+    for(size_t f = 2; f < COUNT_OF(harness_filters); f++) {
+        TEST_CHECK(still[f].rms_um < still[0].rms_um);
+    }
+    TEST_CHECK_EQ(still[1].dropped, 0);
+    TEST_CHECK(still[1].rms_um == still[0].rms_um);
+
+    // Ghosts go straight through without a gate, a median or a gate keeps them out
+    TEST_CHECK(ghosts[0].max_um >= HARNESS_GHOST_MIN_UM - HARNESS_NOISE_UM);
+    TEST_CHECK(ghosts[2].max_um <= HARNESS_NOISE_UM);
+    for(size_t f = 0; f < COUNT_OF(harness_filters); f++) {
+        if(harness_filters[f].config.reject_outliers) {
+            TEST_CHECK(ghosts[f].max_um <= HARNESS_NOISE_UM);
+            TEST_CHECK(ghosts[f].dropped > 0);
+        }
+    }
+
+    // A step is a moved target, not a ghost: the gate drops a few samples and then follows
+    for(size_t f = 0; f < COUNT_OF(harness_filters); f++) {
+        if(harness_filters[f].config.reject_outliers) {
+            TEST_CHECK(step[f].dropped <= HARNESS_GATE_REJECT_MAX + still[f].dropped);
+        }
+        TEST_CHECK(step[f].last_um <= HARNESS_NOISE_UM);
+    }
+
+    free(run.samples);
+    free(run.truth_um);
+    return test_done("filter_harness");
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * Host stand-in for the parts of the furi core the HAL-free modules and sonicmeter_hal.h use.
+ *
+ * The critical section only counts how deep it is nested, the tests check that the register
+ * accesses which must not be interrupted happen inside one. The kernel tick is whatever the test
+ * sets it to.
+*/
+
+#define UNUSED(x) (void)(x)
+#define COUNT_OF(x) (sizeof(x) / sizeof(x[0]))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define furi_assert(x) \
+    do {               \
+        if(!(x)) {     \
+            abort();   \
+        }              \
+    } while(0)
+#define furi_check(x) furi_assert(x)
+
+extern uint32_t host_critical_depth; // Nesting of FURI_CRITICAL_ENTER
+extern uint32_t host_critical_count; // Critical sections entered, since the process started
+extern uint32_t host_tick; // Value of furi_get_tick
+
+#define FURI_CRITICAL_ENTER()  \
+    do {                       \
+        host_critical_depth++; \
+        host_critical_count++; \
+    } while(0)
+#define FURI_CRITICAL_EXIT()   \
+    do {                       \
+        host_critical_depth--; \
+    } while(0)
+
+static inline uint32_t furi_get_tick(void) {
+    return host_tick;
+}
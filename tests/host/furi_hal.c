@@ -0,0 +1,46 @@
+#include "furi_hal.h"
+
+#include <string.h>
+
+uint32_t host_critical_depth = 0;
+uint32_t host_critical_count = 0;
+uint32_t host_tick = 0;
+
+uint32_t host_cycles_step = 1;
+void (*host_cycles_hook)(void* context) = NULL;
+void* host_cycles_context = NULL;
+EXTI_TypeDef host_exti;
+bool host_power_otg = false;
+bool host_power_charging = false;
+bool host_vibro = false;
+uint8_t host_light_red = 0;
+
+static DWT_Type host_dwt_regs;
+static GPIO_TypeDef* host_gpio_ports[HOST_GPIO_PORTS_MAX];
+static size_t host_gpio_port_count = 0;
+
+void host_gpio_attach(GPIO_TypeDef* port) {
+    furi_check(host_gpio_port_count < HOST_GPIO_PORTS_MAX);
+    memset((void*)port, 0, sizeof(GPIO_TypeDef));
+    host_gpio_ports[host_gpio_port_count++] = port;
+}
+
+void host_gpio_update(void) {
+    for(size_t i = 0; i < host_gpio_port_count; i++) {
+        GPIO_TypeDef* port = host_gpio_ports[i];
+        // BSRR: set bits in the low half, reset bits in the high half, set wins
+        port->ODR &= ~(port->BRR | (port->BSRR >> 16));
+        port->ODR |= port->BSRR & 0xFFFF;
+        port->BSRR = 0;
+        port->BRR = 0;
+    }
+}
+
+DWT_Type* host_dwt(void) {
+    host_gpio_update();
+    host_dwt_regs.CYCCNT += host_cycles_step;
+    if(host_cycles_hook) {
+        host_cycles_hook(host_cycles_context);
+    }
+    return &host_dwt_regs;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "furi.h"
+
+/**
+ * Host register model behind sonicmeter_hal.h.
+ *
+ * Just enough of the STM32WB registers for the inline functions of sonicmeter_hal.h to compile
+ * and run unchanged on the host:
+ *  - the cycle counter advances by host_cycles_step on every read, so busy waits on it end
+ *  - attached GPIO ports latch their set and reset registers into ODR on every counter read and
+ *    on host_gpio_update, like the hardware does on the write
+ *  - the EXTI pending register keeps the last value written to it
+ * A test can watch the registers from host_cycles_hook, which runs on every counter read.
+*/
+
+typedef struct {
+    volatile uint32_t MODER, OTYPER, OSPEEDR, PUPDR, IDR, ODR, BSRR, LCKR, AFR[2], BRR;
+} GPIO_TypeDef;
+
+typedef struct {
+    GPIO_TypeDef* port;
+    uint16_t pin;
+} GpioPin;
+
+typedef struct {
+    volatile uint32_t CTRL, CYCCNT;
+} DWT_Type;
+
+typedef struct {
+    volatile uint32_t RTSR1, FTSR1, SWIER1, PR1;
+} EXTI_TypeDef;
+
+typedef enum {
+    LightRed = (1 << 0),
+    LightGreen = (1 << 1),
+    LightBlue = (1 << 2),
+} Light;
+
+#define HOST_GPIO_PORTS_MAX 4 // Ports host_gpio_attach can take
+
+extern uint32_t host_cycles_step; // Counter advance per read, 1 by default
+extern void (*host_cycles_hook)(void* context); // Called on every counter read, NULL for none
+extern void* host_cycles_context;
+extern EXTI_TypeDef host_exti;
+extern bool host_power_otg; // The OTG booster is on
+extern bool host_power_charging; // USB powers the 5V pin
+extern bool host_vibro; // The vibration motor is on
+extern uint8_t host_light_red; // Brightness of the red LED
+
+/**
+ * @brief      Read the cycle counter registers.
+ * @details    Advances the counter, latches the GPIO writes and calls the hook.
+ * @return     The DWT registers.
+*/
+DWT_Type* host_dwt(void);
+
+#define DWT (host_dwt())
+#define EXTI (&host_exti)
+
+/**
+ * @brief      Clear a port and latch its writes from now on.
+ * @param      port  The port.
+*/
+void host_gpio_attach(GPIO_TypeDef* port);
+
+/**
+ * @brief      Latch the set and reset register writes of every attached port into ODR.
+*/
+void host_gpio_update(void);
+
+static inline bool furi_hal_power_is_otg_enabled(void) {
+    return host_power_otg;
+}
+
+static inline bool furi_hal_power_is_charging(void) {
+    return host_power_charging;
+}
+
+static inline void furi_hal_power_enable_otg(void) {
+    host_power_otg = true;
+}
+
+static inline void furi_hal_power_disable_otg(void) {
+    host_power_otg = false;
+}
+
+static inline void furi_hal_vibro_on(bool on) {
+    host_vibro = on;
+}
+
+static inline void furi_hal_light_set(Light light, uint8_t value) {
+    if(light & LightRed) {
+        host_light_red = value;
+    }
+}
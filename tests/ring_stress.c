@@ -0,0 +1,258 @@
+/**
+ * Stress test of the sample ring: one producer, several readers.
+ *
+ * The producer publishes samples whose every field is derived from the sequence number. Each
+ * reader checks every copy it gets:
+ *  - torn: every field agrees with the sequence number
+ *  - order: the sequence is the reader's position, so nothing is reordered, repeated or lost
+ *    without being counted as dropped
+ * and at the end that read plus dropped is everything published after the reader started.
+ *
+ * A small ring makes the producer lap the readers all the time, the worker's ring size shows the
+ * normal case. Each ring runs three ways:
+ *  - threads, flat out: the producer thread never waits, the readers spin on several cores
+ *  - threads, paced: the producer yields every few samples, for a tenth of the samples, so the
+ *    threads interleave even on a single core
+ *  - interrupt: the producer is a timer signal handler preempting the reader at any instruction,
+ *    the way the worker preempts the GUI on the single core of the device, for a fixed number of
+ *    signals
+ *
+ *     ring_stress [samples]
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "test.h"
+#include "sonicmeter_ring.h"
+
+#define RING_STRESS_SAMPLES 10000000
+#define RING_STRESS_READERS 3
+#define RING_STRESS_BURST 5 // Samples between two yields of the paced producer
+#define RING_STRESS_INTERRUPT_US 20 // Period of the producer signal
+#define RING_STRESS_INTERRUPTS 50000 // Signals of the interrupt mode
+
+typedef enum {
+    RingStressModeFlatOut,
+    RingStressModePaced,
+    RingStressModeInterrupt,
+} RingStressMode;
+
+static const char* const ring_stress_mode_names[] = {"flat out", "paced", "interrupt"};
+
+typedef struct {
+    SonicMeterRing* ring;
+    atomic_bool done;
+    atomic_uint readers_started;
+} RingStress;
+
+typedef struct {
+    RingStress* stress;
+    SonicMeterRingReader position;
+    uint32_t start; // Samples published before the reader started
+    uint32_t read;
+    uint32_t torn;
+    uint32_t out_of_order;
+} RingStressReader;
+
+// The producer of the interrupt mode, a signal handler only sees globals
+static SonicMeterRing* ring_stress_interrupt_ring;
+static atomic_uint ring_stress_interrupt_sequence;
+static atomic_uint ring_stress_interrupt_count;
+
+static void ring_stress_fill(SonicMeterSample* sample, uint32_t sequence) {
+    sample->sequence = sequence;
+    sample->sensor = sequence & 3;
+    sample->timestamp = sequence * 7;
+    sample->ticks = ~sequence;
+    sample->echo_us = sequence ^ 0x5A5A5A5A;
+    sample->distance_um = sequence * 3 + 1;
+    sample->filtered_um = sequence * 5;
+    sample->flags = sequence >> 3;
+    sample->result = sequence % 4;
+    sample->spurious_edges = sequence * 11;
+}
+
+static bool ring_stress_check(const SonicMeterSample* sample) {
+    SonicMeterSample expected;
+    ring_stress_fill(&expected, sample->sequence);
+    return sample->sensor == expected.sensor && sample->timestamp == expected.timestamp &&
+           sample->ticks == expected.ticks && sample->echo_us == expected.echo_us &&
+           sample->distance_um == expected.distance_um &&
+           sample->filtered_um == expected.filtered_um && sample->flags == expected.flags &&
+           sample->result == expected.result &&
+           sample->spurious_edges == expected.spurious_edges;
+}
+
+static void ring_stress_reader_init(RingStressReader* reader, RingStress* stress) {
+    reader->stress = stress;
+    sonicmeter_ring_reader_init(stress->ring, &reader->position);
+    reader->start = reader->position.tail;
+}
+
+/**
+ * @brief      Read and check the next sample.
+ * @param      reader  The reader.
+ * @return     false if the reader is caught up.
+*/
+static bool ring_stress_reader_step(RingStressReader* reader) {
+    SonicMeterSample sample;
+    if(!sonicmeter_ring_read(reader->stress->ring, &reader->position, &sample)) {
+        return false;
+    }
+
+    reader->read++;
+    if(!ring_stress_check(&sample)) {
+        reader->torn++;
+    }
+    if(sample.sequence != reader->position.tail - 1) {
+        reader->out_of_order++;
+    }
+    return true;
+}
+
+static void* ring_stress_reader_thread(void* context) {
+    RingStressReader* reader = context;
+    RingStress* stress = reader->stress;
+
+    ring_stress_reader_init(reader, stress);
+    atomic_fetch_add(&stress->readers_started, 1);
+
+    while(true) {
+        const bool done = atomic_load(&stress->done);
+        if(!ring_stress_reader_step(reader)) {
+            if(done) {
+                break;
+            }
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void ring_stress_interrupt(int signal) {
+    (void)signal;
+    SonicMeterSample sample;
+
+    // Bursts of up to one and a half rings, so the reader is often lapped in the middle of a copy
+    uint32_t sequence =
+        atomic_load_explicit(&ring_stress_interrupt_sequence, memory_order_relaxed);
+    const uint32_t burst = sequence % (ring_stress_interrupt_ring->mask * 3 / 2 + 1) + 1;
+    for(uint32_t i = 0; i < burst; i++, sequence++) {
+        ring_stress_fill(&sample, sequence);
+        sonicmeter_ring_write(ring_stress_interrupt_ring, &sample);
+    }
+    atomic_store_explicit(&ring_stress_interrupt_sequence, sequence, memory_order_relaxed);
+    atomic_fetch_add_explicit(&ring_stress_interrupt_count, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief      Publish from a timer signal, read on this thread.
+ * @param      stress  The ring.
+ * @param      reader  The one reader.
+ * @return     Samples published.
+*/
+static uint32_t ring_stress_run_interrupt(RingStress* stress, RingStressReader* reader) {
+    ring_stress_interrupt_ring = stress->ring;
+    atomic_init(&ring_stress_interrupt_sequence, 0);
+    atomic_init(&ring_stress_interrupt_count, 0);
+    ring_stress_reader_init(reader, stress);
+
+    struct sigaction action = {.sa_handler = ring_stress_interrupt};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGALRM, &action, NULL);
+    struct itimerval timer = {
+        .it_interval = {.tv_usec = RING_STRESS_INTERRUPT_US},
+        .it_value = {.tv_usec = RING_STRESS_INTERRUPT_US},
+    };
+    setitimer(ITIMER_REAL, &timer, NULL);
+
+    while(atomic_load_explicit(&ring_stress_interrupt_count, memory_order_relaxed) <
+          RING_STRESS_INTERRUPTS) {
+        ring_stress_reader_step(reader);
+    }
+
+    timer = (struct itimerval){0};
+    setitimer(ITIMER_REAL, &timer, NULL);
+    signal(SIGALRM, SIG_DFL);
+    while(ring_stress_reader_step(reader)) {
+    }
+    return atomic_load(&ring_stress_interrupt_sequence);
+}
+
+static void ring_stress_run(uint32_t capacity, uint32_t samples, RingStressMode mode) {
+    SonicMeterArena* arena = sonicmeter_arena_alloc(sizeof(SonicMeterSample) * capacity);
+    RingStress stress = {.ring = sonicmeter_ring_alloc(arena, capacity)};
+    RingStressReader readers[RING_STRESS_READERS] = {0};
+    pthread_t threads[RING_STRESS_READERS];
+    size_t reader_count = COUNT_OF(readers);
+    atomic_init(&stress.done, false);
+    atomic_init(&stress.readers_started, 0);
+    const uint64_t start_ns = test_ns();
+
+    if(mode == RingStressModeInterrupt) {
+        reader_count = 1;
+        samples = ring_stress_run_interrupt(&stress, &readers[0]);
+    } else {
+        for(size_t i = 0; i < reader_count; i++) {
+            readers[i].stress = &stress;
+            pthread_create(&threads[i], NULL, ring_stress_reader_thread, &readers[i]);
+        }
+        while(atomic_load(&stress.readers_started) < reader_count) {
+            sched_yield();
+        }
+
+        // The producer is this thread, the worker never waits on the readers either
+        SonicMeterSample sample;
+        for(uint32_t sequence = 0; sequence < samples; sequence++) {
+            ring_stress_fill(&sample, sequence);
+            sonicmeter_ring_write(stress.ring, &sample);
+            if(mode == RingStressModePaced && sequence % RING_STRESS_BURST == 0) {
+                sched_yield();
+            }
+        }
+        atomic_store(&stress.done, true);
+        for(size_t i = 0; i < reader_count; i++) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    const uint64_t ns = test_ns() - start_ns;
+
+    uint32_t read = 0;
+    uint32_t dropped = 0;
+    for(size_t i = 0; i < reader_count; i++) {
+        TEST_CHECK_EQ(readers[i].torn, 0);
+        TEST_CHECK_EQ(readers[i].out_of_order, 0);
+        TEST_CHECK_EQ(readers[i].read + readers[i].position.dropped, samples - readers[i].start);
+        read += readers[i].read;
+        dropped += readers[i].position.dropped;
+    }
+
+    printf(
+        "ring of %" PRIu32 ", %s: %" PRIu32 " samples to %zu readers, %" PRIu32 " read, %" PRIu32
+        " dropped, %.1f ns per sample\n",
+        capacity,
+        ring_stress_mode_names[mode],
+        samples,
+        reader_count,
+        read,
+        dropped,
+        (double)ns / samples);
+
+    sonicmeter_ring_free(stress.ring);
+    sonicmeter_arena_free(arena);
+}
+
+int main(int argc, char** argv) {
+    const uint32_t samples = argc > 1 ? strtoul(argv[1], NULL, 0) : RING_STRESS_SAMPLES;
+    const uint32_t capacities[] = {4, 64};
+    for(size_t i = 0; i < COUNT_OF(capacities); i++) {
+        ring_stress_run(capacities[i], samples, RingStressModeFlatOut);
+        ring_stress_run(capacities[i], samples / 10, RingStressModePaced);
+        ring_stress_run(capacities[i], samples, RingStressModeInterrupt);
+    }
+    return test_done("ring_stress");
+}
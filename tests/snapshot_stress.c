@@ -0,0 +1,258 @@
+/**
+ * Stress test of the snapshot: one writer, one reader.
+ *
+ * The writer publishes values whose every word is derived from the sequence number. The reader
+ * checks every copy it gets:
+ *  - torn: every word agrees with the sequence number, checked twice with the writer running in
+ *    between, the copy must not change until the next read
+ *  - order: the sequence never goes back, a reader only ever sees newer copies
+ * and at the end that the last copy read is the last one published.
+ *
+ * Runs four ways:
+ *  - threads, flat out: the writer thread never waits, the reader spins on another core
+ *  - threads, paced: the writer yields every few copies, for a tenth of them, so the threads
+ *    interleave even on a single core
+ *  - interrupt writer: the writer is a timer signal handler preempting the reader at any
+ *    instruction
+ *  - interrupt reader: the reader is the signal handler, the way the GUI thread preempts the app
+ *    thread on the single core of the device
+ * Both interrupt modes run for a fixed number of signals.
+ *
+ *     snapshot_stress [publishes]
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "test.h"
+#include "sonicmeter_snapshot.h"
+
+#define SNAPSHOT_STRESS_PUBLISHES 20000000
+#define SNAPSHOT_STRESS_WORDS 16 // Size of the value, about a frame of text
+#define SNAPSHOT_STRESS_BURST 5 // Copies between two yields of the paced writer
+#define SNAPSHOT_STRESS_INTERRUPT_US 20 // Period of the signal
+#define SNAPSHOT_STRESS_INTERRUPTS 50000 // Signals of the interrupt modes
+
+typedef enum {
+    SnapshotStressModeFlatOut,
+    SnapshotStressModePaced,
+    SnapshotStressModeInterruptWriter,
+    SnapshotStressModeInterruptReader,
+} SnapshotStressMode;
+
+static const char* const snapshot_stress_mode_names[] = {
+    "flat out",
+    "paced",
+    "interrupt writer",
+    "interrupt reader",
+};
+
+typedef struct {
+    uint32_t words[SNAPSHOT_STRESS_WORDS];
+} SnapshotStressValue;
+
+typedef struct {
+    SonicMeterSnapshot* snapshot;
+    atomic_bool done;
+    atomic_bool reader_started;
+    uint32_t reads;
+    uint32_t changes; // Reads that got a newer copy
+    uint32_t last; // Sequence of the last copy read
+    uint32_t torn;
+    uint32_t out_of_order;
+} SnapshotStress;
+
+// The signal handler only sees globals
+static SnapshotStress* snapshot_stress_interrupted;
+static atomic_uint snapshot_stress_sequence;
+static atomic_uint snapshot_stress_interrupt_count;
+
+static void snapshot_stress_fill(SnapshotStressValue* value, uint32_t sequence) {
+    value->words[0] = sequence;
+    for(uint32_t i = 1; i < SNAPSHOT_STRESS_WORDS; i++) {
+        value->words[i] = sequence * (2 * i + 1) + (sequence >> i);
+    }
+}
+
+static bool snapshot_stress_check(const SnapshotStressValue* value) {
+    SnapshotStressValue expected;
+    snapshot_stress_fill(&expected, value->words[0]);
+    for(uint32_t i = 1; i < SNAPSHOT_STRESS_WORDS; i++) {
+        if(value->words[i] != expected.words[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void snapshot_stress_publish(SnapshotStress* stress, uint32_t sequence) {
+    SnapshotStressValue value;
+    snapshot_stress_fill(&value, sequence);
+    sonicmeter_snapshot_publish(stress->snapshot, &value);
+}
+
+static void snapshot_stress_read(SnapshotStress* stress) {
+    const SnapshotStressValue* value = sonicmeter_snapshot_read(stress->snapshot);
+    const uint32_t sequence = value->words[0];
+
+    stress->reads++;
+    if(!snapshot_stress_check(value)) {
+        stress->torn++;
+    }
+    if(sequence < stress->last) {
+        stress->out_of_order++;
+    } else if(sequence > stress->last) {
+        stress->changes++;
+    }
+    stress->last = sequence;
+
+    // Still the same copy after the writer had a chance to run
+    sched_yield();
+    if(value->words[0] != sequence || !snapshot_stress_check(value)) {
+        stress->torn++;
+    }
+}
+
+static void* snapshot_stress_reader_thread(void* context) {
+    SnapshotStress* stress = context;
+    atomic_store(&stress->reader_started, true);
+    while(!atomic_load(&stress->done)) {
+        snapshot_stress_read(stress);
+    }
+    return NULL;
+}
+
+static void snapshot_stress_interrupt_writer(int signal) {
+    (void)signal;
+    // Bursts of one to three copies, so the reader sometimes misses some and sometimes none
+    uint32_t sequence = atomic_load_explicit(&snapshot_stress_sequence, memory_order_relaxed);
+    const uint32_t burst = sequence % 3 + 1;
+    for(uint32_t i = 0; i < burst; i++) {
+        snapshot_stress_publish(snapshot_stress_interrupted, ++sequence);
+    }
+    atomic_store_explicit(&snapshot_stress_sequence, sequence, memory_order_relaxed);
+    atomic_fetch_add_explicit(&snapshot_stress_interrupt_count, 1, memory_order_relaxed);
+}
+
+static void snapshot_stress_interrupt_reader(int signal) {
+    (void)signal;
+    SnapshotStress* stress = snapshot_stress_interrupted;
+    const SnapshotStressValue* value = sonicmeter_snapshot_read(stress->snapshot);
+    stress->reads++;
+    if(!snapshot_stress_check(value)) {
+        stress->torn++;
+    }
+    if(value->words[0] < stress->last) {
+        stress->out_of_order++;
+    } else if(value->words[0] > stress->last) {
+        stress->changes++;
+    }
+    stress->last = value->words[0];
+    atomic_fetch_add_explicit(&snapshot_stress_interrupt_count, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief      Run one side from a timer signal, the other on this thread.
+ * @param      stress  The snapshot.
+ * @param      mode    Which side the signal runs.
+ * @return     Copies published.
+*/
+static uint32_t snapshot_stress_run_interrupt(SnapshotStress* stress, SnapshotStressMode mode) {
+    snapshot_stress_interrupted = stress;
+    atomic_init(&snapshot_stress_sequence, 0);
+    atomic_init(&snapshot_stress_interrupt_count, 0);
+
+    struct sigaction action = {
+        .sa_handler = mode == SnapshotStressModeInterruptWriter ?
+                          snapshot_stress_interrupt_writer :
+                          snapshot_stress_interrupt_reader,
+    };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGALRM, &action, NULL);
+    struct itimerval timer = {
+        .it_interval = {.tv_usec = SNAPSHOT_STRESS_INTERRUPT_US},
+        .it_value = {.tv_usec = SNAPSHOT_STRESS_INTERRUPT_US},
+    };
+    setitimer(ITIMER_REAL, &timer, NULL);
+
+    uint32_t sequence = 0;
+    while(atomic_load_explicit(&snapshot_stress_interrupt_count, memory_order_relaxed) <
+          SNAPSHOT_STRESS_INTERRUPTS) {
+        if(mode == SnapshotStressModeInterruptWriter) {
+            snapshot_stress_read(stress);
+        } else {
+            snapshot_stress_publish(stress, ++sequence);
+        }
+    }
+
+    timer = (struct itimerval){0};
+    setitimer(ITIMER_REAL, &timer, NULL);
+    signal(SIGALRM, SIG_DFL);
+    if(mode == SnapshotStressModeInterruptWriter) {
+        sequence = atomic_load(&snapshot_stress_sequence);
+    }
+    snapshot_stress_read(stress);
+    return sequence;
+}
+
+static void snapshot_stress_run(uint32_t publishes, SnapshotStressMode mode) {
+    SonicMeterArena* arena = sonicmeter_arena_alloc(3 * sizeof(SnapshotStressValue));
+    SnapshotStress stress = {
+        .snapshot = sonicmeter_snapshot_alloc(arena, sizeof(SnapshotStressValue)),
+    };
+    atomic_init(&stress.done, false);
+    atomic_init(&stress.reader_started, false);
+    const uint64_t start_ns = test_ns();
+
+    // The copies start zeroed, which is a valid copy of sequence 0
+    if(mode == SnapshotStressModeInterruptWriter || mode == SnapshotStressModeInterruptReader) {
+        publishes = snapshot_stress_run_interrupt(&stress, mode);
+    } else {
+        pthread_t thread;
+        pthread_create(&thread, NULL, snapshot_stress_reader_thread, &stress);
+        while(!atomic_load(&stress.reader_started)) {
+            sched_yield();
+        }
+
+        for(uint32_t sequence = 1; sequence <= publishes; sequence++) {
+            snapshot_stress_publish(&stress, sequence);
+            if(mode == SnapshotStressModePaced && sequence % SNAPSHOT_STRESS_BURST == 0) {
+                sched_yield();
+            }
+        }
+        atomic_store(&stress.done, true);
+        pthread_join(thread, NULL);
+        snapshot_stress_read(&stress);
+    }
+    const uint64_t ns = test_ns() - start_ns;
+
+    TEST_CHECK_EQ(stress.torn, 0);
+    TEST_CHECK_EQ(stress.out_of_order, 0);
+    TEST_CHECK_EQ(stress.last, publishes);
+    TEST_CHECK(stress.changes > 0);
+
+    printf(
+        "%s: %" PRIu32 " copies published, %" PRIu32 " reads, %" PRIu32
+        " got a newer copy, %.1f ns per copy\n",
+        snapshot_stress_mode_names[mode],
+        publishes,
+        stress.reads,
+        stress.changes,
+        (double)ns / publishes);
+
+    sonicmeter_snapshot_free(stress.snapshot);
+    sonicmeter_arena_free(arena);
+}
+
+int main(int argc, char** argv) {
+    const uint32_t publishes = argc > 1 ? strtoul(argv[1], NULL, 0) : SNAPSHOT_STRESS_PUBLISHES;
+    snapshot_stress_run(publishes, SnapshotStressModeFlatOut);
+    snapshot_stress_run(publishes / 10, SnapshotStressModePaced);
+    snapshot_stress_run(publishes, SnapshotStressModeInterruptWriter);
+    snapshot_stress_run(publishes, SnapshotStressModeInterruptReader);
+    return test_done("snapshot_stress");
+}
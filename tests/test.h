@@ -0,0 +1,90 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * Checks and timing of the host tests and benchmarks.
+ *
+ * A failed check prints where it failed and the test carries on, so one run shows every failure.
+ * test_done gives the exit status. Each test is a single program, the state is per program.
+*/
+
+#ifndef COUNT_OF
+#define COUNT_OF(x) (sizeof(x) / sizeof(x[0]))
+#endif
+
+static unsigned test_checks = 0;
+static unsigned test_failures = 0;
+
+#define TEST_CHECK(cond)                                                    \
+    do {                                                                    \
+        test_checks++;                                                      \
+        if(!(cond)) {                                                       \
+            test_failures++;                                                \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        }                                                                   \
+    } while(0)
+
+#define TEST_CHECK_EQ(a, b)                                       \
+    do {                                                          \
+        const long long test_a = (long long)(a);                  \
+        const long long test_b = (long long)(b);                  \
+        test_checks++;                                            \
+        if(test_a != test_b) {                                    \
+            test_failures++;                                      \
+            printf(                                               \
+                "%s:%d: check failed: %s == %s (%lld != %lld)\n", \
+                __FILE__,                                         \
+                __LINE__,                                         \
+                #a,                                               \
+                #b,                                               \
+                test_a,                                           \
+                test_b);                                          \
+        }                                                         \
+    } while(0)
+
+/**
+ * @brief      Report the checks.
+ * @param      name  Name of the test.
+ * @return     Exit status, 0 if every check passed.
+*/
+static inline int test_done(const char* name) {
+    printf(
+        "%s: %u checks, %u failed%s\n",
+        name,
+        test_checks,
+        test_failures,
+        test_failures ? "" : ", ok");
+    return test_failures ? 1 : 0;
+}
+
+/**
+ * @brief      Get the monotonic clock.
+ * @return     Nanoseconds.
+*/
+static inline uint64_t test_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000U + ts.tv_nsec;
+}
+
+/**
+ * @brief      Get the host cycle counter.
+ * @details    The time stamp counter on x86, nanoseconds elsewhere. Host figures are for comparing
+ *             code paths with each other, the device figures come from the probes.
+ * @return     Cycles.
+*/
+static inline uint64_t test_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return test_ns();
+#endif
+}
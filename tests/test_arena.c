@@ -0,0 +1,117 @@
+/**
+ * Tests of the memory arena.
+ *
+ * Pieces of every small size: aligned, zeroed, not overlapping, accounted for with their
+ * rounding, and an arena filled to the last byte. Taking more than is left must abort, sizes
+ * that wrap when rounded included, so each of those runs in a child process.
+*/
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "sonicmeter_arena.h"
+
+#define TEST_PIECES 200
+#define TEST_DIRT 0xA5
+
+typedef struct {
+    uint8_t* piece;
+    size_t size;
+} TestArenaPiece;
+
+static void test_arena_pieces(void) {
+    static TestArenaPiece pieces[TEST_PIECES];
+    size_t total = 0;
+    for(size_t i = 0; i < TEST_PIECES; i++) {
+        pieces[i].size = i % 41;
+        total += SONICMETER_ARENA_ROUND(pieces[i].size);
+    }
+
+    // Leave dirt where the arena block is likely to land, pieces must be zeroed anyway
+    uint8_t* dirt = malloc(total);
+    memset(dirt, TEST_DIRT, total);
+    free(dirt);
+
+    SonicMeterArena* arena = sonicmeter_arena_alloc(total);
+    TEST_CHECK_EQ(sonicmeter_arena_get_size(arena), total);
+    TEST_CHECK_EQ(sonicmeter_arena_get_used(arena), 0);
+
+    uint32_t misaligned = 0;
+    uint32_t dirty = 0;
+    uint32_t overlapping = 0;
+    size_t used = 0;
+    for(size_t i = 0; i < TEST_PIECES; i++) {
+        pieces[i].piece = sonicmeter_arena_take(arena, pieces[i].size);
+        misaligned += (uintptr_t)pieces[i].piece % SONICMETER_ARENA_ALIGN != 0;
+        for(size_t b = 0; b < pieces[i].size; b++) {
+            dirty += pieces[i].piece[b] != 0;
+        }
+        // Marked with its number, a later piece over it would change that
+        memset(pieces[i].piece, (int)i, pieces[i].size);
+        used += SONICMETER_ARENA_ROUND(pieces[i].size);
+        TEST_CHECK_EQ(sonicmeter_arena_get_used(arena), used);
+    }
+    for(size_t i = 0; i < TEST_PIECES; i++) {
+        for(size_t b = 0; b < pieces[i].size; b++) {
+            overlapping += pieces[i].piece[b] != (uint8_t)i;
+        }
+    }
+    TEST_CHECK_EQ(misaligned, 0);
+    TEST_CHECK_EQ(dirty, 0);
+    TEST_CHECK_EQ(overlapping, 0);
+
+    // Full to the last byte, an empty piece still fits
+    TEST_CHECK_EQ(sonicmeter_arena_get_used(arena), sonicmeter_arena_get_size(arena));
+    TEST_CHECK(sonicmeter_arena_take(arena, 0) != NULL);
+    TEST_CHECK_EQ(sonicmeter_arena_get_used(arena), total);
+    sonicmeter_arena_free(arena);
+}
+
+/**
+ * @brief      Take pieces in a child process.
+ * @param      size   Size of the arena.
+ * @param      first  Size of the first piece.
+ * @param      then   Size of the second piece.
+ * @return     true if the child aborted, false if it got both pieces.
+*/
+static bool test_arena_aborts(size_t size, size_t first, size_t then) {
+    fflush(stdout);
+    const pid_t child = fork();
+    if(child == 0) {
+        SonicMeterArena* arena = sonicmeter_arena_alloc(size);
+        sonicmeter_arena_take(arena, first);
+        sonicmeter_arena_take(arena, then);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    return WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+}
+
+static void test_arena_exhaustion(void) {
+    // Fits exactly, the rounding of the first piece included
+    TEST_CHECK(!test_arena_aborts(64, 60, 0));
+    TEST_CHECK(!test_arena_aborts(64, 56, 8));
+    TEST_CHECK(!test_arena_aborts(64, 57, 0));
+
+    // One byte too many, the rounding of the first piece takes the room
+    TEST_CHECK(test_arena_aborts(64, 64, 1));
+    TEST_CHECK(test_arena_aborts(64, 57, 1));
+    TEST_CHECK(test_arena_aborts(64, 0, 65));
+
+    // Sizes that wrap to a small number when rounded
+    TEST_CHECK(test_arena_aborts(64, 8, SIZE_MAX));
+    TEST_CHECK(test_arena_aborts(64, 8, SIZE_MAX - SONICMETER_ARENA_ALIGN + 2));
+    TEST_CHECK(test_arena_aborts(64, 0, SIZE_MAX - 56));
+}
+
+int main(void) {
+    test_arena_pieces();
+    test_arena_exhaustion();
+    return test_done("arena");
+}
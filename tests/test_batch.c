@@ -0,0 +1,238 @@
+/**
+ * Tests of the batch command arguments and bookkeeping.
+ *
+ * Argument strings that must parse and ones that must not, name matching, then runs of known
+ * samples against the exact summary text, and the largest numbers the outputs can hold against
+ * the buffer sizes the header promises are enough.
+*/
+
+#include <string.h>
+
+#include "test.h"
+#include "sonicmeter_batch.h"
+
+static void test_batch_parse_good(void) {
+    SonicMeterBatchArgs args;
+    const char* error;
+
+    // Defaults
+    TEST_CHECK(sonicmeter_batch_parse("", &args, &error));
+    TEST_CHECK(error == NULL);
+    TEST_CHECK_EQ(args.count, SONICMETER_BATCH_COUNT_DEFAULT);
+    TEST_CHECK_EQ(args.rate_hz, 0);
+    TEST_CHECK_EQ(args.trigger[0], '\0');
+    TEST_CHECK_EQ(args.echo[0], '\0');
+    TEST_CHECK_EQ(args.sensor[0], '\0');
+    TEST_CHECK_EQ(args.output, SonicMeterBatchOutputSummary);
+
+    // Every key, any order, extra spaces
+    TEST_CHECK(sonicmeter_batch_parse(
+        "  out=raw sensor=us100  n=5 trig=PA7 echo=pb2 rate=10 ", &args, &error));
+    TEST_CHECK_EQ(args.count, 5);
+    TEST_CHECK_EQ(args.rate_hz, 10);
+    TEST_CHECK(strcmp(args.trigger, "PA7") == 0);
+    TEST_CHECK(strcmp(args.echo, "pb2") == 0);
+    TEST_CHECK(strcmp(args.sensor, "us100") == 0);
+    TEST_CHECK_EQ(args.output, SonicMeterBatchOutputRaw);
+
+    // The limits themselves, and the last of a repeated key
+    TEST_CHECK(sonicmeter_batch_parse("n=1 n=1000000 rate=16 out=summary", &args, &error));
+    TEST_CHECK_EQ(args.count, SONICMETER_BATCH_COUNT_MAX);
+    TEST_CHECK_EQ(args.rate_hz, SONICMETER_BATCH_RATE_MAX);
+    TEST_CHECK_EQ(args.output, SonicMeterBatchOutputSummary);
+
+    // The longest name that fits
+    TEST_CHECK(sonicmeter_batch_parse("sensor=ABCDEFGHIJK", &args, &error));
+    TEST_CHECK_EQ(strlen(args.sensor), SONICMETER_BATCH_NAME_SIZE - 1);
+}
+
+static void test_batch_parse_bad(void) {
+    static const char* const bad[] = {
+        "n=0",
+        "n=1000001",
+        "n=4294967296", // Past 32 bits
+        "n=99999999999", // Past 10 digits
+        "n=",
+        "n=-1",
+        "n=5x",
+        "n=5=6",
+        "n=0x10",
+        "rate=17", // Faster than the worker triggers a sensor
+        "rate=1000",
+        "rate=",
+        "trig=",
+        "echo=",
+        "sensor=ABCDEFGHIJKL", // One character too many
+        "trig=PA7PA7PA7PA7",
+        "out=csv",
+        "out=",
+        "out=rawx",
+        "n",
+        "=5",
+        "count=5",
+        "nn=5",
+        "N=5",
+        "n=5 bogus",
+    };
+    SonicMeterBatchArgs args;
+    const char* error;
+
+    for(size_t i = 0; i < COUNT_OF(bad); i++) {
+        error = NULL;
+        const bool parsed = sonicmeter_batch_parse(bad[i], &args, &error);
+        if(parsed || error == NULL) {
+            printf("parsed: \"%s\"\n", bad[i]);
+        }
+        TEST_CHECK(!parsed);
+        TEST_CHECK(error != NULL);
+    }
+}
+
+static void test_batch_names(void) {
+    TEST_CHECK(sonicmeter_batch_name_match("us100", "US-100"));
+    TEST_CHECK(sonicmeter_batch_name_match("US-100", "US-100"));
+    TEST_CHECK(sonicmeter_batch_name_match("u-s-1-0-0", "US-100"));
+    TEST_CHECK(sonicmeter_batch_name_match("jsn-sr04t", "JSN-SR04T"));
+    TEST_CHECK(sonicmeter_batch_name_match("pa7", "PA7"));
+    TEST_CHECK(sonicmeter_batch_name_match("", ""));
+    TEST_CHECK(sonicmeter_batch_name_match("-", ""));
+
+    TEST_CHECK(!sonicmeter_batch_name_match("us10", "US-100"));
+    TEST_CHECK(!sonicmeter_batch_name_match("us1000", "US-100"));
+    TEST_CHECK(!sonicmeter_batch_name_match("hc", "HC-SR04"));
+    TEST_CHECK(!sonicmeter_batch_name_match("pa6", "PA7"));
+    TEST_CHECK(!sonicmeter_batch_name_match("", "PA7"));
+    TEST_CHECK(!sonicmeter_batch_name_match("us_100", "US-100"));
+}
+
+static void test_batch_period(void) {
+    TEST_CHECK_EQ(sonicmeter_batch_period_ms(0), 0);
+    TEST_CHECK_EQ(sonicmeter_batch_period_ms(1), 1000);
+    TEST_CHECK_EQ(sonicmeter_batch_period_ms(10), 100);
+    // Not below the 60 ms the worker keeps between two triggers of a sensor
+    TEST_CHECK(sonicmeter_batch_period_ms(SONICMETER_BATCH_RATE_MAX) >= 60);
+}
+
+static SonicMeterSample test_batch_sample(uint64_t timestamp, SonicMeterCaptureResult result) {
+    return (SonicMeterSample){.timestamp = timestamp, .result = result};
+}
+
+static void test_batch_summary(void) {
+    SonicMeterBatch batch;
+    SonicMeterSample sample;
+    char summary[SONICMETER_BATCH_SUMMARY_SIZE];
+
+    // Ten samples at 10 Hz past 2^32 us, where 32 bit timestamps wrapped, seven good ones 2 mm
+    // apart
+    const uint64_t start = UINT32_MAX - 250000;
+    sonicmeter_batch_init(&batch, 10);
+    for(uint32_t i = 0; i < 10; i++) {
+        sample = test_batch_sample(start + i * 100000, SonicMeterCaptureResultOk);
+        sample.distance_um = 1000000 + i * 2000;
+        if(i >= 7) {
+            sample.result = SonicMeterCaptureResultNoEcho + (i - 7);
+        }
+        TEST_CHECK_EQ(sonicmeter_batch_add(&batch, &sample), i == 9);
+    }
+    // Done, more samples do not count
+    TEST_CHECK(sonicmeter_batch_add(&batch, &sample));
+    TEST_CHECK_EQ(batch.samples, 10);
+    TEST_CHECK_EQ(batch.elapsed_us, 900000);
+    batch.dropped = 3;
+
+    sonicmeter_batch_format_summary(&batch, summary, sizeof(summary));
+    TEST_CHECK(
+        strcmp(
+            summary,
+            "samples 10 ok 7 no_echo 1 out_of_range 1 line_high 1 dropped 3\r\n"
+            "rate_hz 10.0\r\n"
+            "distance_mm min 1000 p50 1007 p99 1012 max 1012 mean 1006.0 sd 4.0\r\n") == 0);
+
+    // Nothing good, a single sample has no rate
+    sonicmeter_batch_init(&batch, 5);
+    sample = test_batch_sample(1000, SonicMeterCaptureResultNoEcho);
+    TEST_CHECK(!sonicmeter_batch_add(&batch, &sample));
+    sonicmeter_batch_format_summary(&batch, summary, sizeof(summary));
+    TEST_CHECK(
+        strcmp(
+            summary,
+            "samples 1 ok 0 no_echo 1 out_of_range 0 line_high 0 dropped 0\r\n"
+            "rate_hz -\r\n"
+            "distance_mm -\r\n") == 0);
+
+    // Cut off, still terminated
+    char small[16];
+    sonicmeter_batch_format_summary(&batch, small, sizeof(small));
+    TEST_CHECK(strcmp(small, "samples 1 ok 0 ") == 0);
+}
+
+static void test_batch_sizes(void) {
+    // The largest numbers each output can show still fit the promised buffers
+    static SonicMeterBatch batch;
+    char summary[SONICMETER_BATCH_SUMMARY_SIZE];
+    char line[SONICMETER_BATCH_LINE_SIZE];
+
+    sonicmeter_batch_init(&batch, SONICMETER_BATCH_COUNT_MAX);
+    for(uint32_t i = 0; i < 2; i++) {
+        SonicMeterSample sample = test_batch_sample(i, SonicMeterCaptureResultOk);
+        sample.distance_um = i ? UINT32_MAX : 0;
+        sonicmeter_batch_add(&batch, &sample);
+    }
+    batch.samples = SONICMETER_BATCH_COUNT_MAX;
+    for(size_t i = 0; i < COUNT_OF(batch.results); i++) {
+        batch.results[i] = SONICMETER_BATCH_COUNT_MAX;
+    }
+    batch.dropped = UINT32_MAX;
+    sonicmeter_batch_format_summary(&batch, summary, sizeof(summary));
+    TEST_CHECK(strlen(summary) < sizeof(summary) - 1);
+    TEST_CHECK(strcmp(summary + strlen(summary) - 2, "\r\n") == 0);
+
+    const SonicMeterSample sample = {
+        .sequence = UINT32_MAX,
+        .sensor = SONICMETER_SAMPLE_SENSORS_MAX - 1,
+        .timestamp = UINT64_MAX,
+        .ticks = UINT32_MAX,
+        .filtered_um = UINT32_MAX,
+        .flags = UINT32_MAX,
+        .result = SonicMeterCaptureResultLineHigh,
+    };
+    sonicmeter_batch_format_sample(&sample, line, sizeof(line));
+    TEST_CHECK(strlen(line) < sizeof(line) - 1);
+    TEST_CHECK(strncmp(line, "4294967295,18446744073709551615,", 32) == 0);
+
+    // Timestamps past 32 bits, zeros inside the low nine digits
+    static const struct {
+        uint64_t timestamp;
+        const char* text;
+    } timestamps[] = {
+        {4294967296ULL, "0,4294967296,0,0,0,0,0"},
+        {5000000007ULL, "0,5000000007,0,0,0,0,0"},
+        {1000000000000000000ULL, "0,1000000000000000000,0,0,0,0,0"},
+    };
+    for(size_t i = 0; i < COUNT_OF(timestamps); i++) {
+        const SonicMeterSample wide = {.timestamp = timestamps[i].timestamp};
+        sonicmeter_batch_format_sample(&wide, line, sizeof(line));
+        TEST_CHECK(strcmp(line, timestamps[i].text) == 0);
+    }
+
+    const SonicMeterSample small = {
+        .sequence = 7,
+        .sensor = 2,
+        .timestamp = 123456,
+        .ticks = 4000,
+        .filtered_um = 1006000,
+        .flags = SonicMeterSampleFlagRejected,
+    };
+    sonicmeter_batch_format_sample(&small, line, sizeof(line));
+    TEST_CHECK(strcmp(line, "7,123456,4000,1006000,0,1,2") == 0);
+}
+
+int main(void) {
+    test_batch_parse_good();
+    test_batch_parse_bad();
+    test_batch_names();
+    test_batch_period();
+    test_batch_summary();
+    test_batch_sizes();
+    return test_done("batch");
+}
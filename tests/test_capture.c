@@ -0,0 +1,235 @@
+/**
+ * Tests of the echo capture state machine.
+*/
+
+#include "test.h"
+#include "sonicmeter_capture.h"
+
+#define TEST_TIMEOUT 1000
+
+static void test_capture_echo(void) {
+    SonicMeterCapture capture;
+    sonicmeter_capture_reset(&capture);
+    TEST_CHECK(!sonicmeter_capture_is_busy(&capture));
+
+    TEST_CHECK(sonicmeter_capture_arm(&capture, false, 100));
+    TEST_CHECK(sonicmeter_capture_is_busy(&capture));
+    TEST_CHECK(!sonicmeter_capture_edge(&capture, true, 150));
+    TEST_CHECK_EQ(capture.state, SonicMeterCaptureStateWaitFall);
+    TEST_CHECK(sonicmeter_capture_edge(&capture, false, 400));
+    TEST_CHECK(!sonicmeter_capture_is_busy(&capture));
+    TEST_CHECK_EQ(capture.result, SonicMeterCaptureResultOk);
+    TEST_CHECK_EQ(sonicmeter_capture_get_width(&capture), 250);
+    TEST_CHECK_EQ(capture.spurious_edges, 0);
+
+    // A finished capture does not expire
+    TEST_CHECK(!sonicmeter_capture_expire(&capture, 100 + TEST_TIMEOUT, TEST_TIMEOUT));
+    TEST_CHECK_EQ(capture.result, SonicMeterCaptureResultOk);
+}
+
+static void test_capture_wrap(void) {
+    SonicMeterCapture capture;
+    sonicmeter_capture_reset(&capture);
+
+    // The cycle counter wraps between the edges
+    TEST_CHECK(sonicmeter_capture_arm(&capture, false, UINT32_MAX - 100));
+    sonicmeter_capture_edge(&capture, true, UINT32_MAX - 50);
+    TEST_CHECK(sonicmeter_capture_edge(&capture, false, 49));
+    TEST_CHECK_EQ(sonicmeter_capture_get_width(&capture), 100);
+}
+
+static void test_capture_spurious(void) {
+    SonicMeterCapture capture;
+    sonicmeter_capture_reset(&capture);
+
+    // Nobody asked for an edge
+    TEST_CHECK(!sonicmeter_capture_edge(&capture, true, 10));
+    TEST_CHECK_EQ(capture.spurious_edges, 1);
+
+    // Falling edges before the echo are glitches
+    sonicmeter_capture_arm(&capture, false, 100);
+    TEST_CHECK(!sonicmeter_capture_edge(&capture, false, 101));
+    TEST_CHECK(!sonicmeter_capture_edge(&capture, false, 102));
+    TEST_CHECK_EQ(capture.state, SonicMeterCaptureStateWaitRise);
+    TEST_CHECK_EQ(capture.spurious_edges, 3);
+
+    // A bounce on the rise keeps the first rising edge
+    sonicmeter_capture_edge(&capture, true, 200);
+    TEST_CHECK(!sonicmeter_capture_edge(&capture, true, 210));
+    TEST_CHECK_EQ(capture.spurious_edges, 4);
+    TEST_CHECK(sonicmeter_capture_edge(&capture, false, 500));
+    TEST_CHECK_EQ(sonicmeter_capture_get_width(&capture), 300);
+
+    // Edges after the capture finished do not change it
+    TEST_CHECK(!sonicmeter_capture_edge(&capture, true, 600));
+    TEST_CHECK(!sonicmeter_capture_edge(&capture, false, 700));
+    TEST_CHECK_EQ(capture.spurious_edges, 6);
+    TEST_CHECK_EQ(sonicmeter_capture_get_width(&capture), 300);
+
+    // Arming again keeps counting, reset clears the count
+    sonicmeter_capture_arm(&capture, false, 1000);
+    TEST_CHECK_EQ(capture.spurious_edges, 6);
+    sonicmeter_capture_reset(&capture);
+    TEST_CHECK_EQ(capture.spurious_edges, 0);
+}
+
+static void test_capture_timeout(void) {
+    SonicMeterCapture capture;
+    sonicmeter_capture_reset(&capture);
+
+    // Not expired before the timeout, from the arm call
+    sonicmeter_capture_arm(&capture, false, 100);
+    TEST_CHECK(!sonicmeter_capture_expire(&capture, 100 + TEST_TIMEOUT - 1, TEST_TIMEOUT));
+    TEST_CHECK(sonicmeter_capture_is_busy(&capture));
+
+    // No rising edge at all
+    TEST_CHECK(sonicmeter_capture_expire(&capture, 100 + TEST_TIMEOUT, TEST_TIMEOUT));
+    TEST_CHECK(!sonicmeter_capture_is_busy(&capture));
+    TEST_CHECK_EQ(capture.result, SonicMeterCaptureResultNoEcho);
+    TEST_CHECK_EQ(sonicmeter_capture_get_width(&capture), 0);
+    TEST_CHECK(!sonicmeter_capture_expire(&capture, 200 + TEST_TIMEOUT, TEST_TIMEOUT));
+
+    // The echo started but is longer than the timeout
+    sonicmeter_capture_arm(&capture, false, 5000);
+    sonicmeter_capture_edge(&capture, true, 5100);
+    TEST_CHECK(sonicmeter_capture_expire(&capture, 5000 + TEST_TIMEOUT, TEST_TIMEOUT));
+    TEST_CHECK_EQ(capture.result, SonicMeterCaptureResultOutOfRange);
+    TEST_CHECK_EQ(sonicmeter_capture_get_width(&capture), 0);
+
+    // The fall of the expired echo is spurious
+    TEST_CHECK(!sonicmeter_capture_edge(&capture, false, 5000 + 2 * TEST_TIMEOUT));
+    TEST_CHECK_EQ(capture.spurious_edges, 1);
+
+    // Expiry across a counter wrap
+    sonicmeter_capture_arm(&capture, false, UINT32_MAX - 10);
+    TEST_CHECK(!sonicmeter_capture_expire(&capture, TEST_TIMEOUT - 20, TEST_TIMEOUT));
+    TEST_CHECK(sonicmeter_capture_expire(&capture, TEST_TIMEOUT, TEST_TIMEOUT));
+    TEST_CHECK_EQ(capture.result, SonicMeterCaptureResultNoEcho);
+}
+
+static void test_capture_line_high(void) {
+    SonicMeterCapture capture;
+    sonicmeter_capture_reset(&capture);
+
+    // The previous echo is still going, nothing to wait for
+    TEST_CHECK(!sonicmeter_capture_arm(&capture, true, 100));
+    TEST_CHECK(!sonicmeter_capture_is_busy(&capture));
+    TEST_CHECK_EQ(capture.result, SonicMeterCaptureResultLineHigh);
+    TEST_CHECK_EQ(sonicmeter_capture_get_width(&capture), 0);
+
+    // Its falling edge is not taken for an echo
+    TEST_CHECK(!sonicmeter_capture_edge(&capture, false, 200));
+    TEST_CHECK_EQ(capture.result, SonicMeterCaptureResultLineHigh);
+    TEST_CHECK_EQ(capture.spurious_edges, 1);
+    TEST_CHECK(!sonicmeter_capture_expire(&capture, 100 + TEST_TIMEOUT, TEST_TIMEOUT));
+
+    // Once the line is low again the next capture works
+    TEST_CHECK(sonicmeter_capture_arm(&capture, false, 300));
+    sonicmeter_capture_edge(&capture, true, 400);
+    TEST_CHECK(sonicmeter_capture_edge(&capture, false, 450));
+    TEST_CHECK_EQ(sonicmeter_capture_get_width(&capture), 50);
+}
+
+static void test_capture_timer(void) {
+    SonicMeterCapture capture;
+    SonicMeterCaptureTimerRegs regs;
+    sonicmeter_capture_reset(&capture);
+    sonicmeter_capture_arm(&capture, false, 0);
+
+    // Only the fall interrupts
+    regs.sr = SONICMETER_CAPTURE_TIM_SR_CC2IF;
+    TEST_CHECK(!sonicmeter_capture_timer(&capture, &regs));
+    TEST_CHECK_EQ(capture.spurious_edges, 0);
+
+    // A fall without a rise
+    regs.sr = SONICMETER_CAPTURE_TIM_SR_CC1IF;
+    TEST_CHECK(!sonicmeter_capture_timer(&capture, &regs));
+    TEST_CHECK_EQ(capture.spurious_edges, 1);
+
+    // A rise latched after the fall belongs to the next pulse
+    regs.sr = SONICMETER_CAPTURE_TIM_SR_CC1IF | SONICMETER_CAPTURE_TIM_SR_CC2IF;
+    regs.ccr_rise = 500;
+    regs.ccr_fall = 400;
+    TEST_CHECK(!sonicmeter_capture_timer(&capture, &regs));
+    TEST_CHECK_EQ(capture.spurious_edges, 2);
+    TEST_CHECK(sonicmeter_capture_is_busy(&capture));
+
+    // Overcaptured, the latest pair is still used
+    regs.sr |= SONICMETER_CAPTURE_TIM_SR_CC1OF;
+    regs.ccr_fall = 900;
+    TEST_CHECK(sonicmeter_capture_timer(&capture, &regs));
+    TEST_CHECK_EQ(capture.spurious_edges, 3);
+    TEST_CHECK_EQ(sonicmeter_capture_get_width(&capture), 400);
+
+    // Across a counter wrap
+    sonicmeter_capture_arm(&capture, false, 0);
+    regs.sr = SONICMETER_CAPTURE_TIM_SR_CC1IF | SONICMETER_CAPTURE_TIM_SR_CC2IF;
+    regs.ccr_rise = UINT32_MAX - 9;
+    regs.ccr_fall = 10;
+    TEST_CHECK(sonicmeter_capture_timer(&capture, &regs));
+    TEST_CHECK_EQ(sonicmeter_capture_get_width(&capture), 20);
+
+    // Nothing in flight
+    TEST_CHECK(!sonicmeter_capture_timer(&capture, &regs));
+    TEST_CHECK_EQ(capture.spurious_edges, 4);
+}
+
+static void test_capture_timer_expire(void) {
+    SonicMeterCapture capture;
+    SonicMeterCaptureTimerRegs regs;
+    sonicmeter_capture_reset(&capture);
+
+    // No rise latched and the line low, the echo never came
+    sonicmeter_capture_arm(&capture, false, 100);
+    TEST_CHECK(
+        !sonicmeter_capture_timer_expire(&capture, 0, false, 99 + TEST_TIMEOUT, TEST_TIMEOUT));
+    TEST_CHECK(
+        sonicmeter_capture_timer_expire(&capture, 0, false, 100 + TEST_TIMEOUT, TEST_TIMEOUT));
+    TEST_CHECK_EQ(capture.result, SonicMeterCaptureResultNoEcho);
+
+    // The rise is latched, the fall is not: the echo outlasted the timeout
+    sonicmeter_capture_arm(&capture, false, 2000);
+    TEST_CHECK(sonicmeter_capture_timer_expire(
+        &capture, SONICMETER_CAPTURE_TIM_SR_CC2IF, false, 2000 + TEST_TIMEOUT, TEST_TIMEOUT));
+    TEST_CHECK_EQ(capture.result, SonicMeterCaptureResultOutOfRange);
+    TEST_CHECK_EQ(sonicmeter_capture_get_width(&capture), 0);
+
+    // The line is still high, whatever the flags say
+    sonicmeter_capture_arm(&capture, false, 4000);
+    TEST_CHECK(
+        sonicmeter_capture_timer_expire(&capture, 0, true, 4000 + TEST_TIMEOUT, TEST_TIMEOUT));
+    TEST_CHECK_EQ(capture.result, SonicMeterCaptureResultOutOfRange);
+
+    // Not timed out yet, the fall still completes the capture
+    sonicmeter_capture_arm(&capture, false, 6000);
+    TEST_CHECK(!sonicmeter_capture_timer_expire(
+        &capture, SONICMETER_CAPTURE_TIM_SR_CC2IF, true, 6500, TEST_TIMEOUT));
+    TEST_CHECK(sonicmeter_capture_is_busy(&capture));
+    regs.sr = SONICMETER_CAPTURE_TIM_SR_CC1IF | SONICMETER_CAPTURE_TIM_SR_CC2IF;
+    regs.ccr_rise = 100;
+    regs.ccr_fall = 600;
+    TEST_CHECK(sonicmeter_capture_timer(&capture, &regs));
+    TEST_CHECK_EQ(sonicmeter_capture_get_width(&capture), 500);
+
+    // A finished capture is left alone
+    TEST_CHECK(!sonicmeter_capture_timer_expire(
+        &capture, SONICMETER_CAPTURE_TIM_SR_CC2IF, true, 6000 + TEST_TIMEOUT, TEST_TIMEOUT));
+    TEST_CHECK_EQ(capture.result, SonicMeterCaptureResultOk);
+
+    // The line was high when arming
+    sonicmeter_capture_arm(&capture, true, 8000);
+    TEST_CHECK(
+        !sonicmeter_capture_timer_expire(&capture, 0, true, 8000 + TEST_TIMEOUT, TEST_TIMEOUT));
+    TEST_CHECK_EQ(capture.result, SonicMeterCaptureResultLineHigh);
+}
+
+int main(void) {
+    test_capture_echo();
+    test_capture_wrap();
+    test_capture_spurious();
+    test_capture_timeout();
+    test_capture_line_high();
+    test_capture_timer();
+    test_capture_timer_expire();
+    return test_done("capture");
+}
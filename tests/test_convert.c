@@ -0,0 +1,112 @@
+/**
+ * Tests of the echo width to distance conversion.
+ *
+ * Sweeps every tick value up to the longest range setting, at every temperature of the table,
+ * against the same formula in double precision. The error is the rounding to whole micrometres
+ * plus the rounding of the Q8.24 factor, half a least significant bit per tick: 0.5 um plus
+ * 0.072 um at 6 m and -20 C, where the most ticks reach the range.
+*/
+
+#include <math.h>
+
+#include "test.h"
+#include "sonicmeter_convert.h"
+
+#define TEST_CPU_HZ 64000000
+#define TEST_RANGE_UM 6000000 // Longest range setting
+
+static double test_convert_reference_um(const SonicMeterConvert* convert, uint32_t ticks) {
+    return (double)ticks * convert->speed_mm_s * 1000.0 / (2.0 * convert->cpu_hz);
+}
+
+/**
+ * @brief      Get the largest error a conversion can have.
+ * @param      ticks  Echo width.
+ * @return     Error bound, micrometres.
+*/
+static double test_convert_bound_um(uint32_t ticks) {
+    return 0.5 + ticks / (double)(1U << 25) + 1e-9;
+}
+
+static void test_convert_table(void) {
+    for(int32_t t = SONICMETER_CONVERT_TEMPERATURE_MIN; t <= SONICMETER_CONVERT_TEMPERATURE_MAX;
+        t++) {
+        const double speed_mm_s = 331300.0 * sqrt(1.0 + t / 273.15);
+        TEST_CHECK(fabs(sonicmeter_convert_speed_of_sound(t) - speed_mm_s) <= 0.5);
+    }
+
+    // Clamped to the table
+    TEST_CHECK_EQ(
+        sonicmeter_convert_speed_of_sound(-40),
+        sonicmeter_convert_speed_of_sound(SONICMETER_CONVERT_TEMPERATURE_MIN));
+    TEST_CHECK_EQ(
+        sonicmeter_convert_speed_of_sound(80),
+        sonicmeter_convert_speed_of_sound(SONICMETER_CONVERT_TEMPERATURE_MAX));
+    TEST_CHECK_EQ(
+        sonicmeter_convert_speed_of_sound(SONICMETER_CONVERT_TEMPERATURE_DEFAULT), 343215);
+}
+
+static void test_convert_sweep(void) {
+    double error_max = 0;
+    int32_t error_max_c = 0;
+    uint32_t error_max_ticks = 0;
+    uint64_t conversions = 0;
+    uint64_t beyond_bound = 0;
+
+    for(int32_t t = SONICMETER_CONVERT_TEMPERATURE_MIN; t <= SONICMETER_CONVERT_TEMPERATURE_MAX;
+        t++) {
+        SonicMeterConvert convert;
+        sonicmeter_convert_init(&convert, TEST_CPU_HZ, t);
+        const uint32_t max_ticks = sonicmeter_convert_um_to_ticks(&convert, TEST_RANGE_UM);
+
+        for(uint32_t ticks = 0; ticks <= max_ticks; ticks++) {
+            const double error =
+                fabs(sonicmeter_convert_ticks_to_um(&convert, ticks) -
+                     test_convert_reference_um(&convert, ticks));
+            if(error > test_convert_bound_um(ticks)) {
+                beyond_bound++;
+            }
+            if(error > error_max) {
+                error_max = error;
+                error_max_c = t;
+                error_max_ticks = ticks;
+            }
+        }
+        conversions += max_ticks + 1;
+    }
+
+    printf(
+        "%" PRIu64 " conversions, largest error %.4f um at %" PRId32 " C, %" PRIu32 " ticks\n",
+        conversions,
+        error_max,
+        error_max_c,
+        error_max_ticks);
+    TEST_CHECK_EQ(beyond_bound, 0);
+}
+
+static void test_convert_inverse(void) {
+    SonicMeterConvert convert;
+    sonicmeter_convert_init(&convert, TEST_CPU_HZ, SONICMETER_CONVERT_TEMPERATURE_DEFAULT);
+
+    // The echo width of a distance is the shortest one that reaches it
+    for(uint32_t um = 1; um <= TEST_RANGE_UM; um += 997) {
+        const uint32_t ticks = sonicmeter_convert_um_to_ticks(&convert, um);
+        const uint64_t reach_q24 = (uint64_t)ticks * convert.um_per_tick_q24;
+        TEST_CHECK(reach_q24 >= (uint64_t)um << 24);
+        TEST_CHECK(reach_q24 - convert.um_per_tick_q24 < (uint64_t)um << 24);
+    }
+
+    // Microseconds round to nearest
+    TEST_CHECK_EQ(sonicmeter_convert_ticks_to_us(&convert, 0), 0);
+    TEST_CHECK_EQ(sonicmeter_convert_ticks_to_us(&convert, 31), 0);
+    TEST_CHECK_EQ(sonicmeter_convert_ticks_to_us(&convert, 32), 1);
+    TEST_CHECK_EQ(sonicmeter_convert_ticks_to_us(&convert, 64 * 23324), 23324);
+    TEST_CHECK_EQ(sonicmeter_convert_ticks_to_us(&convert, UINT32_MAX), 67108864);
+}
+
+int main(void) {
+    test_convert_table();
+    test_convert_sweep();
+    test_convert_inverse();
+    return test_done("convert");
+}
@@ -0,0 +1,145 @@
+/**
+ * Tests of the trigger pulses of sonicmeter_hal.h against the register model.
+ *
+ * A hook on the cycle counter watches the port on every read of the busy wait: how long the pin
+ * is high, that it is only high inside the critical section and, for single pin sensors, that it
+ * is an output exactly while it is driven. The hook also raises the EXTI pending bit of the pin
+ * while it is high, the way our own edge does on the device.
+*/
+
+#include <string.h>
+
+#include "test.h"
+#include "sonicmeter_hal.h"
+
+#define TEST_PULSE_CYCLES 640 // 10 us at 64 MHz
+#define TEST_OTHER_PINS 0x8001U // Outputs of the port that are not ours, left alone
+#define TEST_OTHER_MODES 0x55555555U // Modes of the other pins of the port, left alone
+#define TEST_OTHER_PENDING (1U << 9) // EXTI line of another pin, left pending
+
+typedef struct {
+    const SonicMeterHalPin* line;
+    uint32_t reads;
+    uint32_t high_cycles; // Counter advance while the pin was high
+    uint32_t high_outside; // Reads with the pin high outside the critical section
+    uint32_t high_as_input; // Reads with the pin high while not an output
+    uint32_t output_low; // Reads with the pin an output but low
+} TestHalWatch;
+
+static GPIO_TypeDef test_port;
+
+static void test_hal_watch(void* context) {
+    TestHalWatch* watch = context;
+    const SonicMeterHalPin* line = watch->line;
+    const uint32_t shift = 2 * __builtin_ctz(line->mask);
+    const bool high = line->port->ODR & line->mask;
+    const bool output = ((line->port->MODER >> shift) & 3U) == 1U;
+
+    watch->reads++;
+    if(high) {
+        watch->high_cycles += host_cycles_step;
+        if(host_critical_depth == 0) {
+            watch->high_outside++;
+        }
+        host_exti.PR1 |= line->mask;
+    }
+    if(high && !output) {
+        watch->high_as_input++;
+    }
+    if(output && !high) {
+        watch->output_low++;
+    }
+}
+
+/**
+ * @brief      Reset the port and the counter, and start watching a pin.
+ * @param      watch   The watch.
+ * @param      line    The pin.
+ * @param      step    Counter advance per read.
+ * @param      cycles  Counter value to start from.
+*/
+static void test_hal_start(
+    TestHalWatch* watch,
+    const SonicMeterHalPin* line,
+    uint32_t step,
+    uint32_t cycles) {
+    memset((void*)&test_port, 0, sizeof(test_port));
+    *watch = (TestHalWatch){.line = line};
+    DWT->CYCCNT = cycles;
+    host_cycles_step = step;
+    host_cycles_context = watch;
+    host_cycles_hook = test_hal_watch;
+}
+
+static void test_hal_stop(void) {
+    host_cycles_hook = NULL;
+    host_cycles_step = 1;
+    host_gpio_update();
+}
+
+static void test_hal_trigger(uint32_t pin, uint32_t step, uint32_t cycles) {
+    const SonicMeterHalPin line = {.port = &test_port, .mask = 1U << pin};
+    TestHalWatch watch;
+    test_hal_start(&watch, &line, step, cycles);
+    test_port.MODER = 1U << (2 * pin);
+    test_port.ODR = TEST_OTHER_PINS & ~line.mask;
+    const uint32_t critical_count = host_critical_count;
+
+    sonicmeter_hal_trigger(&line, TEST_PULSE_CYCLES);
+    test_hal_stop();
+
+    // High for the whole pulse, one counter step at most longer, all of it with interrupts masked
+    TEST_CHECK(watch.high_cycles >= TEST_PULSE_CYCLES);
+    TEST_CHECK(watch.high_cycles < TEST_PULSE_CYCLES + step);
+    TEST_CHECK_EQ(watch.high_outside, 0);
+    TEST_CHECK_EQ(host_critical_depth, 0);
+    TEST_CHECK_EQ(host_critical_count, critical_count + 1);
+
+    // Low again, the rest of the port untouched
+    TEST_CHECK_EQ(test_port.ODR, TEST_OTHER_PINS & ~line.mask);
+    TEST_CHECK_EQ(test_port.MODER, 1U << (2 * pin));
+}
+
+static void test_hal_trigger_single(uint32_t pin, uint32_t step) {
+    const SonicMeterHalPin line = {.port = &test_port, .mask = 1U << pin};
+    const uint32_t modes = TEST_OTHER_MODES & ~(3U << (2 * pin));
+    TestHalWatch watch;
+    test_hal_start(&watch, &line, step, 0);
+    test_port.MODER = modes;
+    test_port.ODR = TEST_OTHER_PINS & ~line.mask;
+    host_exti.PR1 = TEST_OTHER_PENDING;
+
+    sonicmeter_hal_trigger_single(&line, TEST_PULSE_CYCLES);
+    test_hal_stop();
+
+    // Driven high for the pulse and only then, an output only while driven. The pin comes up
+    // before the start of the wait is read, one more counter step
+    TEST_CHECK(watch.high_cycles >= TEST_PULSE_CYCLES);
+    TEST_CHECK(watch.high_cycles < TEST_PULSE_CYCLES + 2 * step);
+    TEST_CHECK_EQ(watch.high_outside, 0);
+    TEST_CHECK_EQ(watch.high_as_input, 0);
+    TEST_CHECK_EQ(watch.output_low, 0);
+    TEST_CHECK_EQ(host_critical_depth, 0);
+
+    // An input again, the other pins keep their modes and levels
+    TEST_CHECK_EQ(test_port.MODER, modes);
+    TEST_CHECK_EQ(test_port.ODR, TEST_OTHER_PINS & ~line.mask);
+
+    // The pending bit of our own edge is cleared by writing it alone, the register is write one
+    // to clear and the other line stays pending
+    TEST_CHECK_EQ(host_exti.PR1, line.mask);
+}
+
+int main(void) {
+    const uint32_t pins[] = {0, 3, 8, 15};
+    host_gpio_attach(&test_port);
+    for(size_t i = 0; i < COUNT_OF(pins); i++) {
+        test_hal_trigger(pins[i], 1, 0);
+        test_hal_trigger(pins[i], 7, 0);
+        // The counter wraps during the pulse
+        test_hal_trigger(pins[i], 1, UINT32_MAX - TEST_PULSE_CYCLES / 2);
+        test_hal_trigger_single(pins[i], 1);
+        test_hal_trigger_single(pins[i], 7);
+    }
+    return test_done("hal");
+}
@@ -0,0 +1,187 @@
+/**
+ * Tests of the log bucketed histogram.
+ *
+ * Every value up to the top is checked against the range of its bucket, then samples of known
+ * distributions are recorded and their percentiles compared with the exact ones of the sorted
+ * samples. A percentile is the top of the bucket of the exact value: never below it, and above
+ * it by less than a bucket, under 1/32 of the value.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include "sonicmeter_histogram.h"
+
+#define TEST_SAMPLES 200000
+
+static uint32_t test_samples[TEST_SAMPLES];
+static uint32_t test_seed = 1;
+
+static uint32_t test_random(void) {
+    test_seed = test_seed * 1664525U + 1013904223U;
+    return test_seed >> 8;
+}
+
+// Uniform in (0, 1]
+static double test_random_unit(void) {
+    return (test_random() + 1.0) / (double)(1U << 24);
+}
+
+static int test_compare(const void* a, const void* b) {
+    const uint32_t x = *(const uint32_t*)a;
+    const uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void test_histogram_buckets(void) {
+    uint32_t outside = 0;
+    uint32_t too_wide = 0;
+    uint32_t gaps = 0;
+    uint32_t last_upper = 0;
+
+    for(uint32_t value = 0; value <= SONICMETER_HISTOGRAM_VALUE_MAX; value++) {
+        const uint32_t index = sonicmeter_histogram_index(value);
+        uint32_t lower;
+        uint32_t upper;
+        sonicmeter_histogram_bucket_range(index, &lower, &upper);
+        outside += index >= SONICMETER_HISTOGRAM_BUCKETS || value < lower || value > upper;
+        // The width against the smallest value of the bucket, the worst case
+        too_wide += (uint64_t)(upper - lower) * SONICMETER_HISTOGRAM_SUB_BUCKETS >= lower &&
+                    upper != lower;
+        // Buckets follow each other without a gap
+        if(value == lower) {
+            gaps += value > 0 && lower != last_upper + 1;
+            last_upper = upper;
+        }
+    }
+    TEST_CHECK_EQ(outside, 0);
+    TEST_CHECK_EQ(too_wide, 0);
+    TEST_CHECK_EQ(gaps, 0);
+    TEST_CHECK_EQ(
+        sonicmeter_histogram_index(SONICMETER_HISTOGRAM_VALUE_MAX),
+        SONICMETER_HISTOGRAM_BUCKETS - 1);
+}
+
+/**
+ * @brief      Record the samples and check the percentiles against the exact ones.
+ * @param      name   Name of the distribution.
+ * @param      count  Number of samples in test_samples.
+*/
+static void test_histogram_check(const char* name, size_t count) {
+    static const uint32_t permille[] = {0, 10, 250, 500, 900, 990, 999, 1000};
+    static SonicMeterHistogram histogram;
+    uint32_t values[COUNT_OF(permille)];
+    uint32_t overflow = 0;
+    double error_max = 0;
+
+    sonicmeter_histogram_reset(&histogram);
+    const uint64_t start = test_cycles();
+    for(size_t i = 0; i < count; i++) {
+        sonicmeter_histogram_record(&histogram, test_samples[i]);
+    }
+    const double cycles = (double)(test_cycles() - start) / count;
+    sonicmeter_histogram_get_percentiles(&histogram, permille, values, COUNT_OF(permille));
+
+    qsort(test_samples, count, sizeof(uint32_t), test_compare);
+    for(size_t i = 0; i < count; i++) {
+        overflow += test_samples[i] > SONICMETER_HISTOGRAM_VALUE_MAX;
+    }
+    TEST_CHECK_EQ(histogram.total, count);
+    TEST_CHECK_EQ(histogram.overflow, overflow);
+    TEST_CHECK_EQ(histogram.min, test_samples[0]);
+    TEST_CHECK_EQ(histogram.max, test_samples[count - 1]);
+
+    for(size_t p = 0; p < COUNT_OF(permille); p++) {
+        // Nearest rank, the first sample for p0
+        const uint64_t rank = ((uint64_t)permille[p] * count + 999) / 1000;
+        const uint32_t exact = test_samples[rank > 0 ? rank - 1 : 0];
+        if(exact > SONICMETER_HISTOGRAM_VALUE_MAX) {
+            // Past the top all the histogram knows is the top
+            TEST_CHECK_EQ(values[p], SONICMETER_HISTOGRAM_VALUE_MAX);
+            continue;
+        }
+        TEST_CHECK(values[p] >= exact);
+        TEST_CHECK(
+            (uint64_t)(values[p] - exact) * SONICMETER_HISTOGRAM_SUB_BUCKETS < exact ||
+            values[p] == exact);
+        TEST_CHECK_EQ(sonicmeter_histogram_index(values[p]), sonicmeter_histogram_index(exact));
+        if(exact > 0 && (double)(values[p] - exact) / exact > error_max) {
+            error_max = (double)(values[p] - exact) / exact;
+        }
+    }
+    printf(
+        "%-12s p50 %7" PRIu32 "  p99 %7" PRIu32 "  p99.9 %7" PRIu32
+        "  largest error %.2f%%  %.1f cycles per record\n",
+        name,
+        values[3],
+        values[5],
+        values[6],
+        error_max * 100,
+        cycles);
+}
+
+static void test_histogram_distributions(void) {
+    // Echo widths of a target anywhere up to 4 m, in us
+    for(size_t i = 0; i < TEST_SAMPLES; i++) {
+        test_samples[i] = 100 + test_random() % 23300;
+    }
+    test_histogram_check("uniform", TEST_SAMPLES);
+
+    // Sample intervals: mostly on time, an exponential tail of late ones
+    for(size_t i = 0; i < TEST_SAMPLES; i++) {
+        test_samples[i] = 60000 + (uint32_t)(-2000.0 * log(test_random_unit()));
+    }
+    test_histogram_check("exponential", TEST_SAMPLES);
+
+    // A still target, distance in mm with noise
+    for(size_t i = 0; i < TEST_SAMPLES; i++) {
+        const double gauss =
+            sqrt(-2.0 * log(test_random_unit())) * cos(2 * M_PI * test_random_unit());
+        test_samples[i] = (uint32_t)lround(1500 + 3 * gauss);
+    }
+    test_histogram_check("normal", TEST_SAMPLES);
+
+    // Two targets, one in the linear buckets
+    for(size_t i = 0; i < TEST_SAMPLES; i++) {
+        test_samples[i] = test_random() & 1 ? 40 + test_random() % 8 : 3000 + test_random() % 400;
+    }
+    test_histogram_check("bimodal", TEST_SAMPLES);
+
+    // Spread over every power of two, the widest buckets included
+    for(size_t i = 0; i < TEST_SAMPLES; i++) {
+        test_samples[i] = (uint32_t)exp(test_random_unit() * log(SONICMETER_HISTOGRAM_VALUE_MAX));
+    }
+    test_histogram_check("log uniform", TEST_SAMPLES);
+
+    // A few timeouts past the top
+    for(size_t i = 0; i < TEST_SAMPLES; i++) {
+        test_samples[i] = i % 500 ? 20000 + test_random() % 1000 : 5000000;
+    }
+    test_histogram_check("overflow", TEST_SAMPLES);
+}
+
+static void test_histogram_few(void) {
+    // Empty, every percentile is 0, then a single value, every percentile is that value
+    static const uint32_t permille[] = {0, 500, 999};
+    SonicMeterHistogram histogram;
+    uint32_t values[COUNT_OF(permille)] = {1, 1, 1};
+    sonicmeter_histogram_reset(&histogram);
+    sonicmeter_histogram_get_percentiles(&histogram, permille, values, COUNT_OF(permille));
+    for(size_t p = 0; p < COUNT_OF(permille); p++) {
+        TEST_CHECK_EQ(values[p], 0);
+    }
+
+    sonicmeter_histogram_record(&histogram, 12345);
+    sonicmeter_histogram_get_percentiles(&histogram, permille, values, COUNT_OF(permille));
+    for(size_t p = 0; p < COUNT_OF(permille); p++) {
+        TEST_CHECK_EQ(values[p], 12345);
+    }
+}
+
+int main(void) {
+    test_histogram_buckets();
+    test_histogram_distributions();
+    test_histogram_few();
+    return test_done("histogram");
+}
@@ -0,0 +1,141 @@
+/**
+ * Tests of the history pyramid.
+ *
+ * Pushes noise with single sample spikes and dips, and after every push checks each bucket of
+ * every level against the minimum and maximum of the samples it covers, found by brute force:
+ * a decimated level must keep the true extremes, a one sample spike included, the pending bucket
+ * too.
+*/
+
+#include <stdlib.h>
+
+#include "test.h"
+#include "sonicmeter_history.h"
+
+#define TEST_SAMPLES 70000 // Past the wrap of the top level, 256 buckets of 64
+#define TEST_CHECK_EVERY 97 // Pushes between two full checks past the first few thousand
+#define TEST_PLOT_HEIGHT 64
+
+static uint16_t test_samples[TEST_SAMPLES];
+static uint32_t test_seed = 1;
+
+static uint32_t test_random_below(uint32_t n) {
+    test_seed = test_seed * 1664525U + 1013904223U;
+    return ((test_seed >> 16) * n) >> 16;
+}
+
+// A slow wave with noise, now and then a single sample far above or below it
+static uint16_t test_history_sample(uint32_t i) {
+    uint32_t mm = 1000 + (i / 8) % 500 + test_random_below(20);
+    const uint32_t roll = test_random_below(1000);
+    if(roll < 5) {
+        mm += 2000 + test_random_below(1000);
+    } else if(roll < 10) {
+        mm = test_random_below(50);
+    }
+    return mm;
+}
+
+/**
+ * @brief      Check every readable bucket of every level.
+ * @param      history  The history.
+ * @param      pushed   Samples pushed so far, the first pushed ones in test_samples.
+ * @return     Buckets whose extremes are not those of their samples.
+*/
+static uint32_t test_history_check(const SonicMeterHistory* history, uint32_t pushed) {
+    SonicMeterHistoryBucket buckets[SONICMETER_HISTORY_SIZE];
+    uint32_t wrong = 0;
+
+    for(uint32_t level = 0; level < SONICMETER_HISTORY_LEVELS; level++) {
+        const uint32_t scale = sonicmeter_history_get_scale(level);
+        const size_t count =
+            sonicmeter_history_get(history, level, buckets, SONICMETER_HISTORY_SIZE);
+
+        // Newest first: the samples of the pending bucket, then whole buckets
+        uint32_t end = pushed;
+        const uint32_t pending = pushed % scale;
+        size_t expected = pushed / scale + (pending ? 1 : 0);
+        if(expected > SONICMETER_HISTORY_SIZE) {
+            expected = SONICMETER_HISTORY_SIZE;
+        }
+        if(count != expected) {
+            wrong++;
+        }
+
+        for(size_t age = 0; age < count; age++) {
+            const uint32_t width = age == 0 && pending ? pending : scale;
+            const uint32_t start = end - width;
+            uint16_t min = UINT16_MAX;
+            uint16_t max = 0;
+            for(uint32_t i = start; i < end; i++) {
+                min = test_samples[i] < min ? test_samples[i] : min;
+                max = test_samples[i] > max ? test_samples[i] : max;
+            }
+            const SonicMeterHistoryBucket* bucket = &buckets[count - 1 - age];
+            if(bucket->min != min || bucket->max != max) {
+                wrong++;
+            }
+            end = start;
+        }
+    }
+    return wrong;
+}
+
+static void test_history_decimation(void) {
+    SonicMeterHistory* history = malloc(sizeof(SonicMeterHistory));
+    sonicmeter_history_reset(history);
+    uint32_t wrong = 0;
+    uint32_t checks = 0;
+
+    for(uint32_t i = 0; i < TEST_SAMPLES; i++) {
+        test_samples[i] = test_history_sample(i);
+        sonicmeter_history_push(history, test_samples[i]);
+        if(i < 5000 || i % TEST_CHECK_EVERY == 0 || i == TEST_SAMPLES - 1) {
+            wrong += test_history_check(history, i + 1);
+            checks++;
+        }
+    }
+    printf("%" PRIu32 " checks of every level, %" PRIu32 " wrong buckets\n", checks, wrong);
+    TEST_CHECK_EQ(wrong, 0);
+    free(history);
+}
+
+static void test_history_spike(void) {
+    // A single spike in a flat line survives every level and tops the plot of each
+    SonicMeterHistory* history = malloc(sizeof(SonicMeterHistory));
+    sonicmeter_history_reset(history);
+    SonicMeterHistoryPlot plot;
+    const uint32_t top_scale = sonicmeter_history_get_scale(SONICMETER_HISTORY_LEVELS - 1);
+
+    for(uint32_t i = 0; i < top_scale * 10; i++) {
+        sonicmeter_history_push(history, i == top_scale * 5 + 17 ? 3000 : 1000);
+    }
+    for(uint32_t level = 0; level < SONICMETER_HISTORY_LEVELS; level++) {
+        const size_t columns = sonicmeter_history_plot(history, level, &plot, TEST_PLOT_HEIGHT);
+        TEST_CHECK(columns > 0);
+        if(level > 0) {
+            TEST_CHECK_EQ(plot.high_mm, 3000);
+            TEST_CHECK_EQ(plot.low_mm, 1000);
+        }
+
+        // The flat line is the bottom row, or the middle one of a plot without the spike
+        const uint8_t line = level == 0 ? TEST_PLOT_HEIGHT / 2 : TEST_PLOT_HEIGHT - 1;
+        uint32_t peaks = 0;
+        for(size_t x = 0; x < SONICMETER_HISTORY_PLOT_WIDTH; x++) {
+            peaks += plot.top[x] == 0;
+            if(plot.top[x] != SONICMETER_HISTORY_EMPTY) {
+                TEST_CHECK(plot.top[x] <= plot.bottom[x]);
+                TEST_CHECK_EQ(plot.bottom[x], line);
+            }
+        }
+        // Level 0 only shows the latest samples, long after the spike
+        TEST_CHECK_EQ(peaks, level == 0 ? 0 : 1);
+    }
+    free(history);
+}
+
+int main(void) {
+    test_history_decimation();
+    test_history_spike();
+    return test_done("history");
+}
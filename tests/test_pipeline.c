@@ -0,0 +1,91 @@
+/**
+ * Tests of the range limit: the echo timeout derived from it and what happens to an echo beyond
+ * it, on both capture backends.
+*/
+
+#include "test.h"
+#include "sonicmeter_pipeline.h"
+
+#define TEST_CPU_HZ 64000000
+#define TEST_TICKS_PER_MS (TEST_CPU_HZ / 1000)
+#define TEST_RISE_TICKS (TEST_CPU_HZ / 1000000 * 450) // Trigger to echo of an HC-SR04
+
+static const uint32_t test_ranges_cm[] = {100, 200, 300, 400, 600};
+
+static void test_pipeline_timeout(void) {
+    for(size_t i = 0; i < COUNT_OF(test_ranges_cm); i++) {
+        SonicMeterPipeline pipeline;
+        sonicmeter_pipeline_init(
+            &pipeline, TEST_CPU_HZ, SONICMETER_CONVERT_TEMPERATURE_DEFAULT, test_ranges_cm[i]);
+        const uint32_t timeout_ms = sonicmeter_pipeline_get_timeout_ms(&pipeline, 0);
+
+        // An echo from the range limit is in before the timeout, with the rise margin to spare
+        const uint32_t last_ticks = SONICMETER_PIPELINE_RISE_MARGIN_US * (TEST_CPU_HZ / 1000000) +
+                                    pipeline.max_width_ticks;
+        TEST_CHECK(last_ticks <= timeout_ms * TEST_TICKS_PER_MS);
+
+        // And the wait is no longer than that, rounded up to the next millisecond
+        TEST_CHECK(timeout_ms * TEST_TICKS_PER_MS < last_ticks + TEST_TICKS_PER_MS);
+
+        // 58 us per cm of range, 1 ms of margin
+        TEST_CHECK_EQ(timeout_ms, (test_ranges_cm[i] * 583 / 10 + 999) / 1000 + 1);
+
+        // The sensor's own latency comes on top
+        TEST_CHECK_EQ(sonicmeter_pipeline_get_timeout_ms(&pipeline, 15), timeout_ms + 15);
+    }
+}
+
+static void test_pipeline_range(void) {
+    SonicMeterPipeline pipeline;
+    sonicmeter_pipeline_init(&pipeline, TEST_CPU_HZ, SONICMETER_CONVERT_TEMPERATURE_DEFAULT, 200);
+    SonicMeterSample sample = {0};
+
+    // An echo that ended in time but comes from beyond the range
+    sample.result = SonicMeterCaptureResultOk;
+    sample.ticks = pipeline.max_width_ticks;
+    sonicmeter_pipeline_convert(&pipeline, &sample);
+    TEST_CHECK_EQ(sample.result, SonicMeterCaptureResultOk);
+    TEST_CHECK(sample.distance_um >= 2000000 && sample.distance_um < 2000100);
+
+    sample.ticks = pipeline.max_width_ticks + 1;
+    sonicmeter_pipeline_convert(&pipeline, &sample);
+    TEST_CHECK_EQ(sample.result, SonicMeterCaptureResultOutOfRange);
+    TEST_CHECK_EQ(sample.ticks, 0);
+    TEST_CHECK_EQ(sample.echo_us, 0);
+    TEST_CHECK_EQ(sample.distance_um, 0);
+}
+
+static void test_pipeline_expire(void) {
+    SonicMeterPipeline pipeline;
+    sonicmeter_pipeline_init(&pipeline, TEST_CPU_HZ, SONICMETER_CONVERT_TEMPERATURE_DEFAULT, 100);
+    const uint32_t timeout = sonicmeter_pipeline_get_timeout_ms(&pipeline, 0) * TEST_TICKS_PER_MS;
+    SonicMeterCapture capture;
+    sonicmeter_capture_reset(&capture);
+
+    // Interrupt backend: the rise came, the fall did not
+    sonicmeter_capture_arm(&capture, false, 0);
+    sonicmeter_capture_edge(&capture, true, TEST_RISE_TICKS);
+    TEST_CHECK(sonicmeter_capture_expire(&capture, timeout, timeout));
+    TEST_CHECK_EQ(capture.result, SonicMeterCaptureResultOutOfRange);
+
+    // Timer backend: the rise is latched in its capture register, the state machine did not see it
+    sonicmeter_capture_arm(&capture, false, 0);
+    TEST_CHECK(sonicmeter_capture_timer_expire(
+        &capture, SONICMETER_CAPTURE_TIM_SR_CC2IF, true, timeout, timeout));
+    TEST_CHECK_EQ(capture.result, SonicMeterCaptureResultOutOfRange);
+
+    // Nothing came back on either
+    sonicmeter_capture_arm(&capture, false, 0);
+    TEST_CHECK(sonicmeter_capture_expire(&capture, timeout, timeout));
+    TEST_CHECK_EQ(capture.result, SonicMeterCaptureResultNoEcho);
+    sonicmeter_capture_arm(&capture, false, 0);
+    TEST_CHECK(sonicmeter_capture_timer_expire(&capture, 0, false, timeout, timeout));
+    TEST_CHECK_EQ(capture.result, SonicMeterCaptureResultNoEcho);
+}
+
+int main(void) {
+    test_pipeline_timeout();
+    test_pipeline_range();
+    test_pipeline_expire();
+    return test_done("pipeline");
+}
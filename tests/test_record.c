@@ -0,0 +1,275 @@
+/**
+ * Tests of the recording codec.
+ *
+ * Headers of every version the decoder takes and the ones it must refuse, then long runs of
+ * generated samples encoded and decoded by the codec of the app, several sensors interleaved at
+ * far apart distances, timestamps past 32 bits, deltas across the wraps of every field, and every
+ * record cut short. The last run is left next to the program as <program>.smr for
+ * tools/smr2csv.py to read back.
+*/
+
+#include <string.h>
+
+#include "test.h"
+#include "sonicmeter_record.h"
+
+#define TEST_SAMPLES 100000
+#define TEST_CPU_HZ 64000000
+#define TEST_DATA_SIZE (SONICMETER_RECORD_HEADER_SIZE + TEST_SAMPLES * SONICMETER_RECORD_SIZE_MAX)
+
+static uint8_t test_data[TEST_DATA_SIZE];
+static SonicMeterSample test_samples[TEST_SAMPLES];
+static uint32_t test_seed = 1;
+
+static uint32_t test_random_below(uint32_t n) {
+    test_seed = test_seed * 1664525U + 1013904223U;
+    return ((test_seed >> 16) * n) >> 16;
+}
+
+static bool test_record_equal(const SonicMeterSample* a, const SonicMeterSample* b) {
+    return a->sequence == b->sequence && a->sensor == b->sensor && a->timestamp == b->timestamp &&
+           a->ticks == b->ticks && a->filtered_um == b->filtered_um && a->result == b->result &&
+           a->flags == b->flags;
+}
+
+/**
+ * @brief      Encode samples after a header.
+ * @param      header   The header.
+ * @param      samples  The samples.
+ * @param      count    Number of samples.
+ * @param      out      Room for the header and count records.
+ * @return     Number of bytes written.
+*/
+static size_t test_record_encode(
+    const SonicMeterRecordHeader* header,
+    const SonicMeterSample* samples,
+    size_t count,
+    uint8_t* out) {
+    SonicMeterRecordCodec codec;
+    uint32_t too_long = 0;
+    sonicmeter_record_codec_reset(&codec);
+    size_t size = sonicmeter_record_header_encode(header, out);
+    for(size_t i = 0; i < count; i++) {
+        const size_t used = sonicmeter_record_encode(&codec, &samples[i], out + size);
+        too_long += used > SONICMETER_RECORD_SIZE_MAX;
+        size += used;
+    }
+    TEST_CHECK_EQ(too_long, 0);
+    return size;
+}
+
+/**
+ * @brief      Decode a file and compare it with the samples it was encoded from.
+ * @param      data     The file.
+ * @param      size     Size of the file.
+ * @param      samples  The samples.
+ * @param      count    Number of samples.
+ * @return     Samples that did not decode to themselves.
+*/
+static uint32_t test_record_decode(
+    const uint8_t* data,
+    size_t size,
+    const SonicMeterSample* samples,
+    size_t count) {
+    SonicMeterRecordHeader header;
+    SonicMeterRecordCodec codec;
+    SonicMeterSample sample;
+    uint32_t wrong = 0;
+
+    TEST_CHECK(sonicmeter_record_header_decode(data, size, &header));
+    sonicmeter_record_codec_reset(&codec);
+    size_t offset = SONICMETER_RECORD_HEADER_SIZE;
+    for(size_t i = 0; i < count; i++) {
+        const size_t used =
+            sonicmeter_record_decode(&codec, data + offset, size - offset, &sample);
+        if(used == 0) {
+            return wrong + count - i;
+        }
+        wrong += !test_record_equal(&sample, &samples[i]);
+        offset += used;
+    }
+    TEST_CHECK_EQ(offset, size);
+    return wrong;
+}
+
+static void test_record_header(void) {
+    const SonicMeterRecordHeader header = {
+        .cpu_hz = TEST_CPU_HZ,
+        .tick_hz = SONICMETER_SAMPLE_TIMESTAMP_HZ,
+        .temperature_c = -15,
+        .max_range_cm = 600,
+    };
+    uint8_t data[SONICMETER_RECORD_HEADER_SIZE];
+    SonicMeterRecordHeader decoded;
+
+    TEST_CHECK_EQ(sonicmeter_record_header_encode(&header, data), SONICMETER_RECORD_HEADER_SIZE);
+    TEST_CHECK(sonicmeter_record_header_decode(data, sizeof(data), &decoded));
+    TEST_CHECK(memcmp(&decoded, &header, sizeof(header)) == 0);
+
+    // Version 1 files are read, version 0 and newer ones are not
+    data[4] = 1;
+    TEST_CHECK(sonicmeter_record_header_decode(data, sizeof(data), &decoded));
+    data[4] = 0;
+    TEST_CHECK(!sonicmeter_record_header_decode(data, sizeof(data), &decoded));
+    data[4] = SONICMETER_RECORD_VERSION + 1;
+    TEST_CHECK(!sonicmeter_record_header_decode(data, sizeof(data), &decoded));
+    data[4] = 1;
+    data[7] = 1;
+    TEST_CHECK(!sonicmeter_record_header_decode(data, sizeof(data), &decoded));
+    data[7] = 0;
+
+    // A short file or another magic
+    TEST_CHECK(!sonicmeter_record_header_decode(data, sizeof(data) - 1, &decoded));
+    data[0] ^= 1;
+    TEST_CHECK(!sonicmeter_record_header_decode(data, sizeof(data), &decoded));
+}
+
+static void test_record_generate(size_t count, uint32_t sensors) {
+    // Each sensor at its own distance, 0.2 to 5.9 m apart, staggered the way the worker runs them
+    uint32_t distance_um[SONICMETER_SAMPLE_SENSORS_MAX];
+    for(uint32_t s = 0; s < SONICMETER_SAMPLE_SENSORS_MAX; s++) {
+        distance_um[s] = 200000 + s * 1900000;
+    }
+    uint32_t sequence = UINT32_MAX - 1000;
+    // Starts short of 2^32 us, 71 minutes, where 32 bit timestamps wrapped
+    uint64_t timestamp = UINT32_MAX - 5000000;
+
+    for(size_t i = 0; i < count; i++) {
+        SonicMeterSample* sample = &test_samples[i];
+        const uint32_t sensor = i % sensors;
+        // Now and then a few samples dropped by the ring or a late trigger
+        sequence += test_random_below(100) ? 1 : 2 + test_random_below(50);
+        timestamp += 60000 / sensors + test_random_below(2000);
+        distance_um[sensor] += test_random_below(4001) - 2000;
+
+        memset(sample, 0, sizeof(SonicMeterSample));
+        sample->sequence = sequence;
+        sample->sensor = sensor;
+        sample->timestamp = timestamp;
+        sample->result = test_random_below(20) ? SonicMeterCaptureResultOk :
+                                                 1 + test_random_below(3);
+        // About 5.3 um per tick at 64 MHz
+        sample->ticks = sample->result == SonicMeterCaptureResultOk ?
+                            distance_um[sensor] * 10 / 53 + test_random_below(20) :
+                            0;
+        sample->filtered_um = distance_um[sensor] + test_random_below(100);
+        sample->flags = test_random_below(4);
+    }
+}
+
+static void test_record_stream(const char* path) {
+    const SonicMeterRecordHeader header = {
+        .cpu_hz = TEST_CPU_HZ,
+        .tick_hz = SONICMETER_SAMPLE_TIMESTAMP_HZ,
+        .temperature_c = 20,
+        .max_range_cm = 600,
+    };
+
+    // One sensor, then four far apart: the deltas are against the same sensor, so the records do
+    // not grow with the distance between the sensors, only by the byte the sensor number takes
+    double single = 0;
+    for(uint32_t sensors = 1; sensors <= SONICMETER_SAMPLE_SENSORS_MAX; sensors *= 4) {
+        test_record_generate(TEST_SAMPLES, sensors);
+        const size_t size = test_record_encode(&header, test_samples, TEST_SAMPLES, test_data);
+        const double per_record = (double)(size - SONICMETER_RECORD_HEADER_SIZE) / TEST_SAMPLES;
+        printf("%" PRIu32 " sensors: %.2f bytes per record\n", sensors, per_record);
+        if(sensors == 1) {
+            single = per_record;
+        }
+        TEST_CHECK(per_record < single + 1);
+        TEST_CHECK_EQ(test_record_decode(test_data, size, test_samples, TEST_SAMPLES), 0);
+
+        FILE* file = fopen(path, "wb");
+        TEST_CHECK(file != NULL);
+        if(file) {
+            TEST_CHECK_EQ(fwrite(test_data, 1, size, file), size);
+            fclose(file);
+        }
+    }
+}
+
+static void test_record_old_versions(void) {
+    // Before version 3 the timestamps were 32 bit. With a first timestamp below 2^32 and deltas
+    // below it, the records are the bytes the 32 bit encoder wrote for the same samples, and their
+    // timestamps must come out past the wrap, not back at 0
+    const SonicMeterRecordHeader header = {.cpu_hz = TEST_CPU_HZ, .tick_hz = 1000000};
+    const size_t count = 1000;
+    for(uint32_t version = 1; version < 3; version++) {
+        // A version 1 file has no sensor field, the records decode as sensor 0
+        test_record_generate(count, version == 1 ? 1 : SONICMETER_SAMPLE_SENSORS_MAX);
+        TEST_CHECK(test_samples[0].timestamp <= UINT32_MAX);
+        TEST_CHECK(test_samples[count - 1].timestamp > UINT32_MAX);
+        const size_t size = test_record_encode(&header, test_samples, count, test_data);
+        test_data[4] = version;
+        TEST_CHECK_EQ(test_record_decode(test_data, size, test_samples, count), 0);
+    }
+}
+
+static void test_record_extremes(void) {
+    // Every field swinging between its ends, the largest deltas each way
+    static const uint32_t values[] = {0, UINT32_MAX, 0, 1, UINT32_MAX, 0x80000000, 0x7FFFFFFF};
+    SonicMeterSample samples[COUNT_OF(values) * SONICMETER_SAMPLE_SENSORS_MAX];
+    for(size_t i = 0; i < COUNT_OF(samples); i++) {
+        const uint32_t value = values[i / SONICMETER_SAMPLE_SENSORS_MAX];
+        samples[i] = (SonicMeterSample){
+            .sequence = value,
+            .sensor = i % SONICMETER_SAMPLE_SENSORS_MAX,
+            .timestamp = (uint64_t)value << 32 | value,
+            .ticks = value,
+            .filtered_um = ~value,
+            .flags = SonicMeterSampleFlagRejected | SonicMeterSampleFlagAlarm,
+            .result = SonicMeterCaptureResultLineHigh,
+        };
+    }
+    const SonicMeterRecordHeader header = {.cpu_hz = TEST_CPU_HZ};
+    const size_t size = test_record_encode(&header, samples, COUNT_OF(samples), test_data);
+    TEST_CHECK_EQ(test_record_decode(test_data, size, samples, COUNT_OF(samples)), 0);
+}
+
+static void test_record_truncated(void) {
+    // Every record cut at every byte: nothing is decoded and the codec is left as it was, so the
+    // rest of the record still decodes once it is there
+    const SonicMeterRecordHeader header = {.cpu_hz = TEST_CPU_HZ};
+    const size_t count = 200;
+    test_record_generate(count, SONICMETER_SAMPLE_SENSORS_MAX);
+    const size_t size = test_record_encode(&header, test_samples, count, test_data);
+
+    SonicMeterRecordCodec codec;
+    SonicMeterSample sample;
+    uint32_t decoded_short = 0;
+    uint32_t wrong = 0;
+    sonicmeter_record_codec_reset(&codec);
+    size_t offset = SONICMETER_RECORD_HEADER_SIZE;
+    for(size_t i = 0; i < count; i++) {
+        size_t used = 0;
+        for(size_t cut = 0; cut <= size - offset && used == 0; cut++) {
+            used = sonicmeter_record_decode(&codec, test_data + offset, cut, &sample);
+            decoded_short += used != 0 && used != cut;
+        }
+        wrong += used == 0 || !test_record_equal(&sample, &test_samples[i]);
+        offset += used;
+    }
+    TEST_CHECK_EQ(decoded_short, 0);
+    TEST_CHECK_EQ(wrong, 0);
+
+    // A varint longer than five bytes and a sensor past the last one are malformed
+    static const uint8_t long_varint[] = {0x80, 0x80, 0x80, 0x80, 0x80, 0x01, 0, 0, 0, 0};
+    static const uint8_t bad_sensor[] = {1, 1, 0, 0, 0x80, SONICMETER_SAMPLE_SENSORS_MAX << 1};
+    sonicmeter_record_codec_reset(&codec);
+    TEST_CHECK_EQ(
+        sonicmeter_record_decode(&codec, long_varint, sizeof(long_varint), &sample), 0);
+    TEST_CHECK_EQ(sonicmeter_record_decode(&codec, bad_sensor, sizeof(bad_sensor), &sample), 0);
+}
+
+int main(int argc, char* argv[]) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s.smr", argc > 0 ? argv[0] : "test_record");
+
+    test_record_header();
+    test_record_old_versions();
+    test_record_extremes();
+    test_record_truncated();
+    // Last, its file is the one left behind
+    test_record_stream(path);
+    return test_done("record");
+}
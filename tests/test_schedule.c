@@ -0,0 +1,280 @@
+/**
+ * Tests of the trigger scheduling.
+ *
+ * The clock over many counter wraps, single deadlines over a day of late triggers and past
+ * overruns, then the turns the way the worker runs them, against a simulated clock: wait for the
+ * target, fire, wait for the echo, hold the others for the stagger, pass the turn on.
+*/
+
+#include <string.h>
+
+#include "test.h"
+#include "sonicmeter_schedule.h"
+
+#define TEST_PERIOD_US 60000 // Recovery time of an HC-SR04
+#define TEST_STAGGER_US 5000
+#define TEST_TURNS 40000
+
+typedef struct {
+    uint32_t sensors;
+    uint32_t echo_us[SONICMETER_SAMPLE_SENSORS_MAX]; // Trigger to echo of each sensor
+    uint32_t late_us; // Trigger lateness, every other trigger
+} TestTurnsRun;
+
+typedef struct {
+    uint64_t fired_us[TEST_TURNS];
+    uint32_t sensor[TEST_TURNS];
+    SonicMeterScheduleStats stats;
+} TestTurnsLog;
+
+static TestTurnsLog test_log;
+
+static void test_turns_run(const TestTurnsRun* run) {
+    SonicMeterScheduleTurns turns;
+    sonicmeter_schedule_turns_init(&turns, run->sensors, TEST_PERIOD_US, TEST_STAGGER_US);
+    memset(&test_log.stats, 0, sizeof(test_log.stats));
+    uint64_t now_us = 0;
+
+    for(uint32_t t = 0; t < TEST_TURNS; t++) {
+        const uint64_t target_us = sonicmeter_schedule_turns_get_target(&turns);
+        if(now_us < target_us) {
+            now_us = target_us;
+        }
+        now_us += t & 1 ? run->late_us : 0;
+        test_log.fired_us[t] = now_us;
+        test_log.sensor[t] = turns.index;
+        sonicmeter_schedule_turns_fire(&turns, target_us, now_us, &test_log.stats);
+
+        now_us += run->echo_us[turns.index];
+        sonicmeter_schedule_turns_quiet(&turns, now_us);
+        sonicmeter_schedule_turns_next(&turns);
+    }
+}
+
+/**
+ * @brief      Check the order and the spacing of the triggers.
+ * @param      run  What ran.
+*/
+static void test_turns_check_spacing(const TestTurnsRun* run) {
+    uint32_t out_of_turn = 0;
+    uint32_t overlapping = 0;
+    uint32_t too_soon = 0;
+    uint64_t last_us[SONICMETER_SAMPLE_SENSORS_MAX] = {0};
+
+    for(uint32_t t = 0; t < TEST_TURNS; t++) {
+        const uint32_t sensor = test_log.sensor[t];
+        if(sensor != t % run->sensors) {
+            out_of_turn++;
+        }
+        // The previous ping is in and died out
+        if(t > 0 && test_log.fired_us[t] < test_log.fired_us[t - 1] +
+                                               run->echo_us[test_log.sensor[t - 1]] +
+                                               TEST_STAGGER_US) {
+            overlapping++;
+        }
+        // No sensor before its recovery
+        if(t >= run->sensors && test_log.fired_us[t] < last_us[sensor] + TEST_PERIOD_US) {
+            too_soon++;
+        }
+        last_us[sensor] = test_log.fired_us[t];
+    }
+    TEST_CHECK_EQ(out_of_turn, 0);
+    TEST_CHECK_EQ(overlapping, 0);
+    TEST_CHECK_EQ(too_soon, 0);
+}
+
+static void test_turns_fast(void) {
+    // Four short echoes fit in a period: every sensor runs at the full rate on its own grid,
+    // staggered by the echo and the stagger of the ones before it
+    const TestTurnsRun run = {.sensors = 4, .echo_us = {2000, 3000, 1000, 2500}};
+    test_turns_run(&run);
+    test_turns_check_spacing(&run);
+
+    const uint64_t offsets_us[] = {0, 7000, 15000, 21000};
+    uint32_t off_grid = 0;
+    for(uint32_t t = 0; t < TEST_TURNS; t++) {
+        const uint64_t expected_us =
+            offsets_us[test_log.sensor[t]] + (uint64_t)(t / run.sensors) * TEST_PERIOD_US;
+        if(test_log.fired_us[t] != expected_us) {
+            off_grid++;
+        }
+    }
+    TEST_CHECK_EQ(off_grid, 0);
+    TEST_CHECK_EQ(test_log.stats.fired, TEST_TURNS);
+    TEST_CHECK_EQ(test_log.stats.late_max_us, 0);
+    TEST_CHECK_EQ(test_log.stats.overruns, 0);
+}
+
+static void test_turns_late(void) {
+    // Late triggers do not push the grid back, the rate holds over the whole run
+    const TestTurnsRun run = {.sensors = 4, .echo_us = {2000, 3000, 1000, 2500}, .late_us = 700};
+    test_turns_run(&run);
+    test_turns_check_spacing(&run);
+
+    const uint32_t last = TEST_TURNS - 1;
+    const uint64_t rounds = last / run.sensors;
+    TEST_CHECK(test_log.fired_us[last] >= 21000 + rounds * TEST_PERIOD_US);
+    TEST_CHECK(test_log.fired_us[last] <= 21000 + rounds * TEST_PERIOD_US + 2 * run.late_us);
+    TEST_CHECK_EQ(test_log.stats.late_max_us, run.late_us);
+    TEST_CHECK_EQ(test_log.stats.overruns, 0);
+}
+
+static void test_turns_slow(void) {
+    // Four long echoes take longer than a period: the sensors follow each other as closely as
+    // the stagger allows, waiting for a turn is not lateness
+    const TestTurnsRun run = {.sensors = 4, .echo_us = {25000, 25000, 25000, 25000}};
+    test_turns_run(&run);
+    test_turns_check_spacing(&run);
+
+    uint32_t gaps = 0;
+    for(uint32_t t = 1; t < TEST_TURNS; t++) {
+        if(test_log.fired_us[t] - test_log.fired_us[t - 1] != 25000 + TEST_STAGGER_US) {
+            gaps++;
+        }
+    }
+    TEST_CHECK_EQ(gaps, 0);
+    TEST_CHECK_EQ(test_log.stats.late_max_us, 0);
+    TEST_CHECK_EQ(test_log.stats.overruns, 0);
+    TEST_CHECK_EQ(test_log.stats.skipped, 0);
+}
+
+static void test_turns_single(void) {
+    // One sensor is only held by its period
+    const TestTurnsRun run = {.sensors = 1, .echo_us = {30000}};
+    test_turns_run(&run);
+    test_turns_check_spacing(&run);
+    TEST_CHECK_EQ(test_log.fired_us[TEST_TURNS - 1], (uint64_t)(TEST_TURNS - 1) * TEST_PERIOD_US);
+}
+
+static void test_clock_wraps(void) {
+    // Over many wraps of the 32 bit counter, read at uneven intervals, the time is the cycles
+    // since start divided down, nothing lost at a wrap
+    SonicMeterClock clock;
+    const uint32_t start = UINT32_MAX - 1000;
+    sonicmeter_clock_init(&clock, 64000000, start);
+    uint64_t cycles = 0;
+    uint32_t wrong = 0;
+    uint32_t seed = 1;
+
+    for(uint32_t i = 0; i < 100000; i++) {
+        seed = seed * 1664525U + 1013904223U;
+        cycles += seed >> 2; // Up to a quarter wrap per read
+        const uint64_t now_us = sonicmeter_clock_update(&clock, start + (uint32_t)cycles);
+        wrong += now_us != cycles / 64;
+    }
+    TEST_CHECK(cycles > (uint64_t)1000 << 32);
+    TEST_CHECK_EQ(wrong, 0);
+}
+
+static void test_fire_drift(void) {
+    // A day of triggers, each late by up to half a period: the deadlines stay on the grid, the
+    // lateness does not add up
+    SonicMeterScheduleStats stats = {0};
+    uint64_t due_us = 0;
+    uint64_t late_max_us = 0;
+    uint32_t off_grid = 0;
+    uint32_t seed = 1;
+    const uint32_t fires = 24 * 3600 * (1000000 / TEST_PERIOD_US);
+
+    for(uint32_t i = 0; i < fires; i++) {
+        off_grid += due_us != (uint64_t)i * TEST_PERIOD_US;
+        seed = seed * 1664525U + 1013904223U;
+        const uint64_t late_us = (seed >> 16) % (TEST_PERIOD_US / 2);
+        late_max_us = late_us > late_max_us ? late_us : late_max_us;
+        sonicmeter_schedule_fire(&due_us, TEST_PERIOD_US, due_us, due_us + late_us, &stats);
+    }
+    TEST_CHECK_EQ(off_grid, 0);
+    TEST_CHECK_EQ(due_us, (uint64_t)fires * TEST_PERIOD_US);
+    TEST_CHECK_EQ(stats.fired, fires);
+    TEST_CHECK_EQ(stats.late_max_us, late_max_us);
+    TEST_CHECK_EQ(stats.overruns, 0);
+    TEST_CHECK_EQ(stats.skipped, 0);
+}
+
+static void test_fire_overrun(void) {
+    SonicMeterScheduleStats stats = {0};
+    const uint64_t start_us = 10 * TEST_PERIOD_US;
+    uint64_t due_us;
+
+    // Just short of a period late is still in time for the next deadline
+    due_us = start_us;
+    sonicmeter_schedule_fire(&due_us, TEST_PERIOD_US, due_us, due_us + TEST_PERIOD_US - 1, &stats);
+    TEST_CHECK_EQ(due_us, start_us + TEST_PERIOD_US);
+    TEST_CHECK_EQ(stats.overruns, 0);
+
+    // A whole period late missed the next one, it is skipped
+    due_us = start_us;
+    sonicmeter_schedule_fire(&due_us, TEST_PERIOD_US, due_us, due_us + TEST_PERIOD_US, &stats);
+    TEST_CHECK_EQ(due_us, start_us + 2 * TEST_PERIOD_US);
+    TEST_CHECK_EQ(stats.overruns, 1);
+    TEST_CHECK_EQ(stats.skipped, 1);
+
+    // Three and a half periods late skips three, the next deadline is the first one ahead, on
+    // the grid, no burst of catching up
+    due_us = start_us;
+    const uint64_t now_us = start_us + 7 * TEST_PERIOD_US / 2;
+    sonicmeter_schedule_fire(&due_us, TEST_PERIOD_US, due_us, now_us, &stats);
+    TEST_CHECK_EQ(due_us, start_us + 4 * TEST_PERIOD_US);
+    TEST_CHECK(due_us > now_us);
+    TEST_CHECK_EQ(stats.overruns, 2);
+    TEST_CHECK_EQ(stats.skipped, 4);
+    TEST_CHECK_EQ(stats.late_max_us, 7 * TEST_PERIOD_US / 2);
+    TEST_CHECK_EQ(stats.fired, 3);
+}
+
+static void test_turns_stall(void) {
+    // Now and then a trigger goes out whole periods late, the worker was held up: that sensor
+    // skips the deadlines it missed and stays on its grid, the others wait their turn as usual
+    SonicMeterScheduleTurns turns;
+    SonicMeterScheduleStats stats = {0};
+    const uint32_t echo_us[] = {2000, 3000, 1000, 2500};
+    const uint32_t stall_us = 4 * TEST_PERIOD_US + 1000;
+    uint32_t stalls = 0;
+    uint32_t off_grid = 0;
+    uint32_t overlapping = 0;
+    uint64_t now_us = 0;
+    sonicmeter_schedule_turns_init(&turns, 4, TEST_PERIOD_US, TEST_STAGGER_US);
+
+    for(uint32_t t = 0; t < TEST_TURNS; t++) {
+        const uint32_t sensor = turns.index;
+        const uint64_t target_us = sonicmeter_schedule_turns_get_target(&turns);
+        const uint64_t due_us = turns.due_us[sensor];
+        const bool stall = t % 400 == 1;
+        now_us = now_us > target_us ? now_us : target_us;
+        // Never while the previous ping may be in the air
+        overlapping += t > 0 && now_us < turns.quiet_us;
+        now_us += stall ? stall_us : 0;
+        sonicmeter_schedule_turns_fire(&turns, target_us, now_us, &stats);
+
+        if(stall) {
+            stalls++;
+            // The first deadline ahead on the grid of the missed one, which can be less than a
+            // period after the late trigger, the grid does not move
+            const uint64_t base_us = target_us > due_us ? target_us : due_us;
+            off_grid += turns.due_us[sensor] != base_us + 5 * TEST_PERIOD_US;
+            off_grid += turns.due_us[sensor] <= now_us;
+        }
+        now_us += echo_us[sensor];
+        sonicmeter_schedule_turns_quiet(&turns, now_us);
+        sonicmeter_schedule_turns_next(&turns);
+    }
+    TEST_CHECK(stalls > 0);
+    TEST_CHECK_EQ(off_grid, 0);
+    TEST_CHECK_EQ(overlapping, 0);
+    TEST_CHECK_EQ(stats.fired, TEST_TURNS);
+    TEST_CHECK_EQ(stats.overruns, stalls);
+    TEST_CHECK_EQ(stats.skipped, 4 * stalls);
+    TEST_CHECK_EQ(stats.late_max_us, stall_us);
+}
+
+int main(void) {
+    test_clock_wraps();
+    test_fire_drift();
+    test_fire_overrun();
+    test_turns_fast();
+    test_turns_late();
+    test_turns_slow();
+    test_turns_single();
+    test_turns_stall();
+    return test_done("schedule");
+}
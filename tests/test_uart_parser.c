@@ -0,0 +1,202 @@
+/**
+ * Tests of the serial frame parser.
+ *
+ * Hand made byte streams for the cases the JSN resync has to get right, a header byte inside a
+ * bad frame, distance and checksum bytes that look like a header, frames cut by a reset, then a
+ * long random stream of frames with garbage between them that must all be found again.
+*/
+
+#include "test.h"
+#include "sonicmeter_uart_parser.h"
+
+#define TEST_FRAMES 20000
+#define TEST_MM_MAX 8 // Distances per feed
+
+static uint32_t test_seed = 1;
+
+static uint32_t test_random_below(uint32_t n) {
+    test_seed = test_seed * 1664525U + 1013904223U;
+    return ((test_seed >> 16) * n) >> 16;
+}
+
+/**
+ * @brief      Feed a byte stream.
+ * @param      parser  The parser.
+ * @param      bytes   The bytes.
+ * @param      count   Number of bytes.
+ * @param      mm      Filled in with the distances of the frames found, TEST_MM_MAX at most.
+ * @return     Number of frames found.
+*/
+static uint32_t
+    test_feed(SonicMeterUartParser* parser, const uint8_t* bytes, size_t count, uint32_t* mm) {
+    uint32_t frames = 0;
+    uint32_t distance;
+    for(size_t i = 0; i < count; i++) {
+        if(sonicmeter_uart_parser_feed(parser, bytes[i], &distance)) {
+            if(frames < TEST_MM_MAX) {
+                mm[frames] = distance;
+            }
+            frames++;
+        }
+    }
+    return frames;
+}
+
+static size_t test_jsn_frame(uint8_t* bytes, uint16_t mm) {
+    bytes[0] = 0xFF;
+    bytes[1] = mm >> 8;
+    bytes[2] = mm & 0xFF;
+    bytes[3] = bytes[0] + bytes[1] + bytes[2];
+    return 4;
+}
+
+static void test_us100(void) {
+    SonicMeterUartParser parser;
+    uint32_t mm[TEST_MM_MAX];
+    sonicmeter_uart_parser_init(&parser, SonicMeterUartProtocolUs100);
+
+    const uint8_t frames[] = {0x05, 0xDC, 0x00, 0x00, 0xFF, 0xFF};
+    TEST_CHECK_EQ(test_feed(&parser, frames, sizeof(frames), mm), 3);
+    TEST_CHECK_EQ(mm[0], 1500);
+    TEST_CHECK_EQ(mm[1], 0);
+    TEST_CHECK_EQ(mm[2], 0xFFFF);
+    TEST_CHECK_EQ(parser.bad_frames, 0);
+
+    // Nothing pending, a reset is free
+    sonicmeter_uart_parser_reset(&parser);
+    TEST_CHECK_EQ(parser.bad_frames, 0);
+
+    // Half a frame is dropped by the reset before the next request, the next frame is whole
+    const uint8_t half[] = {0x05};
+    TEST_CHECK_EQ(test_feed(&parser, half, sizeof(half), mm), 0);
+    sonicmeter_uart_parser_reset(&parser);
+    TEST_CHECK_EQ(parser.bad_frames, 1);
+    const uint8_t next[] = {0x01, 0x2C};
+    TEST_CHECK_EQ(test_feed(&parser, next, sizeof(next), mm), 1);
+    TEST_CHECK_EQ(mm[0], 300);
+}
+
+static void test_jsn_frames(void) {
+    SonicMeterUartParser parser;
+    uint32_t mm[TEST_MM_MAX];
+    sonicmeter_uart_parser_init(&parser, SonicMeterUartProtocolJsn);
+
+    // Distance bytes that are header bytes, and a checksum that is one
+    const uint8_t frames[] = {
+        0xFF, 0x05, 0xDC, 0xE0, // 1500
+        0xFF, 0xFF, 0xFF, 0xFD, // 65535
+        0xFF, 0x01, 0xFF, 0xFF, // 511, checksum 0xFF
+        0xFF, 0x00, 0xFF, 0xFE, // 255
+    };
+    TEST_CHECK_EQ(test_feed(&parser, frames, sizeof(frames), mm), 4);
+    TEST_CHECK_EQ(mm[0], 1500);
+    TEST_CHECK_EQ(mm[1], 65535);
+    TEST_CHECK_EQ(mm[2], 511);
+    TEST_CHECK_EQ(mm[3], 255);
+    TEST_CHECK_EQ(parser.bad_frames, 0);
+
+    // Leading bytes that are no header are thrown away one by one
+    const uint8_t garbage[] = {0x00, 0x12, 0xFE, 0xFF, 0x00, 0x64, 0x63};
+    TEST_CHECK_EQ(test_feed(&parser, garbage, sizeof(garbage), mm), 1);
+    TEST_CHECK_EQ(mm[0], 100);
+    TEST_CHECK_EQ(parser.bad_frames, 3);
+}
+
+static void test_jsn_resync(void) {
+    SonicMeterUartParser parser;
+    uint32_t mm[TEST_MM_MAX];
+    sonicmeter_uart_parser_init(&parser, SonicMeterUartProtocolJsn);
+
+    // Bad checksum, the frame holds the header of the real one
+    const uint8_t inside[] = {0xFF, 0x01, 0xFF, 0x00, 0x64, 0x63};
+    TEST_CHECK_EQ(test_feed(&parser, inside, sizeof(inside), mm), 1);
+    TEST_CHECK_EQ(mm[0], 100);
+    TEST_CHECK_EQ(parser.bad_frames, 1);
+
+    // A frame missing its checksum, the next header is its fourth byte
+    const uint8_t lost[] = {0xFF, 0x01, 0x2C, 0xFF, 0x00, 0x64, 0x63};
+    TEST_CHECK_EQ(test_feed(&parser, lost, sizeof(lost), mm), 1);
+    TEST_CHECK_EQ(mm[0], 100);
+    TEST_CHECK_EQ(parser.bad_frames, 2);
+
+    // Bad checksum without a header inside, all four bytes go
+    const uint8_t corrupt[] = {0xFF, 0x01, 0x2C, 0x00, 0xFF, 0x01, 0x2C, 0x2C};
+    TEST_CHECK_EQ(test_feed(&parser, corrupt, sizeof(corrupt), mm), 1);
+    TEST_CHECK_EQ(mm[0], 300);
+    TEST_CHECK_EQ(parser.bad_frames, 3);
+
+    // The header the first resync keeps starts a bad frame too
+    const uint8_t twice[] = {0xFF, 0xFF, 0x10, 0x00, 0xFF, 0x05, 0xDC, 0xE0};
+    TEST_CHECK_EQ(test_feed(&parser, twice, sizeof(twice), mm), 1);
+    TEST_CHECK_EQ(mm[0], 1500);
+    TEST_CHECK_EQ(parser.bad_frames, 5);
+}
+
+static void test_jsn_split(void) {
+    SonicMeterUartParser parser;
+    uint32_t mm[TEST_MM_MAX];
+    sonicmeter_uart_parser_init(&parser, SonicMeterUartProtocolJsn);
+
+    // A frame over several receive interrupts is one frame
+    const uint8_t frame[] = {0xFF, 0x05, 0xDC, 0xE0};
+    TEST_CHECK_EQ(test_feed(&parser, frame, 1, mm), 0);
+    TEST_CHECK_EQ(test_feed(&parser, frame + 1, 2, mm), 0);
+    TEST_CHECK_EQ(test_feed(&parser, frame + 3, 1, mm), 1);
+    TEST_CHECK_EQ(mm[0], 1500);
+
+    // Cut by the reset of the next request: the head is dropped, the tail is garbage
+    TEST_CHECK_EQ(test_feed(&parser, frame, 2, mm), 0);
+    sonicmeter_uart_parser_reset(&parser);
+    TEST_CHECK_EQ(parser.bad_frames, 1);
+    TEST_CHECK_EQ(test_feed(&parser, frame + 2, 2, mm), 0);
+    TEST_CHECK_EQ(parser.bad_frames, 3);
+    TEST_CHECK_EQ(test_feed(&parser, frame, sizeof(frame), mm), 1);
+    TEST_CHECK_EQ(mm[0], 1500);
+
+    // A late tail that starts with a header byte is taken for a frame until the next one shows
+    const uint8_t tail[] = {0xFF, 0x12};
+    const uint8_t next[] = {0xFF, 0x00, 0x64, 0x63};
+    sonicmeter_uart_parser_reset(&parser);
+    TEST_CHECK_EQ(test_feed(&parser, tail, sizeof(tail), mm), 0);
+    TEST_CHECK_EQ(test_feed(&parser, next, sizeof(next), mm), 1);
+    TEST_CHECK_EQ(mm[0], 100);
+    TEST_CHECK_EQ(parser.bad_frames, 4);
+}
+
+static void test_jsn_stream(void) {
+    // Random frames with random garbage between them, none of it a header byte
+    SonicMeterUartParser parser;
+    sonicmeter_uart_parser_init(&parser, SonicMeterUartProtocolJsn);
+    uint8_t bytes[4 + 3];
+    uint32_t garbage = 0;
+    uint32_t found = 0;
+    uint32_t wrong = 0;
+
+    for(uint32_t f = 0; f < TEST_FRAMES; f++) {
+        const uint16_t mm = test_random_below(0x10000);
+        size_t count = test_jsn_frame(bytes, mm);
+        const uint32_t extra = test_random_below(4);
+        for(uint32_t i = 0; i < extra; i++) {
+            bytes[count++] = test_random_below(0xFF);
+        }
+        garbage += extra;
+
+        uint32_t distance[TEST_MM_MAX];
+        const uint32_t frames = test_feed(&parser, bytes, count, distance);
+        found += frames;
+        wrong += frames != 1 || distance[0] != mm;
+    }
+    printf("%u frames, %" PRIu32 " garbage bytes\n", TEST_FRAMES, garbage);
+    TEST_CHECK_EQ(found, TEST_FRAMES);
+    TEST_CHECK_EQ(wrong, 0);
+    TEST_CHECK_EQ(parser.bad_frames, garbage);
+}
+
+int main(void) {
+    test_us100();
+    test_jsn_frames();
+    test_jsn_resync();
+    test_jsn_split();
+    test_jsn_stream();
+    return test_done("uart_parser");
+}
@@ -0,0 +1,151 @@
+/**
+ * Tests of the velocity estimate.
+ *
+ * Straight lines must give their slope exactly, noisy and unevenly timed points the slope of a
+ * least squares fit done in double precision, to the millimeter per second the integer division
+ * drops. Then the window: how many points count, which ones fall out, and what starts over.
+*/
+
+#include <math.h>
+
+#include "test.h"
+#include "sonicmeter_velocity.h"
+
+#define TEST_STEP_US 60000 // One sensor at its full rate
+#define TEST_RANDOM_RUNS 20000
+
+static uint32_t test_seed = 1;
+
+static uint32_t test_random_below(uint32_t n) {
+    test_seed = test_seed * 1664525U + 1013904223U;
+    return ((test_seed >> 16) * n) >> 16;
+}
+
+/**
+ * @brief      Fit the points the same way in double precision.
+ * @param      velocity  The points.
+ * @return     Slope, millimeters per second.
+*/
+static double test_velocity_reference(const SonicMeterVelocity* velocity) {
+    double sum_t = 0;
+    double sum_d = 0;
+    double sum_tt = 0;
+    double sum_td = 0;
+    const uint32_t t0 = velocity->timestamp_us[velocity->head];
+    for(uint32_t i = 0; i < velocity->count; i++) {
+        const uint32_t slot = (velocity->head + i) % SONICMETER_VELOCITY_POINTS;
+        const double t = (uint32_t)(velocity->timestamp_us[slot] - t0);
+        const double d = velocity->distance_um[slot];
+        sum_t += t;
+        sum_d += d;
+        sum_tt += t * t;
+        sum_td += t * d;
+    }
+    const double n = velocity->count;
+    return (n * sum_td - sum_t * sum_d) / (n * sum_tt - sum_t * sum_t) * 1000;
+}
+
+static void test_velocity_lines(void) {
+    // Approaching, still and receding, across a timestamp wrap
+    static const int32_t speeds_mm_s[] = {-3000, -250, -1, 0, 1, 37, 1500, 5000};
+    SonicMeterVelocity velocity;
+    int32_t mm_s;
+
+    for(size_t s = 0; s < COUNT_OF(speeds_mm_s); s++) {
+        sonicmeter_velocity_reset(&velocity);
+        const uint32_t start_us = UINT32_MAX - 5 * TEST_STEP_US;
+        for(uint32_t i = 0; i < 20; i++) {
+            // 60 ms is a whole number of micrometers at any whole mm/s
+            const int32_t distance_um = 6000000 + speeds_mm_s[s] * (int32_t)i * 60;
+            sonicmeter_velocity_add(&velocity, start_us + i * TEST_STEP_US, distance_um);
+            const bool valid = sonicmeter_velocity_get(&velocity, &mm_s);
+            TEST_CHECK_EQ(valid, i + 1 >= SONICMETER_VELOCITY_POINTS_MIN);
+            if(valid) {
+                TEST_CHECK_EQ(mm_s, speeds_mm_s[s]);
+            }
+        }
+        TEST_CHECK_EQ(velocity.count, SONICMETER_VELOCITY_POINTS);
+    }
+}
+
+static void test_velocity_noise(void) {
+    // Uneven timing, noise and every distance up to 6 m, against the double precision fit
+    SonicMeterVelocity velocity;
+    uint32_t wrong = 0;
+    double error_max = 0;
+
+    for(uint32_t run = 0; run < TEST_RANDOM_RUNS; run++) {
+        sonicmeter_velocity_reset(&velocity);
+        uint32_t timestamp_us = test_random_below(UINT32_MAX);
+        const uint32_t points = SONICMETER_VELOCITY_POINTS_MIN +
+                                test_random_below(2 * SONICMETER_VELOCITY_POINTS);
+        for(uint32_t i = 0; i < points; i++) {
+            timestamp_us += 1000 + test_random_below(SONICMETER_VELOCITY_WINDOW_US / 4);
+            sonicmeter_velocity_add(&velocity, timestamp_us, test_random_below(6000001));
+        }
+
+        int32_t mm_s;
+        if(!sonicmeter_velocity_get(&velocity, &mm_s)) {
+            // Only when the window has too few points left
+            wrong += velocity.count >= SONICMETER_VELOCITY_POINTS_MIN;
+            continue;
+        }
+        const double error = fabs(mm_s - test_velocity_reference(&velocity));
+        error_max = error > error_max ? error : error_max;
+        wrong += error >= 1.0;
+    }
+    printf("%u random fits, largest error %.3f mm/s\n", TEST_RANDOM_RUNS, error_max);
+    TEST_CHECK_EQ(wrong, 0);
+}
+
+static void test_velocity_window(void) {
+    SonicMeterVelocity velocity;
+    int32_t mm_s;
+
+    // Only the newest points count: a target that stopped reads as still once they are all
+    // behind the stop
+    sonicmeter_velocity_reset(&velocity);
+    uint32_t now_us = 0;
+    for(uint32_t i = 0; i < 20; i++, now_us += TEST_STEP_US) {
+        sonicmeter_velocity_add(&velocity, now_us, 2000000 - i * 60000);
+    }
+    TEST_CHECK(sonicmeter_velocity_get(&velocity, &mm_s));
+    TEST_CHECK_EQ(mm_s, -1000);
+    for(uint32_t i = 0; i < SONICMETER_VELOCITY_POINTS; i++, now_us += TEST_STEP_US) {
+        sonicmeter_velocity_add(&velocity, now_us, 800000);
+    }
+    TEST_CHECK(sonicmeter_velocity_get(&velocity, &mm_s));
+    TEST_CHECK_EQ(mm_s, 0);
+
+    // Slow samples: points older than the window fall out before the fit is full
+    sonicmeter_velocity_reset(&velocity);
+    const uint32_t slow_us = 600000;
+    for(uint32_t i = 0; i < 10; i++) {
+        sonicmeter_velocity_add(&velocity, i * slow_us, 1000000 + i * slow_us / 10);
+    }
+    TEST_CHECK_EQ(velocity.count, 4);
+    TEST_CHECK(sonicmeter_velocity_get(&velocity, &mm_s));
+    TEST_CHECK_EQ(mm_s, 100);
+
+    // A gap longer than the window starts over
+    now_us = 9 * slow_us + SONICMETER_VELOCITY_WINDOW_US + 1;
+    sonicmeter_velocity_add(&velocity, now_us, 5000000);
+    TEST_CHECK_EQ(velocity.count, 1);
+    TEST_CHECK(!sonicmeter_velocity_get(&velocity, &mm_s));
+    sonicmeter_velocity_add(&velocity, now_us + TEST_STEP_US, 5000000);
+    TEST_CHECK(!sonicmeter_velocity_get(&velocity, &mm_s));
+
+    // Points at one instant have no slope
+    sonicmeter_velocity_reset(&velocity);
+    for(uint32_t i = 0; i < 5; i++) {
+        sonicmeter_velocity_add(&velocity, 1000, 1000000 + i);
+    }
+    TEST_CHECK(!sonicmeter_velocity_get(&velocity, &mm_s));
+}
+
+int main(void) {
+    test_velocity_lines();
+    test_velocity_noise();
+    test_velocity_window();
+    return test_done("velocity");
+}
@@ -0,0 +1,268 @@
+#!/usr/bin/env python3
+"""Convert SonicMeter recordings (.smr) to CSV.
+
+The format is described in sonicmeter_record.h. Raw ticks are converted to
+distance with the same fixed point math the app uses, so the CSV matches what
+the device would have shown without the filter.
+
+    smr2csv.py recording.smr [-o out.csv]
+    smr2csv.py --selftest [recording]
+"""
+
+import argparse
+import csv
+import math
+import random
+import struct
+import sys
+
+MAGIC = 0x524D5353
+VERSION = 3
+HEADER = struct.Struct("<IIIIiI")
+FLAGS_SHIFT = 4
+SENSOR_SHIFT = 8
+SENSORS_MAX = 4
+RESULTS = ["ok", "no_echo", "out_of_range", "line_high"]
+FIELDS = ["sequence", "timestamp", "ticks", "filtered_um", "result", "flags", "sensor"]
+
+
+def speed_of_sound_mm_s(temperature_c):
+    temperature_c = min(max(temperature_c, -20), 50)
+    return round(331300 * math.sqrt(1 + temperature_c / 273.15))
+
+
+def um_per_tick_q24(cpu_hz, temperature_c):
+    numerator = (speed_of_sound_mm_s(temperature_c) * 1000) << 24
+    denominator = cpu_hz * 2
+    return (numerator + denominator // 2) // denominator
+
+
+def zigzag(delta):
+    delta &= 0xFFFFFFFF
+    return ((delta << 1) ^ (0xFFFFFFFF if delta & 0x80000000 else 0)) & 0xFFFFFFFF
+
+
+def unzigzag(value):
+    return ((value >> 1) ^ (-(value & 1) & 0xFFFFFFFF)) & 0xFFFFFFFF
+
+
+def put_varint(out, value):
+    while value >= 0x80:
+        out.append((value & 0x7F) | 0x80)
+        value >>= 7
+    out.append(value)
+
+
+def get_varint(data, offset, limit=5):
+    result = 0
+    for i in range(limit):
+        if offset + i >= len(data):
+            return None, offset
+        byte = data[offset + i]
+        result |= (byte & 0x7F) << (7 * i)
+        if not byte & 0x80:
+            return result, offset + i + 1
+    raise ValueError("varint too long at offset %d" % offset)
+
+
+def encode_records(records):
+    out = bytearray()
+    previous = dict.fromkeys(FIELDS, 0)
+    # Ticks and filtered distance are deltas against the same sensor
+    sensors = [dict.fromkeys(FIELDS, 0) for _ in range(SENSORS_MAX)]
+    for record in records:
+        sensor = sensors[record["sensor"]]
+        put_varint(out, (record["sequence"] - previous["sequence"]) & 0xFFFFFFFF)
+        put_varint(out, (record["timestamp"] - previous["timestamp"]) & 0xFFFFFFFFFFFFFFFF)
+        put_varint(out, zigzag(record["ticks"] - sensor["ticks"]))
+        put_varint(out, zigzag(record["filtered_um"] - sensor["filtered_um"]))
+        put_varint(
+            out,
+            record["result"]
+            | (record["flags"] << FLAGS_SHIFT)
+            | (record["sensor"] << SENSOR_SHIFT),
+        )
+        previous = record
+        sensors[record["sensor"]] = record
+    return bytes(out)
+
+
+def decode_records(data, offset=0, count=None):
+    """Decode records until the data or count runs out.
+
+    Returns the records and whether the data ended in the middle of a record.
+    """
+    records = []
+    previous = dict.fromkeys(FIELDS, 0)
+    sensors = [dict.fromkeys(FIELDS, 0) for _ in range(SENSORS_MAX)]
+    while offset < len(data) and (count is None or len(records) < count):
+        fields = []
+        for i in range(5):
+            # The timestamp is 64 bit since version 3
+            value, offset = get_varint(data, offset, 10 if i == 1 else 5)
+            if value is None:
+                return records, True
+            fields.append(value)
+        sensor_index = fields[4] >> SENSOR_SHIFT
+        if sensor_index >= SENSORS_MAX:
+            raise ValueError("bad sensor %d" % sensor_index)
+        sensor = sensors[sensor_index]
+        record = {
+            "sequence": (previous["sequence"] + fields[0]) & 0xFFFFFFFF,
+            "timestamp": (previous["timestamp"] + fields[1]) & 0xFFFFFFFFFFFFFFFF,
+            "ticks": (sensor["ticks"] + unzigzag(fields[2])) & 0xFFFFFFFF,
+            "filtered_um": (sensor["filtered_um"] + unzigzag(fields[3])) & 0xFFFFFFFF,
+            "result": fields[4] & ((1 << FLAGS_SHIFT) - 1),
+            "flags": (fields[4] >> FLAGS_SHIFT) & ((1 << (SENSOR_SHIFT - FLAGS_SHIFT)) - 1),
+            "sensor": sensor_index,
+        }
+        records.append(record)
+        previous = record
+        sensors[sensor_index] = record
+    return records, False
+
+
+def encode(header, records):
+    return HEADER.pack(MAGIC, VERSION, *header) + encode_records(records)
+
+
+def decode(data):
+    if len(data) < HEADER.size:
+        raise ValueError("file too short for a header")
+    magic, version, cpu_hz, tick_hz, temperature_c, max_range_cm = HEADER.unpack_from(data)
+    # Version 1 had no sensor field, its records decode as sensor 0. Before version 3 the
+    # timestamps were 32 bit, their deltas sum up across the wrap all the same
+    if magic != MAGIC or not 1 <= version <= VERSION:
+        raise ValueError("not a SonicMeter recording, or unsupported version")
+    header = (cpu_hz, tick_hz, temperature_c, max_range_cm)
+
+    # A truncated last record means the recording was cut short, keep the rest
+    records, _ = decode_records(data, HEADER.size)
+    return header, records
+
+
+def write_csv(header, records, stream):
+    cpu_hz, tick_hz, temperature_c, _ = header
+    factor = um_per_tick_q24(cpu_hz, temperature_c)
+    writer = csv.writer(stream)
+    writer.writerow(
+        [
+            "sequence",
+            "sensor",
+            "time_s",
+            "ticks",
+            "echo_us",
+            "distance_um",
+            "filtered_um",
+            "result",
+            "flags",
+        ]
+    )
+    for record in records:
+        ticks = record["ticks"]
+        result = record["result"]
+        writer.writerow(
+            [
+                record["sequence"],
+                record["sensor"],
+                "%.3f" % (record["timestamp"] / tick_hz),
+                ticks,
+                (ticks * 1000000 + cpu_hz // 2) // cpu_hz,
+                (ticks * factor + (1 << 23)) >> 24,
+                record["filtered_um"],
+                RESULTS[result] if result < len(RESULTS) else result,
+                record["flags"],
+            ]
+        )
+
+
+def selftest_recording(path):
+    """Check a recording made by the app's codec encodes back to the same bytes here."""
+    with open(path, "rb") as f:
+        data = f.read()
+    header, records = decode(data)
+    if encode(header, records) != data:
+        print("selftest: %s does not encode back to itself" % path, file=sys.stderr)
+        return 1
+    print("selftest: %s, %d records match the device codec" % (path, len(records)))
+    return 0
+
+
+def selftest(count=100000):
+    rng = random.Random(1)
+    header = (64000000, 1000000, 20, 400)
+    records = []
+    sequence = 0
+    timestamp = (1 << 32) - rng.randrange(1 << 30)
+    filtered = [500000] * SENSORS_MAX
+    for _ in range(count):
+        sequence += 1 if rng.random() > 0.01 else rng.randrange(2, 50)
+        timestamp += rng.randrange(15000, 70000)
+        result = 0 if rng.random() > 0.05 else rng.randrange(1, 4)
+        ticks = rng.randrange(8000, 1500000) if result == 0 else 0
+        sensor = rng.randrange(SENSORS_MAX)
+        filtered[sensor] = max(0, filtered[sensor] + rng.randrange(-5000, 5000))
+        records.append(
+            {
+                "sequence": sequence & 0xFFFFFFFF,
+                "timestamp": timestamp,
+                "ticks": ticks,
+                "filtered_um": filtered[sensor],
+                "result": result,
+                "flags": rng.randrange(2),
+                "sensor": sensor,
+            }
+        )
+
+    data = encode(header, records)
+    decoded_header, decoded = decode(data)
+    if decoded_header != header or decoded != records:
+        print("selftest: round trip mismatch", file=sys.stderr)
+        return 1
+    # Past 2^32 us, 71 minutes, the time goes on
+    if records[-1]["timestamp"] < 1 << 32:
+        print("selftest: timestamps did not pass 32 bits", file=sys.stderr)
+        return 1
+
+    # A recording cut mid record keeps everything before the cut
+    _, partial = decode(data[:-3])
+    if partial != records[: len(partial)] or len(partial) < count - 1:
+        print("selftest: truncated recording mismatch", file=sys.stderr)
+        return 1
+
+    print(
+        "selftest: %d records, %d bytes, %.2f bytes/record"
+        % (count, len(data), (len(data) - HEADER.size) / count)
+    )
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("recording", nargs="?", help="recording file")
+    parser.add_argument("-o", "--output", help="CSV file, stdout by default")
+    parser.add_argument(
+        "--selftest",
+        action="store_true",
+        help="round trip generated data, and the recording if one is given",
+    )
+    args = parser.parse_args()
+
+    if args.selftest:
+        return selftest() or (selftest_recording(args.recording) if args.recording else 0)
+    if not args.recording:
+        parser.error("a recording is required")
+
+    with open(args.recording, "rb") as f:
+        header, records = decode(f.read())
+
+    if args.output:
+        with open(args.output, "w", newline="") as f:
+            write_csv(header, records, f)
+    else:
+        write_csv(header, records, sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
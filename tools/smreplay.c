@@ -0,0 +1,208 @@
+/**
+ * Replay SonicMeter recordings (.smr) through the processing of the app.
+ *
+ * Built from the same sources as the app, so the replay gives what the device would have given
+ * with the same settings. Prints the samples that differ from the reference, then a summary with
+ * the throughput. make -C tests builds it into tests/build, or by hand:
+ *
+ *     cc -O2 -I.. -o smreplay smreplay.c ../sonicmeter_replay.c ../sonicmeter_pipeline.c \
+ *         ../sonicmeter_convert.c ../sonicmeter_filter.c ../sonicmeter_record.c \
+ *         ../sonicmeter_text.c -lm
+ *
+ *     smreplay recording.smr [-r reference.smr] [-o replayed.smr] [-t celsius] [-m range_cm]
+ *              [-f none|median|ema|kalman] [-w window] [-z] [-n lines]
+ *
+ * Without -r the reference is the recording itself. Temperature and range default to those of
+ * the recording, the filter is not recorded and defaults to none.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sonicmeter_replay.h"
+
+#define SMREPLAY_LINES_DEFAULT 20 // Mismatches printed
+
+typedef struct {
+    FILE* output; // Replayed samples, NULL for none
+    SonicMeterRecordCodec codec;
+    uint32_t lines; // Mismatches left to print
+} Smreplay;
+
+static size_t smreplay_read(void* context, uint8_t* buffer, size_t size) {
+    return fread(buffer, 1, size, context);
+}
+
+static void smreplay_callback(
+    const SonicMeterSample* replayed,
+    const SonicMeterSample* reference,
+    bool match,
+    void* context) {
+    Smreplay* smreplay = context;
+
+    if(smreplay->output) {
+        uint8_t record[SONICMETER_RECORD_SIZE_MAX];
+        const size_t size = sonicmeter_record_encode(&smreplay->codec, replayed, record);
+        fwrite(record, 1, size, smreplay->output);
+    }
+    if(!match && smreplay->lines) {
+        char line[SONICMETER_REPLAY_LINE_SIZE];
+        sonicmeter_replay_format_mismatch(replayed, reference, line, sizeof(line));
+        printf("%s\n", line);
+        smreplay->lines--;
+    }
+}
+
+static bool smreplay_open(
+    const char* path,
+    FILE** file,
+    SonicMeterReplayStream* stream,
+    SonicMeterRecordHeader* header) {
+    *file = fopen(path, "rb");
+    if(!*file) {
+        perror(path);
+        return false;
+    }
+    if(!sonicmeter_replay_stream_open(stream, smreplay_read, *file, header)) {
+        fprintf(stderr, "%s: not a SonicMeter recording, or unsupported version\n", path);
+        return false;
+    }
+    return true;
+}
+
+static bool smreplay_filter_type(const char* name, SonicMeterFilterType* type) {
+    static const char* const names[] = {"none", "median", "ema", "kalman"};
+    for(size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if(strcmp(name, names[i]) == 0) {
+            *type = (SonicMeterFilterType)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t smreplay_now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+int main(int argc, char** argv) {
+    const char* reference_path = NULL;
+    const char* output_path = NULL;
+    const char* temperature = NULL;
+    const char* range = NULL;
+    SonicMeterFilterConfig filter = {.type = SonicMeterFilterTypeNone, .window = 5};
+    Smreplay smreplay = {.output = NULL, .lines = SMREPLAY_LINES_DEFAULT};
+    int option;
+
+    while((option = getopt(argc, argv, "r:o:t:m:f:w:zn:")) != -1) {
+        switch(option) {
+        case 'r':
+            reference_path = optarg;
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        case 't':
+            temperature = optarg;
+            break;
+        case 'm':
+            range = optarg;
+            break;
+        case 'f':
+            if(!smreplay_filter_type(optarg, &filter.type)) {
+                fprintf(stderr, "unknown filter %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'w':
+            filter.window = strtoul(optarg, NULL, 10);
+            break;
+        case 'z':
+            filter.reject_outliers = true;
+            break;
+        case 'n':
+            smreplay.lines = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            return 2;
+        }
+    }
+    if(optind != argc - 1) {
+        fprintf(
+            stderr,
+            "usage: %s recording.smr [-r reference.smr] [-o replayed.smr] [-t celsius] "
+            "[-m range_cm] [-f none|median|ema|kalman] [-w window] [-z] [-n lines]\n",
+            argv[0]);
+        return 2;
+    }
+    if(filter.window < 1 || filter.window > SONICMETER_FILTER_WINDOW_MAX) {
+        fprintf(stderr, "window must be 1 to %d\n", SONICMETER_FILTER_WINDOW_MAX);
+        return 2;
+    }
+
+    // Streams are large, keep them off the stack
+    SonicMeterReplayStream* input = malloc(sizeof(SonicMeterReplayStream));
+    SonicMeterReplayStream* reference = NULL;
+    SonicMeterRecordHeader header;
+    FILE* input_file;
+    FILE* reference_file = NULL;
+
+    if(!smreplay_open(argv[optind], &input_file, input, &header)) {
+        return 1;
+    }
+    if(reference_path) {
+        SonicMeterRecordHeader reference_header;
+        reference = malloc(sizeof(SonicMeterReplayStream));
+        if(!smreplay_open(reference_path, &reference_file, reference, &reference_header)) {
+            return 1;
+        }
+    }
+
+    SonicMeterReplayConfig config = {
+        .temperature_c = temperature ? atoi(temperature) : header.temperature_c,
+        .max_range_cm = range ? strtoul(range, NULL, 10) : header.max_range_cm,
+        .filter = filter,
+    };
+    if(output_path) {
+        smreplay.output = fopen(output_path, "wb");
+        if(!smreplay.output) {
+            perror(output_path);
+            return 1;
+        }
+        // The replayed samples are a recording of their own, with the settings they were made with
+        SonicMeterRecordHeader replayed = header;
+        uint8_t bytes[SONICMETER_RECORD_HEADER_SIZE];
+        replayed.temperature_c = config.temperature_c;
+        replayed.max_range_cm = config.max_range_cm;
+        fwrite(bytes, 1, sonicmeter_record_header_encode(&replayed, bytes), smreplay.output);
+        sonicmeter_record_codec_reset(&smreplay.codec);
+    }
+
+    SonicMeterReplay* replay = sonicmeter_replay_alloc();
+    const uint64_t start = smreplay_now_us();
+    const SonicMeterReplayDiff* diff = sonicmeter_replay_run(
+        replay, &config, input, header.cpu_hz, reference, smreplay_callback, &smreplay);
+    const uint64_t elapsed = smreplay_now_us() - start;
+
+    char summary[SONICMETER_REPLAY_SUMMARY_SIZE];
+    sonicmeter_replay_format_summary(diff, elapsed, summary, sizeof(summary));
+    fputs(summary, stdout);
+    const int status = diff->mismatches || diff->malformed ? 1 : 0;
+
+    sonicmeter_replay_free(replay);
+    if(smreplay.output) {
+        fclose(smreplay.output);
+    }
+    if(reference_file) {
+        fclose(reference_file);
+    }
+    fclose(input_file);
+    free(reference);
+    free(input);
+    return status;
+}
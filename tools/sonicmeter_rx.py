@@ -0,0 +1,301 @@
+#!/usr/bin/env python3
+"""Receive the SonicMeter USB sample stream and report throughput and gaps.
+
+The frame format is described in sonicmeter_stream.h. Samples can be written
+to CSV while the statistics are printed once per second.
+
+    sonicmeter_rx.py /dev/ttyACM1 [--text] [-o samples.csv] [-t seconds]
+    sonicmeter_rx.py --selftest
+"""
+
+import argparse
+import os
+import random
+import struct
+import sys
+import threading
+import time
+
+from smr2csv import FIELDS, decode_records, encode_records
+
+SYNC = b"\xa5\x5a"
+FRAME_HEADER = struct.Struct("<HHBH")
+BATCH_MAX = 16
+PAYLOAD_MAX = BATCH_MAX * 30
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def decode_payload(payload, count):
+    samples, truncated = decode_records(payload, 0, count)
+    if truncated or len(samples) != count:
+        raise ValueError("payload shorter than its sample count")
+    return samples
+
+
+def build_frame(sequence, dropped, samples):
+    # Same as the device: every frame starts a new delta chain
+    payload = encode_records(samples)
+    body = FRAME_HEADER.pack(sequence & 0xFFFF, min(dropped, 0xFFFF), len(samples), len(payload))
+    body += payload
+    return SYNC + body + struct.pack("<H", crc16(body))
+
+
+class Stats:
+    def __init__(self):
+        self.bytes = 0
+        self.frames = 0
+        self.samples = 0
+        self.crc_errors = 0
+        self.frame_gaps = 0
+        self.sample_gaps = 0
+        self.device_dropped = 0
+        self.last_frame = None
+        self.last_sample = None
+
+    def sample(self, sample):
+        sequence = sample["sequence"]
+        if self.last_sample is not None and sequence != (self.last_sample + 1) & 0xFFFFFFFF:
+            self.sample_gaps += (sequence - self.last_sample - 1) & 0xFFFFFFFF
+        self.last_sample = sequence
+        self.samples += 1
+
+    def line(self, elapsed):
+        return (
+            "%7.1fs %8d samples %7.1f/s %8.1f B/s frames %d crc %d frame gaps %d "
+            "sample gaps %d device drops %d"
+            % (
+                elapsed,
+                self.samples,
+                self.samples / elapsed if elapsed else 0,
+                self.bytes / elapsed if elapsed else 0,
+                self.frames,
+                self.crc_errors,
+                self.frame_gaps,
+                self.sample_gaps,
+                self.device_dropped,
+            )
+        )
+
+
+class BinaryParser:
+    def __init__(self, stats, sink):
+        self.stats = stats
+        self.sink = sink
+        self.buffer = bytearray()
+
+    def feed(self, data):
+        self.stats.bytes += len(data)
+        self.buffer += data
+        while True:
+            start = self.buffer.find(SYNC)
+            if start < 0:
+                del self.buffer[:-1]
+                return
+            del self.buffer[:start]
+            if len(self.buffer) < 2 + FRAME_HEADER.size:
+                return
+            sequence, dropped, count, size = FRAME_HEADER.unpack_from(self.buffer, 2)
+            if count > BATCH_MAX or size > PAYLOAD_MAX:
+                # Sync pattern inside a payload, not a frame
+                del self.buffer[:2]
+                continue
+            end = 2 + FRAME_HEADER.size + size + 2
+            if len(self.buffer) < end:
+                return
+            body = bytes(self.buffer[2 : end - 2])
+            (crc,) = struct.unpack_from("<H", self.buffer, end - 2)
+            if crc != crc16(body):
+                # Resynchronise on the next sync pattern
+                self.stats.crc_errors += 1
+                del self.buffer[:2]
+                continue
+            del self.buffer[:end]
+            self.frame(sequence, dropped, count, body[FRAME_HEADER.size :])
+
+    def frame(self, sequence, dropped, count, payload):
+        stats = self.stats
+        if stats.last_frame is not None and sequence != (stats.last_frame + 1) & 0xFFFF:
+            stats.frame_gaps += (sequence - stats.last_frame - 1) & 0xFFFF
+        stats.last_frame = sequence
+        stats.frames += 1
+        stats.device_dropped += dropped
+        for sample in decode_payload(payload, count):
+            stats.sample(sample)
+            self.sink(sample)
+
+
+class TextParser:
+    def __init__(self, stats, sink):
+        self.stats = stats
+        self.sink = sink
+        self.buffer = bytearray()
+
+    def feed(self, data):
+        self.stats.bytes += len(data)
+        self.buffer += data
+        *lines, rest = self.buffer.split(b"\n")
+        self.buffer = bytearray(rest)
+        for line in lines:
+            try:
+                values = [int(v) for v in line.decode().strip().split(",")]
+            except ValueError:
+                self.stats.crc_errors += 1
+                continue
+            if len(values) != len(FIELDS):
+                self.stats.crc_errors += 1
+                continue
+            sample = dict(zip(FIELDS, values))
+            self.stats.sample(sample)
+            self.sink(sample)
+
+
+def open_port(path):
+    fd = os.open(path, os.O_RDONLY | os.O_NOCTTY)
+    try:
+        import termios
+        import tty
+
+        tty.setraw(fd)
+        attrs = termios.tcgetattr(fd)
+        # Keep DTR asserted, the device only streams to an open port
+        attrs[2] |= termios.HUPCL
+        termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    except (ImportError, OSError):
+        pass
+    return fd
+
+
+def receive(fd, parser, stats, duration=None, report=True, size=None):
+    start = time.monotonic()
+    last_report = start
+    while size is None or stats.bytes < size:
+        data = os.read(fd, 4096)
+        if not data:
+            break
+        parser.feed(data)
+        now = time.monotonic()
+        if report and now - last_report >= 1.0:
+            print(stats.line(now - start), file=sys.stderr)
+            last_report = now
+        if duration is not None and now - start >= duration:
+            break
+    return time.monotonic() - start
+
+
+def selftest():
+    master, slave = os.openpty()
+    import tty
+
+    tty.setraw(slave)
+    rng = random.Random(7)
+    frames = []
+    sequence = 0
+    skipped_samples = 0
+    corrupted = 0
+    expected_frames = 0
+    for frame_sequence in range(2000):
+        samples = []
+        for _ in range(rng.randrange(1, 17)):
+            sequence += 1
+            samples.append(
+                {
+                    "sequence": sequence,
+                    "timestamp": sequence * 60,
+                    "ticks": rng.randrange(0, 1500000),
+                    "filtered_um": rng.randrange(0, 4000000),
+                    "result": rng.randrange(4),
+                    "flags": rng.randrange(2),
+                    "sensor": rng.randrange(4),
+                }
+            )
+        frame = build_frame(frame_sequence, 0, samples)
+        if frame_sequence % 500 == 250:
+            # A frame lost on the wire shows up as a frame gap and a sample gap
+            skipped_samples += len(samples)
+            continue
+        if frame_sequence % 700 == 350:
+            # A corrupted frame is rejected by the CRC, and is also a gap
+            frame = frame[:-1] + bytes([frame[-1] ^ 0xFF])
+            skipped_samples += len(samples)
+            corrupted += 1
+            expected_frames -= 1
+        frames.append(frame)
+        expected_frames += 1
+    data = b"".join(frames)
+
+    def writer():
+        view = memoryview(data)
+        while view:
+            chunk = min(len(view), rng.randrange(1, 200))
+            os.write(master, view[:chunk])
+            view = view[chunk:]
+
+    stats = Stats()
+    received = []
+    parser = BinaryParser(stats, received.append)
+    thread = threading.Thread(target=writer)
+    thread.start()
+    elapsed = receive(slave, parser, stats, report=False, size=len(data))
+    thread.join()
+    os.close(master)
+    os.close(slave)
+
+    ok = (
+        stats.frames == expected_frames
+        and stats.crc_errors >= corrupted
+        and stats.sample_gaps == skipped_samples
+        and stats.samples == sequence - skipped_samples
+    )
+    print("selftest:", stats.line(elapsed), "OK" if ok else "FAILED")
+    return 0 if ok else 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("port", nargs="?", help="serial device of the second CDC channel")
+    parser.add_argument("--text", action="store_true", help="the device streams text lines")
+    parser.add_argument("-o", "--output", help="write samples to this CSV file")
+    parser.add_argument("-t", "--time", type=float, help="stop after this many seconds")
+    parser.add_argument("--selftest", action="store_true", help="run against a pseudo terminal")
+    args = parser.parse_args()
+
+    if args.selftest:
+        return selftest()
+    if not args.port:
+        parser.error("a port is required")
+
+    output = open(args.output, "w") if args.output else None
+    if output:
+        output.write(",".join(FIELDS) + "\n")
+
+    def sink(sample):
+        if output:
+            output.write(",".join(str(sample[field]) for field in FIELDS) + "\n")
+
+    stats = Stats()
+    stream_parser = (TextParser if args.text else BinaryParser)(stats, sink)
+    fd = open_port(args.port)
+    try:
+        elapsed = receive(fd, stream_parser, stats, args.time)
+    except KeyboardInterrupt:
+        elapsed = None
+    finally:
+        os.close(fd)
+        if output:
+            output.close()
+    if elapsed:
+        print(stats.line(elapsed), file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())